@@ -16,6 +16,7 @@
 #include "config.h"
 
 #include <arpa/inet.h>
+#include <sys/mman.h>
 
 #include <assert.h>
 #include <ctype.h>
@@ -120,24 +121,98 @@ struct	fcgi_bgn {
 };
 
 /*
- * A buffer of reads from kfcgi_control().
+ * Flag in fcgi_bgn for keeping the connection open after the request.
+ * Defined in the FastCGI v1.0 spec, section 5.1.
+ */
+#define	FCGI_KEEP_CONN	1
+
+/*
+ * A fixed-size buffer of reads from the FastCGI connection, which is
+ * passed to us by kfcgi_control().
+ * Bytes before "pos" have been consumed: the rest is moved to the
+ * front when there's no room for what needs to be read.
  */
 struct	fcgi_buf {
 	size_t	 sz; /* bytes in buffer */
 	size_t	 pos; /* current position (from last read) */
-	int	 fd; /* file descriptor */
-	char	*buf; /* buffer itself */
+	int	 fd; /* connection */
+	char	*buf; /* buffer itself (of FCGI_BUFSZ) */
+};
+
+/*
+ * Size of the read buffer.
+ * This holds the largest FastCGI record (a header, 65535 content bytes,
+ * and 255 padding bytes) with room to spare.
+ * Stdin content of at least half of this is read directly into the
+ * request body instead.
+ */
+#define	FCGI_BUFSZ	(128 * 1024)
+
+/*
+ * Maximum number of requests multiplexed on one FastCGI connection
+ * whose records we're still reading.
+ */
+#define	FCGI_MAX_REQS	64
+
+/*
+ * Size of the chunks in which a CGI request body is spooled.
+ */
+#define	SPOOL_BUFSZ	(64 * 1024)
+
+/*
+ * A request being read from a FastCGI connection.
+ * Records for several may be interleaved on one connection.
+ */
+struct	fcgi_req {
+	uint16_t	 rid; /* requestId */
+	int		 keep; /* FCGI_KEEP_CONN set */
+	int		 instdin; /* reading FCGI_STDIN */
+	struct env	*envs; /* FCGI_PARAMS */
+	size_t		 envsz;
+	unsigned char	*sbuf; /* FCGI_STDIN */
+	size_t		 ssz;
+	size_t		 smax; /* allocated size of sbuf */
+	int		 spool; /* FCGI_STDIN spooled here (or -1) */
+	size_t		 spoolid; /* slot "spool" was taken from */
+};
+
+/*
+ * Files passed to us by the application for spooling request bodies of
+ * at least "min" bytes, by slot.
+ * A file is taken from its slot by the request spooling into it.
+ */
+struct	fcgi_spool {
+	int		 fds[KFCGI_SPOOLS]; /* free files (or -1) */
+	size_t		 min; /* spool at this size (or 0, never) */
+};
+
+/*
+ * Open-addressed hash table over the names of the recognised keys, so
+ * that looking up a field name doesn't compare against every key.
+ * Each slot holds a key's position plus one, or zero if empty.
+ * If "slots" is NULL, we fall back to a linear scan.
+ */
+struct	keyidx {
+	size_t			*slots;
+	size_t			 mask; /* number of slots less one */
 };
 
 /*
  * Parameters required to validate fields.
  */
 struct	parms {
-	int	 		 fd;
+	struct kframe		*fr;
+	int			 in; /* request body descriptor */
+	int			 spool; /* spool body here (or -1) */
+	size_t			 spoolid; /* parent's name for "spool" */
+	int			 spooled; /* body was spooled */
+	char			*body; /* shared body (or NULL) */
+	size_t			 bodysz; /* size of shared body */
 	const char *const	*mimes;
 	size_t			 mimesz;
 	const struct kvalid	*keys;
 	size_t			 keysz;
+	struct keyidx		 idx; /* index into "keys" */
 	enum input		 type;
 };
 
@@ -224,6 +299,102 @@ str2ctype(const struct parms *pp, const char *ctype)
 	return(i);
 }
 
+/*
+ * FNV-1a hash of a key name.
+ */
+static size_t
+keyhash(const char *key)
+{
+	uint32_t	 h = 2166136261U;
+
+	for ( ; *key != '\0'; key++) {
+		h ^= (unsigned char)*key;
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/*
+ * Initialise the validation parameters and build the key index.
+ * This is done once when the worker starts, not for each request.
+ * If the index can't be allocated, lookups are linear.
+ */
+static void
+parms_init(struct parms *pp, char *body, size_t bodysz,
+	const struct kvalid *keys, size_t keysz, 
+	const char *const *mimes, size_t mimesz)
+{
+	size_t	 i, j, n;
+
+	memset(pp, 0, sizeof(struct parms));
+	pp->in = STDIN_FILENO;
+	pp->spool = -1;
+	pp->body = body;
+	pp->bodysz = bodysz;
+	pp->keys = keys;
+	pp->keysz = keysz;
+	pp->mimes = mimes;
+	pp->mimesz = mimesz;
+
+	if (keysz == 0 || keysz > SIZE_MAX / 4)
+		return;
+
+	/* Keep the load factor at or below one half. */
+
+	for (n = 16; n < keysz * 2; n *= 2)
+		continue;
+
+	if ((pp->idx.slots = kxcalloc(n, sizeof(size_t))) == NULL)
+		return;
+	pp->idx.mask = n - 1;
+
+	/* As with a linear scan, the first of duplicate keys wins. */
+
+	for (i = 0; i < keysz; i++) {
+		j = keyhash(keys[i].name) & pp->idx.mask;
+		while (pp->idx.slots[j] != 0) {
+			if (strcmp(keys[pp->idx.slots[j] - 1].name,
+			    keys[i].name) == 0)
+				break;
+			j = (j + 1) & pp->idx.mask;
+		}
+		if (pp->idx.slots[j] == 0)
+			pp->idx.slots[j] = i + 1;
+	}
+}
+
+static void
+parms_free(struct parms *pp)
+{
+
+	free(pp->idx.slots);
+}
+
+/*
+ * Look up the position of "key" in the recognised keys.
+ * Returns the position or "keysz" if not found.
+ */
+static size_t
+parms_key(const struct parms *pp, const char *key)
+{
+	size_t	 i, j;
+
+	if (pp->idx.slots == NULL) {
+		for (i = 0; i < pp->keysz; i++)
+			if (strcmp(pp->keys[i].name, key) == 0)
+				break;
+		return i;
+	}
+
+	j = keyhash(key) & pp->idx.mask;
+	while ((i = pp->idx.slots[j]) != 0) {
+		if (strcmp(pp->keys[i - 1].name, key) == 0)
+			return i - 1;
+		j = (j + 1) & pp->idx.mask;
+	}
+	return pp->keysz;
+}
+
 /*
  * Given a parsed field "key" with value "val" of size "valsz" and MIME
  * information "mime", first try to look it up in the array of
@@ -235,7 +406,7 @@ static void
 output(const struct parms *pp, char *key, 
 	char *val, size_t valsz, struct mime *mime)
 {
-	size_t	 	 i;
+	size_t	 	 i, valpos;
 	ptrdiff_t	 diff;
 	char		*save;
 	struct kpair	 pair;
@@ -260,53 +431,64 @@ output(const struct parms *pp, char *key,
 	 * identifier or keysz if none is found.
 	 */
 
-	for (i = 0; i < pp->keysz; i++) {
-		if (strcmp(pp->keys[i].name, pair.key)) 
-			continue;
-		if (NULL == pp->keys[i].valid) 
-			break;
+	i = parms_key(pp, pair.key);
+	if (i < pp->keysz && pp->keys[i].valid != NULL) {
 		if ( ! pp->keys[i].valid(&pair)) {
 			pair.state = KPAIR_INVALID;
 			pair.type = KPAIR__MAX;
 			memset(&pair.parsed, 0, sizeof(union parsed));
 		} else
 			pair.state = KPAIR_VALID;
-		break;
 	}
 	pair.keypos = i;
 
-	fullwrite(pp->fd, &pp->type, sizeof(enum input));
-	fullwriteword(pp->fd, pair.key);
-	fullwrite(pp->fd, &pair.valsz, sizeof(size_t));
-	fullwrite(pp->fd, pair.val, pair.valsz);
-	fullwrite(pp->fd, &pair.state, sizeof(enum kpairstate));
-	fullwrite(pp->fd, &pair.type, sizeof(enum kpairtype));
-	fullwrite(pp->fd, &pair.keypos, sizeof(size_t));
+	/*
+	 * If the value (and its NUL terminator) is within the body
+	 * shared with the parent, only send its position.
+	 * Otherwise, the position is SIZE_MAX and the value follows.
+	 */
+
+	if (pp->body != NULL && pair.val >= pp->body &&
+	    pair.val <= pp->body + pp->bodysz &&
+	    pair.valsz <= (size_t)(pp->body + pp->bodysz - pair.val))
+		valpos = (size_t)(pair.val - pp->body);
+	else
+		valpos = SIZE_MAX;
+
+	kframe_write(pp->fr, &pp->type, sizeof(enum input));
+	kframe_writeword(pp->fr, pair.key);
+	kframe_write(pp->fr, &pair.valsz, sizeof(size_t));
+	kframe_write(pp->fr, &valpos, sizeof(size_t));
+	if (valpos == SIZE_MAX)
+		kframe_write(pp->fr, pair.val, pair.valsz);
+	kframe_write(pp->fr, &pair.state, sizeof(enum kpairstate));
+	kframe_write(pp->fr, &pair.type, sizeof(enum kpairtype));
+	kframe_write(pp->fr, &pair.keypos, sizeof(size_t));
 
 	if (KPAIR_VALID == pair.state) 
 		switch (pair.type) {
 		case (KPAIR_DOUBLE):
-			fullwrite(pp->fd, 
+			kframe_write(pp->fr, 
 				&pair.parsed.d, sizeof(double));
 			break;
 		case (KPAIR_INTEGER):
-			fullwrite(pp->fd, 
+			kframe_write(pp->fr, 
 				&pair.parsed.i, sizeof(int64_t));
 			break;
 		case (KPAIR_STRING):
 			assert(pair.parsed.s >= pair.val);
 			assert(pair.parsed.s <= pair.val + pair.valsz);
 			diff = pair.val - pair.parsed.s;
-			fullwrite(pp->fd, &diff, sizeof(ptrdiff_t));
+			kframe_write(pp->fr, &diff, sizeof(ptrdiff_t));
 			break;
 		default:
 			break;
 		}
 
-	fullwriteword(pp->fd, pair.file);
-	fullwriteword(pp->fd, pair.ctype);
-	fullwrite(pp->fd, &pair.ctypepos, sizeof(size_t));
-	fullwriteword(pp->fd, pair.xcode);
+	kframe_writeword(pp->fr, pair.file);
+	kframe_writeword(pp->fr, pair.ctype);
+	kframe_write(pp->fr, &pair.ctypepos, sizeof(size_t));
+	kframe_writeword(pp->fr, pair.xcode);
 
 	/*
 	 * We can write a new "val" in the validator allocated on the
@@ -318,32 +500,24 @@ output(const struct parms *pp, char *key,
 }
 
 /*
- * Read full stdin request into memory.
- * This reads at most "len" bytes and NUL-terminates the results, the
- * length of which may be less than "len" and is stored in *szp if not
- * NULL.
- * Returns the pointer to the data.
+ * Read at most "len" bytes of the request body from "fd" (usually
+ * stdin) into "p".
+ * Returns the number of bytes read, which is less than "len" only if
+ * the sender stopped giving us data.
  * NOTE: we can't use fullread() here because we may not get the total
  * number of bytes requested.
- * NOTE: "szp" can legit be set to zero.
  */
-static char *
-scanbuf(size_t len, size_t *szp)
+static size_t
+scanread(int fd, char *p, size_t len)
 {
 	ssize_t		 ssz;
 	size_t		 sz;
-	char		*p;
 	int		 rc;
 	struct pollfd	 pfd;
 
-	pfd.fd = STDIN_FILENO;
+	pfd.fd = fd;
 	pfd.events = POLLIN;
 
-	/* Allocate the entire buffer here. */
-
-	if ((p = kxmalloc(len + 1)) == NULL)
-		_exit(EXIT_FAILURE);
-
 	/* 
 	 * Keep reading til we get all the data or the sender stops
 	 * giving us data---whichever comes first.
@@ -351,26 +525,55 @@ scanbuf(size_t len, size_t *szp)
 	 */
 
 	for (sz = 0; sz < len; sz += (size_t)ssz) {
+		ssz = 0;
 		if ((rc = poll(&pfd, 1, INFTIM)) < 0) {
+			if (errno == EINTR)
+				continue;
 			kutil_warn(NULL, NULL, "poll");
 			_exit(EXIT_FAILURE);
 		} else if (0 == rc) {
 			kutil_warnx(NULL, NULL, "poll: timeout!?");
-			ssz = 0;
 			continue;
 		}
 		
 		if (!(pfd.revents & POLLIN))
 			break;
 
-		if ((ssz = read(STDIN_FILENO, p + sz, len - sz)) < 0) {
+		if ((ssz = read(fd, p + sz, len - sz)) < 0) {
+			if (errno == EINTR || errno == EAGAIN) {
+				ssz = 0;
+				continue;
+			}
 			kutil_warn(NULL, NULL, "read");
 			_exit(EXIT_FAILURE);
 		} else if (ssz == 0)
 			break;
 	}
 
-	if (sz < len)
+	return sz;
+}
+
+/*
+ * Read full request body from "fd" (usually stdin) into memory.
+ * This reads at most "len" bytes and NUL-terminates the results, the
+ * length of which may be less than "len" and is stored in *szp if not
+ * NULL.
+ * If "p" is not NULL, it's used as the buffer (and must be at least
+ * len + 1 bytes); otherwise, the buffer is allocated.
+ * Returns the pointer to the data.
+ * NOTE: "szp" can legit be set to zero.
+ */
+static char *
+scanbuf(int fd, char *p, size_t len, size_t *szp)
+{
+	size_t		 sz;
+
+	/* Allocate the entire buffer here. */
+
+	if (p == NULL && (p = kxmalloc(len + 1)) == NULL)
+		_exit(EXIT_FAILURE);
+
+	if ((sz = scanread(fd, p, len)) < len)
 		kutil_warnx(NULL, NULL, "content size mismatch: "
 			"have %zu while %zu specified", sz, len);
 
@@ -384,6 +587,90 @@ scanbuf(size_t len, size_t *szp)
 	return p;
 }
 
+/*
+ * Write all "sz" bytes of "buf" to the spool "fd".
+ * Returns zero on failure, non-zero on success.
+ */
+static int
+spoolwrite(int fd, const char *buf, size_t sz)
+{
+	ssize_t		 ssz;
+
+	while (sz > 0) {
+		if ((ssz = write(fd, buf, sz)) == -1) {
+			if (errno == EINTR)
+				continue;
+			kutil_warn(NULL, NULL, "write");
+			return 0;
+		}
+		buf += ssz;
+		sz -= (size_t)ssz;
+	}
+
+	return 1;
+}
+
+/*
+ * Spool at most "len" bytes of the request body from "fd" (usually
+ * stdin) into "spool", a chunk at a time, so the file grows with what
+ * we read and not with what's reported.
+ * Returns the number of bytes spooled.
+ */
+static size_t
+spoolbuf(int fd, int spool, size_t len)
+{
+	char		*buf;
+	size_t		 sz, n, want;
+
+	if ((buf = kxmalloc(SPOOL_BUFSZ)) == NULL)
+		_exit(EXIT_FAILURE);
+
+	for (sz = 0; sz < len; sz += n) {
+		want = len - sz < SPOOL_BUFSZ ? len - sz : SPOOL_BUFSZ;
+		if ((n = scanread(fd, buf, want)) > 0 &&
+		    !spoolwrite(spool, buf, n))
+			_exit(EXIT_FAILURE);
+		if (n < want) {
+			sz += n;
+			break;
+		}
+	}
+
+	free(buf);
+
+	if (sz < len)
+		kutil_warnx(NULL, NULL, "content size mismatch: "
+			"have %zu while %zu specified", sz, len);
+
+	return sz;
+}
+
+/*
+ * NUL-terminate the "sz" bytes spooled into "spool" and map them (with
+ * the NUL) shared with the parent, so we can parse them in place.
+ * Returns the mapping.
+ */
+static char *
+spoolmap(int spool, size_t sz)
+{
+	void		*p;
+
+	if (lseek(spool, (off_t)sz, SEEK_SET) == -1) {
+		kutil_warn(NULL, NULL, "lseek");
+		_exit(EXIT_FAILURE);
+	} else if (!spoolwrite(spool, "", 1))
+		_exit(EXIT_FAILURE);
+
+	p = mmap(NULL, sz + 1, PROT_READ | PROT_WRITE, 
+		MAP_SHARED, spool, 0);
+	if (p == MAP_FAILED) {
+		kutil_warn(NULL, NULL, "mmap");
+		_exit(EXIT_FAILURE);
+	}
+
+	return p;
+}
+
 /*
  * Reset a particular mime component.
  * We can get duplicates, so reallocate.
@@ -1053,7 +1340,7 @@ parse_multi(const struct parms *pp, char *line, char *b, size_t bsz)
  * Disallow zero-length values as per RFC 3875, 4.1.18.
  */
 static void
-kworker_child_env(const struct env *env, int fd, size_t envsz)
+kworker_child_env(const struct env *env, struct kframe *fr, size_t envsz)
 {
 	size_t	 	 i, j, sz, reqs;
 	int		 first;
@@ -1063,13 +1350,13 @@ kworker_child_env(const struct env *env, int fd, size_t envsz)
 
 	/* Serialise all environment variables and count HTTPs. */
 
-	fullwrite(fd, &envsz, sizeof(size_t));
+	kframe_write(fr, &envsz, sizeof(size_t));
 
 	for (reqs = i = 0; i < envsz; i++) {
-		fullwrite(fd, &env[i].keysz, sizeof(size_t));
-		fullwrite(fd, env[i].key, env[i].keysz);
-		fullwrite(fd, &env[i].valsz, sizeof(size_t));
-		fullwrite(fd, env[i].val, env[i].valsz);
+		kframe_write(fr, &env[i].keysz, sizeof(size_t));
+		kframe_write(fr, env[i].key, env[i].keysz);
+		kframe_write(fr, &env[i].valsz, sizeof(size_t));
+		kframe_write(fr, env[i].val, env[i].valsz);
 		if (strncmp(env[i].key, "HTTP_", 5) == 0 &&
 		    env[i].key[5] != '\0')
 			reqs++;
@@ -1077,7 +1364,7 @@ kworker_child_env(const struct env *env, int fd, size_t envsz)
 
 	/* Serialise known headers (starting with HTTP_). */
 
-	fullwrite(fd, &reqs, sizeof(size_t));
+	kframe_write(fr, &reqs, sizeof(size_t));
 
 	for (i = 0; i < envsz; i++) {
 		if (strncmp(env[i].key, "HTTP_", 5) || 
@@ -1088,7 +1375,7 @@ kworker_child_env(const struct env *env, int fd, size_t envsz)
 			if (strcmp(krequs[requ], env[i].key) == 0)
 				break;
 
-		fullwrite(fd, &requ, sizeof(enum krequ));
+		kframe_write(fr, &requ, sizeof(enum krequ));
 
 		/*
 		 * According to RFC 3875, 4.1.18, HTTP headers are
@@ -1101,7 +1388,7 @@ kworker_child_env(const struct env *env, int fd, size_t envsz)
 
 		sz = env[i].keysz - 5;
 		cp = env[i].key + 5;
-		fullwrite(fd, &sz, sizeof(size_t));
+		kframe_write(fr, &sz, sizeof(size_t));
 
 		for (j = 0, first = 1; j < sz; j++) {
 			if (cp[j] == '_') {
@@ -1113,11 +1400,11 @@ kworker_child_env(const struct env *env, int fd, size_t envsz)
 			} else
 				c = tolower((unsigned char)cp[j]);
 
-			fullwrite(fd, &c, 1);
+			kframe_write(fr, &c, 1);
 		}
 
-		fullwrite(fd, &env[i].valsz, sizeof(size_t));
-		fullwrite(fd, env[i].val, env[i].valsz);
+		kframe_write(fr, &env[i].valsz, sizeof(size_t));
+		kframe_write(fr, env[i].val, env[i].valsz);
 	}
 }
 
@@ -1141,7 +1428,7 @@ kworker_env(struct env *env, size_t envsz, const char *key)
  * Defaults to KMETHOD_GET, uses KETHOD__MAX if the method was bad.
  */
 static enum kmethod
-kworker_child_method(struct env *env, int fd, size_t envsz)
+kworker_child_method(struct env *env, struct kframe *fr, size_t envsz)
 {
 	enum kmethod	 meth;
 	const char	*cp;
@@ -1155,7 +1442,7 @@ kworker_child_method(struct env *env, int fd, size_t envsz)
 			if (strcmp(kmethods[meth], cp) == 0)
 				break;
 
-	fullwrite(fd, &meth, sizeof(enum kmethod));
+	kframe_write(fr, &meth, sizeof(enum kmethod));
 	return meth;
 }
 
@@ -1164,7 +1451,7 @@ kworker_child_method(struct env *env, int fd, size_t envsz)
  * Defaults to KAUTH_NONE.
  */
 static void
-kworker_child_auth(struct env *env, int fd, size_t envsz)
+kworker_child_auth(struct env *env, struct kframe *fr, size_t envsz)
 {
 	enum kauth	 auth = KAUTH_NONE;
 	const char	*cp;	
@@ -1179,7 +1466,7 @@ kworker_child_auth(struct env *env, int fd, size_t envsz)
 				break;
 		}
 
-	fullwrite(fd, &auth, sizeof(enum kauth));
+	kframe_write(fr, &auth, sizeof(enum kauth));
 }
 
 /*
@@ -1188,10 +1475,10 @@ kworker_child_auth(struct env *env, int fd, size_t envsz)
  * Most web servers will `handle this for us'.  Ugh.
  */
 static int
-kworker_child_rawauth(struct env *env, int fd, size_t envsz)
+kworker_child_rawauth(struct env *env, struct kframe *fr, size_t envsz)
 {
 
-	return kworker_auth_child(fd, 
+	return kworker_auth_child(fr, 
 	  	kworker_env(env, envsz, "HTTP_AUTHORIZATION"));
 }
 
@@ -1199,7 +1486,7 @@ kworker_child_rawauth(struct env *env, int fd, size_t envsz)
  * Send our HTTP scheme (secure or not) to the parent.
  */
 static void
-kworker_child_scheme(struct env *env, int fd, size_t envsz)
+kworker_child_scheme(struct env *env, struct kframe *fr, size_t envsz)
 {
 	const char	*cp;
 	enum kscheme	 scheme;
@@ -1216,7 +1503,7 @@ kworker_child_scheme(struct env *env, int fd, size_t envsz)
 
 	scheme = strcasecmp(cp, "on") == 0 ?
 		KSCHEME_HTTPS : KSCHEME_HTTP;
-	fullwrite(fd, &scheme, sizeof(enum kscheme));
+	kframe_write(fr, &scheme, sizeof(enum kscheme));
 }
 
 /*
@@ -1225,7 +1512,7 @@ kworker_child_scheme(struct env *env, int fd, size_t envsz)
  * Use 127.0.0.1 on protocol violation.
  */
 static void
-kworker_child_remote(struct env *env, int fd, size_t envsz)
+kworker_child_remote(struct env *env, struct kframe *fr, size_t envsz)
 {
 	const char	*cp;
 
@@ -1235,7 +1522,7 @@ kworker_child_remote(struct env *env, int fd, size_t envsz)
 		cp = "127.0.0.1";
 	}
 
-	fullwriteword(fd, cp);
+	kframe_writeword(fr, cp);
 }
 
 /*
@@ -1244,7 +1531,7 @@ kworker_child_remote(struct env *env, int fd, size_t envsz)
  * Use port 80 if not provided or on parse error.
  */
 static void
-kworker_child_port(struct env *env, int fd, size_t envsz)
+kworker_child_port(struct env *env, struct kframe *fr, size_t envsz)
 {
 	uint16_t	 port = 80;
 	const char	*cp, *er;
@@ -1260,7 +1547,7 @@ kworker_child_port(struct env *env, int fd, size_t envsz)
 		kutil_warnx(NULL, NULL, "RFC warning: "
 			"server port not set");
 
-	fullwrite(fd, &port, sizeof(uint16_t));
+	kframe_write(fr, &port, sizeof(uint16_t));
 }
 
 /*
@@ -1269,7 +1556,7 @@ kworker_child_port(struct env *env, int fd, size_t envsz)
  * Use "localhost" if not provided.
  */
 static void
-kworker_child_httphost(struct env *env, int fd, size_t envsz)
+kworker_child_httphost(struct env *env, struct kframe *fr, size_t envsz)
 {
 	const char	*cp;
 
@@ -1278,7 +1565,7 @@ kworker_child_httphost(struct env *env, int fd, size_t envsz)
 		cp = "localhost";
 	}
 
-	fullwriteword(fd, cp);
+	kframe_writeword(fr, cp);
 }
 
 /* 
@@ -1287,7 +1574,7 @@ kworker_child_httphost(struct env *env, int fd, size_t envsz)
  * Use the empty string on error.
  */
 static void
-kworker_child_scriptname(struct env *env, int fd, size_t envsz)
+kworker_child_scriptname(struct env *env, struct kframe *fr, size_t envsz)
 {
 	const char	*cp;
 
@@ -1297,14 +1584,14 @@ kworker_child_scriptname(struct env *env, int fd, size_t envsz)
 		cp = "";
 	}
 
-	fullwriteword(fd, cp);
+	kframe_writeword(fr, cp);
 }
 
 /*
  * Parse all path information (subpath, path, etc.) and send to parent.
  */
 static void
-kworker_child_path(struct env *env, int fd, size_t envsz)
+kworker_child_path(struct env *env, struct kframe *fr, size_t envsz)
 {
 	char	*cp, *ep, *sub;
 	size_t	 len;
@@ -1316,7 +1603,7 @@ kworker_child_path(struct env *env, int fd, size_t envsz)
 	 */
 
 	cp = kworker_env(env, envsz, "PATH_INFO");
-	fullwriteword(fd, cp);
+	kframe_writeword(fr, cp);
 
 	/* This isn't possible in the real world. */
 
@@ -1332,9 +1619,9 @@ kworker_child_path(struct env *env, int fd, size_t envsz)
 
 		if (*ep == '.') {
 			*ep++ = '\0';
-			fullwriteword(fd, ep);
+			kframe_writeword(fr, ep);
 		} else
-			fullwriteword(fd, NULL);
+			kframe_writeword(fr, NULL);
 
 		/* Now find the top-most path part. */
 
@@ -1343,19 +1630,19 @@ kworker_child_path(struct env *env, int fd, size_t envsz)
 
 		/* Send the base path. */
 
-		fullwriteword(fd, cp);
+		kframe_writeword(fr, cp);
 
 		/* Send the path part. */
 
-		fullwriteword(fd, sub);
+		kframe_writeword(fr, sub);
 	} else {
 		len = 0;
 
 		/* Suffix, base path, and path part. */
 
-		fullwrite(fd, &len, sizeof(size_t));
-		fullwrite(fd, &len, sizeof(size_t));
-		fullwrite(fd, &len, sizeof(size_t));
+		kframe_write(fr, &len, sizeof(size_t));
+		kframe_write(fr, &len, sizeof(size_t));
+		kframe_write(fr, &len, sizeof(size_t));
 	}
 }
 
@@ -1366,7 +1653,7 @@ kworker_child_path(struct env *env, int fd, size_t envsz)
  * We only do this if our authorisation requires it!
  */
 static void
-kworker_child_bodymd5(int fd, const char *b, size_t bsz, int md5)
+kworker_child_bodymd5(struct kframe *fr, const char *b, size_t bsz, int md5)
 {
 	MD5_CTX		 ctx;
 	unsigned char 	 hab[MD5_DIGEST_LENGTH];
@@ -1374,7 +1661,7 @@ kworker_child_bodymd5(int fd, const char *b, size_t bsz, int md5)
 
 	if (!md5) {
 		sz = 0;
-		fullwrite(fd, &sz, sizeof(size_t));
+		kframe_write(fr, &sz, sizeof(size_t));
 		return;
 	}
 
@@ -1385,8 +1672,26 @@ kworker_child_bodymd5(int fd, const char *b, size_t bsz, int md5)
 	/* This is a binary write! */
 
 	sz = MD5_DIGEST_LENGTH;
-	fullwrite(fd, &sz, sizeof(size_t));
-	fullwrite(fd, hab, sz);
+	kframe_write(fr, &sz, sizeof(size_t));
+	kframe_write(fr, hab, sz);
+}
+
+/*
+ * Tell the parent whether the body of "bsz" bytes was spooled and, if
+ * so, to which of its files.
+ */
+static void
+kworker_child_spool(struct kframe *fr, const struct parms *pp, size_t bsz)
+{
+	size_t		 id = SIZE_MAX;
+
+	if (!pp->spooled) {
+		kframe_write(fr, &id, sizeof(size_t));
+		return;
+	}
+
+	kframe_write(fr, &pp->spoolid, sizeof(size_t));
+	kframe_write(fr, &bsz, sizeof(size_t));
 }
 
 /*
@@ -1394,7 +1699,7 @@ kworker_child_bodymd5(int fd, const char *b, size_t bsz, int md5)
  * This is arguably the most complex part of the system.
  */
 static void
-kworker_child_body(struct env *env, int fd, size_t envsz,
+kworker_child_body(struct env *env, struct kframe *fr, size_t envsz,
 	struct parms *pp, enum kmethod meth, char *b, 
 	size_t bsz, unsigned int debugging, int md5)
 {
@@ -1414,16 +1719,19 @@ kworker_child_body(struct env *env, int fd, size_t envsz,
 	if ((cp = kworker_env(env, envsz, "CONTENT_LENGTH")) != NULL)
 		len = strtonum(cp, 0, LLONG_MAX, NULL);
 
+	pp->spooled = 0;
+
 	/* If zero, remember to print our MD5 value. */
 
 	if (len == 0) {
-		kworker_child_bodymd5(fd, "", 0, md5);
+		kworker_child_bodymd5(fr, "", 0, md5);
+		kworker_child_spool(fr, pp, 0);
 		return;
 	}
 
 	/* Check FastCGI input lengths. */
 
-	if (bp != NULL && bsz != len)
+	if (pp->in == -1 && bsz != len)
 		kutil_warnx(NULL, NULL, "RFC warning: real (%zu) "
 			"and reported (%zu) content lengths differ", 
 			bsz, len);
@@ -1441,18 +1749,32 @@ kworker_child_body(struct env *env, int fd, size_t envsz,
 	cp = kworker_env(env, envsz, "CONTENT_TYPE");
 
 	/* 
-	 * If we're CGI, read the request now.
+	 * If we've been given a file, the body is spooled into it (if
+	 * we're CGI, as we read it now; with FastCGI, it already is) and
+	 * parsed from there, as the parent will map the same file.
+	 * Otherwise, if we're CGI, read the request now.
+	 * Read directly into the body shared with the parent, if
+	 * provided and large enough, so that values needn't be copied.
 	 * Note that the "bsz" can come out as zero.
 	 */
 
-	if (b == NULL)
-		b = scanbuf(len, &bsz);
+	if (b == NULL && pp->spool != -1) {
+		if (pp->in != -1)
+			bsz = spoolbuf(pp->in, pp->spool, len);
+		b = pp->body = spoolmap(pp->spool, bsz);
+		pp->bodysz = bsz;
+		pp->spooled = 1;
+	} else if (b == NULL && pp->body != NULL && pp->bodysz >= len)
+		b = scanbuf(pp->in, pp->body, len, &bsz);
+	else if (b == NULL)
+		b = scanbuf(pp->in, NULL, len, &bsz);
 
 	assert(b != NULL);
 
 	/* If requested, print our MD5 value. */
 
-	kworker_child_bodymd5(fd, b, bsz, md5);
+	kworker_child_bodymd5(fr, b, bsz, md5);
+	kworker_child_spool(fr, pp, bsz);
 
 	/*
 	 * If we're debugging read bodies, emit the body line by line
@@ -1498,9 +1820,16 @@ kworker_child_body(struct env *env, int fd, size_t envsz,
 	} else
 		parse_body(kmimetypes[KMIME_APP_OCTET_STREAM], pp, b, bsz);
 
-	/* Free CGI parsed buffer (FastCGI is done elsewhere). */
+	/* 
+	 * Unmap the spool (the parent maps its own) or free CGI parsed
+	 * buffer (FastCGI is done elsewhere).
+	 */
 
-	if (bp == NULL)
+	if (pp->spooled) {
+		munmap(b, bsz + 1);
+		pp->body = NULL;
+		pp->bodysz = 0;
+	} else if (bp == NULL && b != pp->body)
 		free(b);
 }
 
@@ -1512,7 +1841,7 @@ kworker_child_body(struct env *env, int fd, size_t envsz,
  */
 static void
 kworker_child_query(struct env *env, 
-	int fd, size_t envsz, struct parms *pp)
+	struct kframe *fr, size_t envsz, struct parms *pp)
 {
 	char 	*cp;
 
@@ -1528,7 +1857,7 @@ kworker_child_query(struct env *env,
  */
 static void
 kworker_child_cookies(struct env *env, 
-	int fd, size_t envsz, struct parms *pp)
+	struct kframe *fr, size_t envsz, struct parms *pp)
 {
 	char	*cp;
 
@@ -1541,66 +1870,45 @@ kworker_child_cookies(struct env *env,
  * Terminate the input fields for the parent. 
  */
 static void
-kworker_child_last(int fd)
+kworker_child_last(struct kframe *fr)
 {
 	enum input last = IN__MAX;
 
-	fullwrite(fd, &last, sizeof(enum input));
+	kframe_write(fr, &last, sizeof(enum input));
 }
 
 /*
- * This is the child kcgi process that's going to do the unsafe reading
- * of network data to parse input.
- * When it parses a field, it outputs the key, key size, value, and
- * value size along with the field type.
- * We use the CGI specification in RFC 3875.
+ * Pull all reasonable values from the NULL-terminated array of
+ * "key=value" strings "evp" into a newly-allocated array, the length of
+ * which is stored in "envszp".
+ * Filter out variables that don't meet RFC 3875, section 4.1.
+ * However, we're a bit more relaxed: we don't let through zero-length,
+ * non-ASCII, control characters, and whitespace.
+ * Returns the array (which may be NULL if there are no entries) or
+ * exits on memory exhaustion.
  */
-enum kcgi_err
-kworker_child(int wfd,
-	const struct kvalid *keys, size_t keysz, 
-	const char *const *mimes, size_t mimesz,
-	unsigned int debugging)
+static struct env *
+kworker_child_envs(char *const *evp, size_t *envszp)
 {
-	struct parms	  pp;
+	struct env	 *envs = NULL;
+	char *const	 *ep;
 	char		 *cp;
 	const char	 *start;
-	char		**evp;
-	int		  md5;
-	enum kmethod	  meth;
-	size_t	 	  i;
-	extern char	**environ;
-	struct env	 *envs = NULL;
-	size_t		  envsz;
-
-	pp.fd = wfd;
-	pp.keys = keys;
-	pp.keysz = keysz;
-	pp.mimes = mimes;
-	pp.mimesz = mimesz;
+	size_t		  i, envsz;
 
-	/*
-	 * Pull the entire environment into an array.
-	 */
-	for (envsz = 0, evp = environ; NULL != *evp; evp++) 
+	for (envsz = 0, ep = evp; *ep != NULL; ep++) 
 		envsz++;
 
 	if (envsz) {
 		envs = kxcalloc(envsz, sizeof(struct env));
 		if (envs == NULL)
-			return KCGI_ENOMEM;
+			_exit(EXIT_FAILURE);
 	}
 
-	/* 
-	 * Pull all reasonable values from the environment into "envs".
-	 * Filter out variables that don't meet RFC 3875, section 4.1.
-	 * However, we're a bit more relaxed: we don't let through
-	 * zero-length, non-ASCII, control characters, and whitespace.
-	 */
-
-	for (i = 0, evp = environ; *evp != NULL; evp++) {
-		if ((cp = strchr(*evp, '=')) == NULL || cp == *evp)
+	for (i = 0, ep = evp; *ep != NULL; ep++) {
+		if ((cp = strchr(*ep, '=')) == NULL || cp == *ep)
 			continue;
-		for (start = *evp; *start != '='; start++)
+		for (start = *ep; *start != '='; start++)
 			if (!isascii((unsigned char)*start) ||
 			    !isgraph((unsigned char)*start))
 				break;
@@ -1618,7 +1926,7 @@ kworker_child(int wfd,
 
 		assert(i < envsz);
 
-		if ((envs[i].key = kxstrdup(*evp)) == NULL)
+		if ((envs[i].key = kxstrdup(*ep)) == NULL)
 			_exit(EXIT_FAILURE);
 		envs[i].val = strchr(envs[i].key, '=');
 		*envs[i].val++ = '\0';
@@ -1629,92 +1937,293 @@ kworker_child(int wfd,
 
 	/* Reset this, accounting for crappy entries. */
 
-	envsz = i;
-
-	/*
-	 * Now run a series of transmissions based upon what's in our
-	 * environment.
-	 */
+	*envszp = i;
+	return envs;
+}
 
-	kworker_child_env(envs, wfd, envsz);
-	meth = kworker_child_method(envs, wfd, envsz);
-	kworker_child_auth(envs, wfd, envsz);
-	md5 = kworker_child_rawauth(envs, wfd, envsz);
-	kworker_child_scheme(envs, wfd, envsz);
-	kworker_child_remote(envs, wfd, envsz);
-	kworker_child_path(envs, wfd, envsz);
-	kworker_child_scriptname(envs, wfd, envsz);
-	kworker_child_httphost(envs, wfd, envsz);
-	kworker_child_port(envs, wfd, envsz);
+/*
+ * Run the series of transmissions for a single request based upon
+ * what's in our environment "envs".
+ * The body "b" of size "bsz" is the request body (if NULL, the body
+ * is read from standard input).
+ * See kworker_parent() for the other side of the conversation.
+ */
+static void
+kworker_child_request(struct env *envs, size_t envsz, int wfd,
+	struct parms *pp, char *b, size_t bsz, unsigned int debugging)
+{
+	enum kmethod	 meth;
+	int		 md5;
+	struct kframe	 fr;
+
+	memset(&fr, 0, sizeof(struct kframe));
+	pp->fr = &fr;
+
+	kworker_child_env(envs, &fr, envsz);
+	meth = kworker_child_method(envs, &fr, envsz);
+	kworker_child_auth(envs, &fr, envsz);
+	md5 = kworker_child_rawauth(envs, &fr, envsz);
+	kworker_child_scheme(envs, &fr, envsz);
+	kworker_child_remote(envs, &fr, envsz);
+	kworker_child_path(envs, &fr, envsz);
+	kworker_child_scriptname(envs, &fr, envsz);
+	kworker_child_httphost(envs, &fr, envsz);
+	kworker_child_port(envs, &fr, envsz);
 
 	/* And now the message body itself. */
 
-	kworker_child_body(envs, wfd, envsz, 
-		&pp, meth, NULL, 0, debugging, md5);
-	kworker_child_query(envs, wfd, envsz, &pp);
-	kworker_child_cookies(envs, wfd, envsz, &pp);
-	kworker_child_last(wfd);
+	kworker_child_body(envs, &fr, envsz, 
+		pp, meth, b, bsz, debugging, md5);
+	kworker_child_query(envs, &fr, envsz, pp);
+	kworker_child_cookies(envs, &fr, envsz, pp);
+	kworker_child_last(&fr);
+
+	/* Send everything to the parent in one frame. */
+
+	kframe_send(wfd, &fr);
+	kframe_free(&fr);
+	pp->fr = NULL;
+}
+
+/*
+ * This is the child kcgi process that's going to do the unsafe reading
+ * of network data to parse input.
+ * When it parses a field, it outputs the key, key size, value, and
+ * value size along with the field type.
+ * If "body" is not NULL, it's a region of "bodysz" + 1 bytes shared
+ * with the parent into which the request body is read.
+ * If "spool" is not -1, the request body is instead spooled into it,
+ * which the parent knows as its first file.
+ * We use the CGI specification in RFC 3875.
+ */
+enum kcgi_err
+kworker_child(int wfd, char *body, size_t bodysz, int spool,
+	const struct kvalid *keys, size_t keysz, 
+	const char *const *mimes, size_t mimesz,
+	unsigned int debugging)
+{
+	struct parms	  pp;
+	size_t	 	  i;
+	extern char	**environ;
+	struct env	 *envs;
+	size_t		  envsz;
+
+	parms_init(&pp, body, bodysz, keys, keysz, mimes, mimesz);
+	pp.spool = spool;
+
+	envs = kworker_child_envs(environ, &envsz);
+	kworker_child_request(envs, envsz, wfd, 
+		&pp, NULL, 0, debugging);
 
 	/* Note: the "val" is from within the key. */
 
 	for (i = 0; i < envsz; i++) 
 		free(envs[i].key);
 	free(envs);
+	parms_free(&pp);
 	return KCGI_OK;
 }
 
 /*
- * Reads from the FastCGI control process, kfcgi_control(), are buffered
- * according to what the control process can read from the web server.
+ * This is the persistent variant of kworker_child(), used when the
+ * "persist" option has been passed to khttp_parsex().
+ * Instead of inheriting the environment and standard input, which are
+ * fixed at the time of fork(), each request is read from the
+ * application as a single frame of the number of environment strings
+ * and each of the "key=value" strings, followed by the application's
+ * standard input, from which we read the request body, and the file
+ * into which to spool it, if the byte sent with standard input is set.
+ * Keep reading requests until the application closes the channel.
+ */
+void
+kworker_cgi_child(int wfd,
+	const struct kvalid *keys, size_t keysz, 
+	const char *const *mimes, size_t mimesz,
+	unsigned int debugging)
+{
+	struct parms	  pp;
+	struct env	 *envs;
+	struct kframe	  fr;
+	char		**evp;
+	char		  c;
+	size_t		  i, envsz, evpsz;
+	int		  rc;
+	enum kcgi_err	  er;
+
+	memset(&fr, 0, sizeof(struct kframe));
+
+	parms_init(&pp, NULL, 0, keys, keysz, mimes, mimesz);
+
+	for (;;) {
+		if ((er = kframe_recv(wfd, &fr)) == KCGI_HUP)
+			break;
+		if (er != KCGI_OK) {
+			kutil_warnx(NULL, NULL, "CGI worker: "
+				"error reading request");
+			break;
+		}
+
+		if (kframe_read(&fr, &evpsz, sizeof(size_t)) != KCGI_OK ||
+		    evpsz > fr.sz / sizeof(size_t)) {
+			kutil_warnx(NULL, NULL, "CGI worker: "
+				"error reading environment size");
+			_exit(EXIT_FAILURE);
+		}
+
+		if ((evp = kxcalloc(evpsz + 1, sizeof(char *))) == NULL)
+			_exit(EXIT_FAILURE);
+
+		for (i = 0; i < evpsz; i++)
+			if (kframe_readword(&fr, NULL, &evp[i]) != KCGI_OK) {
+				kutil_warnx(NULL, NULL, "CGI worker: "
+					"error reading environment");
+				_exit(EXIT_FAILURE);
+			}
+
+		if ((rc = fullreadfd(wfd, &pp.in, &c, 1)) <= 0) {
+			kutil_warnx(NULL, NULL, "CGI worker: "
+				"error reading standard input");
+			_exit(EXIT_FAILURE);
+		}
+		if (c && (rc = fullreadfd(wfd, &pp.spool, &c, 1)) <= 0) {
+			kutil_warnx(NULL, NULL, "CGI worker: "
+				"error reading spool");
+			_exit(EXIT_FAILURE);
+		}
+
+		envs = kworker_child_envs(evp, &envsz);
+		kworker_child_request(envs, envsz, wfd, 
+			&pp, NULL, 0, debugging);
+		close(pp.in);
+		pp.in = -1;
+		if (pp.spool != -1)
+			close(pp.spool);
+		pp.spool = -1;
+
+		for (i = 0; i < envsz; i++) 
+			free(envs[i].key);
+		free(envs);
+		for (i = 0; i < evpsz; i++)
+			free(evp[i]);
+		free(evp);
+	}
+
+	kframe_free(&fr);
+	parms_free(&pp);
+}
+
+/*
+ * Read what's available, at most "sz" bytes, from the FastCGI
+ * connection "fd" into "buf", waiting until there's something.
+ * Returns the number of bytes read or zero on failure (the error is
+ * reported in "er").
+ * The error is KCGI_HUP if the connection was closed or failed.
+ */
+static size_t
+kworker_fcgi_recv(int fd, char *buf, size_t sz, enum kcgi_err *er)
+{
+	struct pollfd	 pfd;
+	ssize_t		 ssz;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	for (;;) {
+		if (poll(&pfd, 1, INFTIM) < 0) {
+			kutil_warn(NULL, NULL, "poll");
+			*er = KCGI_SYSTEM;
+			return 0;
+		}
+		if ((ssz = read(fd, buf, sz)) > 0)
+			return ssz;
+		if (ssz == 0) {
+			kutil_warnx(NULL, NULL, "FastCGI: "
+				"connection closed");
+			*er = KCGI_HUP;
+			return 0;
+		} else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+			kutil_warn(NULL, NULL, "read");
+			*er = KCGI_HUP;
+			return 0;
+		}
+	}
+}
+
+/*
+ * Reads from the FastCGI connection are buffered according to what the
+ * web server has sent us.
  * Here we read ahead til we have enough data for what currently needs
- * to be read.
+ * to be read, which must fit into the buffer.
  * Returns a pointer to the data of size "sz" or NULL if errors occured.
+ * The pointer is valid until the next read.
  * If error is KCGI_OK, this *always* returns a buffer.
  * The error is reported in "er".
  */
 static char *
 kworker_fcgi_read(struct fcgi_buf *b, size_t nsz, enum kcgi_err *er)
 {
-	void	*pp;
-	int	 rc;
 	size_t	 sz;
 
-again:
+	assert(nsz <= FCGI_BUFSZ);
 	*er = KCGI_OK;
-	if (b->pos + nsz <= b->sz) {
-		b->pos += nsz;
-		return &b->buf[b->pos - nsz];
-	}
 
-	/* Fill up the next frame. */
-
-	rc = fullread(b->fd, &sz, sizeof(size_t), 0, er);
-	if (rc <= 0) {
-		kutil_warnx(NULL, NULL, "FastCGI: "
-			"error reading frame size from control");
-		return NULL;
-	} else if (sz == 0) {
-		kutil_warnx(NULL, NULL, "FastCGI: connection "
-			"closed while reading frame size");
-		*er = KCGI_HUP;
-		return NULL;
-	} 
+	if (b->pos + nsz > FCGI_BUFSZ) {
+		b->sz -= b->pos;
+		memmove(b->buf, b->buf + b->pos, b->sz);
+		b->pos = 0;
+	}
 
-	if ((pp = kxrealloc(b->buf, b->sz + sz)) == NULL) {
-		*er = KCGI_ENOMEM;
-		return NULL;
+	while (b->pos + nsz > b->sz) {
+		sz = kworker_fcgi_recv(b->fd, 
+			b->buf + b->sz, FCGI_BUFSZ - b->sz, er);
+		if (sz == 0)
+			return NULL;
+		b->sz += sz;
 	}
 
-	b->buf = pp;
-	rc = fullread(b->fd, b->buf + b->sz, sz, 0, er);
-	if (rc <= 0) {
-		kutil_warnx(NULL, NULL, "FastCGI: error "
-			"reading frame data from control");
-		return NULL;
+	b->pos += nsz;
+	return &b->buf[b->pos - nsz];
+}
+
+/*
+ * Copy "sz" bytes of the FastCGI connection into "buf".
+ * Buffered bytes are copied from the buffer.
+ * If that's not enough, large remainders are read from the connection
+ * directly into "buf", small ones through the buffer.
+ * Either way, each byte is copied once.
+ * Returns zero on failure (the error is reported in "er"), non-zero on
+ * success.
+ */
+static int
+kworker_fcgi_copy(struct fcgi_buf *b, 
+	unsigned char *buf, size_t sz, enum kcgi_err *er)
+{
+	size_t	 n;
+
+	*er = KCGI_OK;
+
+	while (sz > 0) {
+		if (b->pos < b->sz) {
+			n = b->sz - b->pos < sz ? b->sz - b->pos : sz;
+			memcpy(buf, b->buf + b->pos, n);
+			b->pos += n;
+			buf += n;
+			sz -= n;
+			continue;
+		}
+		b->pos = b->sz = 0;
+		if (sz >= FCGI_BUFSZ / 2) {
+			n = kworker_fcgi_recv(b->fd, (char *)buf, sz, er);
+			if (n == 0)
+				return 0;
+			buf += n;
+			sz -= n;
+		} else if ((b->sz = kworker_fcgi_recv
+		    (b->fd, b->buf, FCGI_BUFSZ, er)) == 0)
+			return 0;
 	}
 
-	b->sz += sz;
-	goto again;
+	return 1;
 }
 
 
@@ -1753,79 +2262,124 @@ kworker_fcgi_header(struct fcgi_buf *b, struct fcgi_hdr *hdr)
 }
 
 /*
- * Read in the entire header and data for the begin sequence request.
+ * Read in the data for the begin sequence request, whose header "hdr"
+ * has already been read.
  * This is defined in section 5.1 of the v1.0 specification.
+ * Sets "keep" to whether the web server wants the connection kept open
+ * after the request.
  * Return KCGI_OK on success, KCGI_HUP on connection close, KCGI_FORM
  * with FastCGI protocol errors, and a fatal error otherwise.
  */
 static enum kcgi_err
-kworker_fcgi_begin(struct fcgi_buf *b, uint16_t *rid)
+kworker_fcgi_begin(struct fcgi_buf *b, 
+	const struct fcgi_hdr *hdr, int *keep)
 {
-	struct fcgi_hdr	 hdr;
 	const struct fcgi_bgn *ptr;
 	const char	*buf;
 	enum kcgi_err	 er;
 
-	/* Read the header entry. */
-
-	if ((er = kworker_fcgi_header(b, &hdr)) != KCGI_OK)
-		return er;
-
-	*rid = hdr.requestId;
-
-	if (hdr.type != FCGI_BEGIN_REQUEST) {
-		kutil_warnx(NULL, NULL, "FastCGI: bad type: %" PRIu8 
-			" (want %d)", hdr.type, FCGI_BEGIN_REQUEST);
+	if (hdr->contentLength < sizeof(struct fcgi_bgn)) {
+		kutil_warnx(NULL, NULL, "FastCGI: bad begin "
+			"length: %" PRIu16, hdr->contentLength);
 		return KCGI_FORM;
-	} 
-	
+	}
+
 	/* Read the "begin" content and discard padding. */
 
 	buf = kworker_fcgi_read(b, 
-		hdr.contentLength + 
-		hdr.paddingLength, &er);
+		hdr->contentLength + 
+		hdr->paddingLength, &er);
+	if (buf == NULL)
+		return er;
 
 	ptr = (const struct fcgi_bgn *)buf;
 
-	if (ptr->flags) {
+	if (ptr->flags & ~FCGI_KEEP_CONN) {
 		kutil_warnx(NULL, NULL, "FastCGI: bad flags: %" PRId8 
-			" (want 0)", ptr->flags);
+			" (want 0 or %d)", ptr->flags, FCGI_KEEP_CONN);
 		return KCGI_FORM;
 	}
 
+	*keep = (ptr->flags & FCGI_KEEP_CONN) != 0;
 	return KCGI_OK;
 }
 
+/*
+ * Take a free file from "sp" to spool the body of "req" into if its
+ * CONTENT_LENGTH is at least the spooling size.
+ * If there's none, the body isn't spooled.
+ */
+static void
+kworker_fcgi_spool(struct fcgi_req *req, struct fcgi_spool *sp)
+{
+	const char	*cp;
+	size_t		 i;
+
+	if (sp->min == 0 || (cp = kworker_env
+	    (req->envs, req->envsz, "CONTENT_LENGTH")) == NULL ||
+	    (size_t)strtonum(cp, 0, LLONG_MAX, NULL) < sp->min)
+		return;
+
+	for (i = 0; i < KFCGI_SPOOLS; i++)
+		if (sp->fds[i] != -1)
+			break;
+	if (i == KFCGI_SPOOLS)
+		return;
+
+	/* The file may have been used by an aborted request. */
+
+	if (lseek(sp->fds[i], 0, SEEK_SET) == -1) {
+		kutil_warn(NULL, NULL, "lseek");
+		return;
+	}
+
+	req->spool = sp->fds[i];
+	req->spoolid = i;
+	sp->fds[i] = -1;
+}
+
 /*
  * Read in a data stream as defined within section 5.3 of the v1.0
  * specification.
  * We might have multiple stdin buffers for the same data, so always
- * append to the existing NUL-terminated buffer.
+ * append to the existing NUL-terminated buffer, which grows by at least
+ * doubling, or write them to the request's spool (see "sp").
  * Return KCGI_OK on success, KCGI_HUP on connection close, KCGI_FORM
  * with FastCGI protocol errors, and a fatal error otherwise.
  */
 static enum kcgi_err
-kworker_fcgi_stdin(struct fcgi_buf *b, const struct fcgi_hdr *hdr,
-	unsigned char **sbp, size_t *ssz)
+kworker_fcgi_stdin(struct fcgi_buf *b, const struct fcgi_hdr *hdr, 
+	struct fcgi_req *req, struct fcgi_spool *sp)
 {
 	enum kcgi_err	 er;
 	void		*ptr;
-	char		*bp;
-
-	/* Read the "begin" content and discard padding. */
-
-	bp = kworker_fcgi_read(b, 
-		hdr->contentLength + 
-		hdr->paddingLength, &er);
+	const char	*cp;
+	size_t		 max;
 
-	/* 
-	 * Short-circuit: no data to read.
-	 * The caller should detect this and stop reading from the
-	 * FastCGI connection.
+	/*
+	 * Whether to spool is decided with the first content.
+	 * If so, write the content as it comes (it's within our read
+	 * buffer), so the file grows as we read.
 	 */
 
-	if (hdr->contentLength == 0)
+	if (hdr->contentLength > 0 && req->ssz == 0 && req->spool == -1)
+		kworker_fcgi_spool(req, sp);
+
+	if (req->spool != -1) {
+		if (req->ssz > SIZE_MAX - hdr->contentLength - 1) {
+			kutil_warnx(NULL, NULL, 
+				"FastCGI: stdin overflow");
+			return KCGI_FORM;
+		}
+		cp = kworker_fcgi_read(b, hdr->contentLength + 
+			hdr->paddingLength, &er);
+		if (cp == NULL)
+			return er;
+		if (!spoolwrite(req->spool, cp, hdr->contentLength))
+			return KCGI_SYSTEM;
+		req->ssz += hdr->contentLength;
 		return KCGI_OK;
+	}
 
 	/* 
 	 * Use another buffer for the stdin.
@@ -1833,17 +2387,38 @@ kworker_fcgi_stdin(struct fcgi_buf *b, const struct fcgi_hdr *hdr,
 	 * frames (data interspersed with control information).
 	 * Obviously, we want to extract our data from that.
 	 * Make sure it's NUL-terminated!
-	 * FIXME: check for addition overflow.
 	 */
 
-	ptr = kxrealloc(*sbp, *ssz + hdr->contentLength + 1);
-	if (ptr == NULL)
-		return KCGI_ENOMEM;
+	if (hdr->contentLength > 0 &&
+	    req->ssz + hdr->contentLength + 1 > req->smax) {
+		if (req->ssz > SIZE_MAX - hdr->contentLength - 1) {
+			kutil_warnx(NULL, NULL, 
+				"FastCGI: stdin overflow");
+			return KCGI_FORM;
+		}
+		max = req->ssz + hdr->contentLength + 1;
+		if (req->smax <= SIZE_MAX / 2 && max < req->smax * 2)
+			max = req->smax * 2;
+		if ((ptr = kxrealloc(req->sbuf, max)) == NULL)
+			return KCGI_ENOMEM;
+		req->sbuf = ptr;
+		req->smax = max;
+	}
+
+	/* Read the content, then discard padding. */
+
+	if (hdr->contentLength > 0) {
+		if (!kworker_fcgi_copy(b, req->sbuf + req->ssz, 
+		    hdr->contentLength, &er))
+			return er;
+		req->ssz += hdr->contentLength;
+		req->sbuf[req->ssz] = '\0';
+	}
+
+	if (hdr->paddingLength > 0 &&
+	    kworker_fcgi_read(b, hdr->paddingLength, &er) == NULL)
+		return er;
 
-	*sbp = ptr;
-	memcpy(*sbp + *ssz, bp, hdr->contentLength);
-	(*sbp)[*ssz + hdr->contentLength] = '\0';
-	*ssz += hdr->contentLength;
 	return KCGI_OK;
 }
 
@@ -2008,78 +2583,236 @@ kworker_fcgi_params(struct fcgi_buf *buf, const struct fcgi_hdr *hdr,
 	return KCGI_OK;
 }
 
+/*
+ * Free the parameters and data of a FastCGI request, putting any spool
+ * it's still holding back into its slot of "sp".
+ */
+static void
+kworker_fcgi_req_free(struct fcgi_req *req, struct fcgi_spool *sp)
+{
+	size_t	 i;
+
+	for (i = 0; i < req->envsz; i++) {
+		free(req->envs[i].key);
+		free(req->envs[i].val);
+	}
+	free(req->envs);
+	free(req->sbuf);
+	if (req->spool != -1)
+		sp->fds[req->spoolid] = req->spool;
+	memset(req, 0, sizeof(struct fcgi_req));
+	req->spool = -1;
+}
+
+/*
+ * Take the spooling files sent by the application on "fd" since we
+ * last looked, without waiting for any.
+ * Each comes with its slot in "sp", which must be free.
+ */
+static void
+kworker_fcgi_spools(int fd, struct fcgi_spool *sp)
+{
+	struct pollfd	 pfd;
+	size_t		 id;
+	int		 spool;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+		if (fullreadfd(fd, &spool, &id, sizeof(size_t)) <= 0)
+			return;
+		if (id < KFCGI_SPOOLS && sp->fds[id] == -1) {
+			sp->fds[id] = spool;
+			continue;
+		}
+		kutil_warnx(NULL, NULL, "FastCGI: bad spool");
+		close(spool);
+	}
+}
+
+/*
+ * Read FastCGI records until one of the requests on the connection has
+ * been fully read, then move it into "done" and remove it from "reqs".
+ * Records of several requests may be interleaved: they're routed to
+ * their request by requestId.
+ * Requests aborted by the web server are dropped and their identifiers
+ * passed to the control process on "ctl", which ends them.
+ * Large bodies are spooled into files taken from "sp".
+ * Return KCGI_OK on success, KCGI_HUP on connection close, KCGI_FORM
+ * with FastCGI protocol errors, and a fatal error otherwise.
+ */
+static enum kcgi_err
+kworker_fcgi_reqs(struct fcgi_buf *b, int ctl, struct fcgi_spool *sp,
+	struct fcgi_req *reqs, size_t *reqsz, struct fcgi_req *done)
+{
+	struct fcgi_hdr	 hdr;
+	struct fcgi_req	*req;
+	enum kcgi_err	 er;
+	size_t		 i;
+	int		 rc;
+
+	for (;;) {
+		if ((er = kworker_fcgi_header(b, &hdr)) != KCGI_OK)
+			return er;
+
+		for (i = 0; i < *reqsz; i++)
+			if (reqs[i].rid == hdr.requestId)
+				break;
+		req = i < *reqsz ? &reqs[i] : NULL;
+
+		switch (hdr.type) {
+		case FCGI_BEGIN_REQUEST:
+			if (req != NULL) {
+				kutil_warnx(NULL, NULL, "FastCGI: "
+					"duplicate request ID");
+				return KCGI_FORM;
+			} else if (*reqsz == FCGI_MAX_REQS) {
+				kutil_warnx(NULL, NULL, "FastCGI: "
+					"too many requests");
+				return KCGI_FORM;
+			}
+			req = &reqs[(*reqsz)++];
+			memset(req, 0, sizeof(struct fcgi_req));
+			req->rid = hdr.requestId;
+			req->spool = -1;
+			er = kworker_fcgi_begin(b, &hdr, &req->keep);
+			break;
+		case FCGI_ABORT_REQUEST:
+			/*
+			 * Forget about the request, but have the
+			 * control process end it (section 5.4) while we
+			 * go on reading.
+			 * Requests already read are the application's:
+			 * its response ends them.
+			 */
+			if (kworker_fcgi_read(b, hdr.contentLength +
+			    hdr.paddingLength, &er) == NULL)
+				return er;
+			if (req == NULL)
+				break;
+			kworker_fcgi_req_free(req, sp);
+			reqs[i] = reqs[--(*reqsz)];
+			rc = 2;
+			fullwrite(ctl, &rc, sizeof(int));
+			fullwrite(ctl, &hdr.requestId, sizeof(uint16_t));
+			break;
+		case FCGI_PARAMS:
+			if (req == NULL || req->instdin) {
+				kutil_warnx(NULL, NULL, 
+					"FastCGI: wrong request ID");
+				return KCGI_FORM;
+			}
+			er = kworker_fcgi_params
+				(b, &hdr, &req->envs, &req->envsz);
+			break;
+		case FCGI_STDIN:
+			if (req == NULL) {
+				kutil_warnx(NULL, NULL, 
+					"FastCGI: wrong request ID");
+				return KCGI_FORM;
+			}
+
+			/*
+			 * Call this even if we have a zero-length data
+			 * payload as specified by contentLength.
+			 * This is because there might be padding, and
+			 * we want to make sure we've drawn everything
+			 * from the socket.
+			 * The stdin content ends with a single
+			 * zero-length record.
+			 */
+
+			req->instdin = 1;
+			er = kworker_fcgi_stdin(b, &hdr, req, sp);
+			if (er != KCGI_OK || hdr.contentLength > 0)
+				break;
+			*done = *req;
+			reqs[i] = reqs[--(*reqsz)];
+			return KCGI_OK;
+		default:
+			kutil_warnx(NULL, NULL, 
+				"FastCGI: bad header type");
+			return KCGI_FORM;
+		}
+
+		if (er != KCGI_OK)
+			return er;
+	}
+}
+
 /*
  * This is executed by the untrusted child for FastCGI setups.
  * Throughout, we follow the FastCGI specification, version 1.0, 29
  * April 1996.
+ * Request bodies of at least "spoolsz" bytes, if not zero, are spooled
+ * into files sent to us by the application on "wfd".
  */
 void
-kworker_fcgi_child(int wfd, int work_ctl,
+kworker_fcgi_child(int wfd, int work_ctl, size_t spoolsz,
 	const struct kvalid *keys, size_t keysz, 
 	const char *const *mimes, size_t mimesz,
 	unsigned int debugging)
 {
 	struct parms 	 pp;
-	struct fcgi_hdr	 hdr;
+	struct fcgi_req	 reqs[FCGI_MAX_REQS], req;
+	struct fcgi_spool sp;
 	enum kcgi_err	 er;
-	unsigned char	*sbuf = NULL;
-	struct env	*envs = NULL;
-	uint16_t	 rid;
 	uint32_t	 cookie = 0;
-	size_t		 i, ssz = 0, sz, envsz = 0;
-	int		 rc, md5;
-	enum kmethod	 meth;
+	size_t		 i, reqsz = 0;
+	int		 rc, fd, more = 0;
 	struct fcgi_buf	 fbuf;
+	char		 nil = '\0';
 
 	memset(&fbuf, 0, sizeof(struct fcgi_buf));
+	memset(&req, 0, sizeof(struct fcgi_req));
+	fbuf.fd = -1;
+	req.spool = -1;
+
+	for (i = 0; i < KFCGI_SPOOLS; i++)
+		sp.fds[i] = -1;
+	sp.min = spoolsz;
+
+	if ((fbuf.buf = kxmalloc(FCGI_BUFSZ)) == NULL)
+		return;
+
+	/* Bodies are read from the connection, not descriptors. */
 
-	pp.fd = wfd;
-	pp.keys = keys;
-	pp.keysz = keysz;
-	pp.mimes = mimes;
-	pp.mimesz = mimesz;
+	parms_init(&pp, NULL, 0, keys, keysz, mimes, mimesz);
+	pp.in = -1;
 
 	/*
 	 * Loop over all incoming sequences to this particular slave.
 	 * Sequences must consist of a single FastCGI session as defined
-	 * in the FastCGI version 1.0 reference document.
+	 * in the FastCGI version 1.0 reference document, though the
+	 * connection may multiplex several requests in one session.
+	 * Each sequence ends when one of these requests has been read.
 	 *
-	 * If the connection closes out at any point, we receive a
-	 * zero-length read from the control socket.
-	 * The response to this should be to write an zero error code
-	 * back to the control socket, then keep on listening.
+	 * Each sequence starts with the control process passing us the
+	 * connection, from which we read directly.
+	 * If the connection closes out at any point, we write a zero
+	 * error code back to the control socket, then keep on
+	 * listening.
+	 * For each request aborted by the web server, we write a code
+	 * of two and its identifier.
 	 * Otherwise, if we've read the full message, write a non-zero
 	 * error code, then our identifier and cookie, then the rest
 	 * goes directly to the parse routines in kworker_parent().
 	 */
 
 	for (;;) {
-		free(sbuf);
-		for (i = 0; i < envsz; i++) {
-			free(envs[i].key);
-			free(envs[i].val);
-		}
-		free(envs);
-		free(fbuf.buf);
-
-		sbuf = NULL;
-		ssz = 0;
-		envs = NULL;
-		envsz = 0;
+		kworker_fcgi_req_free(&req, &sp);
 		cookie = 0;
-		memset(&fbuf, 0, sizeof(struct fcgi_buf));
-		fbuf.fd = work_ctl;
 
 		/* 
-		 * Begin by reading our magic cookie.
+		 * Begin by reading our magic cookie and the connection.
 		 * This is emitted by kfcgi_control() at the start of
 		 * our sequence.
 		 * When we've finished reading data with success, we'll
 		 * respond with this value.
 		 */
 
-		rc = fullread(fbuf.fd, 
-			&cookie, sizeof(uint32_t), 1, &er);
+		rc = fullreadfd(work_ctl, &fd, &cookie, sizeof(uint32_t));
 		if (rc < 0) {
 			kutil_warnx(NULL, NULL, "FastCGI: "
 				"error reading worker cookie");
@@ -2090,123 +2823,45 @@ kworker_fcgi_child(int wfd, int work_ctl,
 			break;
 		}
 
-		/* Now start the FastCGI sequence. */
-
-		er = kworker_fcgi_begin(&fbuf, &rid);
-		if (er == KCGI_HUP) {
-			kutil_warnx(NULL, NULL, "FastCGI: "
-				"connection severed at start");
-			/* Note: writing error code... */
-			rc = 0;
-			fullwrite(work_ctl, &rc, sizeof(int));
-			continue;
-		} else if (er != KCGI_OK) {
-			kutil_warnx(NULL, NULL, "FastCGI: "
-				"unrecoverable error at start");
-			break;
-		}
-
 		/*
-		 * Now read one or more parameters.
-		 * We read them all at once, then do the parsing later
-		 * after we've read all of our data.
-		 * We read parameters til we no longer have the
-		 * FCGI_PARAMS type on the current header.
+		 * If the last sequence's connection has more for us
+		 * (buffered records or requests being read), keep them
+		 * for this sequence, which is on the same connection.
+		 * Otherwise, start from scratch.
 		 */
 
-		er = KCGI_OK;
-		envsz = 0;
-		memset(&hdr, 0, sizeof(struct fcgi_hdr));
-
-		while (er == KCGI_OK) {
-			er = kworker_fcgi_header(&fbuf, &hdr);
-			if (er != KCGI_OK)
-				break;
-			if (rid != hdr.requestId) {
-				kutil_warnx(NULL, NULL, 
-					"FastCGI: wrong request ID");
-				er = KCGI_FORM;
-				break;
-			} 
-			if (hdr.type != FCGI_PARAMS)
-				break;
-			er = kworker_fcgi_params
-				(&fbuf, &hdr, &envs, &envsz);
+		if (!more) {
+			for (i = 0; i < reqsz; i++)
+				kworker_fcgi_req_free(&reqs[i], &sp);
+			reqsz = 0;
+			fbuf.sz = fbuf.pos = 0;
 		}
 
-		if (er == KCGI_HUP) {
-			kutil_warnx(NULL, NULL, "FastCGI: "
-				"connection severed at parameters");
-			/* Note: writing error code... */
-			rc = 0;
-			fullwrite(work_ctl, &rc, sizeof(int));
-			continue;
-		} else if (er != KCGI_OK) {
-			kutil_warnx(NULL, NULL, "FastCGI: "
-				"unrecoverable error at parameters");
-			break;
-		} else if (hdr.type != FCGI_STDIN) {
-			kutil_warnx(NULL, NULL, "FastCGI: "
-				"bad header type");
-			er = KCGI_FORM;
-			break;
-		} else if (rid != hdr.requestId) {
-			kutil_warnx(NULL, NULL, "FastCGI: "
-				"wrong request ID");
-			er = KCGI_FORM;
-			break;
-		}
+		fbuf.fd = fd;
+		more = 0;
+		kworker_fcgi_spools(wfd, &sp);
 
-		/*
-		 * Lastly, we want to process the stdin content.
-		 * These will end with a single zero-length record.
-		 * Keep looping til we've flushed all input.
+		/* 
+		 * Read records until a request is complete.
+		 * The control process and application have their own
+		 * copies of the connection, so we're done with ours.
 		 */
 
-		for (;;) {
-			/*
-			 * Call this even if we have a zero-length data
-			 * payload as specified by contentLength.
-			 * This is because there might be padding, and
-			 * we want to make sure we've drawn everything
-			 * from the socket before exiting.
-			 */
-
-			er = kworker_fcgi_stdin
-				(&fbuf, &hdr, &sbuf, &ssz);
-			if (er != KCGI_OK || hdr.contentLength == 0)
-				break;
-
-			/* Now read the next header. */
-
-			er = kworker_fcgi_header(&fbuf, &hdr);
-			if (er != KCGI_OK)
-				break;
-			if (rid != hdr.requestId) {
-				kutil_warnx(NULL, NULL, "FastCGI: "
-					"wrong FastCGI request ID");
-				er = KCGI_FORM;
-				break;
-			} 
-
-			if (hdr.type == FCGI_STDIN)
-				continue;
-			kutil_warnx(NULL, NULL, 
-				"FastCGI: bad header type");
-			er = KCGI_FORM;
-			break;
-		}
+		er = kworker_fcgi_reqs(&fbuf, 
+			work_ctl, &sp, reqs, &reqsz, &req);
+		close(fbuf.fd);
+		fbuf.fd = -1;
 
 		if (er == KCGI_HUP) {
 			kutil_warnx(NULL, NULL, "FastCGI: "
-				"connection severed at stdin");
-			/* Note: writing error code. */
+				"connection severed");
+			/* Note: writing error code... */
 			rc = 0;
 			fullwrite(work_ctl, &rc, sizeof(int));
 			continue;
 		} else if (er != KCGI_OK) {
 			kutil_warnx(NULL, NULL, "FastCGI: "
-				"unrecoverable error at stdin");
+				"unrecoverable error");
 			break;
 		}
 
@@ -2219,67 +2874,51 @@ kworker_fcgi_child(int wfd, int work_ctl,
 		rc = 1;
 		fullwrite(work_ctl, &rc, sizeof(int));
 		fullwrite(work_ctl, &cookie, sizeof(uint32_t));
-		fullwrite(work_ctl, &rid, sizeof(uint16_t));
+		fullwrite(work_ctl, &req.rid, sizeof(uint16_t));
 
-		/* 
-		 * Read our last zero-length frame.
-		 * This is because kfcgi_control() always ends with an
-		 * empty frame, regardless of whether we're in an error
-		 * or not.
-		 * So if we're this far, we've read the full request,
-		 * and we should have an empty frame.
+		/*
+		 * Tell the control process whether to keep the
+		 * connection open and whether we have more to read from
+		 * it, in which case the next sequence must be on it.
+		 * If the connection isn't kept, we discard the rest.
 		 */
 
-		rc = fullread(fbuf.fd, &sz, sizeof(size_t), 0, &er);
-		if (rc <= 0) {
-			kutil_warnx(NULL, NULL, 
-				"FastCGI: error reading trailer");
-			break;
-		} else if (sz != 0) {
-			kutil_warnx(NULL, NULL, 
-				"FastCGI: trailer not zero-length");
-			er = KCGI_FORM;
-			break;
-		} 
+		more = req.keep && 
+			(fbuf.pos < fbuf.sz || reqsz > 0);
+		fullwrite(work_ctl, &req.keep, sizeof(int));
+		fullwrite(work_ctl, &more, sizeof(int));
 
 		/* 
 		 * Now we can reply to our request.
 		 * See kworker_parent().
-		 * These are in a very specific order.
-		 */
-
-		kworker_child_env(envs, wfd, envsz);
-		meth = kworker_child_method(envs, wfd, envsz);
-		kworker_child_auth(envs, wfd, envsz);
-		md5 = kworker_child_rawauth(envs, wfd, envsz);
-		kworker_child_scheme(envs, wfd, envsz);
-		kworker_child_remote(envs, wfd, envsz);
-		kworker_child_path(envs, wfd, envsz);
-		kworker_child_scriptname(envs, wfd, envsz);
-		kworker_child_httphost(envs, wfd, envsz);
-		kworker_child_port(envs, wfd, envsz);
-
-		/* 
-		 * And now the message body itself.
 		 * We must either have a NULL message or non-zero
 		 * length.
+		 * A spooled body is parsed from its file, which is the
+		 * application's once used: it sends us another.
 		 */
 
-		assert(ssz == 0 || sbuf != NULL);
-		kworker_child_body(envs, wfd, envsz, &pp, 
-			meth, (char *)sbuf, ssz, debugging, md5);
-		kworker_child_query(envs, wfd, envsz, &pp);
-		kworker_child_cookies(envs, wfd, envsz, &pp);
-		kworker_child_last(wfd);
+		assert(req.ssz == 0 || req.sbuf != NULL || req.spool != -1);
+		pp.spool = req.spool;
+		pp.spoolid = req.spoolid;
+		kworker_child_request(req.envs, req.envsz, wfd, &pp, 
+			req.spool != -1 ? NULL : 
+			req.sbuf != NULL ? (char *)req.sbuf : &nil,
+			req.ssz, debugging);
+		pp.spool = -1;
+		if (pp.spooled) {
+			close(req.spool);
+			req.spool = -1;
+		}
 	}
 
 	/* The same as what we do at the loop start. */
 
-	free(sbuf);
-	for (i = 0; i < envsz; i++) {
-		free(envs[i].key);
-		free(envs[i].val);
-	}
-	free(envs);
+	kworker_fcgi_req_free(&req, &sp);
+	for (i = 0; i < reqsz; i++)
+		kworker_fcgi_req_free(&reqs[i], &sp);
+	for (i = 0; i < KFCGI_SPOOLS; i++)
+		if (sp.fds[i] != -1)
+			close(sp.fds[i]);
 	free(fbuf.buf);
+	parms_free(&pp);
 }
@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 
 #include "kcgi.h"
@@ -519,6 +520,51 @@ khttp_datetime2epoch(int64_t *res, int64_t day, int64_t mon,
 	return khttp_mktime(res, &tm);
 }
 
+/*
+ * Parse an HTTP date (RFC 9110 section 5.6.7): the preferred IMF-fixdate
+ * "Sun, 06 Nov 1994 08:49:37 GMT" and the obsolete RFC 850 and asctime()
+ * forms.
+ * The day of the week is not checked.
+ */
+int
+khttp_str2epoch(int64_t *res, const char *str)
+{
+	char		 wday[10], mon[4];
+	int		 day, year, hour, min, sec, n = -1;
+	size_t		 i;
+	const char	*months[12] = {
+		"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+		"Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+	};
+
+	if (str == NULL)
+		return 0;
+
+	if (sscanf(str, "%3[A-Za-z], %2d %3[A-Za-z] %4d "
+	    "%2d:%2d:%2d GMT%n", wday, &day, mon, &year,
+	    &hour, &min, &sec, &n) == 7 && n > 0 && str[n] == '\0') {
+		/* IMF-fixdate. */
+	} else if (sscanf(str, "%9[A-Za-z], %2d-%3[A-Za-z]-%2d "
+	    "%2d:%2d:%2d GMT%n", wday, &day, mon, &year,
+	    &hour, &min, &sec, &n) == 7 && n > 0 && str[n] == '\0') {
+		/* RFC 850: two-digit year, assumed 1970--2069. */
+		year += year < 70 ? 2000 : 1900;
+	} else if (sscanf(str, "%3[A-Za-z] %3[A-Za-z] %2d "
+	    "%2d:%2d:%2d %4d%n", wday, mon, &day, 
+	    &hour, &min, &sec, &year, &n) == 7 && n > 0 && str[n] == '\0') {
+		/* asctime(). */
+	} else
+		return 0;
+
+	for (i = 0; i < 12; i++)
+		if (strcasecmp(mon, months[i]) == 0)
+			break;
+	if (i == 12)
+		return 0;
+
+	return khttp_datetime2epoch(res, day, i + 1, year, hour, min, sec);
+}
+
 int
 khttp_date2epoch(int64_t *res, int64_t day, int64_t mon, int64_t year)
 {
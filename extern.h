@@ -31,6 +31,7 @@ enum	input {
 
 enum	sandtype {
 	SAND_WORKER,
+	SAND_WORKER_FCGI, /* also receives descriptors */
 	SAND_CONTROL_NEW,
 	SAND_CONTROL_OLD
 };
@@ -38,23 +39,132 @@ enum	sandtype {
 #define KWORKER_PARENT  1
 #define KWORKER_CHILD	0
 
+/*
+ * Number of files the FastCGI application keeps with the worker for
+ * spooling request bodies (see the "spoolsz" option).
+ * Bodies arriving while all are in use aren't spooled.
+ */
+#define	KFCGI_SPOOLS	4
+
+/*
+ * Alignment of and default block size for arena allocations.
+ */
+#define	KARENA_ALIGN	16
+#define	KARENA_BLKSZ	(16 * 1024)
+
+/*
+ * A block of arena memory.
+ * The data follows the header, which is a multiple of KARENA_ALIGN.
+ */
+struct	karena_blk {
+	struct karena_blk *next; /* next block in arena */
+	size_t		 sz; /* bytes allocated after header */
+	size_t		 pos; /* bytes used after header */
+	size_t		 pad; /* keep data aligned */
+	char		 data[]; /* data itself */
+};
+
+/*
+ * A bump allocator whose allocations are released all at once.
+ * See karena_alloc() and karena_free().
+ */
+struct	karena {
+	struct karena_blk *blks; /* blocks (current first) */
+};
+
+/*
+ * A slot in a struct kstrmap.
+ */
+struct	kstrmap_ent {
+	const char	*name; /* name (not copied) or NULL if empty */
+	size_t		 val; /* value for name */
+};
+
+/*
+ * Open-addressed, case-insensitive hash table mapping names to values.
+ * This is used to resolve page names and MIME suffixes, which are fixed
+ * when the tables are passed in.
+ */
+struct	kstrmap {
+	struct kstrmap_ent *slots;
+	size_t		 mask; /* number of slots less one */
+};
+
+/*
+ * Private per-request data attached to struct kreq.
+ * This is allocated only when needed, so it may be NULL.
+ */
+struct	kpriv {
+	char		*body; /* body shared with worker (or NULL) */
+	size_t		 bodysz; /* length of "body" (mapped + 1 for NUL) */
+	int		 bodyfd; /* file "body" is spooled to (or -1) */
+	struct karena	 arena; /* request allocations */
+	size_t		 fieldmax; /* allocated kreq "fields" */
+	size_t		 cookiemax; /* allocated kreq "cookies" */
+};
+
+/*
+ * A frame of serialised fields passed from the worker to the parent.
+ * The worker appends to the frame, then sends it in one write with
+ * kframe_send(); the parent receives it whole with kframe_recv() and
+ * consumes it in order.
+ * On the wire, the frame is prefixed by its size_t length.
+ */
+struct	kframe {
+	char	*buf; /* buffer itself */
+	size_t	 sz; /* bytes in buffer */
+	size_t	 maxsz; /* allocated bytes */
+	size_t	 pos; /* read position */
+};
+
+struct	iovec;
+
 __BEGIN_DECLS
 
 struct kdata	*kdata_alloc(int, int, uint16_t, 
 			unsigned int, const struct kopts *);
 void		 kdata_free(struct kdata *, int);
 
-int		 kworker_auth_child(int, const char *);
-enum kcgi_err	 kworker_auth_parent(int, struct khttpauth *);
-enum kcgi_err	 kworker_child(int,
+int		 kworker_auth_child(struct kframe *, const char *);
+enum kcgi_err	 kworker_auth_parent(struct kframe *,
+			struct karena *, struct khttpauth *);
+void		 kworker_cgi_child(int,
 			const struct kvalid *, size_t, 
 			const char *const *, size_t,
 			unsigned int);
-void	 	 kworker_fcgi_child(int, int,
+enum kcgi_err	 kworker_child(int, char *, size_t, int,
 			const struct kvalid *, size_t, 
 			const char *const *, size_t,
 			unsigned int);
-enum kcgi_err	 kworker_parent(int, struct kreq *, int, size_t);
+void	 	 kworker_fcgi_child(int, int, size_t,
+			const struct kvalid *, size_t, 
+			const char *const *, size_t,
+			unsigned int);
+enum kcgi_err	 kworker_parent(int, struct kreq *, size_t,
+			int *, size_t);
+
+void		*karena_alloc(struct karena *, size_t);
+void		*karena_calloc(struct karena *, size_t, size_t);
+void		 karena_free(struct karena *);
+
+size_t		 kstrmap_get(const struct kstrmap *, 
+			const char *, size_t);
+void		 kstrmap_free(struct kstrmap *);
+int		 kstrmap_pages(struct kstrmap *, 
+			const char *const *, size_t);
+int		 kstrmap_suffixes(struct kstrmap *, 
+			const struct kmimemap *);
+
+void		 kframe_free(struct kframe *);
+enum kcgi_err	 kframe_read(struct kframe *, void *, size_t);
+enum kcgi_err	 kframe_readword(struct kframe *, 
+			struct karena *, char **);
+enum kcgi_err	 kframe_readwordsz(struct kframe *, 
+			struct karena *, char **, size_t *);
+enum kcgi_err	 kframe_recv(int, struct kframe *);
+void		 kframe_send(int, struct kframe *);
+void		 kframe_write(struct kframe *, const void *, size_t);
+void		 kframe_writeword(struct kframe *, const char *);
 
 int		 fullread(int, void *, size_t, int, enum kcgi_err *);
 enum kcgi_err	 fullreadword(int, char **);
@@ -62,6 +172,9 @@ enum kcgi_err	 fullreadwordsz(int, char **, size_t *);
 int		 fullreadfd(int, int *, void *, size_t);
 void		 fullwrite(int, const void *, size_t);
 enum kcgi_err	 fullwritenoerr(int, const void *, size_t);
+enum kcgi_err	 fullwritevnoerr(int, struct iovec *, int);
+enum kcgi_err	 fullsendfile(int, int, off_t *, size_t);
+enum kcgi_err	 trywritevnoerr(int, struct iovec *, int);
 void		 fullwriteword(int, const char *);
 int		 fullwritefd(int, int, void *, size_t);
 
@@ -80,6 +193,9 @@ int	 	 ksandbox_darwin_init_child(enum sandtype);
 int	 	 ksandbox_seccomp_init_child(enum sandtype);
 #endif
 void		 kreq_free(struct kreq *);
+struct kpriv	*kpriv_alloc(struct kreq *);
+int		 kpriv_body(const struct kpriv *, const char *);
+int		 kpriv_body_spool(void);
 
 enum kcgi_err	 kxsocketpair(int[2]);
 enum kcgi_err	 kxsocketprep(int);
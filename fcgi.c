@@ -17,6 +17,7 @@
 
 #include <sys/ioctl.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 
 #include <assert.h>
 #include <errno.h>
@@ -28,7 +29,6 @@
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <stdio.h> /* BUFSIZ */
 #include <string.h>
 #include <unistd.h>
 
@@ -46,10 +46,13 @@ struct	kfcgi {
 	size_t			  pagesz;
 	size_t			  defpage;
 	const struct kmimemap 	 *mimemap;
+	struct kstrmap		  pagemap; /* index of pages */
+	struct kstrmap		  suffixes; /* index of mimemap */
 	pid_t			  work_pid;
 	pid_t			  sock_pid;
 	int			  work_dat;
 	int			  sock_ctl;
+	int			  spools[KFCGI_SPOOLS]; /* worker's files */
 	struct kopts		  opts;
 	void			 *arg;
 };
@@ -63,18 +66,96 @@ dosignal(int arg)
 	sig = 1;
 }
 
+/*
+ * Maximum number of idle connections kept open by the control process
+ * for web servers that set FCGI_KEEP_CONN.
+ * Beyond this, connections are closed after their request.
+ */
+#define	KFCGI_KEEPMAX	64
+
+/*
+ * Maximum number of connections to which the control process writes
+ * output held by the application (see "asyncbufsz" in struct kopts).
+ * Beyond this, the output is written before the next request.
+ */
+#define	KFCGI_DRAINMAX	64
+
+/*
+ * Output handed to the control process to write to a connection.
+ */
+struct	kfcgi_drain {
+	int		 fd; /* connection */
+	int		 keep; /* keep connection when done */
+	short		 revents; /* from poll() */
+	char		*buf; /* output */
+	size_t		 sz; /* size of output */
+	size_t		 pos; /* written so far */
+};
+
+/*
+ * Close the connection "fd".
+ * If it's the one the manager passed us in extended mode ("filedfd"),
+ * tell the manager on "fdfiled" that we're free by writing back its
+ * "magic".
+ * Returns zero if the manager couldn't be told, non-zero otherwise.
+ */
+static int
+kfcgi_close(int fd, int fdfiled, int *filedfd, uint64_t magic)
+{
+
+	close(fd);
+	if (fd != *filedfd)
+		return 1;
+	*filedfd = -1;
+	return fullwritenoerr(fdfiled, 
+		&magic, sizeof(uint64_t)) == KCGI_OK;
+}
+
+/*
+ * End the request "rid" on the connection "fd", which the web server
+ * aborted before the application saw it, with an FCGI_END_REQUEST
+ * record whose application and protocol status (FCGI_REQUEST_COMPLETE)
+ * are zero.
+ * Errors are left for the worker to find when reading.
+ */
+static void
+kfcgi_end(int fd, uint16_t rid)
+{
+	uint8_t	 rec[16];
+
+	memset(rec, 0, sizeof(rec));
+	rec[0] = 1;
+	rec[1] = 3;
+	rec[2] = (rid >> 8) & 0xff;
+	rec[3] = rid & 0xff;
+	rec[5] = 8;
+	fullwritenoerr(fd, rec, sizeof(rec));
+}
+
 /*
  * This is our control process.
  * It listens for FastCGI connections on the manager connection in
  * traditional mode ("fdaccept") xor extended mode ("fdfiled").
- * When it has one, it reads and passes to the worker (sibling) process,
- * which will be parsing the data.
+ * When it has one, it passes it to the worker (sibling) process, which
+ * will be reading and parsing the data.
  * When the worker has finished, it passes back the request identifier,
  * which this passes to the main application for output.
  * If the current FastCGI connection closes, abandon it and wait for the
  * next.
+ * If the web server asked to keep the connection open (FCGI_KEEP_CONN),
+ * then hold on to it after the application is done and poll it along
+ * with the manager connection: the next request may arrive on it.
+ * If the connection multiplexes requests and the worker has more of
+ * them, start the next sequence on it right away.
+ * If the application hands back output it couldn't write without
+ * blocking, write it as the connection allows, polling it along with
+ * the others, and only then keep or close the connection.
+ * In extended mode, the manager is told we're free only once the
+ * connection it passed us has closed, kept or not: until then, it
+ * mustn't pass us another or release us.
  * This exits with the manager connection closes.
- * On exit, it will close the fdaccept or fdfiled descriptor.
+ * On exit, it will close the fdaccept or fdfiled descriptor and any
+ * kept connections.
  */
 static int
 kfcgi_control(int work, int ctrl, 
@@ -83,10 +164,14 @@ kfcgi_control(int work, int ctrl,
 	struct sockaddr_storage ss;
 	socklen_t	 sslen;
 	int		 fd = -1, rc, ourfd, erc = EXIT_FAILURE;
-	uint64_t	 magic;
+	int		 keep, more, filedfd = -1;
+	uint64_t	 magic = 0;
 	uint32_t	 cookie, test;
-	struct pollfd	 pfd[2];
-	char		 buf[BUFSIZ];
+	struct pollfd	 pfd[2 + KFCGI_KEEPMAX + KFCGI_DRAINMAX];
+	struct kfcgi_drain drains[KFCGI_DRAINMAX], *d;
+	struct iovec	 iov;
+	size_t		 i, keepsz = 0, drainsz = 0, asz;
+	char		 c, *abuf = NULL;
 	ssize_t		 ssz;
 	enum kcgi_err	 kerr;
 	uint16_t	 rid, rtest;
@@ -104,6 +189,15 @@ kfcgi_control(int work, int ctrl,
 		pfd[1].fd = ctrl;
 		pfd[1].events = POLLIN;
 		pfd[1].revents = 0;
+		for (i = 0; i < keepsz; i++) {
+			pfd[2 + i].events = POLLIN;
+			pfd[2 + i].revents = 0;
+		}
+		for (i = 0; i < drainsz; i++) {
+			pfd[2 + keepsz + i].fd = drains[i].fd;
+			pfd[2 + keepsz + i].events = POLLOUT;
+			pfd[2 + keepsz + i].revents = 0;
+		}
 
 		/*
 		 * If either the worker or manager disconnect, then exit
@@ -113,7 +207,7 @@ kfcgi_control(int work, int ctrl,
 		 * we don't really care.
 		 */
 
-		if ((rc = poll(pfd, 2, INFTIM)) < 0) {
+		if ((rc = poll(pfd, 2 + keepsz + drainsz, INFTIM)) < 0) {
 			kutil_warn(NULL, NULL, "poll");
 			goto out;
 		} else if (rc == 0) {
@@ -121,21 +215,98 @@ kfcgi_control(int work, int ctrl,
 			continue;
 		} 
 
-		if ((pfd[1].revents & POLLHUP) || 
-		    !(pfd[0].revents & POLLIN))
+		if (pfd[1].revents & POLLHUP)
 			break;
 
-		/* 
-		 * Accept a new connection.
-		 * In the old way, a blocking accept from FastCGI
-		 * socket.
-		 * This will be round-robined by the kernel so that
-		 * other control processes are fairly notified.
-		 * In the new one, accepting a descriptor from the
-		 * caller.
+		/*
+		 * Write held output to the connections that can take
+		 * it, giving up on those that error out.
+		 * When done, keep or close the connection as usual.
+		 * Newly kept connections use the slots of the pending
+		 * output, so first copy out the events.
 		 */
 
-		if (fdaccept != -1) {
+		for (i = 0; i < drainsz; i++)
+			drains[i].revents = pfd[2 + keepsz + i].revents;
+
+		for (i = 0; i < drainsz; ) {
+			d = &drains[i];
+			if (d->revents == 0) {
+				i++;
+				continue;
+			}
+			rc--;
+			iov.iov_base = d->buf + d->pos;
+			iov.iov_len = d->sz - d->pos;
+			if (!(d->revents & POLLOUT) ||
+			    trywritevnoerr(d->fd, &iov, 1) != KCGI_OK) {
+				d->keep = 0;
+				iov.iov_len = 0;
+			}
+			d->pos = d->sz - iov.iov_len;
+			if (d->pos < d->sz) {
+				i++;
+				continue;
+			}
+			free(d->buf);
+			if (d->keep && keepsz < KFCGI_KEEPMAX) {
+				pfd[2 + keepsz].fd = d->fd;
+				pfd[2 + keepsz++].revents = 0;
+			} else if (!kfcgi_close(d->fd, 
+			    fdfiled, &filedfd, magic)) {
+				*d = drains[--drainsz];
+				goto out;
+			}
+			*d = drains[--drainsz];
+		}
+
+		if (rc == 0)
+			continue;
+
+		for (i = 0; i < keepsz; i++)
+			if (pfd[2 + i].revents)
+				break;
+
+		if (i < keepsz) {
+			/*
+			 * A kept connection is readable: either the web
+			 * server has started its next request or it has
+			 * closed the connection, which isn't an error.
+			 * Remove it from the kept set either way.
+			 * Peek so that the worker reads the request.
+			 */
+
+			fd = pfd[2 + i].fd;
+			pfd[2 + i] = pfd[2 + keepsz - 1];
+			keepsz--;
+
+			if ((ssz = recv(fd, &c, 1, MSG_PEEK)) < 0 &&
+			    (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				pfd[2 + keepsz++].fd = fd;
+				fd = -1;
+				continue;
+			} else if (ssz <= 0) {
+				if (ssz < 0 && errno != ECONNRESET)
+					kutil_warn(NULL, NULL, "recv");
+				rc = kfcgi_close(fd, 
+					fdfiled, &filedfd, magic);
+				fd = -1;
+				if (!rc)
+					goto out;
+				continue;
+			}
+		} else if (!(pfd[0].revents & POLLIN)) {
+			break;
+		} else if (fdaccept != -1) {
+			/* 
+			 * Accept a new connection.
+			 * In the old way, a blocking accept from
+			 * FastCGI socket.
+			 * This will be round-robined by the kernel so
+			 * that other control processes are fairly
+			 * notified.
+			 */
+
 			assert(fdfiled == -1);
 			sslen = sizeof(ss);
 			fd = accept(fdaccept, 
@@ -147,7 +318,22 @@ kfcgi_control(int work, int ctrl,
 				kutil_warn(NULL, NULL, "accept");
 				goto out;
 			} 
+
+			/* 
+			 * We then set that the FastCGI socket is
+			 * non-blocking, making it consistent with the
+			 * behaviour of the CGI socket, which is also
+			 * set as such.
+			 */
+
+			if (kxsocketprep(fd) != KCGI_OK)
+				goto out;
 		} else {
+			/*
+			 * In the new way, accepting a descriptor from
+			 * the caller.
+			 */
+
 			assert(fdfiled != -1);
 			rc = fullreadfd(fdfiled, 
 				&fd, &magic, sizeof(uint64_t));
@@ -155,108 +341,49 @@ kfcgi_control(int work, int ctrl,
 				goto out;
 			else if (rc == 0)
 				break;
+			filedfd = fd;
+
+			/* As above, make non-blocking. */
+
+			if (kxsocketprep(fd) != KCGI_OK)
+				goto out;
 		}
-		
-		/* 
-		 * We then set that the FastCGI socket is non-blocking,
-		 * making it consistent with the behaviour of the CGI
-		 * socket, which is also set as such.
-		 */
 
-		if (kxsocketprep(fd) != KCGI_OK)
-			goto out;
+		/*
+		 * Begin a sequence with the worker for the next request
+		 * on this connection.
+		 */
+sequence:
+		keep = more = 0;
 
 		/* This doesn't need to be crypto quality. */
 
 		cookie = arc4random();
 
-		/* Write a header cookie to the work. */
-
-		fullwrite(work, &cookie, sizeof(uint32_t));
-
 		/*
-		 * Keep pushing data into the worker til it has read it
-		 * all, at which point it will write to us.
-		 * If at any point we have errors (e.g., the connection
-		 * closes), then write a zero-length frame.
-		 * Write a zero-length frame at the end anyway.
+		 * Pass the connection and a header cookie to the
+		 * worker, which reads the request from it directly.
+		 * When it has read the full request, or the connection
+		 * has closed, it will write to us.
+		 * A zero code means the latter.
+		 * Before that, it may report requests aborted by the web
+		 * server with a code of two, which we end as we go.
 		 */
 
-		pfd[0].fd = fd;
-		pfd[0].events = POLLIN;
-		pfd[1].fd = work;
-		pfd[1].events = POLLIN;
-
-		for (;;) {
-			if ((rc = poll(pfd, 2, INFTIM)) < 0) {
-				kutil_warn(NULL, NULL, "poll");
-				goto out;
-			} else if (rc == 0) {
-				kutil_warnx(NULL, NULL, "poll: timeout!?");
-				continue;
-			}
-
-			/*
-			 * If the child responds, that means that the
-			 * full request has been read and processed.
-			 * If not, we probably still have data to write
-			 * to it from the connection.
-			 */
-
-			if (pfd[1].revents & POLLIN) {
-				ssz = 0;
-				kerr = fullwritenoerr
-					(pfd[1].fd, &ssz, sizeof(size_t));
-				if (kerr != KCGI_OK)
-					goto out;
-				break;
-			}
-
-			if (!(pfd[0].revents & POLLIN)) {
-				kutil_warnx(NULL, NULL, "poll: no input");
+		if (!fullwritefd(work, fd, &cookie, sizeof(uint32_t)))
+			goto out;
+		if (fullread(work, &rc, sizeof(int), 0, &kerr) < 0)
+			goto out;
+		while (rc == 2) {
+			if (fullread(work, &rid, 
+			    sizeof(uint16_t), 0, &kerr) < 0)
 				goto out;
-			} else if ((ssz = read(fd, buf, BUFSIZ)) < 0) {
-				kutil_warn(NULL, NULL, "read");
+			kfcgi_end(fd, rid);
+			if (fullread(work, &rc, 
+			    sizeof(int), 0, &kerr) < 0)
 				goto out;
-			} 
-
-			/* 
-			 * Send the child the amount of data we've read.
-			 * This will let the child see if the connection
-			 * abruptly closes, at which point we'll have a
-			 * read size of zero, and error out.
-			 */
-
-			kerr = fullwritenoerr
-				(pfd[1].fd, &ssz, sizeof(size_t));
-			if (KCGI_OK != kerr)
-				goto out;
-
-			kerr = fullwritenoerr(pfd[1].fd, buf, ssz);
-			if (KCGI_OK != kerr)
-				goto out;
-
-			/*
-			 * If we wrote a zero-sized buffer, it means
-			 * that the connection has unexpectedly closed.
-			 * The child will stop all processing for the
-			 * request and will not return to the parsing
-			 * routine for the given session.
-			 */
-
-			if (ssz == 0) {
-				kutil_warnx(NULL, NULL, "read: "
-					"connection closed");
-				break;
-			}
 		}
 
-		/* Now verify that the worker is sane. */
-
-		if (fullread(pfd[1].fd, &rc,
-		    sizeof(int), 0, &kerr) < 0)
-			goto out;
-
 		if (rc == 0) {
 			kutil_warnx(NULL, NULL, "FastCGI: bad code");
 			goto recover;
@@ -267,7 +394,7 @@ kfcgi_control(int work, int ctrl,
 		 * Check our cookie and responseId values.
 		 */
 
-		if (fullread(pfd[1].fd, &test,
+		if (fullread(work, &test,
 		    sizeof(uint32_t), 0, &kerr) < 0)
 			goto out;
 
@@ -276,9 +403,15 @@ kfcgi_control(int work, int ctrl,
 			goto out;
 		} 
 
-		if (fullread(pfd[1].fd, &rid, 
+		if (fullread(work, &rid, 
 		    sizeof(uint16_t), 0, &kerr) < 0)
 			goto out;
+		if (fullread(work, &keep, 
+		    sizeof(int), 0, &kerr) < 0)
+			goto out;
+		if (fullread(work, &more, 
+		    sizeof(int), 0, &kerr) < 0)
+			goto out;
 
 		/*
 		 * Pass the file descriptor, which has had its data
@@ -304,40 +437,131 @@ kfcgi_control(int work, int ctrl,
 			goto out;
 		}
 
+		/* Output the application couldn't write itself. */
+
+		if (fullread(ctrl, &asz, 
+		    sizeof(size_t), 0, &kerr) < 0)
+			goto out;
+		if (asz > 0) {
+			if ((abuf = kxmalloc(asz)) == NULL)
+				goto out;
+			if (fullread(ctrl, abuf, asz, 0, &kerr) < 0)
+				goto out;
+		}
+
 recover:
 		/*
-		 * If we are being passed descriptors (instead of
-		 * waiting on the accept()), then notify the manager
-		 * that we've finished processing this request.
 		 * We also jump to here if the connection fails in any
 		 * way whilst being transcribed to the worker.
+		 * Queue held output unless the connection has another
+		 * request (whose output must follow) or we have too
+		 * many queued, in which case write it now.
 		 */
 
-		if (fdfiled != -1) {
-			kerr = fullwritenoerr(fdfiled, 
-				&magic, sizeof(uint64_t));
-			if (KCGI_OK != kerr)
-				goto out;
+		if (abuf != NULL && !more && drainsz < KFCGI_DRAINMAX) {
+			d = &drains[drainsz++];
+			d->fd = fd;
+			d->keep = keep;
+			d->buf = abuf;
+			d->sz = asz;
+			d->pos = 0;
+			abuf = NULL;
+			fd = -1;
+			continue;
+		} else if (abuf != NULL) {
+			if (fullwritenoerr(fd, abuf, asz) != KCGI_OK)
+				keep = more = 0;
+			free(abuf);
+			abuf = NULL;
 		}
 
-		close(fd);
+		if (more)
+			goto sequence;
+
+		/*
+		 * The application has closed its copy of the
+		 * connection, so unless we keep ours, the connection
+		 * is closed.
+		 */
+
+		if (keep && keepsz < KFCGI_KEEPMAX)
+			pfd[2 + keepsz++].fd = fd;
+		else if (!kfcgi_close(fd, fdfiled, &filedfd, magic)) {
+			fd = -1;
+			goto out;
+		}
 		fd = -1;
 	}
 
 	erc = EXIT_SUCCESS;
 out:
+	/* Finish held output if exiting cleanly. */
+
+	for (i = 0; i < drainsz; i++) {
+		if (erc == EXIT_SUCCESS)
+			fullwritenoerr(drains[i].fd, 
+				drains[i].buf + drains[i].pos,
+				drains[i].sz - drains[i].pos);
+		free(drains[i].buf);
+		close(drains[i].fd);
+	}
+	free(abuf);
 	if (fd != -1)
 		close(fd);
+	for (i = 0; i < keepsz; i++)
+		close(pfd[2 + i].fd);
 	close(ourfd);
 	return erc;
 }
 
+/*
+ * Make sure that the worker has all of its files to spool request
+ * bodies into (see the "spoolsz" option), creating and sending it any
+ * it doesn't: at the start, and those it's since used for a request,
+ * which are the request's.
+ * See kworker_fcgi_spools().
+ * Failure only means fewer files (until the next try).
+ */
+static void
+kfcgi_spools(struct kfcgi *fcgi)
+{
+	size_t	 i;
+
+	if (fcgi->opts.spoolsz == 0)
+		return;
+
+	for (i = 0; i < KFCGI_SPOOLS; i++) {
+		if (fcgi->spools[i] != -1 ||
+		    (fcgi->spools[i] = kpriv_body_spool()) == -1)
+			continue;
+		if (fullwritefd(fcgi->work_dat, 
+		    fcgi->spools[i], &i, sizeof(size_t)))
+			continue;
+		close(fcgi->spools[i]);
+		fcgi->spools[i] = -1;
+	}
+}
+
+/*
+ * Close our copies of the worker's spooling files.
+ */
+static void
+kfcgi_spools_free(struct kfcgi *fcgi)
+{
+	size_t	 i;
+
+	for (i = 0; i < KFCGI_SPOOLS; i++)
+		if (fcgi->spools[i] != -1)
+			close(fcgi->spools[i]);
+}
+
 void
 khttp_fcgi_child_free(struct kfcgi *fcgi)
 {
 
 	close(fcgi->sock_ctl);
 	close(fcgi->work_dat);
+	kfcgi_spools_free(fcgi);
 	free(fcgi);
 }
 
@@ -350,8 +574,11 @@ khttp_fcgi_free(struct kfcgi *fcgi)
 
 	close(fcgi->sock_ctl);
 	close(fcgi->work_dat);
+	kfcgi_spools_free(fcgi);
 	kxwaitpid(fcgi->work_pid);
 	kxwaitpid(fcgi->sock_pid);
+	kstrmap_free(&fcgi->pagemap);
+	kstrmap_free(&fcgi->suffixes);
 	free(fcgi);
 	return KCGI_OK;
 }
@@ -366,6 +593,7 @@ khttp_fcgi_initx(struct kfcgi **fcgip,
 	unsigned int debugging, const struct kopts *opts)
 {
 	struct kfcgi	*fcgi;
+	size_t		 i, spoolsz;
 	int 		 er, fdaccept, fdfiled;
 	int		 work_ctl[2], work_dat[2], sock_ctl[2];
 	pid_t		 work_pid, sock_pid;
@@ -381,6 +609,7 @@ khttp_fcgi_initx(struct kfcgi **fcgip,
 
 	st = SAND_CONTROL_OLD;
 	fdaccept = fdfiled = -1;
+	spoolsz = opts == NULL ? 0 : opts->spoolsz;
 
 	if ((cp = getenv("FCGI_LISTENSOCK_DESCRIPTORS")) != NULL) {
 		fdfiled = strtonum(cp, 0, INT_MAX, &ercp);
@@ -457,14 +686,14 @@ khttp_fcgi_initx(struct kfcgi **fcgip,
 		 */
 
 		er = EXIT_SUCCESS;
-		if (!ksandbox_init_child(SAND_WORKER, 
+		if (!ksandbox_init_child(SAND_WORKER_FCGI, 
 		    work_dat[KWORKER_CHILD], 
 		    work_ctl[KWORKER_CHILD], -1, -1))
 			er = EXIT_FAILURE;
 		else
 			kworker_fcgi_child
 				(work_dat[KWORKER_CHILD],
-				 work_ctl[KWORKER_CHILD],
+				 work_ctl[KWORKER_CHILD], spoolsz,
 				 keys, keysz, mimes, mimesz,
 				 debugging);
 
@@ -540,14 +769,31 @@ khttp_fcgi_initx(struct kfcgi **fcgip,
 		return KCGI_ENOMEM;
 	}
 
+	for (i = 0; i < KFCGI_SPOOLS; i++)
+		fcgi->spools[i] = -1;
+
+	/* 
+	 * The page and MIME suffix tables are fixed from now on, so
+	 * index them once for all requests.
+	 */
+
+	if (!kstrmap_pages(&fcgi->pagemap, pages, pagesz) ||
+	    !kstrmap_suffixes(&fcgi->suffixes, mimemap)) {
+		kstrmap_free(&fcgi->pagemap);
+		close(sock_ctl[KWORKER_PARENT]);
+		close(work_dat[KWORKER_PARENT]);
+		kxwaitpid(work_pid);
+		kxwaitpid(sock_pid);
+		free(fcgi);
+		*fcgip = NULL;
+		return KCGI_ENOMEM;
+	}
+
 	if (opts == NULL)
 		fcgi->opts.sndbufsz = -1;
 	else
 		memcpy(&fcgi->opts, opts, sizeof(struct kopts));
 
-	if (fcgi->opts.sndbufsz < 0)
-		fcgi->opts.sndbufsz = UINT16_MAX;
-
 	fcgi->work_pid = work_pid;
 	fcgi->work_dat = work_dat[KWORKER_PARENT];
 	fcgi->sock_pid = sock_pid;
@@ -563,6 +809,7 @@ khttp_fcgi_initx(struct kfcgi **fcgip,
 	fcgi->pagesz = pagesz;
 	fcgi->defpage = defpage;
 	fcgi->debugging = debugging;
+	kfcgi_spools(fcgi);
 	return KCGI_OK;
 }
 
@@ -642,12 +889,14 @@ enum kcgi_err
 khttp_fcgi_parse(struct kfcgi *fcgi, struct kreq *req)
 {
 	enum kcgi_err	 kerr;
-	const struct kmimemap *mm;
 	int		 c, fd = -1;
 	uint16_t	 rid;
+	struct karena	*a;
 
 	memset(req, 0, sizeof(struct kreq));
 
+	kfcgi_spools(fcgi);
+
 	/*
 	 * Blocking wait until our control process sends us the file
 	 * descriptor and requestId of the current sequence.
@@ -667,6 +916,7 @@ khttp_fcgi_parse(struct kfcgi *fcgi, struct kreq *req)
 
 	/* Now get ready to receive data from the child. */
 
+	kerr = KCGI_ENOMEM;
 	req->arg = fcgi->arg;
 	req->keys = fcgi->keys;
 	req->keysz = fcgi->keysz;
@@ -678,21 +928,25 @@ khttp_fcgi_parse(struct kfcgi *fcgi, struct kreq *req)
 		goto err;
 	}
 
+	if (kpriv_alloc(req) == NULL)
+		goto err;
+	a = &req->priv->arena;
+
 	if (fcgi->keysz) {
-		req->cookiemap = kxcalloc
-			(fcgi->keysz, sizeof(struct kpair *));
+		req->cookiemap = karena_calloc
+			(a, fcgi->keysz, sizeof(struct kpair *));
 		if (req->cookiemap == NULL)
 			goto err;
-		req->cookienmap = kxcalloc
-			(fcgi->keysz, sizeof(struct kpair *));
+		req->cookienmap = karena_calloc
+			(a, fcgi->keysz, sizeof(struct kpair *));
 		if (req->cookienmap == NULL)
 			goto err;
-		req->fieldmap = kxcalloc
-			(fcgi->keysz, sizeof(struct kpair *));
+		req->fieldmap = karena_calloc
+			(a, fcgi->keysz, sizeof(struct kpair *));
 		if (req->fieldmap == NULL)
 			goto err;
-		req->fieldnmap = kxcalloc
-			(fcgi->keysz, sizeof(struct kpair *));
+		req->fieldnmap = karena_calloc
+			(a, fcgi->keysz, sizeof(struct kpair *));
 		if (req->fieldnmap == NULL)
 			goto err;
 	}
@@ -703,31 +957,21 @@ khttp_fcgi_parse(struct kfcgi *fcgi, struct kreq *req)
 	 * until we're interrupted during a read by the parent.
 	 */
 
-	kerr = kworker_parent(fcgi->work_dat, req, 0, fcgi->mimesz);
+	kerr = kworker_parent(fcgi->work_dat, req, 
+		fcgi->mimesz, fcgi->spools, KFCGI_SPOOLS);
 	if (KCGI_OK != kerr)
 		goto err;
 
-	/* Look up page type from component. */
-
-	req->page = fcgi->defpage;
-	if (*req->pagename != '\0')
-		for (req->page = 0; req->page < fcgi->pagesz; req->page++)
-			if (strcasecmp(fcgi->pages[req->page], req->pagename) == 0)
-				break;
-
-	/* Start with the default. */
+	/*
+	 * Look up page and MIME type from the indices, defaulting to
+	 * defpage and defmime.
+	 * If we can't find them, use pagesz and mimesz.
+	 */
 
-	req->mime = fcgi->defmime;
-	if (*req->suffix != '\0') {
-		for (mm = fcgi->mimemap; NULL != mm->name; mm++)
-			if (strcasecmp(mm->name, req->suffix) == 0) {
-				req->mime = mm->mime;
-				break;
-			}
-		 /* Could not find this mime type! */
-		if (mm->name == NULL)
-			req->mime = fcgi->mimesz;
-	}
+	req->page = *req->pagename == '\0' ? fcgi->defpage :
+		kstrmap_get(&fcgi->pagemap, req->pagename, fcgi->pagesz);
+	req->mime = *req->suffix == '\0' ? fcgi->defmime :
+		kstrmap_get(&fcgi->suffixes, req->suffix, fcgi->mimesz);
 
 	return kerr;
 err:
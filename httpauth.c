@@ -256,23 +256,23 @@ kauth_eq(const char *p, const char *start, size_t sz, size_t want)
  * handled by the calling context: we don't do any validation here.
  */
 static void
-khttpbasic_input(int fd, const char *cp, enum kauth auth)
+khttpbasic_input(struct kframe *fr, const char *cp, enum kauth auth)
 {
 	int		 authorised;
 
-	fullwrite(fd, &auth, sizeof(enum kauth));
+	kframe_write(fr, &auth, sizeof(enum kauth));
 	while (isspace((unsigned char)*cp))
 		cp++;
 
 	if ('\0' == *cp) {
 		authorised = 0;
-		fullwrite(fd, &authorised, sizeof(int));
+		kframe_write(fr, &authorised, sizeof(int));
 		return;
 	}
 
 	authorised = 1;
-	fullwrite(fd, &authorised, sizeof(int));
-	fullwriteword(fd, cp);
+	kframe_write(fr, &authorised, sizeof(int));
+	kframe_writeword(fr, cp);
 }
 
 /*
@@ -280,7 +280,7 @@ khttpbasic_input(int fd, const char *cp, enum kauth auth)
  * string, which can be NULL or malformed.
  */
 static int
-khttpdigest_input(int fd, const char *cp)
+khttpdigest_input(struct kframe *fr, const char *cp)
 {
 	enum kauth	 auth;
 	const char	*start;
@@ -289,7 +289,7 @@ khttpdigest_input(int fd, const char *cp)
 	struct pdigest	 d;
 
 	auth = KAUTH_DIGEST;
-	fullwrite(fd, &auth, sizeof(enum kauth));
+	kframe_write(fr, &auth, sizeof(enum kauth));
 	memset(&d, 0, sizeof(struct pdigest));
 
 	for (rc = 1; 1 == rc && '\0' != *cp; ) {
@@ -338,75 +338,76 @@ khttpdigest_input(int fd, const char *cp)
 			0 != d.count &&
 			0 != d.cnonce.sz;
 
-	fullwrite(fd, &authorised, sizeof(int));
+	kframe_write(fr, &authorised, sizeof(int));
 
 	if ( ! authorised)
 		return(0);
 
-	fullwrite(fd, &d.alg, sizeof(enum khttpalg));
-	fullwrite(fd, &d.qop, sizeof(enum khttpqop));
-	fullwrite(fd, &d.user.sz, sizeof(size_t));
-	fullwrite(fd, d.user.pos, d.user.sz);
-	fullwrite(fd, &d.uri.sz, sizeof(size_t));
-	fullwrite(fd, d.uri.pos, d.uri.sz);
-	fullwrite(fd, &d.realm.sz, sizeof(size_t));
-	fullwrite(fd, d.realm.pos, d.realm.sz);
-	fullwrite(fd, &d.nonce.sz, sizeof(size_t));
-	fullwrite(fd, d.nonce.pos, d.nonce.sz);
-	fullwrite(fd, &d.cnonce.sz, sizeof(size_t));
-	fullwrite(fd, d.cnonce.pos, d.cnonce.sz);
-	fullwrite(fd, &d.response.sz, sizeof(size_t));
-	fullwrite(fd, d.response.pos, d.response.sz);
-	fullwrite(fd, &d.count, sizeof(uint32_t));
-	fullwrite(fd, &d.opaque.sz, sizeof(size_t));
-	fullwrite(fd, d.opaque.pos, d.opaque.sz);
+	kframe_write(fr, &d.alg, sizeof(enum khttpalg));
+	kframe_write(fr, &d.qop, sizeof(enum khttpqop));
+	kframe_write(fr, &d.user.sz, sizeof(size_t));
+	kframe_write(fr, d.user.pos, d.user.sz);
+	kframe_write(fr, &d.uri.sz, sizeof(size_t));
+	kframe_write(fr, d.uri.pos, d.uri.sz);
+	kframe_write(fr, &d.realm.sz, sizeof(size_t));
+	kframe_write(fr, d.realm.pos, d.realm.sz);
+	kframe_write(fr, &d.nonce.sz, sizeof(size_t));
+	kframe_write(fr, d.nonce.pos, d.nonce.sz);
+	kframe_write(fr, &d.cnonce.sz, sizeof(size_t));
+	kframe_write(fr, d.cnonce.pos, d.cnonce.sz);
+	kframe_write(fr, &d.response.sz, sizeof(size_t));
+	kframe_write(fr, d.response.pos, d.response.sz);
+	kframe_write(fr, &d.count, sizeof(uint32_t));
+	kframe_write(fr, &d.opaque.sz, sizeof(size_t));
+	kframe_write(fr, d.opaque.pos, d.opaque.sz);
 
 	/* Do we need to MD5-hash our contents? */
 	return(KHTTPQOP_AUTH_INT == d.qop);
 }
 
 enum kcgi_err
-kworker_auth_parent(int fd, struct khttpauth *auth)
+kworker_auth_parent(struct kframe *fr, struct karena *a,
+	struct khttpauth *auth)
 {
 	enum kcgi_err	 ke;
 
-	if (fullread(fd, &auth->type, sizeof(enum kauth), 0, &ke) < 0)
+	if ((ke = kframe_read(fr, &auth->type, sizeof(enum kauth))) != KCGI_OK)
 		return ke;
 
 	switch (auth->type) {
 	case KAUTH_DIGEST:
-		if (fullread(fd, &auth->authorised, sizeof(int), 0, &ke) < 0)
+		if ((ke = kframe_read(fr, &auth->authorised, sizeof(int))) != KCGI_OK)
 			return ke;
 		if (!auth->authorised)
 			break;
-		if (fullread(fd, &auth->d.digest.alg, sizeof(enum khttpalg), 0, &ke) < 0)
+		if ((ke = kframe_read(fr, &auth->d.digest.alg, sizeof(enum khttpalg))) != KCGI_OK)
 			return ke;
-		if (fullread(fd, &auth->d.digest.qop, sizeof(enum khttpqop), 0, &ke) < 0)
+		if ((ke = kframe_read(fr, &auth->d.digest.qop, sizeof(enum khttpqop))) != KCGI_OK)
 			return ke;
-		if ((ke = fullreadword(fd, &auth->d.digest.user)) != KCGI_OK)
+		if ((ke = kframe_readword(fr, a, &auth->d.digest.user)) != KCGI_OK)
 			return ke;
-		if ((ke = fullreadword(fd, &auth->d.digest.uri)) != KCGI_OK)
+		if ((ke = kframe_readword(fr, a, &auth->d.digest.uri)) != KCGI_OK)
 			return ke;
-		if ((ke = fullreadword(fd, &auth->d.digest.realm)) != KCGI_OK)
+		if ((ke = kframe_readword(fr, a, &auth->d.digest.realm)) != KCGI_OK)
 			return ke;
-		if ((ke = fullreadword(fd, &auth->d.digest.nonce)) != KCGI_OK)
+		if ((ke = kframe_readword(fr, a, &auth->d.digest.nonce)) != KCGI_OK)
 			return ke;
-		if ((ke = fullreadword(fd, &auth->d.digest.cnonce)) != KCGI_OK)
+		if ((ke = kframe_readword(fr, a, &auth->d.digest.cnonce)) != KCGI_OK)
 			return ke;
-		if ((ke = fullreadword(fd, &auth->d.digest.response)) != KCGI_OK)
+		if ((ke = kframe_readword(fr, a, &auth->d.digest.response)) != KCGI_OK)
 			return ke;
-		if (fullread(fd, &auth->d.digest.count, sizeof(uint32_t), 0, &ke) < 0)
+		if ((ke = kframe_read(fr, &auth->d.digest.count, sizeof(uint32_t))) != KCGI_OK)
 			return ke;
-		if ((ke = fullreadword(fd, &auth->d.digest.opaque)) != KCGI_OK)
+		if ((ke = kframe_readword(fr, a, &auth->d.digest.opaque)) != KCGI_OK)
 			return ke;
 		break;
 	case KAUTH_BASIC:
 	case KAUTH_BEARER:
-		if (fullread(fd, &auth->authorised, sizeof(int), 0, &ke) < 0)
+		if ((ke = kframe_read(fr, &auth->authorised, sizeof(int))) != KCGI_OK)
 			return ke;
 		if (!auth->authorised)
 			break;
-		if ((ke = fullreadword(fd, &auth->d.basic.response)) != KCGI_OK)
+		if ((ke = kframe_readword(fr, a, &auth->d.basic.response)) != KCGI_OK)
 			return ke;
 		break;
 	default:
@@ -422,7 +423,7 @@ kworker_auth_parent(int fd, struct khttpauth *auth)
  * i.e., if we have auth-int digest QOP.
  */
 int
-kworker_auth_child(int fd, const char *cp)
+kworker_auth_child(struct kframe *fr, const char *cp)
 {
 	const char	*start;
 	size_t	 	 sz;
@@ -430,22 +431,22 @@ kworker_auth_child(int fd, const char *cp)
 
 	if (cp == NULL || *cp == '\0') {
 		auth = KAUTH_NONE;
-		fullwrite(fd, &auth, sizeof(enum kauth));
+		kframe_write(fr, &auth, sizeof(enum kauth));
 		return 0;
 	}
 
 	start = kauth_nexttok(&cp, '\0', &sz);
 
 	if (sz == 6 && strncasecmp(start, "bearer", sz) == 0) {
-		khttpbasic_input(fd, cp, KAUTH_BEARER);
+		khttpbasic_input(fr, cp, KAUTH_BEARER);
 		return 0;
 	} else if (sz == 5 && strncasecmp(start, "basic", sz) == 0) {
-		khttpbasic_input(fd, cp, KAUTH_BASIC);
+		khttpbasic_input(fr, cp, KAUTH_BASIC);
 		return 0;
 	} else if (sz == 6 && strncasecmp(start, "digest", sz) == 0)
-		return khttpdigest_input(fd, cp);
+		return khttpdigest_input(fr, cp);
 
 	auth = KAUTH_UNKNOWN;
-	fullwrite(fd, &auth, sizeof(enum kauth));
+	kframe_write(fr, &auth, sizeof(enum kauth));
 	return 0;
 }
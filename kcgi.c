@@ -42,6 +42,34 @@
  */
 #define	INT_MAXSZ	 22
 
+/*
+ * The persistent CGI parse worker started by khttp_parsex() when the
+ * "persist" option is set.
+ * It lives across invocations and is only torn down on errors, at exit,
+ * or when invoked with different tables or flags than it was started
+ * with.
+ * The "owner" is the process that started the worker: forked children
+ * of the application must not share their parent's worker.
+ * Alongside it, we keep indices of the page and MIME suffix tables.
+ */
+static struct {
+	pid_t			 pid; /* worker process or -1 */
+	pid_t			 owner; /* process that started the worker */
+	int			 fd; /* channel to worker or -1 */
+	const struct kvalid	*keys; /* validators worker started with */
+	size_t			 keysz;
+	const char *const	*mimes; /* MIME types worker started with */
+	size_t			 mimesz;
+	unsigned int		 debugging; /* flags worker started with */
+	const char *const	*pages; /* pages indexed or NULL */
+	size_t			 pagesz;
+	const struct kmimemap	*suffixmap; /* suffixes indexed or NULL */
+	struct kstrmap		 pagemap;
+	struct kstrmap		 suffixes;
+	int			 atexit; /* cgi_worker_exit() registered */
+} cgi_worker = { -1, -1, -1, NULL, 0, NULL, 0, 0, NULL, 0, NULL, 
+	{ NULL, 0 }, { NULL, 0 }, 0 };
+
 const char *const kschemes[KSCHEME__MAX] = {
 	"aaa", /* KSCHEME_AAA */
 	"aaas", /* KSCHEME_AAAS */
@@ -879,65 +907,362 @@ khttp_vurlpart(const char *path,
 	return khttp_url_query_string(p, ap);
 }
 
-static void
-kpair_free(struct kpair *p, size_t sz)
+/*
+ * Return non-zero if "cp" points into the request body shared with the
+ * worker (see the "sharedbody" option), which must not be freed.
+ */
+int
+kpriv_body(const struct kpriv *priv, const char *cp)
 {
-	size_t	 i;
-
-	for (i = 0; i < sz; i++) {
-		free(p[i].key);
-		free(p[i].val);
-		free(p[i].file);
-		free(p[i].ctype);
-		free(p[i].xcode);
-	}
-	free(p);
+
+	return priv != NULL && priv->body != NULL && cp != NULL &&
+		cp >= priv->body && cp <= priv->body + priv->bodysz;
+}
+
+int
+khttp_body_fd(const struct kreq *req, const struct kpair *kp, off_t *off)
+{
+	const struct kpriv *priv = req->priv;
+
+	if (priv == NULL || priv->bodyfd == -1)
+		return -1;
+	if (kp != NULL && !kpriv_body(priv, kp->val))
+		return -1;
+	if (off != NULL)
+		*off = kp == NULL ? 0 : kp->val - priv->body;
+	return priv->bodyfd;
+}
+
+/*
+ * Allocate the private data of "req" if not already allocated.
+ * Returns the private data or NULL on memory exhaustion.
+ */
+struct kpriv *
+kpriv_alloc(struct kreq *req)
+{
+
+	if (req->priv == NULL && 
+	    (req->priv = kxcalloc(1, sizeof(struct kpriv))) != NULL)
+		req->priv->bodyfd = -1;
+	return req->priv;
 }
 
 void
 kreq_free(struct kreq *req)
 {
-	size_t	 i;
 
-	for (i = 0; i < req->reqsz; i++) {
-		free(req->reqs[i].key);
-		free(req->reqs[i].val);
+	/* 
+	 * All we read from the worker is in the request arena, except
+	 * for the field and cookie arrays, which grow.
+	 */
+
+	free(req->cookies);
+	free(req->fields);
+
+	if (req->priv == NULL)
+		return;
+	if (req->priv->body != NULL)
+		munmap(req->priv->body, req->priv->bodysz + 1);
+	if (req->priv->bodyfd != -1)
+		close(req->priv->bodyfd);
+	karena_free(&req->priv->arena);
+	free(req->priv);
+	req->priv = NULL;
+}
+
+/*
+ * Stop the persistent CGI parse worker, if any.
+ * The worker exits when its channel closes.
+ * We only reap the worker if we started it.
+ */
+static void
+cgi_worker_stop(void)
+{
+
+	if (cgi_worker.fd != -1)
+		close(cgi_worker.fd);
+	if (cgi_worker.pid != -1 && cgi_worker.owner == getpid())
+		kxwaitpid(cgi_worker.pid);
+
+	cgi_worker.fd = -1;
+	cgi_worker.pid = cgi_worker.owner = -1;
+
+	kstrmap_free(&cgi_worker.pagemap);
+	kstrmap_free(&cgi_worker.suffixes);
+	cgi_worker.pages = NULL;
+	cgi_worker.suffixmap = NULL;
+}
+
+/*
+ * Stop the persistent CGI parse worker and free its indices when the
+ * application exits.
+ */
+static void
+cgi_worker_exit(void)
+{
+
+	cgi_worker_stop();
+}
+
+/*
+ * Make sure that the persistent worker's indices are of the given page
+ * and suffix tables, rebuilding either if its table has changed (by
+ * address or size) since the last call.
+ * Returns zero on memory allocation failure, non-zero on success.
+ */
+static int
+cgi_worker_maps(const char *const *pages, size_t pagesz,
+	const struct kmimemap *suffixmap)
+{
+
+	if (cgi_worker.pages == NULL || cgi_worker.pages != pages || 
+	    cgi_worker.pagesz != pagesz) {
+		kstrmap_free(&cgi_worker.pagemap);
+		cgi_worker.pages = NULL;
+		if (!kstrmap_pages(&cgi_worker.pagemap, pages, pagesz))
+			return 0;
+		cgi_worker.pages = pages;
+		cgi_worker.pagesz = pagesz;
+	}
+
+	if (cgi_worker.suffixmap == NULL || 
+	    cgi_worker.suffixmap != suffixmap) {
+		kstrmap_free(&cgi_worker.suffixes);
+		cgi_worker.suffixmap = NULL;
+		if (!kstrmap_suffixes(&cgi_worker.suffixes, suffixmap))
+			return 0;
+		cgi_worker.suffixmap = suffixmap;
 	}
 
-	for (i = 0; i < req->envsz; i++) {
-		free(req->envs[i].key);
-		free(req->envs[i].val);
+	return 1;
+}
+
+/*
+ * Start the persistent CGI parse worker if it's not already running,
+ * if it's been inherited from the process that started it, or if it was
+ * started with different validators, MIME types, or debugging flags:
+ * it validates with the tables it was forked with.
+ * Returns KCGI_OK on success or an error otherwise.
+ */
+static enum kcgi_err
+cgi_worker_start(const struct kvalid *keys, size_t keysz,
+	const char *const *mimes, size_t mimesz, void *arg,
+	void (*argfree)(void *arg), unsigned int debugging)
+{
+	int	 er, work_dat[2];
+	pid_t	 pid;
+
+	if (cgi_worker.pid != -1 && 
+	    cgi_worker.owner == getpid() &&
+	    cgi_worker.keys == keys &&
+	    cgi_worker.keysz == keysz &&
+	    cgi_worker.mimes == mimes &&
+	    cgi_worker.mimesz == mimesz &&
+	    cgi_worker.debugging == debugging)
+		return KCGI_OK;
+
+	cgi_worker_stop();
+
+	if (kxsocketpair(work_dat) != KCGI_OK)
+		return KCGI_SYSTEM;
+
+	if ((pid = fork()) == -1) {
+		er = errno;
+		kutil_warn(NULL, NULL, "fork");
+		close(work_dat[KWORKER_PARENT]);
+		close(work_dat[KWORKER_CHILD]);
+		return (er == EAGAIN) ? KCGI_EAGAIN : KCGI_ENOMEM;
+	} else if (pid == 0) {
+		if (argfree != NULL)
+			(*argfree)(arg);
+
+		/* 
+		 * Requests and the descriptors of their bodies come
+		 * over the channel, so we don't need (or want to hold
+		 * open) our standard input and output.
+		 */
+
+		close(STDIN_FILENO);
+		close(STDOUT_FILENO);
+		close(work_dat[KWORKER_PARENT]);
+
+		er = EXIT_SUCCESS;
+		if (!ksandbox_init_child(SAND_WORKER_FCGI,
+		    work_dat[KWORKER_CHILD], -1, -1, -1))
+			er = EXIT_FAILURE;
+		else
+			kworker_cgi_child(work_dat[KWORKER_CHILD],
+			    keys, keysz, mimes, mimesz, debugging);
+
+		close(work_dat[KWORKER_CHILD]);
+		_exit(er);
+		/* NOTREACHED */
 	}
 
-	free(req->reqs);
-	kpair_free(req->cookies, req->cookiesz);
-	kpair_free(req->fields, req->fieldsz);
-	free(req->path);
-	free(req->fullpath);
-	free(req->remote);
-	free(req->host);
-	free(req->cookiemap);
-	free(req->cookienmap);
-	free(req->fieldmap);
-	free(req->fieldnmap);
-	free(req->suffix);
-	free(req->pagename);
-	free(req->pname);
-	free(req->rawauth.digest);
-
-	if (req->rawauth.type == KAUTH_DIGEST) {
-		free(req->rawauth.d.digest.user);
-		free(req->rawauth.d.digest.uri);
-		free(req->rawauth.d.digest.realm);
-		free(req->rawauth.d.digest.nonce);
-		free(req->rawauth.d.digest.cnonce);
-		free(req->rawauth.d.digest.response);
-		free(req->rawauth.d.digest.opaque);
-	} else if (req->rawauth.type == KAUTH_BASIC) {
-		free(req->rawauth.d.basic.response);
-	} else if (req->rawauth.type == KAUTH_BEARER) {
-		free(req->rawauth.d.basic.response);
+	close(work_dat[KWORKER_CHILD]);
+	if (!cgi_worker.atexit && atexit(cgi_worker_exit) == 0)
+		cgi_worker.atexit = 1;
+	cgi_worker.pid = pid;
+	cgi_worker.owner = getpid();
+	cgi_worker.fd = work_dat[KWORKER_PARENT];
+	cgi_worker.keys = keys;
+	cgi_worker.keysz = keysz;
+	cgi_worker.mimes = mimes;
+	cgi_worker.mimesz = mimesz;
+	cgi_worker.debugging = debugging;
+	return KCGI_OK;
+}
+
+/*
+ * Create an empty, unlinked temporary file in TMPDIR (or /tmp) for the
+ * worker to spool a request body into (see the "spoolsz" option).
+ * Returns the descriptor or -1 on failure.
+ */
+int
+kpriv_body_spool(void)
+{
+	const char	*dir;
+	char		*path;
+	int		 fd;
+
+	if ((dir = getenv("TMPDIR")) == NULL || *dir == '\0')
+		dir = "/tmp";
+	if (kxasprintf(&path, "%s/kcgi.XXXXXXXXXX", dir) == -1)
+		return -1;
+	if ((fd = mkstemp(path)) == -1) {
+		kutil_warn(NULL, NULL, "%s", path);
+		free(path);
+		return -1;
 	}
+	unlink(path);
+	free(path);
+	return fd;
+}
+
+/*
+ * Return the reported length of the request body (zero if none or not
+ * a valid number).
+ * RFC 3875, 4.1.2.
+ */
+static size_t
+kpriv_body_len(void)
+{
+	const char	*cp;
+
+	if ((cp = getenv("CONTENT_LENGTH")) == NULL)
+		return 0;
+	return strtonum(cp, 0, LLONG_MAX, NULL);
+}
+
+/*
+ * Map an anonymous region of "len" bytes shared with the worker into
+ * which it will read the request body (see the "sharedbody" option).
+ * The region is one more than the body length for the NUL terminator.
+ * Returns KCGI_OK on success or an error.
+ */
+static enum kcgi_err
+kpriv_body_map(struct kreq *req, size_t len)
+{
+	void		*p;
+
+	if (kpriv_alloc(req) == NULL)
+		return KCGI_ENOMEM;
+
+	p = mmap(NULL, len + 1, PROT_READ | PROT_WRITE, 
+		MAP_SHARED | MAP_ANON, -1, 0);
+	if (p == MAP_FAILED) {
+		kutil_warn(NULL, NULL, "mmap");
+		return KCGI_ENOMEM;
+	}
+
+	req->priv->body = p;
+	req->priv->bodysz = len;
+	return KCGI_OK;
+}
+
+/*
+ * Seal the body shared with the (now-exited) worker by making it
+ * read-only, then make sure that all values pointing into it are
+ * NUL-terminated, as the worker could have changed the body after
+ * sending the values.
+ * Returns KCGI_OK on success or an error.
+ */
+static enum kcgi_err
+kpriv_body_seal(struct kreq *req)
+{
+	const struct kpriv *priv = req->priv;
+	size_t		 i;
+
+	if (priv == NULL || priv->body == NULL)
+		return KCGI_OK;
+
+	if (mprotect(priv->body, priv->bodysz + 1, PROT_READ) == -1) {
+		kutil_warn(NULL, NULL, "mprotect");
+		return KCGI_SYSTEM;
+	}
+
+	for (i = 0; i < req->fieldsz; i++)
+		if (kpriv_body(priv, req->fields[i].val) &&
+		    req->fields[i].val[req->fields[i].valsz] != '\0') {
+			kutil_warnx(NULL, NULL, 
+				"shared body value not terminated");
+			return KCGI_FORM;
+		}
+
+	return KCGI_OK;
+}
+
+/*
+ * Append "sz" bytes of "buf" to "p", returning the end.
+ */
+static char *
+cgi_worker_append(char *p, const void *buf, size_t sz)
+{
+
+	memcpy(p, buf, sz);
+	return p + sz;
+}
+
+/*
+ * Send the current request to the persistent CGI parse worker as a
+ * single frame (see kframe_recv()) of the number of environment
+ * strings and each string, then pass it our standard input, from which
+ * it reads the body itself, and "spool", if not -1, to spool it into.
+ * See kworker_cgi_child().
+ * Returns KCGI_OK on success or an error otherwise.
+ */
+static enum kcgi_err
+cgi_worker_send(int fd, int spool)
+{
+	extern char	**environ;
+	char		**evp;
+	char		 *buf, *p, c = spool != -1;
+	size_t		  sz, evpsz, frsz;
+	enum kcgi_err	  er;
+
+	frsz = sizeof(size_t);
+	for (evpsz = 0, evp = environ; *evp != NULL; evp++, evpsz++)
+		frsz += sizeof(size_t) + strlen(*evp);
+
+	if ((buf = kxmalloc(sizeof(size_t) + frsz)) == NULL)
+		return KCGI_ENOMEM;
+
+	p = cgi_worker_append(buf, &frsz, sizeof(size_t));
+	p = cgi_worker_append(p, &evpsz, sizeof(size_t));
+	for (evp = environ; *evp != NULL; evp++) {
+		sz = strlen(*evp);
+		p = cgi_worker_append(p, &sz, sizeof(size_t));
+		p = cgi_worker_append(p, *evp, sz);
+	}
+	assert((size_t)(p - buf) == sizeof(size_t) + frsz);
+
+	er = fullwritenoerr(fd, buf, sizeof(size_t) + frsz);
+	free(buf);
+	if (er == KCGI_OK && !fullwritefd(fd, STDIN_FILENO, &c, 1))
+		er = KCGI_SYSTEM;
+	if (er == KCGI_OK && c && !fullwritefd(fd, spool, &c, 1))
+		er = KCGI_SYSTEM;
+	return er;
 }
 
 enum kcgi_err
@@ -966,11 +1291,19 @@ khttp_parsex(struct kreq *req,
 	enum kcgi_err	  kerr;
 	int 		  er;
 	struct kopts	  kopts;
-	int		  work_dat[2];
+	struct karena	 *a;
+	int		  work_dat[2], spool = -1;
 	pid_t		  work_pid;
+	size_t		  len;
 
 	memset(req, 0, sizeof(struct kreq));
 
+	if (opts == NULL) {
+		memset(&kopts, 0, sizeof(struct kopts));
+		kopts.sndbufsz = -1;
+	} else
+		kopts = *opts;
+
 	/*
 	 * We'll be using poll(2) for reading our HTTP document, so this
 	 * must be non-blocking in order to make the reads not spin the
@@ -979,8 +1312,61 @@ khttp_parsex(struct kreq *req,
 
 	if (kxsocketprep(STDIN_FILENO) != KCGI_OK)
 		return KCGI_SYSTEM;
-	if (kxsocketpair(work_dat) != KCGI_OK)
+
+	/*
+	 * Large bodies are spooled by the worker into a file we create
+	 * (it can't), which grows as the body is read.
+	 * If the worker uses it, kworker_parent() takes it (setting it
+	 * to -1) for the request; otherwise, we close it when done.
+	 */
+
+	len = kpriv_body_len();
+	if (kopts.spoolsz > 0 && len >= kopts.spoolsz &&
+	    (spool = kpriv_body_spool()) == -1)
+		return KCGI_SYSTEM;
+
+	/*
+	 * If we're using a persistent worker, start it (if it's not
+	 * already started) and forward our request.
+	 * The worker isn't ours to close or reap when we're done.
+	 */
+
+	if (kopts.persist) {
+		kerr = cgi_worker_start(keys, keysz, 
+			mimes, mimesz, arg, argfree, debugging);
+		if (kerr == KCGI_OK && 
+		    !cgi_worker_maps(pages, pagesz, suffixmap))
+			kerr = KCGI_ENOMEM;
+		if (kerr != KCGI_OK) {
+			if (spool != -1)
+				close(spool);
+			return kerr;
+		}
+		if ((kerr = cgi_worker_send
+		    (cgi_worker.fd, spool)) != KCGI_OK) {
+			cgi_worker_stop();
+			if (spool != -1)
+				close(spool);
+			return kerr;
+		}
+		work_dat[KWORKER_PARENT] = cgi_worker.fd;
+		work_dat[KWORKER_CHILD] = -1;
+		work_pid = -1;
+		goto parse;
+	}
+
+	if (spool == -1 && kopts.sharedbody && len > 0 && 
+	    (kerr = kpriv_body_map(req, len)) != KCGI_OK) {
+		kreq_free(req);
+		return kerr;
+	}
+
+	if (kxsocketpair(work_dat) != KCGI_OK) {
+		if (spool != -1)
+			close(spool);
+		kreq_free(req);
 		return KCGI_SYSTEM;
+	}
 
 	if ((work_pid = fork()) == -1) {
 		er = errno;
@@ -988,6 +1374,9 @@ khttp_parsex(struct kreq *req,
 
 		close(work_dat[KWORKER_PARENT]);
 		close(work_dat[KWORKER_CHILD]);
+		if (spool != -1)
+			close(spool);
+		kreq_free(req);
 		return (er == EAGAIN) ? KCGI_EAGAIN : KCGI_ENOMEM;
 	} else if (work_pid == 0) {
 		if (argfree != NULL)
@@ -1001,6 +1390,8 @@ khttp_parsex(struct kreq *req,
 		    work_dat[KWORKER_CHILD], -1, -1, -1))
 			er = EXIT_FAILURE;
 		else if (kworker_child(work_dat[KWORKER_CHILD],
+		    req->priv == NULL ? NULL : req->priv->body,
+		    req->priv == NULL ? 0 : req->priv->bodysz, spool,
 		    keys, keysz, mimes, mimesz, debugging) != KCGI_OK)
 			er = EXIT_FAILURE;
 
@@ -1011,16 +1402,7 @@ khttp_parsex(struct kreq *req,
 
 	close(work_dat[KWORKER_CHILD]);
 	work_dat[KWORKER_CHILD] = -1;
-
-	if (opts == NULL) {
-		memset(&kopts, 0, sizeof(struct kopts));
-		kopts.sndbufsz = -1;
-	} else
-		kopts = *opts;
-
-	if (kopts.sndbufsz < 0)
-		kopts.sndbufsz = 1024 * 8;
-
+parse:
 	kerr = KCGI_ENOMEM;
 
 	/*
@@ -1038,17 +1420,25 @@ khttp_parsex(struct kreq *req,
 	if (req->kdata == NULL)
 		goto err;
 
+	if (kpriv_alloc(req) == NULL)
+		goto err;
+	a = &req->priv->arena;
+
 	if (keysz) {
-		req->cookiemap = kxcalloc(keysz, sizeof(struct kpair *));
+		req->cookiemap = karena_calloc
+			(a, keysz, sizeof(struct kpair *));
 		if (req->cookiemap == NULL)
 			goto err;
-		req->cookienmap = kxcalloc(keysz, sizeof(struct kpair *));
+		req->cookienmap = karena_calloc
+			(a, keysz, sizeof(struct kpair *));
 		if (req->cookienmap == NULL)
 			goto err;
-		req->fieldmap = kxcalloc(keysz, sizeof(struct kpair *));
+		req->fieldmap = karena_calloc
+			(a, keysz, sizeof(struct kpair *));
 		if (req->fieldmap == NULL)
 			goto err;
-		req->fieldnmap = kxcalloc(keysz, sizeof(struct kpair *));
+		req->fieldnmap = karena_calloc
+			(a, keysz, sizeof(struct kpair *));
 		if (req->fieldnmap == NULL)
 			goto err;
 	}
@@ -1059,11 +1449,31 @@ khttp_parsex(struct kreq *req,
 	 */
 
 	kerr = kworker_parent
-		(work_dat[KWORKER_PARENT], req, 1, mimesz);
+		(work_dat[KWORKER_PARENT], req, mimesz, &spool, 1);
 	if (kerr != KCGI_OK)
 		goto err;
+	if (spool != -1) {
+		close(spool);
+		spool = -1;
+	}
 
-	/* Look up page type from component. */
+	/* 
+	 * Look up the page and MIME type, defaulting to defpage and
+	 * defmime.
+	 * If we can't find them, use pagesz and mimesz.
+	 * A persistent worker's tables are indexed; otherwise, the
+	 * tables are only searched once, so just scan them.
+	 */
+
+	if (kopts.persist) {
+		req->page = *req->pagename == '\0' ? defpage :
+			kstrmap_get(&cgi_worker.pagemap, 
+				req->pagename, pagesz);
+		req->mime = *req->suffix == '\0' ? defmime :
+			kstrmap_get(&cgi_worker.suffixes, 
+				req->suffix, mimesz);
+		return KCGI_OK;
+	}
 
 	req->page = defpage;
 	if (*req->pagename != '\0')
@@ -1072,11 +1482,6 @@ khttp_parsex(struct kreq *req,
 			    (pages[req->page], req->pagename) == 0)
 				break;
 
-	/*
-	 * Look up the MIME type, defaulting to defmime if none.
-	 * If we can't find it, use the maximum (mimesz).
-	 */
-
 	req->mime = defmime;
 	if (*req->suffix != '\0') {
 		for (mm = suffixmap; mm->name != NULL; mm++)
@@ -1094,11 +1499,24 @@ khttp_parsex(struct kreq *req,
 	work_pid = -1;
 	if (kerr != KCGI_OK)
 		goto err;
+	if ((kerr = kpriv_body_seal(req)) != KCGI_OK)
+		goto err;
 	return kerr;
 err:
 	assert(kerr != KCGI_OK);
-	if (work_dat[KWORKER_PARENT] != -1)
+
+	/*
+	 * A persistent worker is in an unknown state (we might not have
+	 * read all of its output), so stop it: it will be restarted on
+	 * the next invocation.
+	 */
+
+	if (kopts.persist)
+		cgi_worker_stop();
+	else if (work_dat[KWORKER_PARENT] != -1)
 		close(work_dat[KWORKER_PARENT]);
+	if (spool != -1)
+		close(spool);
 	if (work_pid != -1)
 		kxwaitpid(work_pid);
 	kdata_free(req->kdata, 0);
@@ -447,6 +447,7 @@ struct	khttpauth {
 };
 
 struct	kdata;
+struct	kpriv;
 
 struct	khead {
 	char		*key;
@@ -485,10 +486,21 @@ struct	kreq {
 	size_t			  keysz;
 	char			 *pname;
 	void			 *arg; 
+	struct kpriv		 *priv;
 };
 
 struct	kopts {
 	ssize_t		  	  sndbufsz;
+	int			  persist;
+	int			  sharedbody;
+	int			  complevel;
+	size_t			  compminsz;
+	const enum kmime	 *compskip;
+	size_t			  compskipsz;
+	int			  etag;
+	size_t			  fullbufsz;
+	size_t			  asyncbufsz;
+	size_t			  spoolsz;
 };
 
 struct	kcgi_buf {
@@ -538,6 +550,13 @@ const char	*kcgi_strerror(enum kcgi_err);
 
 enum kcgi_err	 khttp_body(struct kreq *);
 enum kcgi_err	 khttp_body_compress(struct kreq *, int);
+int		 khttp_body_fd(const struct kreq *, 
+			const struct kpair *, off_t *);
+enum kcgi_err	 khttp_body_file(struct kreq *, int,
+			const char *, const char *, int64_t);
+enum kcgi_err	 khttp_body_sendfile(struct kreq *, const char *);
+enum khttp	 khttp_cond(const struct kreq *, 
+			const char *, int64_t);
 void		 khttp_free(struct kreq *);
 void		 khttp_child_free(struct kreq *);
 enum kcgi_err	 khttp_head(struct kreq *, const char *, 
@@ -572,6 +591,7 @@ enum kcgi_err	 khttp_templatex_buf(const struct ktemplate *,
 enum kcgi_err	 khttp_templatex_fd(const struct ktemplate *, 
 			int, const char *,
 			const struct ktemplatex *, void *);
+enum kcgi_err	 khttp_sendfile(struct kreq *, int, off_t, size_t);
 enum kcgi_err	 khttp_write(struct kreq *, const char *, size_t);
 
 enum kcgi_err	 kcgi_buf_printf(struct kcgi_buf *, const char *, ...)
@@ -642,6 +662,7 @@ int	 	 khttp_datetime2epoch(int64_t *, int64_t, int64_t,
 			int64_t, int64_t, int64_t, int64_t);
 int	 	 khttp_date2epoch(int64_t *, int64_t, int64_t,
 			int64_t);
+int		 khttp_str2epoch(int64_t *, const char *);
 
 char 		*khttp_urlabs(enum kscheme, const char *, 
 			uint16_t, const char *, ...);
@@ -485,6 +485,10 @@ dochild_params(int fd, void *arg, size_t *length,
 				if (!fp("REQUEST_METHOD", "OPTIONS", arg))
 					return 0;
 				path = head + 8;
+			} else if (strncmp(head, "HEAD ", 5) == 0) {
+				if (!fp("REQUEST_METHOD", "HEAD", arg))
+					return 0;
+				path = head + 5;
 			} else {
 				fprintf(stderr, "Unknown HTTP "
 					"first line: %s\n", head);
@@ -19,14 +19,20 @@
 #include <sys/stat.h>
 #include <sys/un.h>
 #include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <limits.h>
+#include <netdb.h>
 #include <pwd.h>
 #include <poll.h>
+#ifdef __linux__
+# include <sched.h>
+#endif
 #include <signal.h>
 #include <stdarg.h>
 #include <stdio.h>
@@ -43,10 +49,13 @@
  */
 struct	worker {
 	int	 fd; /* active request fd or -1 */
-	int	 ctrl; /* control socket */
+	int	 ctrl; /* control socket or -1 once released */
 	pid_t	 pid; /* process */
-	time_t	 last; /* last deschedule or 0 if never */
+	time_t	 last; /* last start, deschedule, or release */
 	uint64_t cookie;
+	size_t	 reqs; /* connections served */
+	int	 retire; /* release when idle (restarting) */
+	int	 signalled; /* sent SIGTERM after release */
 };
 
 /*
@@ -243,42 +252,65 @@ xsocketpair(int *sock)
 }
 
 /*
- * Start a worker for the variable pool.
+ * Start a worker for the variable pool, appending it to the workers
+ * "ws" of size "wsz", growing the array (of capacity "wmax") if need
+ * be.
+ * Returns the new worker or NULL on failure.
  */
-static int
-varpool_start(struct worker *w, const struct worker *ws, 
-	size_t wsz, int fd, char **nargv)
+static struct worker *
+varpool_start(struct worker **ws, size_t *wsz, size_t *wmax,
+	int fd, char **nargv)
 {
-	int	 pair[2];
-	char	 buf[64];
-	size_t	 i;
+	struct worker	*w;
+	int		 pair[2];
+	char		 buf[64];
+	size_t		 i;
+	void		*pp;
 
-	w->ctrl = w->fd = -1;
-	w->pid = -1;
+	if (*wsz == *wmax) {
+		pp = reallocarray(*ws, 
+			*wmax + 8, sizeof(struct worker));
+		if (NULL == pp) {
+			syslog(LOG_ERR, "reallocarray: workers: %m");
+			return(NULL);
+		}
+		*ws = pp;
+		*wmax += 8;
+	}
 
 	if ( ! xsocketpair(pair))
-		return(0);
+		return(NULL);
+
+	w = &(*ws)[*wsz];
+	memset(w, 0, sizeof(struct worker));
 	w->ctrl = pair[0];
+	w->fd = -1;
+	w->last = time(NULL);
 
 	if (-1 == (w->pid = fork())) {
 		syslog(LOG_ERR, "fork: worker: %m");
 		close(pair[0]);
 		close(pair[1]);
-		w->ctrl = -1;
-		return(0);
+		return(NULL);
 	} else if (0 == w->pid) {
 		/* 
-		 * Close out all current descriptors.
+		 * Close out all current descriptors, including the
+		 * connections other workers are serving, lest we keep
+		 * them open.
 		 * Note that we're a "new-mode" FastCGI manager to the
 		 * child via our environment variable.
 		 */
-		for (i = 0; i < wsz; i++)
-			if (-1 != ws[i].ctrl && 
-			    -1 == close(ws[i].ctrl))
+		for (i = 0; i < *wsz; i++) {
+			if (-1 != (*ws)[i].ctrl && 
+			    -1 == close((*ws)[i].ctrl))
 				syslog(LOG_ERR, "close: "
 					"worker cleanup: %m");
+			if (-1 != (*ws)[i].fd)
+				close((*ws)[i].fd);
+		}
 
 		close(fd);
+		close(pair[0]);
 		snprintf(buf, sizeof(buf), "%d", pair[1]);
 		setenv("FCGI_LISTENSOCK_DESCRIPTORS", buf, 1);
 		execv(nargv[0], nargv);
@@ -289,29 +321,84 @@ varpool_start(struct worker *w, const struct worker *ws,
 	/* Close the child descriptor. */
 	if (-1 == close(pair[1])) {
 		syslog(LOG_ERR, "close: worker-%u pipe: %m", w->pid);
-		return(0);
+		close(pair[0]);
+		return(NULL);
 	}
 
+	(*wsz)++;
 	dbg("worker-%u: started", w->pid);
+	return(w);
+}
+
+/*
+ * Release the idle worker "ws[i]" by closing its control socket, which
+ * makes kcgi(3) workers exit once they've finished any connections they
+ * kept open.
+ * The worker is moved (keeping the order of the others) to the "slough"
+ * array of size "sloughsz", growing it (of capacity "sloughmax") if
+ * need be, to be signalled if it hasn't exited within the wait time.
+ * Returns zero on failure, non-zero on success.
+ */
+static int
+varpool_release(struct worker *ws, size_t *wsz, size_t i,
+	struct worker **slough, size_t *sloughsz, size_t *sloughmax)
+{
+	void	*pp;
+
+	assert(-1 == ws[i].fd);
+
+	if (*sloughsz == *sloughmax) {
+		pp = reallocarray(*slough, 
+			*sloughmax + 8, sizeof(struct worker));
+		if (NULL == pp) {
+			syslog(LOG_ERR, "reallocarray: slough: %m");
+			return(0);
+		}
+		*slough = pp;
+		*sloughmax += 8;
+	}
+
+	if (-1 == close(ws[i].ctrl))
+		syslog(LOG_ERR, "close: worker-%u "
+			"control socket: %m", ws[i].pid);
+	ws[i].ctrl = -1;
+	ws[i].last = time(NULL);
+
+	dbg("slough: acquiring worker-%u (served %zu)", 
+		ws[i].pid, ws[i].reqs);
+	(*slough)[(*sloughsz)++] = ws[i];
+	memmove(&ws[i], &ws[i + 1], 
+		(*wsz - i - 1) * sizeof(struct worker));
+	(*wsz)--;
 	return(1);
 }
 
 /*
  * A variable-sized pool of web application clients.
- * A minimum of "wsz" applications are always running, and will grow to
- * "maxwsz" at which point no new connections are accepted.
- * This is an EXPERIMENTAL extension.
+ * A minimum of "minwsz" applications are always running, and will grow
+ * to "maxwsz" at which point no new connections are accepted until a
+ * worker is free.
+ * Each worker serves one of our connections at a time, acknowledging
+ * it once the connection has closed: a connection the web server keeps
+ * open (FCGI_KEEP_CONN) keeps its worker busy.
+ * Connections go to the lowest free worker so that, when load drops,
+ * the highest workers go idle and are released after "waittime".
+ * To absorb bursts, we start a spare worker whenever none are free
+ * instead of when the next connection arrives.
+ * On SIGHUP, we start a new pool and release the old workers as they
+ * finish their connections: the socket stays open throughout.
  */
 static int
-varpool(size_t wsz, size_t maxwsz, time_t waittime,
+varpool(size_t minwsz, size_t maxwsz, time_t waittime,
 	int fd, const char *sockpath, char *argv[])
 {
-	struct worker	*ws;
-	struct worker	*slough;
-	size_t		 pfdsz, opfdsz, pfdmaxsz, i, j, minwsz,
-			 sloughsz, sloughmaxsz;
-	int		 rc, exitcode, afd, accepting;
-	struct pollfd	*pfd, *opfd;
+	struct worker	*ws = NULL, *slough = NULL, *w;
+	size_t		*pws = NULL;
+	size_t		 wsz = 0, wmax = 0, sloughsz = 0, sloughmax = 0,
+			 pfdsz, pfdmax = 0, nact, nbusy, i, j;
+	int		 rc, exitcode = 0, afd, accepting = 1, 
+			 listening, fl, started;
+	struct pollfd	*pfd = NULL;
 	struct sockaddr_storage ss;
 	socklen_t	 sslen;
 	void		*pp;
@@ -319,8 +406,6 @@ varpool(size_t wsz, size_t maxwsz, time_t waittime,
 	sigset_t	 set;
 	uint64_t	 cookie;
 
-	dbg("YOU ARE RUNNING VARIABLE MODE AT YOUR OWN RISK.");
-
 	signal(SIGCHLD, sighandlechld);
 	signal(SIGTERM, sighandlestop);
 	signal(SIGHUP, sighandlehup);
@@ -330,378 +415,318 @@ varpool(size_t wsz, size_t maxwsz, time_t waittime,
 	sigaddset(&set, SIGHUP);
 	sigprocmask(SIG_BLOCK, &set, NULL);
 
-again:
 	stop = chld = hup = 0;
 
 	/* 
-	 * Allocate worker array, polling descriptor array, and slough
-	 * array (exiting workers).
-	 * Set our initial exit code and our acceptance status.
+	 * We accept as many connections as we have workers for at
+	 * once, so don't block when we run out.
 	 */
-	minwsz = wsz;
-	ws = calloc(wsz, sizeof(struct worker));
-	sloughmaxsz = (maxwsz - minwsz) * 2;
-	slough = calloc(sloughmaxsz, sizeof(struct worker));
-	pfdmaxsz = wsz + 1;
-	pfd = calloc(pfdmaxsz, sizeof(struct pollfd));
-	exitcode = 0;
-
-	if (NULL == ws || NULL == pfd || NULL == slough) {
-		/* Serious problems. */
-		syslog(LOG_ERR, "calloc: initialisation: %m");
-		close(fd);
-		unlink(sockpath);
-		free(ws);
-		free(slough);
-		free(pfd);
-		return(0);
-	}
-
-	/* Zeroth pfd is always the domain socket. */
-	pfd[0].fd = fd;
-	pfd[0].events = POLLIN;
-
-	/* Guard against bad de-allocation. */
-	for (i = 0; i < wsz; i++) {
-		ws[i].ctrl = ws[i].fd = -1;
-		ws[i].pid = -1;
+	if (-1 == (fl = fcntl(fd, F_GETFL, 0)) ||
+	    -1 == fcntl(fd, F_SETFL, fl | O_NONBLOCK)) {
+		syslog(LOG_ERR, "fcntl: control: %m");
+		goto out;
 	}
 
-	sloughsz = 0;
-	accepting = 1;
-	pfdsz = 1;
-
 	/*
 	 * Start up the [initial] worker processes.
 	 * We'll later spin up workers when we need them.
 	 * If these die immediately, we'll find out below when we
 	 * unblock our signals.
 	 */
-	for (i = 0; i < wsz; i++)
-		if ( ! varpool_start(&ws[i], ws, wsz, fd, argv))
+	for (i = 0; i < minwsz; i++)
+		if (NULL == varpool_start(&ws, &wsz, &wmax, fd, argv))
 			goto out;
-pollagain:
-	/*
-	 * Main part.
-	 * Poll on our control socket (pfd[0]) and the children that
-	 * have active connections.
-	 * If we're not accepting new connections, avoid polling on the
-	 * first entry by offsetting.
-	 * We have a timeout if we get a termination signal whilst
-	 * waiting.
-	 */
-	opfd = accepting ? pfd : pfd + 1;
-	opfdsz = accepting ? pfdsz : pfdsz - 1;
 
-	sigprocmask(SIG_UNBLOCK, &set, NULL);
-	rc = poll(opfd, opfdsz, 1000);
-	sigprocmask(SIG_BLOCK, &set, NULL);
-
-	/* Did an error occur? */
-	if (rc < 0 && EINTR != errno) {
-		syslog(LOG_ERR, "poll: main event: %m");
-		goto out;
-	} 
-
-	if (stop) {
-		/* 
-		 * If we're being requested to stop, go to exit now. 
-		 * We'll immediately kill off our children and wait.
-		 */
-		dbg("servicing exit request");
-		exitcode = 1;
-		goto out;
-	} else if (chld) {
+	for (;;) {
 		/*
-		 * A child has exited.
-		 * This can mean one of two things: either a worker has
-		 * exited abnormally or one of the "sloughed" workers
-		 * has finished its exit.
+		 * Poll on our control socket if we're accepting
+		 * connections, and on the workers that have them.
+		 * We have a timeout to release idle workers.
 		 */
-		if (0 == sloughsz) {
-			syslog(LOG_ERR, "worker unexpectedly exited");
-			goto out;
+		if (wsz + 1 > pfdmax) {
+			pp = reallocarray(pfd, 
+				wsz + 1, sizeof(struct pollfd));
+			if (NULL == pp) {
+				syslog(LOG_ERR, "reallocarray: "
+					"descriptor array: %m");
+				goto out;
+			}
+			pfd = pp;
+			pp = reallocarray(pws, wsz + 1, sizeof(size_t));
+			if (NULL == pp) {
+				syslog(LOG_ERR, "reallocarray: "
+					"descriptor array: %m");
+				goto out;
+			}
+			pws = pp;
+			pfdmax = wsz + 1;
 		}
 
-		/* Look at the running children. */
+		pfdsz = 0;
+		if ((listening = accepting)) {
+			pfd[pfdsz].fd = fd;
+			pfd[pfdsz].events = POLLIN;
+			pfd[pfdsz].revents = 0;
+			pws[pfdsz++] = SIZE_MAX;
+		}
 		for (i = 0; i < wsz; i++) {
-			assert(-1 != ws[i].pid);
-			rc = waitpid(ws[i].pid, NULL, WNOHANG);
-			if (rc < 0) {
-				syslog(LOG_ERR, "wait: worker-%u "
-					"check: %m", ws[i].pid);
-				goto out;
-			} else if (0 == rc)
+			if (-1 == ws[i].fd)
 				continue;
-			/*
-			 * We found a process that has already exited.
-			 * Close its fd as well so that we know that the
-			 * pid of -1 means it's completely finished.
-			 */
-			syslog(LOG_ERR, "worker-%u "
-				"unexpectedly exited", ws[i].pid);
-			if (-1 == close(ws[i].ctrl))
-				syslog(LOG_ERR, "close: worker-%u "
-					"control socket: %m",
-					ws[wsz - 1].pid);
-			ws[i].pid = -1;
-			goto out;
+			pfd[pfdsz].fd = ws[i].ctrl;
+			pfd[pfdsz].events = POLLIN;
+			pfd[pfdsz].revents = 0;
+			pws[pfdsz++] = i;
 		}
 
-		/* Ok... an exiting child can be reaped. */
-		chld = 0;
-		for (i = 0; i < sloughsz; ) {
-			rc = waitpid(slough[i].pid, NULL, WNOHANG);
-			if (0 == rc) {
-				i++;
-				continue;
-			} else if (rc < 0) {
-				syslog(LOG_ERR, "wait: sloughed "
-					"worker-%u check: %m", 
-					slough[i].pid);
+		sigprocmask(SIG_UNBLOCK, &set, NULL);
+		rc = poll(pfd, pfdsz, 1000);
+		sigprocmask(SIG_BLOCK, &set, NULL);
+
+		if (rc < 0 && EINTR != errno) {
+			syslog(LOG_ERR, "poll: main event: %m");
+			goto out;
+		} else if (rc < 0)
+			rc = 0;
+
+		if (stop) {
+			/* 
+			 * If we're being requested to stop, go to exit
+			 * now. 
+			 * We'll immediately kill off our children and
+			 * wait.
+			 */
+			dbg("servicing exit request");
+			exitcode = 1;
+			goto out;
+		} 
+		
+		if (chld) {
+			/*
+			 * A child has exited.
+			 * This can mean one of two things: either a
+			 * worker has exited abnormally or one of the
+			 * "sloughed" workers has finished its exit.
+			 */
+			chld = 0;
+			for (i = 0; i < wsz; i++) {
+				rc = waitpid(ws[i].pid, NULL, WNOHANG);
+				if (0 == rc)
+					continue;
+				else if (rc < 0)
+					syslog(LOG_ERR, "wait: worker-%u "
+						"check: %m", ws[i].pid);
+				else
+					syslog(LOG_ERR, "worker-%u "
+						"unexpectedly exited", 
+						ws[i].pid);
 				goto out;
 			}
-			dbg("slough: releasing worker-%u\n", 
-				slough[i].pid);
-			if (i < sloughsz - 1)
-				slough[i] = slough[sloughsz - 1];
-			sloughsz--;
+			for (i = 0; i < sloughsz; ) {
+				rc = waitpid(slough[i].pid, NULL, WNOHANG);
+				if (0 == rc) {
+					i++;
+					continue;
+				} else if (rc < 0) {
+					syslog(LOG_ERR, "wait: sloughed "
+						"worker-%u check: %m", 
+						slough[i].pid);
+					goto out;
+				}
+				dbg("slough: releasing worker-%u", 
+					slough[i].pid);
+				slough[i] = slough[--sloughsz];
+			}
+			rc = 0;
+		} 
+		
+		if (hup) {
+			/*
+			 * Restart: mark all current workers for
+			 * release when they've finished their
+			 * connections, then start a new pool.
+			 * Connections waiting on our socket will go to
+			 * the new workers.
+			 */
+			hup = 0;
+			dbg("servicing restart request");
+			for (i = 0; i < wsz; i++)
+				ws[i].retire = 1;
+			for (i = 0; i < minwsz; i++)
+				if (NULL == varpool_start
+				    (&ws, &wsz, &wmax, fd, argv))
+					goto out;
+			accepting = 1;
 		}
-	} else if (hup) {
-		dbg("servicing restart request");
-		goto out;
-	}
 
-	/*
-	 * See if we should reduce our pool size.
-	 * We only do this if we've grown beyond the minimum.
-	 */
-	if (wsz > minwsz) {
-		t = time(NULL);
 		/*
-		 * We only reduce if the last worker is (1) not running
-		 * and (2) was last descheduled a while ago.
+		 * See which of the workers have finished with their
+		 * connections (we only poll on those with them).
 		 */
-		assert(-1 != ws[wsz - 1].fd || ws[wsz - 1].last);
-		assert(wsz > 1);
-
-		if (-1 == ws[wsz - 1].fd &&
-		    t - ws[wsz - 1].last > waittime) {
-			assert(-1 != ws[wsz - 1].ctrl);
-			assert(-1 != ws[wsz - 1].pid);
-			assert(-1 == ws[wsz - 1].fd);
-			assert(-1 == pfd[pfdmaxsz - 1].fd);
-
-			if (sloughsz >= sloughmaxsz) {
-				syslog(LOG_ERR, "slough pool "
-					"maximum size reached");
-				goto out;
-			}
-			
-			/* Close down the worker in the usual way. */
-			if (-1 == close(ws[wsz - 1].ctrl)) {
-				syslog(LOG_ERR, "close: worker-%u "
-					"control socket: %m",
-					ws[wsz - 1].pid);
-				goto out;
-			} 
-			if (-1 == kill(ws[wsz - 1].pid, SIGTERM)) {
-				syslog(LOG_ERR, "kill: worker-%u: %m",
-					ws[wsz - 1].pid);
+		t = time(NULL);
+		for (i = listening ? 1 : 0; i < pfdsz && rc > 0; i++) {
+			if (0 == pfd[i].revents)
+				continue;
+			rc--;
+			w = &ws[pws[i]];
+			if ( ! (POLLIN & pfd[i].revents)) {
+				syslog(LOG_ERR, "poll: worker-%u "
+					"disconnect", w->pid);
 				goto out;
 			}
 
 			/* 
-			 * Append the dying client to the slough array,
-			 * since workers may take time to die.
+			 * Read the "identifier" that the child process
+			 * gives to us.
 			 */
-			dbg("slough: acquiring worker-%u\n", 
-				ws[wsz - 1].pid);
-			slough[sloughsz++] = ws[wsz - 1];
-
-			/* Reallocations. */
-			pp = reallocarray(ws, wsz - 1, 
-				sizeof(struct worker));
-			if (NULL == pp) {
-				syslog(LOG_ERR, "reallocarray: "
-					"worker array: %m");
+			if ( ! fullread(w->ctrl, &cookie, sizeof(uint64_t)))
 				goto out;
-			}
-			ws = pp;
-			wsz--;
-			pp = reallocarray(pfd, pfdmaxsz - 1,
-				sizeof(struct pollfd));
-			if (NULL == pp) {
-				syslog(LOG_ERR, "reallocarray: "
-					"descriptor array: %m");
+			if (cookie != w->cookie) {
+				syslog(LOG_ERR, "poll: bad worker response");
 				goto out;
 			}
-			pfd = pp;
-			pfdmaxsz--;
-		}
-	}
-	
-	if (0 == rc)
-		goto pollagain;
 
-	/*
-	 * Now we see which of the workers has exited.
-	 * We do this until we've processed all of them.
-	 */
-	assert(rc > 0);
-	for (i = 1; i < pfdsz && rc > 0; ) {
-		if (POLLHUP & pfd[i].revents ||
-		    POLLERR & pfd[i].revents) {
-			syslog(LOG_ERR, "poll: worker disconnect");
-			goto out;
-		} else if ( ! (POLLIN & pfd[i].revents)) {
-			i++;
-			continue;
-		} 
+			dbg("worker-%u: release %d", w->pid, w->fd);
 
-		/* 
-		 * Read the "identifier" that the child process gives
-		 * to us.
-		 */
-		if ( ! fullread(pfd[i].fd, &cookie, sizeof(uint64_t)))
-			goto out;
+			/*
+			 * Close the descriptor (that we still hold) and
+			 * mark this worker as no longer working.
+			 */
+			close(w->fd);
+			w->fd = -1;
+			w->last = t;
+			w->reqs++;
+			if (0 == accepting) {
+				accepting = 1;
+				dbg("rate-limiting: disabled");
+			}
+		}
 
 		/*
-		 * First, look up the worker that's now free.
-		 * Mark its active descriptor as free.
-		 * TODO: use a queue of "working" processes to prevent
-		 * this from being so expensive.
+		 * Release idle workers marked by a restart, then those
+		 * beyond the minimum pool size that have been idle for
+		 * the wait time.
+		 * Start from the top, where the idle workers are.
 		 */
-		for (j = 0; j < wsz; j++)
-			if (ws[j].cookie == cookie)
-				break;
-
-		if (j == wsz) {
-			syslog(LOG_ERR, "poll: bad worker response");
-			goto out;
+		for (i = wsz, nact = 0; i > 0; i--)
+			if ( ! ws[i - 1].retire)
+				nact++;
+		for (i = wsz; i > 0; i--) {
+			w = &ws[i - 1];
+			if (-1 != w->fd)
+				continue;
+			if ( ! w->retire && 
+			    (nact <= minwsz || t - w->last <= waittime))
+				continue;
+			if ( ! w->retire)
+				nact--;
+			if ( ! varpool_release(ws, &wsz, i - 1, 
+			    &slough, &sloughsz, &sloughmax))
+				goto out;
 		}
 
-		dbg("worker-%u: release %d", ws[j].pid, ws[j].fd);
-
 		/*
-		 * Close the descriptor (that we still hold) and mark
-		 * this worker as no longer working.
+		 * Workers we've released that haven't exited within the
+		 * wait time (e.g., don't exit when their control socket
+		 * closes) are told to.
 		 */
-		rc--;
-		close(ws[j].fd);
-		if (0 == accepting) {
-			accepting = 1;
-			dbg("rate-limiting: disabled");
+		for (i = 0; i < sloughsz; i++) {
+			if (slough[i].signalled || 
+			    t - slough[i].last < waittime)
+				continue;
+			dbg("slough: terminating worker-%u", 
+				slough[i].pid);
+			if (-1 == kill(slough[i].pid, SIGTERM))
+				syslog(LOG_ERR, "kill: worker-%u: %m",
+					slough[i].pid);
+			slough[i].signalled = 1;
 		}
-		ws[j].fd = -1;
-		ws[j].last = time(NULL);
+
+		if ( ! listening || ! accepting)
+			continue;
+
+		if (POLLHUP & pfd[0].revents) {
+			syslog(LOG_ERR, "poll: control hangup");
+			goto out;
+		} else if (POLLERR & pfd[0].revents) {
+			syslog(LOG_ERR, "poll: control error?");
+			goto out;
+		} else if ( ! (POLLIN & pfd[0].revents))
+			continue;
 
 		/*
-		 * Now, clear the active descriptor from the file
-		 * descriptor array.
-		 * Do so by flipping it into the last slot then
-		 * truncating the array size.
-		 * Obviously, we only do this if we're not the current
-		 * end of array...
+		 * We have new connections.
+		 * Accept as many as we have (or can start) workers for,
+		 * giving each to the lowest free worker.
 		 */
-		if (pfdsz - 1 != i)
-			pfd[i] = pfd[pfdsz - 1];
-		pfd[pfdsz - 1].fd = -1;
-		pfdsz--;
-	}
+		for (;;) {
+			for (i = 0, nact = nbusy = 0; i < wsz; i++) {
+				if (ws[i].retire)
+					continue;
+				nact++;
+				if (-1 != ws[i].fd)
+					nbusy++;
+			}
+			for (j = 0; j < wsz; j++)
+				if ( ! ws[j].retire && -1 == ws[j].fd)
+					break;
 
-	if (0 == accepting)
-		goto pollagain;
+			if (j == wsz && nact >= maxwsz) {
+				accepting = 0;
+				dbg("rate-limiting: enabled");
+				break;
+			} else if ((started = j == wsz) && NULL == 
+			    varpool_start(&ws, &wsz, &wmax, fd, argv))
+				goto out;
 
-	if (POLLHUP & pfd[0].revents) {
-		syslog(LOG_ERR, "poll: control hangup");
-		goto out;
-	} else if (POLLERR & pfd[0].revents) {
-		syslog(LOG_ERR, "poll: control error?");
-		goto out;
-	} else if ( ! (POLLIN & pfd[0].revents))
-		goto pollagain;
+			sslen = sizeof(ss);
+			afd = accept(fd, (struct sockaddr *)&ss, &sslen);
+			if (afd < 0) {
+				if (EAGAIN == errno || 
+				    EWOULDBLOCK == errno ||
+				    ECONNABORTED == errno)
+					break;
+				syslog(LOG_ERR, "accept: "
+					"new connection: %m");
+				goto out;
+			} 
 
-	/* 
-	 * We have a new request.
-	 * First, see if we need to allocate more workers.
-	 */
-	if (pfdsz == pfdmaxsz) {
-		if (wsz + 1 > maxwsz) {
-			accepting = 0;
-			dbg("rate-limiting: enabled");
-			goto pollagain;
-		}
-		pp = reallocarray(pfd, pfdmaxsz + 1,
-			sizeof(struct pollfd));
-		if (NULL == pp) {
-			syslog(LOG_ERR, "reallocarray: workers: %m");
-			goto out;
+			w = &ws[j];
+			w->fd = afd;
+			w->cookie = arc4random();
+			dbg("worker-%u: acquire %d "
+				"(busy %zu/%zu, maximum %zu)", 
+				w->pid, afd, nbusy + 1, 
+				nact + started, maxwsz);
+			if ( ! fullwritefd(w->ctrl, 
+			    w->fd, &w->cookie, sizeof(uint64_t)))
+				goto out;
 		}
-		pfd = pp;
-		memset(&pfd[pfdmaxsz], 0, sizeof(struct pollfd));
-		pfd[pfdmaxsz].fd = -1;
 
-		pp = reallocarray(ws, wsz + 1,
-			sizeof(struct worker));
-		if (NULL == pp) {
-			syslog(LOG_ERR, "reallocarray: descriptors: %m");
-			goto out;
+		/* 
+		 * Keep a spare worker ready for the next connection
+		 * if we've used up the free ones.
+		 */
+		for (i = 0, nact = 0, j = wsz; i < wsz; i++) {
+			if (ws[i].retire)
+				continue;
+			nact++;
+			if (-1 == ws[i].fd)
+				j = i;
 		}
-		ws = pp;
-		memset(&ws[wsz], 0, sizeof(struct worker));
-
-		if ( ! varpool_start(&ws[wsz], ws, wsz + 1, fd, argv))
-			goto out;
-		pfdmaxsz++;
-		wsz++;
-	} 
-
-	/*
-	 * Actually accept the socket.
-	 * Don't do anything with it, however.
-	 */
-	sslen = sizeof(ss);
-	afd = accept(fd, (struct sockaddr *)&ss, &sslen);
-	if (afd < 0) {
-		if (EAGAIN == errno || 
-		    EWOULDBLOCK == errno)
-			goto pollagain;
-		syslog(LOG_ERR, "accept: new connection: %m");
-		goto out;
-	} 
+		if (j == wsz && nact < maxwsz) {
+			dbg("starting spare worker");
+			if (NULL == varpool_start(&ws, &wsz, &wmax, fd, argv))
+				goto out;
+		}
+	}
 
+out:
 	/*
-	 * Look up the next unavailable worker.
+	 * Close the FastCGI file descriptor as soon as possible.
 	 */
-	for (i = 0; i < wsz; i++)
-		if (-1 == ws[i].fd) 
-			break;
-
-	assert(i < wsz);
-	ws[i].fd = afd;
-	ws[i].cookie = arc4random();
-	dbg("worker-%u: acquire %d "
-		"(pollers %zu/%zu: workers %zu/%zu)", 
-		ws[i].pid, afd, pfdsz, pfdmaxsz, wsz, maxwsz);
-	pfd[pfdsz].events = POLLIN;
-	pfd[pfdsz].fd = ws[i].ctrl;
-	pfdsz++;
-
-	if (fullwritefd(ws[i].ctrl, ws[i].fd, &ws[i].cookie, sizeof(uint64_t)))
-		goto pollagain;
-
-out:
-	if ( ! hup) {
-		/*
-		 * If we're not going to restart, then close the FastCGI
-		 * file descriptor as soon as possible.
-		 */
-		dbg("closing control socket");
-		if (-1 == close(fd))
-			syslog(LOG_ERR, "close: control: %m");
-		fd = -1;
-	}
+	dbg("closing control socket");
+	if (-1 == close(fd))
+		syslog(LOG_ERR, "close: control: %m");
 
 	/*
 	 * Close the application's control socket; then, if that doesn't
@@ -709,6 +734,8 @@ out:
 	 * we also deliver a SIGTERM.
 	 */
 	for (i = 0; i < wsz; i++) {
+		if (-1 != ws[i].fd)
+			close(ws[i].fd);
 		if (-1 == ws[i].pid)
 			continue;
 		dbg("worker-%u: terminating", ws[i].pid);
@@ -719,6 +746,11 @@ out:
 			syslog(LOG_ERR, "kill: "
 				"worker-%u: %m", ws[i].pid);
 	}
+	for (i = 0; i < sloughsz; i++)
+		if ( ! slough[i].signalled && 
+		    -1 == kill(slough[i].pid, SIGTERM))
+			syslog(LOG_ERR, "kill: "
+				"worker-%u: %m", slough[i].pid);
 
 	/*
 	 * Now wait for the children and pending children.
@@ -742,27 +774,44 @@ out:
 	free(ws);
 	free(slough);
 	free(pfd);
-
-	if (hup)
-		goto again;
-
-	/* 
-	 * Now we're really exiting.
-	 * Do our final cleanup if we didn't already...
-	 */
-	if (-1 != fd) {
-		dbg("closing control socket");
-		if (-1 == close(fd))
-			syslog(LOG_ERR, "close: control: %m");
-	}
+	free(pws);
 	return(exitcode);
 }
 
+/*
+ * Pin the current process to one CPU, chosen by the listener group
+ * "group" of a fixed pool.
+ * This is only supported on Linux: elsewhere, it does nothing.
+ */
+static void
+fixedpool_pin(size_t group)
+{
+#ifdef __linux__
+	cpu_set_t	 set;
+	long		 ncpu;
+
+	if ((ncpu = sysconf(_SC_NPROCESSORS_ONLN)) < 1)
+		ncpu = 1;
+	CPU_ZERO(&set);
+	CPU_SET(group % ncpu, &set);
+	if (-1 == sched_setaffinity(0, sizeof(set), &set))
+		syslog(LOG_WARNING, "sched_setaffinity: "
+			"cpu-%zu: %m", group % ncpu);
+#endif
+}
+
+/*
+ * Start "wsz" workers, each of which will accept(2) on its own from
+ * one of the "fdsz" listening sockets "fds".
+ * If there are several (see listen_group()), workers are spread evenly
+ * among them and are optionally pinned to a CPU per socket.
+ */
 static int
-fixedpool(size_t wsz, int fd, const char *sockpath, char *argv[])
+fixedpool(size_t wsz, int *fds, size_t fdsz, int pin,
+	const char *sockpath, char *argv[])
 {
 	pid_t		 *ws;
-	size_t		  i;
+	size_t		  i, j;
 	sigset_t	  set, oset;
 	void 		(*sigfp)(int);
 
@@ -786,8 +835,10 @@ again:
 	/* Allocate worker array. */
 	if (NULL == (ws = calloc(wsz, sizeof(pid_t)))) {
 		syslog(LOG_ERR, "calloc: initialisation: %m");
-		close(fd);
-		unlink(sockpath);
+		for (j = 0; j < fdsz; j++)
+			close(fds[j]);
+		if (NULL != sockpath)
+			unlink(sockpath);
 		return(0);
 	}
 
@@ -808,11 +859,14 @@ again:
 			 * we're going to transfer request descriptors
 			 * when we get them.
 			 */
-			if (-1 == dup2(fd, STDIN_FILENO)) {
+			if (-1 == dup2(fds[i % fdsz], STDIN_FILENO)) {
 				syslog(LOG_ERR, "dup2: worker: %m");
 				_exit(EXIT_FAILURE);
 			}
-			close(fd);
+			for (j = 0; j < fdsz; j++)
+				close(fds[j]);
+			if (pin)
+				fixedpool_pin(i % fdsz);
 			execv(argv[0], argv);
 			syslog(LOG_ERR, "execve: %s: %m", argv[0]);
 			_exit(EXIT_FAILURE);
@@ -831,11 +885,12 @@ out:
 	if ( ! hup) {
 		/*
 		 * If we're not going to restart, then close the FastCGI
-		 * file descriptor as soon as possible.
+		 * file descriptors as soon as possible.
 		 */
-		if (-1 == close(fd))
-			syslog(LOG_ERR, "close: control: %m");
-		fd = -1;
+		for (j = 0; j < fdsz; j++)
+			if (-1 == close(fds[j]))
+				syslog(LOG_ERR, "close: control: %m");
+		fdsz = 0;
 	}
 
 	/* Suppress child exit signals whilst we kill them. */
@@ -865,22 +920,268 @@ out:
 	 * Now we're really exiting.
 	 * Do our final cleanup if we didn't already...
 	 */
-	if (-1 != fd && -1 == close(fd))
-		syslog(LOG_ERR, "close: control: %m");
+	for (j = 0; j < fdsz; j++)
+		if (-1 == close(fds[j]))
+			syslog(LOG_ERR, "close: control: %m");
+	return(1);
+}
+
+/*
+ * Seconds the kernel may hold a connection with no data before handing
+ * it to accept(2), where TCP_DEFER_ACCEPT is available.
+ * Web servers write the request as soon as they connect.
+ */
+#define	DEFER_ACCEPT_SECS 30
+
+/*
+ * Bind and listen on a TCP socket at "sa".
+ * If "reuse" is set, the address may be bound by other sockets that
+ * also set it, so the kernel spreads connections among them.
+ * Accepted connections inherit TCP_NODELAY: responses are written in
+ * several records and shouldn't wait on the web server's acks.
+ * Returns the socket or -1 on failure.
+ */
+static int
+listen_bind(const struct sockaddr *sa, socklen_t salen,
+	int reuse, size_t lsz)
+{
+	int	 fd, opt = 1;
+#ifdef TCP_DEFER_ACCEPT
+	int	 secs = DEFER_ACCEPT_SECS;
+#endif
+
+	if (-1 == (fd = socket(sa->sa_family, SOCK_STREAM, 0))) {
+		perror("socket");
+		return(-1);
+	}
+
+	if (-1 == setsockopt(fd, SOL_SOCKET, 
+	    SO_REUSEADDR, &opt, sizeof(opt))) {
+		perror("setsockopt: SO_REUSEADDR");
+		close(fd);
+		return(-1);
+	}
+#ifdef SO_REUSEPORT
+	if (reuse && -1 == setsockopt(fd, SOL_SOCKET, 
+	    SO_REUSEPORT, &opt, sizeof(opt))) {
+		perror("setsockopt: SO_REUSEPORT");
+		close(fd);
+		return(-1);
+	}
+#else
+	assert(0 == reuse);
+#endif
+	if (-1 == setsockopt(fd, IPPROTO_TCP, 
+	    TCP_NODELAY, &opt, sizeof(opt))) {
+		perror("setsockopt: TCP_NODELAY");
+		close(fd);
+		return(-1);
+	}
+#ifdef TCP_DEFER_ACCEPT
+	if (-1 == setsockopt(fd, IPPROTO_TCP, 
+	    TCP_DEFER_ACCEPT, &secs, sizeof(secs))) {
+		perror("setsockopt: TCP_DEFER_ACCEPT");
+		close(fd);
+		return(-1);
+	}
+#endif
+	if (-1 == bind(fd, sa, salen)) {
+		perror("bind");
+		close(fd);
+		return(-1);
+	} else if (-1 == listen(fd, lsz)) {
+		perror("listen");
+		close(fd);
+		return(-1);
+	}
+
+	return(fd);
+}
+
+/*
+ * Open "fdsz" TCP listening sockets on "addr", which is "host:port" or
+ * "[host]:port" with an empty or "*" host for all addresses.
+ * With more than one, all are bound to the same address with
+ * SO_REUSEPORT, giving each its own accept queue.
+ * Returns zero on failure (having printed why), non-zero on success.
+ */
+static int
+listen_group(const char *addr, int *fds, size_t fdsz, size_t lsz)
+{
+	struct addrinfo		 hints, *res, *rp;
+	struct sockaddr_storage	 ss;
+	socklen_t		 sslen;
+	char			*buf, *host, *port, *cp;
+	size_t			 i;
+	int			 er;
+
+	if (NULL == (buf = strdup(addr))) {
+		perror(NULL);
+		return(0);
+	}
+
+	host = buf;
+	if ('[' == buf[0] && NULL != (cp = strchr(buf, ']'))) {
+		host = buf + 1;
+		*cp++ = '\0';
+		port = ':' == *cp ? cp + 1 : NULL;
+	} else if (NULL != (cp = strrchr(buf, ':'))) {
+		*cp = '\0';
+		port = cp + 1;
+	} else
+		port = NULL;
+
+	if (NULL == port || '\0' == *port) {
+		fprintf(stderr, "%s: missing port\n", addr);
+		free(buf);
+		return(0);
+	}
+	if ('\0' == *host || 0 == strcmp(host, "*"))
+		host = NULL;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+
+	if (0 != (er = getaddrinfo(host, port, &hints, &res))) {
+		fprintf(stderr, "%s: %s\n", addr, gai_strerror(er));
+		free(buf);
+		return(0);
+	}
+	free(buf);
+
+	fds[0] = -1;
+	for (rp = res; NULL != rp && -1 == fds[0]; rp = rp->ai_next)
+		fds[0] = listen_bind(rp->ai_addr, 
+			rp->ai_addrlen, fdsz > 1, lsz);
+	freeaddrinfo(res);
+
+	if (-1 == fds[0])
+		return(0);
+
+	/*
+	 * Bind the rest of the group to the address we actually got,
+	 * which also picks up the port if it was ephemeral.
+	 */
+
+	sslen = sizeof(ss);
+	if (-1 == getsockname(fds[0], (struct sockaddr *)&ss, &sslen)) {
+		perror("getsockname");
+		close(fds[0]);
+		return(0);
+	}
+
+	for (i = 1; i < fdsz; i++) {
+		fds[i] = listen_bind
+			((struct sockaddr *)&ss, sslen, 1, lsz);
+		if (-1 != fds[i])
+			continue;
+		while (i-- > 0)
+			close(fds[i]);
+		return(0);
+	}
+
 	return(1);
 }
 
+/*
+ * Close and free the listening sockets when failing to start.
+ */
+static void
+closeall(int *fds, size_t fdsz)
+{
+	size_t	 i;
+
+	for (i = 0; i < fdsz; i++)
+		close(fds[i]);
+	free(fds);
+}
+
+/*
+ * Bind and listen on the UNIX socket "sockpath", replacing any that
+ * exists, owned by "sockuid" and "sockgid" if "sockuser" is set.
+ * Returns the socket or -1 on failure (having printed why).
+ */
+static int
+listen_unix(const char *sockpath, const char *sockuser,
+	uid_t sockuid, gid_t sockgid, size_t lsz)
+{
+	struct sockaddr_un	 un;
+	mode_t			 old_umask;
+	size_t			 sz;
+	int			 fd;
+
+	/* Do the usual dance to set up UNIX sockets. */
+	memset(&un, 0, sizeof(un));
+	un.sun_family = AF_UNIX;
+	sz = strlcpy(un.sun_path, sockpath, sizeof(un.sun_path));
+	if (sz >= sizeof(un.sun_path)) {
+		fprintf(stderr, "socket path to long\n");
+		return(-1);
+	}
+#if !defined(__linux__) && !defined(__sun)
+	un.sun_len = sz;
+#endif
+
+	/*
+	 * Prepare the socket then unlink any dead existing ones.
+	 * This is because we want to control the socket.
+	 */
+	if (-1 == (fd = socket(AF_UNIX, SOCK_STREAM, 0))) {
+		perror("socket");
+		return(-1);
+	} else if (-1 == unlink(sockpath)) {
+		if (ENOENT != errno) {
+			perror(sockpath);
+			close(fd);
+			return(-1);
+		}
+	}
+
+	old_umask = umask(S_IXUSR|S_IXGRP|S_IWOTH|S_IROTH|S_IXOTH);
+
+	/* 
+	 * Now actually bind to the FastCGI socket set up our
+	 * listeners, and make sure that we're not blocking.
+	 * If necessary, change the file's ownership.
+	 * We buffer up to the number of available workers.
+	 */
+	if (-1 == bind(fd, (struct sockaddr *)&un, sizeof(un))) {
+		perror("bind");
+		close(fd);
+		return(-1);
+	}
+	umask(old_umask);
+
+	if (NULL != sockuser) 
+		if (chown(sockpath, sockuid, sockgid) == -1) {
+			perror(sockpath);
+			close(fd);
+			return(-1);
+		}
+
+	if (-1 == listen(fd, lsz)) {
+		perror(sockpath);
+		close(fd);
+		return(-1);
+	}
+
+	return(fd);
+}
+
 int
 main(int argc, char *argv[])
 {
-	int			  c, fd, varp, usemax, useq, nod, logop;
+	int			  c, varp, usemax, useq, nod, logop,
+				  pin;
+	int			 *fds;
 	struct passwd		 *pw;
-	size_t			  i, wsz, sz, lsz, maxwsz;
+	size_t			  i, wsz, lsz, maxwsz, fdsz;
 	time_t			  waittime;
 	const char		 *pname, *sockpath, *chpath,
-	      			 *sockuser, *procuser, *errstr;
-	struct sockaddr_un	  un;
-	mode_t			  old_umask;
+	      			 *sockuser, *procuser, *errstr,
+				 *addr;
 	uid_t		 	  sockuid, procuid;
 	gid_t			  sockgid, procgid;
 	char			**nargv;
@@ -899,6 +1200,9 @@ main(int argc, char *argv[])
 	wsz = 5;
 	usemax = useq = 0;
 	sockpath = "/var/www/run/httpd.sock";
+	addr = NULL;
+	fdsz = 1;
+	pin = 0;
 	chpath = "/var/www";
 	sockuser = procuser = NULL;
 	varp = 0;
@@ -906,8 +1210,26 @@ main(int argc, char *argv[])
 	maxwsz = lsz = 0;
 	waittime = 60 * 5;
 
-	while (-1 != (c = getopt(argc, argv, "l:p:n:N:s:u:U:rvdw:")))
+	while (-1 != (c = getopt(argc, argv, "a:cg:l:p:n:N:s:u:U:rvdw:")))
 		switch (c) {
+		case ('a'):
+			addr = optarg;
+			break;
+		case ('c'):
+#ifndef __linux__
+			fprintf(stderr, "-c is not "
+				"supported on this system\n");
+			return(EXIT_FAILURE);
+#endif
+			pin = 1;
+			break;
+		case ('g'):
+			fdsz = strtonum(optarg, 1, INT_MAX, &errstr);
+			if (NULL == errstr)
+				break;
+			fprintf(stderr, "-g must be "
+				"between 1 and %d\n", INT_MAX);
+			return(EXIT_FAILURE);	
 		case ('l'):
 			useq = 1;
 			lsz = strtonum(optarg, 1, INT_MAX, &errstr);
@@ -977,11 +1299,43 @@ main(int argc, char *argv[])
 	} else
 		maxwsz = wsz * 2;
 
+	/*
+	 * A web server on another host will retry a dropped connection
+	 * only after a timeout, so give TCP a generous backlog.
+	 */
+
 	if (0 == useq)
 		lsz = (varp ? maxwsz : wsz) * 2;
+	if (0 == useq && NULL != addr && lsz < SOMAXCONN)
+		lsz = SOMAXCONN;
 
 	assert(lsz);
 
+	/*
+	 * Listener groups are only for fixed pools with a TCP address:
+	 * UNIX sockets can't share a path, and the variable pool does
+	 * its own accepting.
+	 */
+
+	if (fdsz > 1 || pin) {
+		if (NULL == addr || varp) {
+			fprintf(stderr, "-c and -g need -a "
+				"and may not be used with -r\n");
+			return(EXIT_FAILURE);
+		} else if (fdsz > wsz) {
+			fprintf(stderr, "-g must not be "
+				"greater than -n\n");
+			return(EXIT_FAILURE);
+		}
+#ifndef SO_REUSEPORT
+		if (fdsz > 1) {
+			fprintf(stderr, "-g is not "
+				"supported on this system\n");
+			return(EXIT_FAILURE);
+		}
+#endif
+	}
+
 	pw = NULL;
 	if (NULL != procuser && NULL == (pw = getpwnam(procuser))) { 
 		fprintf(stderr, "%s: no such user\n", procuser);
@@ -1000,59 +1354,24 @@ main(int argc, char *argv[])
 		sockgid = pw->pw_gid;
 	}
 
-	/* Do the usual dance to set up UNIX sockets. */
-	memset(&un, 0, sizeof(un));
-	un.sun_family = AF_UNIX;
-	sz = strlcpy(un.sun_path, sockpath, sizeof(un.sun_path));
-	if (sz >= sizeof(un.sun_path)) {
-		fprintf(stderr, "socket path to long\n");
+	if (NULL == (fds = calloc(fdsz, sizeof(int)))) {
+		perror(NULL);
 		return(EXIT_FAILURE);
 	}
-#if !defined(__linux__) && !defined(__sun)
-	un.sun_len = sz;
-#endif
 
-	/*
-	 * Prepare the socket then unlink any dead existing ones.
-	 * This is because we want to control the socket.
-	 */
-	if (-1 == (fd = socket(AF_UNIX, SOCK_STREAM, 0))) {
-		perror("socket");
-		return(EXIT_FAILURE);
-	} else if (-1 == unlink(sockpath)) {
-		if (ENOENT != errno) {
-			perror(sockpath);
-			close(fd);
+	if (NULL != addr) {
+		if ( ! listen_group(addr, fds, fdsz, lsz)) {
+			free(fds);
 			return(EXIT_FAILURE);
 		}
-	}
-
-	old_umask = umask(S_IXUSR|S_IXGRP|S_IWOTH|S_IROTH|S_IXOTH);
-
-	/* 
-	 * Now actually bind to the FastCGI socket set up our
-	 * listeners, and make sure that we're not blocking.
-	 * If necessary, change the file's ownership.
-	 * We buffer up to the number of available workers.
-	 */
-	if (-1 == bind(fd, (struct sockaddr *)&un, sizeof(un))) {
-		perror("bind");
-		close(fd);
-		return(EXIT_FAILURE);
-	}
-	umask(old_umask);
-
-	if (NULL != sockuser) 
-		if (chown(sockpath, sockuid, sockgid) == -1) {
-			perror(sockpath);
-			close(fd);
+		sockpath = NULL;
+	} else {
+		fds[0] = listen_unix(sockpath, 
+			sockuser, sockuid, sockgid, lsz);
+		if (-1 == fds[0]) {
+			free(fds);
 			return(EXIT_FAILURE);
 		}
-
-	if (-1 == listen(fd, lsz)) {
-		perror(sockpath);
-		close(fd);
-		return(EXIT_FAILURE);
 	}
 
 	/* 
@@ -1060,28 +1379,29 @@ main(int argc, char *argv[])
 	 */
 	if (-1 == chroot(chpath)) {
 		perror("chroot");
-		close(fd);
+		closeall(fds, fdsz);
 		return(EXIT_FAILURE);
 	} else if (-1 == chdir("/")) {
 		perror("chdir");
-		close(fd);
-		unlink(sockpath);
+		closeall(fds, fdsz);
+		if (NULL != sockpath)
+			unlink(sockpath);
 		return(EXIT_FAILURE);
 	}
 
 	if (NULL != procuser)  {
 		if (0 != setgid(procgid)) {
 			perror(procuser);
-			close(fd);
+			closeall(fds, fdsz);
 			return(EXIT_FAILURE);
 		} else if (0 != setuid(procuid)) {
 			perror(procuser);
-			close(fd);
+			closeall(fds, fdsz);
 			return(EXIT_FAILURE);
 		} else if (-1 != setuid(0)) {
 			fprintf(stderr, "%s: managed to regain "
 				"root privileges: aborting\n", pname);
-			close(fd);
+			closeall(fds, fdsz);
 			return(EXIT_FAILURE);
 		}
 	}
@@ -1089,7 +1409,7 @@ main(int argc, char *argv[])
 	nargv = calloc(argc + 1, sizeof(char *));
 	if (NULL == nargv) {
 		perror(NULL);
-		close(fd);
+		closeall(fds, fdsz);
 		return(EXIT_FAILURE);
 	}
 
@@ -1098,8 +1418,9 @@ main(int argc, char *argv[])
 
 	if ( ! nod && -1 == daemon(1, 0)) {
 		perror("daemon");
-		close(fd);
-		unlink(sockpath);
+		closeall(fds, fdsz);
+		if (NULL != sockpath)
+			unlink(sockpath);
 		free(nargv);
 		return(EXIT_FAILURE);
 	} 
@@ -1112,19 +1433,25 @@ main(int argc, char *argv[])
 	openlog(pname, logop, LOG_DAEMON);
 
 	c = varp ?
-		varpool(wsz, maxwsz, waittime, fd, sockpath, nargv) :
-		fixedpool(wsz, fd, sockpath, nargv);
+		varpool(wsz, maxwsz, waittime, fds[0], sockpath, nargv) :
+		fixedpool(wsz, fds, fdsz, pin, sockpath, nargv);
 
+	free(fds);
 	free(nargv);
 	return(c ? EXIT_SUCCESS : EXIT_FAILURE);
 usage:
 	fprintf(stderr, "usage: %s "
+		"[-cdrv] "
+		"[-a address] "
+		"[-g groups] "
 		"[-l backlog] "
 		"[-n workers] "
+		"[-N maxworkers] "
 		"[-p chroot] "
 		"[-s sockpath] "
 		"[-u sockuser] "
 		"[-U procuser] "
+		"[-w waittime] "
 		"-- prog [arg1...]\n", pname);
 	return(EXIT_FAILURE);
 }
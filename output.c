@@ -16,18 +16,32 @@
  */
 #include "config.h"
 
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
 #include <arpa/inet.h>
 
 #include <assert.h>
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <zlib.h>
+#if HAVE_BROTLI
+# include <brotli/encode.h>
+#endif
+#if HAVE_ZSTD
+# include <zstd.h>
+#endif
 
 #include "kcgi.h"
 #include "extern.h"
@@ -44,6 +58,8 @@ enum	kstate {
 	KSTATE_BODY
 };
 
+struct	kcodec;
+
 /*
  * Interior data.
  * This is used for managing HTTP compression.
@@ -57,10 +73,31 @@ struct	kdata {
 	uint64_t	 bytes; /* total bytes written */
 	uint16_t	 requestId; /* current requestId or 0 */
 	enum kstate	 state; /* see enum kstate */
-	gzFile		 gz; /* if not NULL, then compressor */
+	const struct kcodec *codec; /* if not NULL, then compressor */
+	void		*enc; /* compressor state */
+	const struct kcodec *pending; /* deferred compressor */
+	size_t		 headpos; /* if deferred, end of headers */
+	int		 complevel; /* compression level or zero */
+	size_t		 compminsz; /* minimum size to compress */
+	const enum kmime *compskip; /* content types not compressed */
+	size_t		 compskipsz; /* length of "compskip" */
+	int		 compskipped; /* content type is not compressed */
+	int		 etag; /* generate entity-tags */
+	int		 hold; /* holding the body */
+	int		 holdtag; /* when held, add an entity-tag */
+	int		 holdlen; /* when held, add the length */
+	size_t		 holdmax; /* most body to hold (or 0) */
+	const char	*inm; /* If-None-Match if holding (or NULL) */
+	int		 headsent; /* headers (partly) written out */
+	int		 capture; /* kdata_wire() to "capbuf" */
+	struct kcgi_buf	 capbuf; /* captured output */
 	char		*outbuf; /* buffered output */
 	size_t		 outbufpos; /* position in output buffer */
 	size_t		 outbufsz; /* size of output buffer */
+	size_t		 outbufmax; /* adaptive buffer maximum (or 0) */
+	int		 outbufgrew; /* adaptive buffer overflowed */
+	size_t		 asyncmax; /* most output to hand off (or 0) */
+	struct kcgi_buf	 async; /* output for the control process */
 	int		 disabled; /* no more writers */
 };
 
@@ -74,11 +111,63 @@ struct	kcgi_writer {
 	int		 type; /* currently unused */
 };
 
-static char *
-fcgi_header(uint8_t type, uint16_t requestId, 
+/*
+ * Maximum number of records gathered into one write.
+ */
+#define	FCGI_WRITE_RECS	16
+
+/*
+ * Length of records with data sent from a file.
+ * This is the largest multiple of eight, so only the last is padded.
+ */
+#define	FCGI_SENDFILE_REC (UINT16_MAX & ~7)
+
+/*
+ * The output buffer, if its size isn't given, adapts to the response.
+ * It starts at the minimum (or one FastCGI record) and doubles whenever
+ * it fills, until reaching the send buffer of the socket (or the
+ * maximum, if not a socket): larger writes would only block.
+ */
+#define	KDATA_BUFMIN	(8 * 1024)
+#define	KDATA_BUFMAX	(1024 * 1024)
+
+/*
+ * Size of the adaptive buffer of the last response, if it was filled,
+ * or half of it otherwise.
+ * Since FastCGI workers (and persistent CGI) serve many requests, this
+ * lets the buffer settle on the size of their responses.
+ */
+static size_t	 kdata_bufhint;
+
+/*
+ * Size of the buffer into which compressed output is deflated before
+ * being written.
+ */
+#define	KDATA_ZBUFSZ	(16 * 1024)
+
+/*
+ * Brotli quality: the library default (11) is meant for static content
+ * and is far too slow for dynamic responses.
+ */
+#define	KBROTLI_QUALITY	4
+
+/*
+ * A content coding (RFC 9110 section 8.4.1) applied to the body.
+ * The "write" function compresses the given buffer, writing output to
+ * the wire as it fills; if its last argument is set, it also finishes
+ * the compressed stream (and, for FastCGI, the request).
+ */
+struct	kcodec {
+	const char	*name; /* content-coding token */
+	int		(*init)(struct kdata *);
+	enum kcgi_err	(*write)(struct kdata *, const char *, size_t, int);
+	void		(*free)(struct kdata *);
+};
+
+static void
+fcgi_header(uint8_t *header, uint8_t type, uint16_t requestId, 
 	uint16_t contentLength, uint8_t paddingLength)
 {
-	static uint8_t	header[8];
 
 	/* Masking probably not necessary: truncation. */
 
@@ -90,20 +179,71 @@ fcgi_header(uint8_t type, uint16_t requestId,
 	header[5] = contentLength & 0xff;
 	header[6] = paddingLength;
 	header[7] = 0;
-	return((char *)header);
+}
+
+/*
+ * Write "iov" to the FastCGI connection.
+ * With asynchronous output, whatever can't be written without blocking
+ * is held (along with all that follows) in "async", which is handed to
+ * the control process at the end of the response to drain while we go
+ * on to the next request.
+ * If the held output would exceed "asyncmax", it's written out, as is
+ * all that follows, blocking as usual.
+ * Returns KCGI_OK, KCGI_SYSTEM, KCGI_ENOMEM, or KCGI_HUP.
+ */
+static enum kcgi_err
+fcgi_writev(struct kdata *p, struct iovec *iov, int iovcnt)
+{
+	size_t		 sz = 0;
+	int		 i;
+	enum kcgi_err	 er;
+
+	if (p->asyncmax == 0)
+		return fullwritevnoerr(p->fcgi, iov, iovcnt);
+
+	if (p->async.sz == 0 &&
+	    (er = trywritevnoerr(p->fcgi, iov, iovcnt)) != KCGI_OK)
+		return er;
+	for (i = 0; i < iovcnt; i++)
+		sz += iov[i].iov_len;
+	if (sz == 0)
+		return KCGI_OK;
+
+	if (p->async.sz + sz > p->asyncmax) {
+		er = fullwritenoerr(p->fcgi, p->async.buf, p->async.sz);
+		free(p->async.buf);
+		memset(&p->async, 0, sizeof(struct kcgi_buf));
+		p->asyncmax = 0;
+		if (er != KCGI_OK)
+			return er;
+		return fullwritevnoerr(p->fcgi, iov, iovcnt);
+	}
+
+	for (i = 0; i < iovcnt; i++)
+		if ((er = kcgi_buf_write(iov[i].iov_base, 
+		    iov[i].iov_len, &p->async)) != KCGI_OK)
+			return er;
+	return KCGI_OK;
 }
 
 /*
  * Write a `stdout' FastCGI packet.
  * This involves writing the header, then the data itself, then padding.
- * Returns KCGI_OK, KCGI_SYSTEM, or KCGI_HUP.
+ * The records are gathered into as few writes as possible.
+ * If "end" is set, follow the data with the empty record ending the
+ * stream and the end-of-request record.
+ * Returns KCGI_OK, KCGI_SYSTEM, KCGI_ENOMEM, or KCGI_HUP.
  */
 static enum kcgi_err
-fcgi_write(uint8_t type, const struct kdata *p, const char *buf, size_t sz)
+fcgi_write(uint8_t type, struct kdata *p, 
+	const char *buf, size_t sz, int end)
 {
 	const char	*pad = "\0\0\0\0\0\0\0\0";
-	char		*head;
-	size_t	 	 rsz, padlen;
+	uint8_t		 head[FCGI_WRITE_RECS + 2][8], body[8];
+	struct iovec	 iov[FCGI_WRITE_RECS * 3 + 3];
+	size_t	 	 rsz, padlen, recs;
+	uint32_t 	 appStatus;
+	int		 iovcnt;
 	enum kcgi_err	 er = KCGI_OK;
 
 	/* 
@@ -114,26 +254,565 @@ fcgi_write(uint8_t type, const struct kdata *p, const char *buf, size_t sz)
 	 */
 
 	do {
-		rsz = sz > UINT16_MAX ? UINT16_MAX : sz;
-		padlen = -rsz % 8;
-		head = fcgi_header(type, p->requestId, rsz, padlen);
-		if ((er = fullwritenoerr(p->fcgi, head, 8)) != KCGI_OK)
+		iovcnt = 0;
+		for (recs = 0; sz > 0 && recs < FCGI_WRITE_RECS; recs++) {
+			rsz = sz > UINT16_MAX ? UINT16_MAX : sz;
+			padlen = -rsz % 8;
+			fcgi_header(head[recs], 
+				type, p->requestId, rsz, padlen);
+			iov[iovcnt].iov_base = head[recs];
+			iov[iovcnt++].iov_len = 8;
+			iov[iovcnt].iov_base = (void *)buf;
+			iov[iovcnt++].iov_len = rsz;
+			iov[iovcnt].iov_base = (void *)pad;
+			iov[iovcnt++].iov_len = padlen;
+			sz -= rsz;
+			buf += rsz;
+		}
+
+		/* 
+		 * The standard implies that we need a blank record to
+		 * end the stream before ending the request.
+		 */
+
+		if (sz == 0 && end) {
+			fcgi_header(head[recs], type, p->requestId, 0, 0);
+			iov[iovcnt].iov_base = head[recs++];
+			iov[iovcnt++].iov_len = 8;
+			appStatus = htonl(EXIT_SUCCESS);
+			memset(body, 0, sizeof(body));
+			memcpy(body, &appStatus, sizeof(uint32_t));
+			fcgi_header(head[recs], 3, p->requestId, 8, 0);
+			iov[iovcnt].iov_base = head[recs];
+			iov[iovcnt++].iov_len = 8;
+			iov[iovcnt].iov_base = body;
+			iov[iovcnt++].iov_len = sizeof(body);
+		}
+
+		er = fcgi_writev(p, iov, iovcnt);
+	} while (er == KCGI_OK && sz > 0);
+
+	return er;
+}
+
+/*
+ * Write a buffer "buf" of size "sz" to the wire: stdout in the case of
+ * CGI, the socket for FastCGI.
+ * If "end" is set and we're FastCGI, also end the stream and request.
+ * While capturing, append to the capture buffer instead.
+ * Returns KCGI_OK, KCGI_SYSTEM, KCGI_ENOMEM, or KCGI_HUP.
+ */
+static enum kcgi_err
+kdata_wire(struct kdata *p, const char *buf, size_t sz, int end)
+{
+
+	if (p->capture)
+		return kcgi_buf_write(buf, sz, &p->capbuf);
+
+	return (p->fcgi == -1) ?
+		fullwritenoerr(STDOUT_FILENO, buf, sz) :
+		fcgi_write(6, p, buf, sz, end);
+}
+
+static int
+kgzip_init(struct kdata *p)
+{
+	z_stream	*z;
+
+	if ((z = kxcalloc(1, sizeof(z_stream))) == NULL)
+		return 0;
+
+	/* Window bits of 15 + 16 produce a gzip header and trailer. */
+
+	if (deflateInit2(z, p->complevel == 0 ? Z_DEFAULT_COMPRESSION :
+	    p->complevel > Z_BEST_COMPRESSION ? Z_BEST_COMPRESSION :
+	    p->complevel, Z_DEFLATED, 15 + 16, 8, 
+	    Z_DEFAULT_STRATEGY) != Z_OK) {
+		kutil_warnx(NULL, NULL, "deflateInit2");
+		free(z);
+		return 0;
+	}
+	p->enc = z;
+	return 1;
+}
+
+static enum kcgi_err
+kgzip_write(struct kdata *p, const char *buf, size_t sz, int end)
+{
+	z_stream	*z = p->enc;
+	unsigned char	 out[KDATA_ZBUFSZ];
+	size_t		 have;
+	int		 rc, done;
+	enum kcgi_err	 er;
+
+	/* Input is in chunks of at most UINT_MAX (uInt) bytes. */
+
+	do {
+		z->next_in = (Bytef *)buf;
+		z->avail_in = sz > UINT_MAX ? UINT_MAX : sz;
+		buf += z->avail_in;
+		sz -= z->avail_in;
+		do {
+			z->next_out = out;
+			z->avail_out = sizeof(out);
+			rc = deflate(z, 
+				end && sz == 0 ? Z_FINISH : Z_NO_FLUSH);
+			if (rc == Z_STREAM_ERROR) {
+				kutil_warnx(NULL, NULL, "deflate");
+				return KCGI_SYSTEM;
+			}
+			have = sizeof(out) - z->avail_out;
+			done = end && sz == 0 && rc == Z_STREAM_END;
+			if ((have > 0 || done) && (er = kdata_wire
+			    (p, (char *)out, have, done)) != KCGI_OK)
+				return er;
+		} while (!done && z->avail_out == 0);
+	} while (sz > 0);
+
+	return KCGI_OK;
+}
+
+static void
+kgzip_free(struct kdata *p)
+{
+
+	deflateEnd(p->enc);
+	free(p->enc);
+}
+
+#if HAVE_BROTLI
+static int
+kbrotli_init(struct kdata *p)
+{
+	BrotliEncoderState	*s;
+
+	if ((s = BrotliEncoderCreateInstance(NULL, NULL, NULL)) == NULL) {
+		kutil_warnx(NULL, NULL, "BrotliEncoderCreateInstance");
+		return 0;
+	}
+	BrotliEncoderSetParameter(s, BROTLI_PARAM_QUALITY, 
+		p->complevel == 0 ? KBROTLI_QUALITY :
+		p->complevel > BROTLI_MAX_QUALITY ? BROTLI_MAX_QUALITY :
+		p->complevel);
+	p->enc = s;
+	return 1;
+}
+
+static enum kcgi_err
+kbrotli_write(struct kdata *p, const char *buf, size_t sz, int end)
+{
+	BrotliEncoderState	*s = p->enc;
+	uint8_t			 out[KDATA_ZBUFSZ], *next_out;
+	const uint8_t		*next_in = (const uint8_t *)buf;
+	size_t			 avail_out;
+	int			 done;
+	enum kcgi_err		 er;
+
+	for (;;) {
+		next_out = out;
+		avail_out = sizeof(out);
+		if (!BrotliEncoderCompressStream(s, end ? 
+		    BROTLI_OPERATION_FINISH : BROTLI_OPERATION_PROCESS,
+		    &sz, &next_in, &avail_out, &next_out, NULL)) {
+			kutil_warnx(NULL, NULL, 
+				"BrotliEncoderCompressStream");
+			return KCGI_SYSTEM;
+		}
+		done = end && BrotliEncoderIsFinished(s);
+		if ((next_out > out || done) && (er = kdata_wire(p, 
+		    (char *)out, next_out - out, done)) != KCGI_OK)
+			return er;
+		if (done || (!end && sz == 0 && 
+		    !BrotliEncoderHasMoreOutput(s)))
 			break;
-		if ((er = fullwritenoerr(p->fcgi, buf, rsz)) != KCGI_OK)
+	}
+
+	return KCGI_OK;
+}
+
+static void
+kbrotli_free(struct kdata *p)
+{
+
+	BrotliEncoderDestroyInstance(p->enc);
+}
+#endif
+
+#if HAVE_ZSTD
+static int
+kzstd_init(struct kdata *p)
+{
+
+	if ((p->enc = ZSTD_createCCtx()) == NULL) {
+		kutil_warnx(NULL, NULL, "ZSTD_createCCtx");
+		return 0;
+	}
+	if (p->complevel != 0)
+		ZSTD_CCtx_setParameter(p->enc, ZSTD_c_compressionLevel,
+			p->complevel > ZSTD_maxCLevel() ? 
+			ZSTD_maxCLevel() : p->complevel);
+	return 1;
+}
+
+static enum kcgi_err
+kzstd_write(struct kdata *p, const char *buf, size_t sz, int end)
+{
+	char		 obuf[KDATA_ZBUFSZ];
+	ZSTD_inBuffer	 in;
+	ZSTD_outBuffer	 out;
+	size_t		 rem;
+	int		 done;
+	enum kcgi_err	 er;
+
+	in.src = buf;
+	in.size = sz;
+	in.pos = 0;
+
+	for (;;) {
+		out.dst = obuf;
+		out.size = sizeof(obuf);
+		out.pos = 0;
+		rem = ZSTD_compressStream2(p->enc, &out, &in, 
+			end ? ZSTD_e_end : ZSTD_e_continue);
+		if (ZSTD_isError(rem)) {
+			kutil_warnx(NULL, NULL, "ZSTD_compressStream2: "
+				"%s", ZSTD_getErrorName(rem));
+			return KCGI_SYSTEM;
+		}
+		done = end && rem == 0;
+		if ((out.pos > 0 || done) && (er = kdata_wire
+		    (p, obuf, out.pos, done)) != KCGI_OK)
+			return er;
+		if (done || (!end && in.pos == in.size &&
+		    out.pos < out.size))
 			break;
-		if ((er = fullwritenoerr(p->fcgi, pad, padlen)) != KCGI_OK)
+	}
+
+	return KCGI_OK;
+}
+
+static void
+kzstd_free(struct kdata *p)
+{
+
+	ZSTD_freeCCtx(p->enc);
+}
+#endif
+
+static const struct kcodec kcodec_gzip = {
+	"gzip", kgzip_init, kgzip_write, kgzip_free
+};
+
+#if HAVE_BROTLI
+static const struct kcodec kcodec_brotli = {
+	"br", kbrotli_init, kbrotli_write, kbrotli_free
+};
+#endif
+
+#if HAVE_ZSTD
+static const struct kcodec kcodec_zstd = {
+	"zstd", kzstd_init, kzstd_write, kzstd_free
+};
+#endif
+
+/*
+ * Available content codings in order of preference when the client
+ * doesn't otherwise distinguish between them.
+ */
+static const struct kcodec *const kcodecs[] = {
+#if HAVE_ZSTD
+	&kcodec_zstd,
+#endif
+#if HAVE_BROTLI
+	&kcodec_brotli,
+#endif
+	&kcodec_gzip,
+};
+
+#define	KCODEC__MAX (sizeof(kcodecs) / sizeof(kcodecs[0]))
+
+/*
+ * Parse a quality value (RFC 9110 section 12.4.2) at "cp", a string of
+ * the form "0", "1", or either followed by a dot and up to three digits.
+ * Returns the value in thousandths, or zero if malformed.
+ */
+static int
+kcodec_qvalue(const char *cp)
+{
+	int	 v, m;
+
+	if (*cp != '0' && *cp != '1')
+		return 0;
+	v = (*cp++ - '0') * 1000;
+	if (*cp == '.')
+		for (cp++, m = 100; m > 0; m /= 10, cp++) {
+			if (!isdigit((unsigned char)*cp))
+				break;
+			v += (*cp - '0') * m;
+		}
+	return v > 1000 ? 1000 : v;
+}
+
+/*
+ * Look up the quality value of the content coding "name" in the
+ * Accept-Encoding header "cp" (RFC 9110 section 12.5.3).
+ * A wildcard applies if the coding is not otherwise listed.
+ * Returns the value in thousandths, zero meaning not acceptable.
+ */
+static int
+kaccept_q(const char *cp, const char *name)
+{
+	int		 wild = 0, v;
+	size_t		 sz;
+	const char	*tok;
+
+	while (*cp != '\0') {
+		while (*cp == ',' || isspace((unsigned char)*cp))
+			cp++;
+		if (*cp == '\0')
+			break;
+
+		/* Coding token, then parameters, of which only "q". */
+
+		tok = cp;
+		while (*cp != '\0' && *cp != ',' && *cp != ';' &&
+		    !isspace((unsigned char)*cp))
+			cp++;
+		sz = cp - tok;
+		v = 1000;
+		while (*cp != '\0' && *cp != ',') {
+			while (*cp == ';' || isspace((unsigned char)*cp))
+				cp++;
+			if ((cp[0] == 'q' || cp[0] == 'Q') && cp[1] == '=')
+				v = kcodec_qvalue(cp + 2);
+			while (*cp != '\0' && *cp != ',' && *cp != ';')
+				cp++;
+		}
+
+		if (sz == 1 && *tok == '*') {
+			wild = v;
+			continue;
+		}
+		if (sz == 6 && strncasecmp(tok, "x-gzip", 6) == 0) {
+			tok += 2;
+			sz -= 2;
+		}
+		if (strlen(name) == sz && strncasecmp(tok, name, sz) == 0)
+			return v;
+	}
+
+	return wild;
+}
+
+/*
+ * Choose a content coding given the Accept-Encoding header "cp": the
+ * available coding with the highest non-zero quality value, preferring
+ * the order of "kcodecs" on ties.
+ * Returns NULL if no coding is acceptable.
+ */
+static const struct kcodec *
+kcodec_negotiate(const char *cp)
+{
+	int		 v, best = 0;
+	size_t		 i;
+	const struct kcodec *codec = NULL;
+
+	for (i = 0; i < KCODEC__MAX; i++)
+		if ((v = kaccept_q(cp, kcodecs[i]->name)) > best) {
+			best = v;
+			codec = kcodecs[i];
+		}
+
+	return codec;
+}
+
+/*
+ * Whether the entity-tag "etag" matches a member of the list "cp" of an
+ * If-Match or If-None-Match header.
+ * If "etag" is NULL, only the wildcard matches.
+ * The "strong" comparison (RFC 9110 section 8.8.3.2) fails if either
+ * tag is weak; otherwise, only the opaque tags are compared.
+ */
+static int
+ketag_match(const char *cp, const char *etag, int strong)
+{
+	const char	*tok;
+	size_t		 sz, esz = 0;
+	int		 weak, eweak = 0;
+
+	if (etag != NULL) {
+		if ((eweak = strncmp(etag, "W/", 2) == 0))
+			etag += 2;
+		esz = strlen(etag);
+	}
+
+	while (*cp != '\0') {
+		while (*cp == ',' || isspace((unsigned char)*cp))
+			cp++;
+		if (*cp == '\0')
 			break;
+		if (*cp == '*')
+			return 1;
+		if ((weak = strncmp(cp, "W/", 2) == 0))
+			cp += 2;
+		tok = cp;
+		if (*cp == '"') {
+			for (cp++; *cp != '\0' && *cp != '"'; cp++)
+				continue;
+			if (*cp == '"')
+				cp++;
+		} else
+			while (*cp != '\0' && *cp != ',' &&
+			    !isspace((unsigned char)*cp))
+				cp++;
+		sz = cp - tok;
+		if (etag == NULL || (strong && (weak || eweak)))
+			continue;
+		if (sz == esz && strncmp(tok, etag, sz) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Primes of the XXH64 hash (https://github.com/Cyan4973/xxHash).
+ */
+#define	XXH_P1	UINT64_C(0x9E3779B185EBCA87)
+#define	XXH_P2	UINT64_C(0xC2B2AE3D27D4EB4F)
+#define	XXH_P3	UINT64_C(0x165667B19E3779F9)
+#define	XXH_P4	UINT64_C(0x85EBCA77C2B2AE63)
+#define	XXH_P5	UINT64_C(0x27D4EB2F165667C5)
+#define	XXH_ROTL(_x, _r) (((_x) << (_r)) | ((_x) >> (64 - (_r))))
+
+/*
+ * Little-endian loads, written so that compilers emit a single load.
+ */
+static uint64_t
+kxxh_read64(const unsigned char *cp)
+{
+
+	return (uint64_t)cp[0] | (uint64_t)cp[1] << 8 |
+	    (uint64_t)cp[2] << 16 | (uint64_t)cp[3] << 24 |
+	    (uint64_t)cp[4] << 32 | (uint64_t)cp[5] << 40 |
+	    (uint64_t)cp[6] << 48 | (uint64_t)cp[7] << 56;
+}
+
+static uint64_t
+kxxh_read32(const unsigned char *cp)
+{
+
+	return (uint64_t)cp[0] | (uint64_t)cp[1] << 8 |
+	    (uint64_t)cp[2] << 16 | (uint64_t)cp[3] << 24;
+}
+
+static uint64_t
+kxxh_round(uint64_t acc, uint64_t v)
+{
+
+	acc += v * XXH_P2;
+	acc = XXH_ROTL(acc, 31);
+	return acc * XXH_P1;
+}
+
+static uint64_t
+kxxh_merge(uint64_t acc, uint64_t v)
+{
+
+	acc ^= kxxh_round(0, v);
+	return acc * XXH_P1 + XXH_P4;
+}
+
+/*
+ * XXH64 (seed zero) of "sz" bytes at "buf", used for generated
+ * entity-tags: fast, and well-distributed enough that a changed body
+ * changes its tag.
+ */
+static uint64_t
+kxxh64(const void *buf, size_t sz)
+{
+	const unsigned char *cp = buf, *end = cp + sz;
+	uint64_t	 h, v[4];
+	size_t		 i;
+
+	if (sz >= 32) {
+		v[0] = XXH_P1 + XXH_P2;
+		v[1] = XXH_P2;
+		v[2] = 0;
+		v[3] = -XXH_P1;
+		for ( ; end - cp >= 32; cp += 32) {
+			v[0] = kxxh_round(v[0], kxxh_read64(cp));
+			v[1] = kxxh_round(v[1], kxxh_read64(cp + 8));
+			v[2] = kxxh_round(v[2], kxxh_read64(cp + 16));
+			v[3] = kxxh_round(v[3], kxxh_read64(cp + 24));
+		}
+		h = XXH_ROTL(v[0], 1) + XXH_ROTL(v[1], 7) +
+		    XXH_ROTL(v[2], 12) + XXH_ROTL(v[3], 18);
+		for (i = 0; i < 4; i++)
+			h = kxxh_merge(h, v[i]);
+	} else
+		h = XXH_P5;
+
+	h += sz;
+
+	for ( ; end - cp >= 8; cp += 8) {
+		h ^= kxxh_round(0, kxxh_read64(cp));
+		h = XXH_ROTL(h, 27) * XXH_P1 + XXH_P4;
+	}
+	if (end - cp >= 4) {
+		h ^= kxxh_read32(cp) * XXH_P1;
+		h = XXH_ROTL(h, 23) * XXH_P2 + XXH_P3;
+		cp += 4;
+	}
+	for ( ; cp < end; cp++) {
+		h ^= *cp * XXH_P5;
+		h = XXH_ROTL(h, 11) * XXH_P1;
+	}
+
+	h ^= h >> 33;
+	h *= XXH_P2;
+	h ^= h >> 29;
+	h *= XXH_P3;
+	h ^= h >> 32;
+	return h;
+}
+
+/*
+ * Write `stdout' FastCGI records with "sz" bytes of data from the file
+ * "fd" at offset "off".
+ * Each record's header and padding are written around the data, which
+ * is sent with fullsendfile().
+ * Returns KCGI_OK, KCGI_SYSTEM, or KCGI_HUP.
+ */
+static enum kcgi_err
+fcgi_sendfile(const struct kdata *p, int fd, off_t off, size_t sz)
+{
+	const char	*pad = "\0\0\0\0\0\0\0\0";
+	uint8_t		 head[8];
+	size_t		 rsz, padlen;
+	enum kcgi_err	 er;
+
+	while (sz > 0) {
+		rsz = sz > FCGI_SENDFILE_REC ? FCGI_SENDFILE_REC : sz;
+		padlen = -rsz % 8;
+		fcgi_header(head, 6, p->requestId, rsz, padlen);
+		if ((er = fullwritenoerr(p->fcgi, head, 8)) != KCGI_OK)
+			return er;
+		if ((er = fullsendfile(p->fcgi, fd, &off, rsz)) != KCGI_OK)
+			return er;
+		if (padlen > 0 && (er = fullwritenoerr
+		    (p->fcgi, pad, padlen)) != KCGI_OK)
+			return er;
 		sz -= rsz;
-		buf += rsz;
-	} while (sz > 0);
+	}
 
-	return er;
+	return KCGI_OK;
 }
 
 /*
  * Flushes a buffer "buf" of size "sz" to the wire (stdout in the case
- * of CGI, the socket for FastCGI, and a gz stream for compression IFF
- * in body parts).
+ * of CGI, the socket for FastCGI), through the compressor IFF in body
+ * parts.
  * If sz is zero or buf is NULL, this is a no-op.
  * Return zero on failure (system error writing to output) or non-zero
  * on success.
@@ -145,24 +824,13 @@ kdata_flush(struct kdata *p, const char *buf, size_t sz)
 	if (sz == 0 || buf == NULL)
 		return KCGI_OK;
 
-	/*
-	 * FIXME: make this work properly on all systems.
-	 * This is known (?) to break on FreeBSD: we may need to break
-	 * the uncompressed buffer into chunks that will not cause
-	 * EAGAIN to be raised.
-	 */
+	if (p->state == KSTATE_HEAD)
+		p->headsent = 1;
 
-	if (p->gz != NULL && p->state != KSTATE_HEAD) {
-		if (gzwrite(p->gz, buf, sz) == 0) {
-			kutil_warnx(NULL, NULL, "gzwrite");
-			return KCGI_SYSTEM;
-		}
-		return KCGI_OK;
-	}
+	if (p->codec != NULL && p->state != KSTATE_HEAD)
+		return p->codec->write(p, buf, sz, 0);
 
-	return (p->fcgi == -1) ?
-		fullwritenoerr(STDOUT_FILENO, buf, sz) :
-		fcgi_write(6, p, buf, sz);
+	return kdata_wire(p, buf, sz, 0);
 }
 
 /*
@@ -180,6 +848,147 @@ kdata_drain(struct kdata *p)
 	return er;
 }
 
+/*
+ * Decide whether to start deferred compression.
+ * While deferred, the output buffer holds the headers (ending at
+ * "headpos" with the blank line) followed by the body so far.
+ * If "full" is set or the body is at least the minimum size, write the
+ * headers with the content coding and compress the body; otherwise,
+ * leave the buffer to be written as-is.
+ * Returns KCGI_OK, KCGI_ENOMEM, KCGI_SYSTEM, or KCGI_HUP.
+ * On KCGI_ENOMEM, output continues uncompressed.
+ */
+static enum kcgi_err
+kdata_decide(struct kdata *p, int full)
+{
+	const struct kcodec *codec = p->pending;
+	size_t		 bodypos = p->headpos + 2;
+	char		 head[64];
+	int		 len;
+	enum kcgi_err	 er;
+
+	assert(codec != NULL);
+	assert(p->outbufpos >= bodypos);
+	p->pending = NULL;
+
+	if (!full && p->outbufpos - bodypos < p->compminsz)
+		return KCGI_OK;
+
+	if (!codec->init(p))
+		return KCGI_ENOMEM;
+	p->codec = codec;
+
+	len = snprintf(head, sizeof(head), "%s: %s\r\n\r\n",
+		kresps[KRESP_CONTENT_ENCODING], codec->name);
+	assert(len > 0 && (size_t)len < sizeof(head));
+
+	if ((er = kdata_wire(p, p->outbuf, p->headpos, 0)) == KCGI_OK &&
+	    (er = kdata_wire(p, head, len, 0)) == KCGI_OK)
+		er = codec->write(p, p->outbuf + bodypos, 
+			p->outbufpos - bodypos, 0);
+	p->outbufpos = 0;
+	return er;
+}
+
+/*
+ * Grow the output buffer to hold at least "sz" bytes.
+ * Returns KCGI_OK or KCGI_ENOMEM.
+ */
+static enum kcgi_err
+kdata_grow(struct kdata *p, size_t sz)
+{
+	size_t	 nsz;
+	char	*pp;
+
+	if (sz <= p->outbufsz)
+		return KCGI_OK;
+	for (nsz = p->outbufsz; nsz < sz; )
+		nsz = nsz > SIZE_MAX / 2 ? sz : nsz * 2;
+	if ((pp = kxrealloc(p->outbuf, nsz)) == NULL)
+		return KCGI_ENOMEM;
+	p->outbuf = pp;
+	p->outbufsz = nsz;
+	return KCGI_OK;
+}
+
+/*
+ * Double an adaptive output buffer, which must be empty, up to its
+ * maximum.
+ * Returns KCGI_OK or KCGI_ENOMEM.
+ */
+static enum kcgi_err
+kdata_adapt(struct kdata *p)
+{
+	size_t	 nsz;
+	char	*pp;
+
+	assert(p->outbufpos == 0);
+	if (p->outbufmax == 0)
+		return KCGI_OK;
+	p->outbufgrew = 1;
+	if (p->outbufsz >= p->outbufmax)
+		return KCGI_OK;
+
+	nsz = p->outbufsz > p->outbufmax / 2 ? 
+		p->outbufmax : p->outbufsz * 2;
+	if ((pp = kxmalloc(nsz)) == NULL)
+		return KCGI_ENOMEM;
+	free(p->outbuf);
+	p->outbuf = pp;
+	p->outbufsz = nsz;
+	return KCGI_OK;
+}
+
+/*
+ * Size the adaptive output buffer: "outbufmax" and the initial
+ * "outbufsz" are multiples of the unit, which is a full record for
+ * FastCGI, so each drain writes full records.
+ */
+static void
+kdata_bufsize(struct kdata *p)
+{
+	int		 sndbuf;
+	socklen_t	 len = sizeof(int);
+	size_t		 unit, max = KDATA_BUFMAX;
+
+	unit = p->fcgi == -1 ? KDATA_BUFMIN : UINT16_MAX;
+	if (getsockopt(p->fcgi == -1 ? STDOUT_FILENO : p->fcgi, 
+	    SOL_SOCKET, SO_SNDBUF, &sndbuf, &len) == 0 && 
+	    sndbuf > 0 && (size_t)sndbuf < max)
+		max = (size_t)sndbuf;
+
+	p->outbufmax = max < unit ? unit : max / unit * unit;
+	for (p->outbufsz = unit; 
+	     p->outbufsz < kdata_bufhint && 
+	     p->outbufsz <= p->outbufmax / 2; )
+		p->outbufsz *= 2;
+}
+
+/*
+ * Replace the "oldsz" bytes at "pos" in the output buffer with the
+ * "sz" bytes of "buf", moving the rest of the buffer.
+ * This is used to edit held headers, so "headpos" is moved along if
+ * the edit is within the headers.
+ * Returns KCGI_OK or KCGI_ENOMEM.
+ */
+static enum kcgi_err
+kdata_splice(struct kdata *p, size_t pos, size_t oldsz, 
+	const char *buf, size_t sz)
+{
+	enum kcgi_err	 er;
+
+	assert(pos + oldsz <= p->outbufpos);
+	if ((er = kdata_grow(p, p->outbufpos - oldsz + sz)) != KCGI_OK)
+		return er;
+	memmove(p->outbuf + pos + sz, p->outbuf + pos + oldsz, 
+		p->outbufpos - pos - oldsz);
+	memcpy(p->outbuf + pos, buf, sz);
+	p->outbufpos = p->outbufpos - oldsz + sz;
+	if (pos <= p->headpos)
+		p->headpos = p->headpos - oldsz + sz;
+	return KCGI_OK;
+}
+
 /*
  * In this function, we handle arbitrary writes of data to the output.
  * In the event of CGI, this will be to stdout; in the event of FastCGI,
@@ -195,7 +1004,7 @@ kdata_drain(struct kdata *p)
 static enum kcgi_err
 kdata_write(struct kdata *p, const char *buf, size_t sz)
 {
-	size_t	 	 i, max;
+	size_t	 	 i, max, len;
 	int		 newln;
 	enum kcgi_err	 er = KCGI_OK;
 
@@ -255,18 +1064,117 @@ kdata_write(struct kdata *p, const char *buf, size_t sz)
 	 * If we don't, then copy it into the buffer.
 	 */
 
+	/*
+	 * A held body grows the buffer until it would exceed the most
+	 * we hold, after which it is no longer held and is written out
+	 * as usual.
+	 */
+
+	if (p->hold && p->holdmax > 0 && 
+	    p->outbufpos - p->headpos - 2 + sz > p->holdmax)
+		p->hold = 0;
+	if (p->hold && p->outbufpos + sz > p->outbufsz &&
+	    (er = kdata_grow(p, p->outbufpos + sz)) != KCGI_OK)
+		return er;
+
+	if (p->pending != NULL && p->outbufpos + sz > p->outbufsz &&
+	    (er = kdata_decide(p, 1)) != KCGI_OK)
+		return er;
+
+	/*
+	 * Fill the buffer to the brim and drain it, growing it if
+	 * adaptive, then write the remainder directly if it would fill
+	 * the buffer again.
+	 */
+
 	if (p->outbufpos + sz > p->outbufsz) {
-		if ((er = kdata_drain(p)) != KCGI_OK)
+		if (p->outbufpos > 0) {
+			len = p->outbufsz - p->outbufpos;
+			memcpy(p->outbuf + p->outbufpos, buf, len);
+			p->outbufpos += len;
+			buf += len;
+			sz -= len;
+			if ((er = kdata_drain(p)) != KCGI_OK)
+				return er;
+		}
+		if ((er = kdata_adapt(p)) != KCGI_OK)
 			return er;
-		if (sz > p->outbufsz)
+		if (sz >= p->outbufsz)
 			return kdata_flush(p, buf, sz);
 	}
 
-	assert(p->outbufpos + sz <= p->outbufsz);
-	assert(p->outbuf != NULL);
-	memcpy(p->outbuf + p->outbufpos, buf, sz);
-	p->outbufpos += sz;
-	return er;
+	assert(p->outbufpos + sz <= p->outbufsz);
+	assert(p->outbuf != NULL);
+	memcpy(p->outbuf + p->outbufpos, buf, sz);
+	p->outbufpos += sz;
+	return er;
+}
+
+/*
+ * Write "sz" bytes of the file "fd" from offset "off", as clamped to
+ * the file's size.
+ * If the output is uncompressed, this bypasses the output buffer
+ * (after draining it) and sends the file directly to the wire.
+ * Otherwise, or when debugging writes or holding asynchronous output,
+ * the file is read and written as usual with kdata_write().
+ * Returns KCGI_OK, KCGI_SYSTEM, KCGI_ENOMEM, or KCGI_HUP.
+ */
+static enum kcgi_err
+kdata_sendfile(struct kdata *p, int fd, off_t off, size_t sz)
+{
+	struct stat	 st;
+	char		 buf[KDATA_ZBUFSZ];
+	ssize_t		 ssz;
+	enum kcgi_err	 er;
+
+	if (fstat(fd, &st) == -1) {
+		kutil_warn(NULL, NULL, "fstat");
+		return KCGI_SYSTEM;
+	} else if (off < 0 || off >= st.st_size) 
+		return KCGI_OK;
+	if ((uint64_t)(st.st_size - off) < sz)
+		sz = (size_t)(st.st_size - off);
+
+	if (p->codec != NULL || p->pending != NULL || p->hold ||
+	    p->asyncmax > 0 || (p->debugging & KREQ_DEBUG_WRITE)) {
+		while (sz > 0) {
+			ssz = pread(fd, buf, 
+				sz < sizeof(buf) ? sz : sizeof(buf), off);
+			if (ssz < 0 && errno == EINTR)
+				continue;
+			if (ssz < 0) {
+				kutil_warn(NULL, NULL, "pread");
+				return KCGI_SYSTEM;
+			} else if (ssz == 0) {
+				kutil_warnx(NULL, NULL, "pread: short file");
+				return KCGI_SYSTEM;
+			}
+			if ((er = kdata_write(p, buf, ssz)) != KCGI_OK)
+				return er;
+			off += ssz;
+			sz -= (size_t)ssz;
+		}
+		return KCGI_OK;
+	}
+
+	if ((er = kdata_drain(p)) != KCGI_OK)
+		return er;
+
+	return (p->fcgi == -1) ?
+		fullsendfile(STDOUT_FILENO, fd, &off, sz) :
+		fcgi_sendfile(p, fd, off, sz);
+}
+
+enum kcgi_err
+khttp_sendfile(struct kreq *req, int fd, off_t off, size_t sz)
+{
+
+	assert(req->kdata != NULL);
+	if (req->kdata->state != KSTATE_BODY)
+		return KCGI_FORM;
+	assert(!req->kdata->disabled);
+
+	return kdata_sendfile(req->kdata, fd, off, sz);
 }
 
 enum kcgi_err
@@ -323,6 +1231,30 @@ khttp_putc(struct kreq *req, int c)
 	return khttp_write(req, (char *)&cc, 1);
 }
 
+/*
+ * Note whether the content type "val" (a header value, possibly with
+ * parameters) is one that shouldn't be compressed.
+ */
+static void
+kdata_mime(struct kdata *p, const char *val)
+{
+	size_t		 i, sz;
+	const char	*mime;
+
+	for (i = 0; i < p->compskipsz; i++) {
+		if (p->compskip[i] >= KMIME__MAX)
+			continue;
+		mime = kmimetypes[p->compskip[i]];
+		sz = strlen(mime);
+		if (strncasecmp(val, mime, sz) == 0 &&
+		    (val[sz] == '\0' || val[sz] == ';' ||
+		     isspace((unsigned char)val[sz]))) {
+			p->compskipped = 1;
+			return;
+		}
+	}
+}
+
 enum kcgi_err
 khttp_head(struct kreq *req, const char *key, const char *fmt, ...)
 {
@@ -342,6 +1274,10 @@ khttp_head(struct kreq *req, const char *key, const char *fmt, ...)
 	if (len == -1) 
 		return KCGI_ENOMEM;
 
+	if (req->kdata->compskipsz > 0 &&
+	    strcasecmp(key, kresps[KRESP_CONTENT_TYPE]) == 0)
+		kdata_mime(req->kdata, buf);
+
 	ksz = strlen(key);
 	if ((er = kdata_write(req->kdata, key, ksz)) != KCGI_OK)
 		goto out;
@@ -373,9 +1309,21 @@ kdata_alloc(int control, int fcgi, uint16_t requestId,
 	p->fcgi = fcgi;
 	p->control = control;
 	p->requestId = requestId;
-
-	if (opts->sndbufsz > 0) {
+	p->complevel = opts->complevel;
+	p->compminsz = opts->compminsz;
+	p->compskip = opts->compskip;
+	p->compskipsz = opts->compskipsz;
+	p->etag = opts->etag;
+	p->holdmax = opts->fullbufsz;
+	if (fcgi != -1)
+		p->asyncmax = opts->asyncbufsz;
+
+	if (opts->sndbufsz < 0)
+		kdata_bufsize(p);
+	else
 		p->outbufsz = opts->sndbufsz;
+
+	if (p->outbufsz > 0) {
 		if ((p->outbuf = kxmalloc(p->outbufsz)) == NULL) {
 			free(p);
 			return NULL;
@@ -385,6 +1333,186 @@ kdata_alloc(int control, int fcgi, uint16_t requestId,
 	return p;
 }
 
+/*
+ * Look up the header "name" in the held headers.
+ * Returns zero if not found, else non-zero with "pos" and "sz" set to
+ * the offset and length (with the CRLF) of its line.
+ */
+static int
+kdata_header(const struct kdata *p, const char *name, 
+	size_t *pos, size_t *sz)
+{
+	size_t		 start, end, nsz = strlen(name);
+
+	for (start = 0; start < p->headpos; start = end) {
+		for (end = start; end < p->headpos; end++)
+			if (p->outbuf[end] == '\n') {
+				end++;
+				break;
+			}
+		if (end - start > nsz && p->outbuf[start + nsz] == ':' &&
+		    strncasecmp(p->outbuf + start, name, nsz) == 0) {
+			*pos = start;
+			*sz = end - start;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Get the status code of the held headers: 200 if not given, zero if
+ * not a number.
+ */
+static int
+kdata_status(const struct kdata *p)
+{
+	size_t		 pos, sz;
+	const char	*cp;
+
+	if (!kdata_header(p, kresps[KRESP_STATUS], &pos, &sz))
+		return 200;
+	cp = p->outbuf + pos + strlen(kresps[KRESP_STATUS]) + 1;
+	while (*cp == ' ')
+		cp++;
+	return isdigit((unsigned char)*cp) ? atoi(cp) : 0;
+}
+
+/*
+ * Add an entity-tag to a held response.
+ * The tag is the hash of the body, marked with the content coding if
+ * the body will be compressed.
+ * If it matches If-None-Match, the body is discarded and the status
+ * replaced with 304; either way, the ETag header is added.
+ * Only 200 responses (explicitly or by default) are tagged, and only
+ * if the application hasn't tagged them itself.
+ * Returns KCGI_OK or KCGI_ENOMEM.
+ */
+static enum kcgi_err
+kdata_etag(struct kdata *p)
+{
+	size_t		 bodypos = p->headpos + 2, bodysz, 
+			 spos = 0, ssz = 0;
+	char		 tag[64], line[128];
+	int		 len;
+	uint64_t	 hash;
+	enum kcgi_err	 er;
+
+	if (kdata_status(p) != 200)
+		return KCGI_OK;
+	if (kdata_header(p, kresps[KRESP_ETAG], &spos, &ssz))
+		return KCGI_OK;
+
+	bodysz = p->outbufpos - bodypos;
+	hash = kxxh64(p->outbuf + bodypos, bodysz);
+	if (p->pending != NULL && bodysz >= p->compminsz)
+		snprintf(tag, sizeof(tag), "W/\"%016" PRIx64 "-%s\"", 
+			hash, p->pending->name);
+	else
+		snprintf(tag, sizeof(tag), "\"%016" PRIx64 "\"", hash);
+
+	if (p->inm != NULL && ketag_match(p->inm, tag, 0)) {
+		p->outbufpos = bodypos;
+		p->pending = NULL;
+		kdata_header(p, kresps[KRESP_STATUS], &spos, &ssz);
+		len = snprintf(line, sizeof(line), "%s: %s\r\n", 
+			kresps[KRESP_STATUS], khttps[KHTTP_304]);
+		assert(len > 0 && (size_t)len < sizeof(line));
+		if ((er = kdata_splice(p, spos, ssz, line, len)) != KCGI_OK)
+			return er;
+	}
+
+	len = snprintf(line, sizeof(line), "%s: %s\r\n", 
+		kresps[KRESP_ETAG], tag);
+	assert(len > 0 && (size_t)len < sizeof(line));
+	return kdata_splice(p, p->headpos, 0, line, len);
+}
+
+/*
+ * Add the Content-Length header to a held response.
+ * If compression is deferred and the body is large enough, the body is
+ * first compressed in memory and replaced, with its Content-Encoding.
+ * Responses that have no body by their status or already have a
+ * length are left as they are.
+ * Returns KCGI_OK, KCGI_ENOMEM, or KCGI_SYSTEM.
+ */
+static enum kcgi_err
+kdata_length(struct kdata *p)
+{
+	const struct kcodec *codec = p->pending;
+	size_t		 bodypos = p->headpos + 2, bodysz, pos, sz;
+	char		 enc[64], len[64];
+	int		 code, encsz = 0, lensz;
+	enum kcgi_err	 er;
+
+	code = kdata_status(p);
+	if ((code >= 100 && code < 200) || code == 204 || code == 304)
+		return KCGI_OK;
+	if (kdata_header(p, kresps[KRESP_CONTENT_LENGTH], &pos, &sz))
+		return KCGI_OK;
+
+	bodysz = p->outbufpos - bodypos;
+	memset(&p->capbuf, 0, sizeof(struct kcgi_buf));
+
+	if (codec != NULL && bodysz >= p->compminsz) {
+		if (!codec->init(p))
+			return KCGI_ENOMEM;
+		p->capture = 1;
+		er = codec->write(p, p->outbuf + bodypos, bodysz, 1);
+		p->capture = 0;
+		codec->free(p);
+		if (er != KCGI_OK) {
+			free(p->capbuf.buf);
+			return er;
+		}
+		encsz = snprintf(enc, sizeof(enc), "%s: %s\r\n",
+			kresps[KRESP_CONTENT_ENCODING], codec->name);
+		assert(encsz > 0 && (size_t)encsz < sizeof(enc));
+		bodysz = p->capbuf.sz;
+	}
+
+	lensz = snprintf(len, sizeof(len), "%s: %zu\r\n",
+		kresps[KRESP_CONTENT_LENGTH], bodysz);
+	assert(lensz > 0 && (size_t)lensz < sizeof(len));
+
+	/* Size the buffer first so that the edits can't fail. */
+
+	if ((er = kdata_grow(p, bodypos + 
+	    encsz + lensz + bodysz)) != KCGI_OK) {
+		free(p->capbuf.buf);
+		return er;
+	}
+
+	if (encsz > 0) {
+		p->pending = NULL;
+		p->outbufpos = bodypos;
+		kdata_splice(p, bodypos, 0, p->capbuf.buf, p->capbuf.sz);
+		kdata_splice(p, p->headpos, 0, enc, encsz);
+		free(p->capbuf.buf);
+	}
+	kdata_splice(p, p->headpos, 0, len, lensz);
+	return KCGI_OK;
+}
+
+/*
+ * Stop holding the body: add the entity-tag, then the length, if so
+ * configured.
+ * Returns KCGI_OK, KCGI_ENOMEM, or KCGI_SYSTEM.
+ */
+static enum kcgi_err
+kdata_unhold(struct kdata *p)
+{
+	enum kcgi_err	 er;
+
+	p->hold = 0;
+	if (p->holdtag && (er = kdata_etag(p)) != KCGI_OK)
+		return er;
+	if (p->holdlen && (er = kdata_length(p)) != KCGI_OK)
+		return er;
+	return KCGI_OK;
+}
+
 /*
  * Two ways of doing this: with or without "flush".
  * If we're flushing, then we drain our output buffers to the output.
@@ -393,8 +1521,7 @@ kdata_alloc(int control, int fcgi, uint16_t requestId,
 void
 kdata_free(struct kdata *p, int flush)
 {
-	char	 	 buf[8];
-	uint32_t 	 appStatus;
+	char	 msg[sizeof(uint16_t) + sizeof(size_t)];
 
 	if (p == NULL)
 		return;
@@ -411,17 +1538,33 @@ kdata_free(struct kdata *p, int flush)
 			(unsigned long)getpid(), p->bytes);
 	}
 
-	/* Remaining buffered data. */
+	/* 
+	 * Remaining buffered data.
+	 * For FastCGI, this is written along with the end of the stream
+	 * and request: for compressed data, the tail of the compressed
+	 * stream; otherwise, the buffer itself.
+	 */
 
-	if (flush) 
-		kdata_drain(p);
+	if (flush && p->hold)
+		kdata_unhold(p);
+	if (flush && p->pending != NULL)
+		kdata_decide(p, 0);
 
-	free(p->outbuf);
+	if (flush) {
+		if (p->codec != NULL) {
+			kdata_drain(p);
+			p->codec->write(p, NULL, 0, 1);
+		} else if (p->fcgi == -1)
+			kdata_drain(p);
+		else
+			fcgi_write(6, p, p->outbuf, p->outbufpos, 1);
+		p->outbufpos = 0;
+	}
 
 	/*
 	 * If we're not FastCGI and we're not going to flush, then close
-	 * the file descriptors outright: we don't want gzclose()
-	 * flushing anything to the wire.
+	 * the file descriptors outright: we don't want anything more
+	 * going to the wire.
 	 */
 
 	if (!flush && p->fcgi == -1) {
@@ -429,68 +1572,62 @@ kdata_free(struct kdata *p, int flush)
 		close(STDIN_FILENO);
 	}
 
-	if (p->gz != NULL)
-		gzclose(p->gz);
+	if (p->codec != NULL)
+		p->codec->free(p);
+
+	/* Carry the adaptive buffer size over to the next response. */
+
+	if (p->outbufmax > 0) {
+		kdata_bufhint = p->outbufsz > p->outbufmax ?
+			p->outbufmax : p->outbufsz;
+		if (!p->outbufgrew)
+			kdata_bufhint /= 2;
+	}
 
 	if (p->fcgi == -1) {
+		free(p->outbuf);
 		free(p);
 		return;
 	}
 
-	/* 
-	 * If flushing, end the stream.
-	 * Note that we've already flushed our last FastCGI record to
-	 * the stream, but the standard implies that we need a blank
-	 * record to really shut this thing down.
-	 */
-
 	if (flush) {
-		fcgi_write(6, p, "", 0);
-		appStatus = htonl(EXIT_SUCCESS);
-		memset(buf, 0, 8);
-		memcpy(buf, &appStatus, sizeof(uint32_t));
-
-		/* End of request. */
-
-		fcgi_write(3, p, buf, 8);
-
-		/* Close out. */
+		/* 
+		 * Close out our copy of the connection.
+		 * The control process holds its own, which it keeps
+		 * open if the web server set FCGI_KEEP_CONN.
+		 * Hand it any output we held to finish writing.
+		 */
 
 		close(p->fcgi);
-		fullwrite(p->control, &p->requestId, sizeof(uint16_t));
+		memcpy(msg, &p->requestId, sizeof(uint16_t));
+		memcpy(msg + sizeof(uint16_t), 
+			&p->async.sz, sizeof(size_t));
+		fullwrite(p->control, msg, sizeof(msg));
+		fullwrite(p->control, p->async.buf, p->async.sz);
 	} else
 		close(p->fcgi);
 
+	free(p->async.buf);
+	free(p->outbuf);
 	free(p);
 }
 
 /*
- * Try to enable compression on the output stream itself.
- * This function is only available with zlib.
- * We disallow compression on FastCGI streams because I don't yet have
- * the structure in place to copy the compressed data into a buffer then
- * write that out.
- * Set "ret" to zero if compression is not enabled, non-zero if enabled.
- * Returns zero if allocation errors occured (via gzdopen(3)), non-zero
- * otherwise.
- * On failure, "ret" is always zero.
+ * Enable compression on the output stream itself with "codec".
+ * Compressed output is written into a fixed buffer, which is written
+ * to stdout for CGI or framed as records for FastCGI.
+ * Returns zero if allocation errors occured, non-zero otherwise.
  */
 static int
-kdata_compress(struct kdata *p, int *ret)
+kdata_compress(struct kdata *p, const struct kcodec *codec)
 {
 
-	*ret = 0;
 	assert(p->state == KSTATE_HEAD);
+	assert(p->codec == NULL);
 
-	if (p->fcgi != -1)
-		return 1;
-
-	assert(p->gz == NULL);
-	if ((p->gz = gzdopen(STDOUT_FILENO, "w")) == NULL) {
-		kutil_warn(NULL, NULL, "gzdopen");
+	if (!codec->init(p))
 		return 0;
-	}
-	*ret = 1;
+	p->codec = codec;
 	return 1;
 }
 
@@ -510,15 +1647,35 @@ kdata_body(struct kdata *p)
 	if ((er = kdata_write(p, "\r\n", 2)) != KCGI_OK)
 		return er;
 
+	/*
+	 * If compression is deferred or the body is held, hold the
+	 * headers in the buffer until kdata_decide() or kdata_unhold().
+	 * If they've been pushed out (tiny buffer), do neither.
+	 */
+
+	if (p->pending != NULL || p->hold) {
+		if (!p->headsent) {
+			p->headpos = p->outbufpos - 2;
+			p->state = KSTATE_BODY;
+			return KCGI_OK;
+		}
+		p->pending = NULL;
+		p->hold = 0;
+	}
+
 	/*
 	 * XXX: we always drain our buffer after the headers have been
 	 * written.
 	 * This incurs more chat on the wire, but also ensures that our
 	 * response gets to the server as quickly as possible.
 	 * Should an option be added to disable this?
+	 * Uncompressed FastCGI responses are the exception: the headers
+	 * stay buffered with the body, so small responses are written
+	 * in one go.
 	 */
 
-	if ((er = kdata_drain(p)) != KCGI_OK)
+	if ((p->fcgi == -1 || p->codec != NULL) &&
+	    (er = kdata_drain(p)) != KCGI_OK)
 		return er;
 
 	p->state = KSTATE_BODY;
@@ -528,25 +1685,59 @@ kdata_body(struct kdata *p)
 enum kcgi_err
 khttp_body(struct kreq *req)
 {
-	int	 	 hasreq = 0;
 	enum kcgi_err	 er;
-	const char	*cp;
+	const struct kcodec *codec = NULL;
 
 	/*
-	 * First determine if the request wants HTTP compression.
-	 * Use RFC 2616 14.3 as a guide for checking this: if we have
-	 * the "gzip" accept encoding and a non-zero quality, then use
-	 * compression.
+	 * First determine if the request wants HTTP compression by
+	 * negotiating a content coding from its Accept-Encoding.
 	 */
 
-	if (req->reqmap[KREQU_ACCEPT_ENCODING] != NULL) {
-		cp = req->reqmap[KREQU_ACCEPT_ENCODING]->val;
-		if ((cp = strstr(cp, "gzip")) != NULL) {
-			hasreq = 1;
-			cp += 4;
-			if (strncmp(cp, ";q=0", 4) == 0) 
-				hasreq = '.' == cp[4];
-		}
+	if (req->reqmap[KREQU_ACCEPT_ENCODING] != NULL &&
+	    !req->kdata->compskipped)
+		codec = kcodec_negotiate
+			(req->reqmap[KREQU_ACCEPT_ENCODING]->val);
+
+	/*
+	 * Unless the content type isn't compressed, whether (and how)
+	 * the body is compressed depends on Accept-Encoding, even if
+	 * this request has none or the size decides later on, so caches
+	 * must key on it.
+	 */
+
+	if (!req->kdata->compskipped && (er = khttp_head(req, 
+	    kresps[KRESP_VARY], "%s", "Accept-Encoding")) != KCGI_OK)
+		return er;
+
+	/*
+	 * With entity-tags, hold the body of GET responses until the
+	 * response ends; with a maximum held size, hold any response
+	 * but to HEAD (whose body may be omitted) to add its length.
+	 * See kdata_unhold().
+	 */
+
+	if (req->kdata->outbufsz > 0 && 
+	    req->kdata->etag && req->method == KMETHOD_GET) {
+		req->kdata->hold = req->kdata->holdtag = 1;
+		if (req->reqmap[KREQU_IF_NONE_MATCH] != NULL)
+			req->kdata->inm = 
+				req->reqmap[KREQU_IF_NONE_MATCH]->val;
+	}
+	if (req->kdata->outbufsz > 0 && 
+	    req->kdata->holdmax > 0 && req->method != KMETHOD_HEAD)
+		req->kdata->hold = req->kdata->holdlen = 1;
+
+	/*
+	 * With a minimum size or a held body, defer the decision (and
+	 * the compressor set-up) until the output buffer fills or the
+	 * response ends.
+	 * See kdata_decide().
+	 */
+
+	if (codec != NULL && req->kdata->outbufsz > 0 &&
+	    (req->kdata->compminsz > 0 || req->kdata->hold)) {
+		req->kdata->pending = codec;
+		return kdata_body(req->kdata);
 	}
 
 	/*
@@ -556,23 +1747,21 @@ khttp_body(struct kreq *req)
 	 * compression then write headers) is ok.
 	 */
 
-	if (hasreq) {
+	if (codec != NULL) {
 		/*
-		 * We could just ignore this error, which means gzdopen
-		 * failed, and just continue with hasreq=0.
-		 * However, if gzdopen fails (memory allocation), it
+		 * We could just ignore this error, which means the
+		 * compressor failed, and just continue uncompressed.
+		 * However, if that fails (memory allocation), it
 		 * probably means other things are going to fail, so we
 		 * might as well just die now.
 		 */
 
-		if (!kdata_compress(req->kdata, &hasreq))
+		if (!kdata_compress(req->kdata, codec))
 			return KCGI_ENOMEM;
-		if (hasreq) {
-			er = khttp_head(req, 
-				kresps[KRESP_CONTENT_ENCODING], "gzip");
-			if (er != KCGI_OK)
-				return er;
-		}
+		er = khttp_head(req, 
+			kresps[KRESP_CONTENT_ENCODING], "%s", codec->name);
+		if (er != KCGI_OK)
+			return er;
 	}
 
 	return kdata_body(req->kdata);
@@ -581,7 +1770,6 @@ khttp_body(struct kreq *req)
 enum kcgi_err
 khttp_body_compress(struct kreq *req, int comp)
 {
-	int	 didcomp;
 
 	/* 
 	 * First, if we didn't request compression, go directly into the
@@ -592,18 +1780,423 @@ khttp_body_compress(struct kreq *req, int comp)
 		return kdata_body(req->kdata);
 
 	/*
-	 * If we do have compression requested, try enabling it on the
+	 * If we do have compression requested, try enabling gzip on the
 	 * output stream.
 	 */
 
-	if (!kdata_compress(req->kdata, &didcomp))
+	if (!kdata_compress(req->kdata, &kcodec_gzip))
 		return KCGI_ENOMEM;
-	else if (!didcomp)
-		return KCGI_FORM;
 
 	return kdata_body(req->kdata);
 }
 
+enum kcgi_err
+khttp_body_sendfile(struct kreq *req, const char *path)
+{
+	static const struct {
+		const char	*coding;
+		const char	*suffix;
+	} sibs[] = {
+		{ "zstd", ".zst" },
+		{ "br", ".br" },
+		{ "gzip", ".gz" },
+	};
+	const size_t	 sibsz = sizeof(sibs) / sizeof(sibs[0]);
+	int		 q[sizeof(sibs) / sizeof(sibs[0])];
+	const char	*accept = NULL;
+	char		*sib;
+	size_t		 i, best;
+	int		 fd = -1;
+	struct stat	 st;
+	enum kcgi_err	 er;
+
+	if (req->reqmap[KREQU_ACCEPT_ENCODING] != NULL)
+		accept = req->reqmap[KREQU_ACCEPT_ENCODING]->val;
+
+	/*
+	 * Try precompressed siblings of the file, in order of the
+	 * client's preference, then the file itself.
+	 */
+
+	for (i = 0; i < sibsz; i++)
+		q[i] = accept == NULL ? 0 : kaccept_q(accept, sibs[i].coding);
+
+	for (;;) {
+		for (best = sibsz, i = 0; i < sibsz; i++)
+			if (q[i] > 0 && (best == sibsz || q[i] > q[best]))
+				best = i;
+		if (best == sibsz)
+			break;
+		q[best] = 0;
+		if (kxasprintf(&sib, "%s%s", path, sibs[best].suffix) == -1)
+			return KCGI_ENOMEM;
+		fd = open(sib, O_RDONLY | O_NONBLOCK);
+		free(sib);
+		if (fd == -1)
+			continue;
+		if (fstat(fd, &st) != -1 && S_ISREG(st.st_mode))
+			break;
+		close(fd);
+		fd = -1;
+	}
+
+	/*
+	 * Which representation we send depends on Accept-Encoding, even
+	 * if it's the file itself, so caches must key on it.
+	 */
+
+	er = khttp_head(req, kresps[KRESP_VARY], "%s", "Accept-Encoding");
+	if (er != KCGI_OK)
+		goto out;
+
+	if (fd != -1) {
+		er = khttp_head(req, kresps[KRESP_CONTENT_ENCODING], 
+			"%s", sibs[best].coding);
+		if (er != KCGI_OK)
+			goto out;
+	} else if ((fd = open(path, O_RDONLY | O_NONBLOCK)) == -1) {
+		kutil_warn(NULL, NULL, "%s", path);
+		return KCGI_SYSTEM;
+	} else if (fstat(fd, &st) == -1) {
+		kutil_warn(NULL, NULL, "%s", path);
+		er = KCGI_SYSTEM;
+		goto out;
+	} else if (!S_ISREG(st.st_mode)) {
+		kutil_warnx(NULL, NULL, "%s: not a regular file", path);
+		er = KCGI_SYSTEM;
+		goto out;
+	}
+
+	er = khttp_head(req, kresps[KRESP_CONTENT_LENGTH], 
+		"%" PRId64, (int64_t)st.st_size);
+	if (er != KCGI_OK)
+		goto out;
+	if ((er = khttp_body_compress(req, 0)) != KCGI_OK)
+		goto out;
+	if (req->method != KMETHOD_HEAD)
+		er = kdata_sendfile(req->kdata, fd, 0, (size_t)st.st_size);
+out:
+	close(fd);
+	return er;
+}
+
+/*
+ * Maximum number of ranges honoured in a Range request.
+ * Requests with more are answered in full, which RFC 9110 section 14.2
+ * permits: this bounds the work of many small or overlapping ranges.
+ */
+#define	KRANGE_MAX	16
+
+struct	krange {
+	uint64_t	 first; /* first byte position */
+	uint64_t	 last; /* last byte position (inclusive) */
+};
+
+/*
+ * Parse an unsigned decimal at "*cp", advancing it.
+ * Returns zero if there are no digits or the value overflows.
+ */
+static int
+krange_num(const char **cp, uint64_t *v)
+{
+	const char	*start = *cp;
+
+	for (*v = 0; isdigit((unsigned char)**cp); (*cp)++) {
+		if (*v > (UINT64_MAX - 9) / 10)
+			return 0;
+		*v = *v * 10 + (**cp - '0');
+	}
+	return *cp != start;
+}
+
+/*
+ * Parse the Range header "cp" (RFC 9110 section 14.1.2) for a
+ * representation of "sz" bytes into at most KRANGE_MAX "ranges",
+ * dropping unsatisfiable ones and clamping the rest.
+ * Returns the number of ranges, which may be zero if none are
+ * satisfiable, or -1 if the header should be ignored (malformed, not
+ * in bytes, or too many ranges).
+ */
+static int
+krange_parse(const char *cp, uint64_t sz, struct krange *ranges)
+{
+	uint64_t	 first, last;
+	int		 n = 0, spec = 0;
+
+	if (strncasecmp(cp, "bytes", 5) != 0)
+		return -1;
+	cp += 5;
+	while (*cp == ' ' || *cp == '\t')
+		cp++;
+	if (*cp++ != '=')
+		return -1;
+
+	for (;;) {
+		while (*cp == ' ' || *cp == '\t' || *cp == ',')
+			cp++;
+		if (*cp == '\0')
+			break;
+
+		if (*cp == '-') {
+			/* Suffix range: the last "last" bytes. */
+			cp++;
+			if (!krange_num(&cp, &last))
+				return -1;
+			if (last == 0 || sz == 0) {
+				first = 1;
+				last = 0;
+			} else {
+				first = last > sz ? 0 : sz - last;
+				last = sz - 1;
+			}
+		} else {
+			if (!krange_num(&cp, &first) || *cp++ != '-')
+				return -1;
+			if (!isdigit((unsigned char)*cp))
+				last = UINT64_MAX;
+			else if (!krange_num(&cp, &last) || last < first)
+				return -1;
+			if (last >= sz)
+				last = sz - 1;
+		}
+
+		while (*cp == ' ' || *cp == '\t')
+			cp++;
+		if (*cp != '\0' && *cp != ',')
+			return -1;
+
+		if (++spec > KRANGE_MAX)
+			return -1;
+		if (first >= sz || first > last)
+			continue;
+		ranges[n].first = first;
+		ranges[n].last = last;
+		n++;
+	}
+
+	return spec == 0 ? -1 : n;
+}
+
+/*
+ * Whether the Last-Modified time "mtime" (zero if unknown) is after the
+ * HTTP date "cp".
+ * Returns -1 if either is unknown or invalid.
+ */
+static int
+kmodified_since(const char *cp, int64_t mtime)
+{
+	int64_t		 date;
+
+	if (mtime == 0 || !khttp_str2epoch(&date, cp))
+		return -1;
+	return mtime > date;
+}
+
+enum khttp
+khttp_cond(const struct kreq *req, const char *etag, int64_t mtime)
+{
+	const struct khead *h;
+	int		 get;
+
+	get = req->method == KMETHOD_GET || req->method == KMETHOD_HEAD;
+
+	/* 
+	 * Evaluate preconditions as in RFC 9110 section 13.2.2: with
+	 * If-Match, If-Unmodified-Since is ignored; with If-None-Match,
+	 * If-Modified-Since is ignored.
+	 */
+
+	if ((h = req->reqmap[KREQU_IF_MATCH]) != NULL) {
+		if (!ketag_match(h->val, etag, 1))
+			return KHTTP_412;
+	} else if ((h = req->reqmap[KREQU_IF_UNMODIFIED_SINCE]) != NULL) {
+		if (kmodified_since(h->val, mtime) == 1)
+			return KHTTP_412;
+	}
+
+	if ((h = req->reqmap[KREQU_IF_NONE_MATCH]) != NULL) {
+		if (ketag_match(h->val, etag, 0))
+			return get ? KHTTP_304 : KHTTP_412;
+	} else if (get &&
+	    (h = req->reqmap[KREQU_IF_MODIFIED_SINCE]) != NULL) {
+		if (kmodified_since(h->val, mtime) == 0)
+			return KHTTP_304;
+	}
+
+	return KHTTP_200;
+}
+
+/*
+ * Whether Range should be honoured given an If-Range header "cp" (RFC
+ * 9110 section 13.1.5): a strong entity-tag must match "etag" or a date
+ * must exactly equal "mtime".
+ */
+static int
+kif_range(const char *cp, const char *etag, int64_t mtime)
+{
+	int64_t		 date;
+
+	if (cp[0] == '"' || strncmp(cp, "W/", 2) == 0)
+		return cp[0] == '"' && ketag_match(cp, etag, 1);
+	return mtime != 0 && khttp_str2epoch(&date, cp) && date == mtime;
+}
+
+enum kcgi_err
+khttp_body_file(struct kreq *req, int fd, 
+	const char *ctype, const char *etag, int64_t mtime)
+{
+	struct stat	 st;
+	struct krange	 ranges[KRANGE_MAX];
+	char		 tag[64], date[64], bound[24], *part;
+	unsigned char	 rnd[8];
+	const struct khead *h;
+	enum khttp	 code;
+	enum kcgi_err	 er;
+	uint64_t	 sz, len;
+	int		 i, n = -1, plen;
+
+	if (fstat(fd, &st) == -1) {
+		kutil_warn(NULL, NULL, "fstat");
+		return KCGI_SYSTEM;
+	} else if (!S_ISREG(st.st_mode)) {
+		kutil_warnx(NULL, NULL, "not a regular file");
+		return KCGI_SYSTEM;
+	}
+	sz = (uint64_t)st.st_size;
+
+	/* Default validators: modification time and size. */
+
+	if (mtime == 0)
+		mtime = st.st_mtime;
+	if (etag == NULL) {
+		snprintf(tag, sizeof(tag), "\"%" PRIx64 "-%" PRIx64 "\"",
+			(uint64_t)mtime, sz);
+		etag = tag;
+	}
+
+	if ((code = khttp_cond(req, etag, mtime)) == KHTTP_200 &&
+	    req->method == KMETHOD_GET &&
+	    (h = req->reqmap[KREQU_RANGE]) != NULL &&
+	    (req->reqmap[KREQU_IF_RANGE] == NULL ||
+	     kif_range(req->reqmap[KREQU_IF_RANGE]->val, etag, mtime))) {
+		n = krange_parse(h->val, sz, ranges);
+		if (n == 0)
+			code = KHTTP_416;
+		else if (n > 0)
+			code = KHTTP_206;
+	}
+
+	if ((er = khttp_head(req, kresps[KRESP_STATUS], 
+	    "%s", khttps[code])) != KCGI_OK)
+		return er;
+
+	if (code == KHTTP_412)
+		return khttp_body_compress(req, 0);
+	if (code == KHTTP_416) {
+		if ((er = khttp_head(req, kresps[KRESP_CONTENT_RANGE], 
+		    "bytes */%" PRIu64, sz)) != KCGI_OK)
+			return er;
+		return khttp_body_compress(req, 0);
+	}
+
+	if ((er = khttp_head(req, kresps[KRESP_ETAG], 
+	    "%s", etag)) != KCGI_OK)
+		return er;
+	if (khttp_epoch2str(mtime, date, sizeof(date)) != NULL &&
+	    (er = khttp_head(req, kresps[KRESP_LAST_MODIFIED], 
+	     "%s", date)) != KCGI_OK)
+		return er;
+	if (code == KHTTP_304)
+		return khttp_body_compress(req, 0);
+	if ((er = khttp_head(req, kresps[KRESP_ACCEPT_RANGES], 
+	    "bytes")) != KCGI_OK)
+		return er;
+
+	if (code == KHTTP_200 || n == 1) {
+		if (code == KHTTP_200) {
+			ranges[0].first = 0;
+			ranges[0].last = sz - 1;
+		} else if ((er = khttp_head(req, 
+		    kresps[KRESP_CONTENT_RANGE], 
+		    "bytes %" PRIu64 "-%" PRIu64 "/%" PRIu64, 
+		    ranges[0].first, ranges[0].last, sz)) != KCGI_OK)
+			return er;
+		len = sz == 0 ? 0 : ranges[0].last - ranges[0].first + 1;
+		if (ctype != NULL && (er = khttp_head(req, 
+		    kresps[KRESP_CONTENT_TYPE], "%s", ctype)) != KCGI_OK)
+			return er;
+		if ((er = khttp_head(req, kresps[KRESP_CONTENT_LENGTH], 
+		    "%" PRIu64, len)) != KCGI_OK)
+			return er;
+		if ((er = khttp_body_compress(req, 0)) != KCGI_OK)
+			return er;
+		if (req->method == KMETHOD_HEAD)
+			return KCGI_OK;
+		return kdata_sendfile(req->kdata, fd, 
+			(off_t)ranges[0].first, (size_t)len);
+	}
+
+	/* 
+	 * Multiple ranges: a multipart/byteranges body (RFC 9110
+	 * section 14.6), whose length is computed beforehand.
+	 */
+
+	arc4random_buf(rnd, sizeof(rnd));
+	for (i = 0; i < (int)sizeof(rnd); i++)
+		snprintf(bound + i * 2, 3, "%02x", rnd[i]);
+
+	for (len = 0, i = 0; i < n; i++) {
+		plen = snprintf(NULL, 0, "\r\n--%s\r\n%s%s%s"
+			"Content-Range: bytes %" PRIu64 "-%" PRIu64 
+			"/%" PRIu64 "\r\n\r\n", bound,
+			ctype == NULL ? "" : "Content-Type: ",
+			ctype == NULL ? "" : ctype,
+			ctype == NULL ? "" : "\r\n",
+			ranges[i].first, ranges[i].last, sz);
+		if (plen < 0)
+			return KCGI_SYSTEM;
+		len += (uint64_t)plen + 
+			ranges[i].last - ranges[i].first + 1;
+	}
+	len += strlen(bound) + 8;
+
+	if ((er = khttp_head(req, kresps[KRESP_CONTENT_TYPE], 
+	    "multipart/byteranges; boundary=%s", bound)) != KCGI_OK)
+		return er;
+	if ((er = khttp_head(req, kresps[KRESP_CONTENT_LENGTH], 
+	    "%" PRIu64, len)) != KCGI_OK)
+		return er;
+	if ((er = khttp_body_compress(req, 0)) != KCGI_OK)
+		return er;
+
+	for (i = 0; i < n; i++) {
+		plen = kxasprintf(&part, "\r\n--%s\r\n%s%s%s"
+			"Content-Range: bytes %" PRIu64 "-%" PRIu64 
+			"/%" PRIu64 "\r\n\r\n", bound,
+			ctype == NULL ? "" : "Content-Type: ",
+			ctype == NULL ? "" : ctype,
+			ctype == NULL ? "" : "\r\n",
+			ranges[i].first, ranges[i].last, sz);
+		if (plen == -1)
+			return KCGI_ENOMEM;
+		er = kdata_write(req->kdata, part, (size_t)plen);
+		free(part);
+		if (er != KCGI_OK)
+			return er;
+		er = kdata_sendfile(req->kdata, fd, 
+			(off_t)ranges[i].first, 
+			ranges[i].last - ranges[i].first + 1);
+		if (er != KCGI_OK)
+			return er;
+	}
+
+	if ((plen = kxasprintf(&part, "\r\n--%s--\r\n", bound)) == -1)
+		return KCGI_ENOMEM;
+	er = kdata_write(req->kdata, part, (size_t)plen);
+	free(part);
+	return er;
+}
+
 /*
  * Allocate a writer.
  * This only works if we haven't disabled allocation of writers yet via
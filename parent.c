@@ -16,7 +16,10 @@
  */
 #include "config.h"
 
+#include <sys/mman.h>
+
 #include <assert.h>
+#include <limits.h>
 #if HAVE_MD5
 # include <sys/types.h>
 # include <md5.h>
@@ -27,35 +30,31 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "kcgi.h"
 #include "extern.h"
 
 /*
- * Read a single kpair from the child.
- * This returns 0 if there are no more pairs to read (and eofok has been
- * set) and -1 if any errors occur (the parent should also exit with
- * server failure).
+ * Read a single kpair from the child's frame.
+ * All memory is allocated from the request's arena.
+ * If the request has a body shared with the child, values may point
+ * into it instead of being copied.
+ * This returns 0 if there are no more pairs to read and -1 if any
+ * errors occur (the parent should also exit with server failure).
  * Otherwise, it returns 1 and the pair is zeroed and filled in.
  */
 static int
-input(enum input *type, struct kpair *kp, int fd, 
-	enum kcgi_err *ke, int eofok, size_t mimesz, size_t keysz)
+input(enum input *type, struct kpair *kp, struct kframe *fr, 
+	enum kcgi_err *ke, size_t mimesz, size_t keysz,
+	struct kpriv *priv)
 {
-	size_t		 sz;
-	int		 rc;
+	size_t		 sz, valpos;
 	ptrdiff_t	 diff;
 
 	memset(kp, 0, sizeof(struct kpair));
 
-	rc = fullread(fd, type, sizeof(enum input), 1, ke);
-	if (rc == 0) {
-		if (eofok) 
-			return 0;
-		kutil_warnx(NULL, NULL, "unexpected EOF from child");
-		*ke = KCGI_FORM;
-		return (-1);
-	} else if (rc < 0) {
+	if ((*ke = kframe_read(fr, type, sizeof(enum input))) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "failed read kpair type");
 		return (-1);
 	}
@@ -69,20 +68,49 @@ input(enum input *type, struct kpair *kp, int fd,
 		return (-1);
 	}
 
-	*ke = fullreadword(fd, &kp->key);
+	*ke = kframe_readword(fr, &priv->arena, &kp->key);
 	if (*ke != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "failed read kpair key");
 		return (-1);
 	}
 
-	*ke = fullreadwordsz(fd, &kp->val, &kp->valsz);
-	if (*ke != KCGI_OK) {
+	/*
+	 * The value is either in the frame or, if its position isn't
+	 * SIZE_MAX, in the shared body.
+	 * The latter's NUL terminator is checked after the child exits,
+	 * as it might still change the contents.
+	 */
+
+	sz = sizeof(size_t);
+	if ((*ke = kframe_read(fr, &kp->valsz, sz)) != KCGI_OK ||
+	    (*ke = kframe_read(fr, &valpos, sz)) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "failed read kpair value");
 		return (-1);
 	}
 
+	if (valpos == SIZE_MAX) {
+		if (kp->valsz > fr->sz - fr->pos) {
+			kutil_warnx(NULL, NULL, "invalid kpair value");
+			*ke = KCGI_FORM;
+			return (-1);
+		}
+		kp->val = karena_alloc(&priv->arena, kp->valsz + 1);
+		if (kp->val == NULL) {
+			*ke = KCGI_ENOMEM;
+			return (-1);
+		}
+		kframe_read(fr, kp->val, kp->valsz);
+		kp->val[kp->valsz] = '\0';
+	} else if (priv->body == NULL || valpos > priv->bodysz || 
+	    kp->valsz > priv->bodysz - valpos) {
+		kutil_warnx(NULL, NULL, "invalid kpair value position");
+		*ke = KCGI_FORM;
+		return (-1);
+	} else
+		kp->val = priv->body + valpos;
+
 	sz = sizeof(enum kpairstate);
-	if (fullread(fd, &kp->state, sz, 0, ke) < 0) {
+	if ((*ke = kframe_read(fr, &kp->state, sz)) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "failed read kpair state");
 		return (-1);
 	} else if (kp->state > KPAIR_INVALID) {
@@ -91,7 +119,7 @@ input(enum input *type, struct kpair *kp, int fd,
 	}
 
 	sz = sizeof(enum kpairtype);
-	if (fullread(fd, &kp->type, sz, 0, ke) < 0) {
+	if ((*ke = kframe_read(fr, &kp->type, sz)) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "failed read kpair type");
 		return (-1);
 	} else if (kp->type > KPAIR__MAX) {
@@ -100,7 +128,7 @@ input(enum input *type, struct kpair *kp, int fd,
 	}
 
 	sz = sizeof(size_t);
-	if (fullread(fd, &kp->keypos, sz, 0, ke) < 0) {
+	if ((*ke = kframe_read(fr, &kp->keypos, sz)) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "failed read kpair position");
 		return (-1);
 	} else if (kp->keypos > keysz) {
@@ -112,21 +140,21 @@ input(enum input *type, struct kpair *kp, int fd,
 		switch (kp->type) {
 		case KPAIR_DOUBLE:
 			sz = sizeof(double);
-			if (fullread(fd, &kp->parsed.d, sz, 0, ke) > 0)
+			if ((*ke = kframe_read(fr, &kp->parsed.d, sz)) == KCGI_OK)
 				break;
 			kutil_warnx(NULL, NULL, 
 				"failed read kpair double");
 			return (-1);
 		case KPAIR_INTEGER:
 			sz = sizeof(int64_t);
-			if (fullread(fd, &kp->parsed.i, sz, 0, ke) > 0)
+			if ((*ke = kframe_read(fr, &kp->parsed.i, sz)) == KCGI_OK)
 				break;
 			kutil_warnx(NULL, NULL, 
 				"failed read kpair integer");
 			return (-1);
 		case KPAIR_STRING:
 			sz = sizeof(ptrdiff_t);
-			if (fullread(fd, &diff, sz, 0, ke) < 0) {
+			if ((*ke = kframe_read(fr, &diff, sz)) != KCGI_OK) {
 				kutil_warnx(NULL, NULL, 
 					"failed read kpair ptrdiff");
 				return (-1);
@@ -143,14 +171,14 @@ input(enum input *type, struct kpair *kp, int fd,
 			break;
 		}
 
-	*ke = fullreadword(fd, &kp->file);
+	*ke = kframe_readword(fr, &priv->arena, &kp->file);
 	if (*ke != KCGI_OK) {
 		kutil_warnx(NULL, NULL, 
 			"failed read kpair filename");
 		return (-1);
 	}
 
-	*ke = fullreadword(fd, &kp->ctype);
+	*ke = kframe_readword(fr, &priv->arena, &kp->ctype);
 	if (*ke != KCGI_OK) {
 		kutil_warnx(NULL, NULL, 
 			"failed read kpair content type");
@@ -158,7 +186,7 @@ input(enum input *type, struct kpair *kp, int fd,
 	}
 
 	sz = sizeof(size_t);
-	if (fullread(fd, &kp->ctypepos, sz, 0, ke) < 0) {
+	if ((*ke = kframe_read(fr, &kp->ctypepos, sz)) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, 
 			"failed read kpair MIME position");
 		return (-1);
@@ -168,7 +196,7 @@ input(enum input *type, struct kpair *kp, int fd,
 		return (-1);
 	}
 
-	*ke = fullreadword(fd, &kp->xcode);
+	*ke = kframe_readword(fr, &priv->arena, &kp->xcode);
 	if (*ke != KCGI_OK) {
 		kutil_warnx(NULL, NULL, 
 			"failed read kpair content transfer encoding");
@@ -178,53 +206,164 @@ input(enum input *type, struct kpair *kp, int fd,
 	return 1;
 }
 
+/*
+ * Append a zeroed pair to "kv", which has "*kvsz" pairs in use and
+ * room for "*kvmax".
+ * The array grows geometrically so that adding pairs is amortised
+ * constant time regardless of the number of fields.
+ * Returns the new pair or NULL on memory allocation failure.
+ */
 static struct kpair *
-kpair_expand(struct kpair **kv, size_t *kvsz)
+kpair_expand(struct kpair **kv, size_t *kvsz, size_t *kvmax)
 {
 	void	*pp;
+	size_t	 max;
+
+	if (*kvsz == *kvmax) {
+		max = *kvmax == 0 ? 16 : *kvmax * 2;
+		pp = kxreallocarray(*kv, max, sizeof(struct kpair));
+		if (pp == NULL)
+			return NULL;
+		*kv = pp;
+		*kvmax = max;
+	}
 
-	pp = kxreallocarray(*kv, *kvsz + 1, sizeof(struct kpair));
-	if (pp == NULL)
-		return NULL;
-
-	*kv = pp;
 	memset(&(*kv)[*kvsz], 0, sizeof(struct kpair));
 	(*kvsz)++;
 	return(&(*kv)[*kvsz - 1]);
 }
 
+/*
+ * Read whether the child spooled the body into one of the "spoolsz"
+ * files "spools" we gave it and, if so, take the file and map it as the
+ * body into which values may point.
+ * We size the file to what the child reports, so the mapping is always
+ * backed, and map it privately, so the child's later changes can't
+ * reach pages we've written.
+ * Returns KCGI_OK on success (spooled or not) or an error.
+ */
+static enum kcgi_err
+kworker_parent_spool(struct kframe *fr, struct kpriv *priv,
+	int *spools, size_t spoolsz)
+{
+	size_t		 id, sz;
+	enum kcgi_err	 ke;
+	void		*p;
+
+	if ((ke = kframe_read(fr, &id, sizeof(size_t))) != KCGI_OK) {
+		kutil_warnx(NULL, NULL, "failed read spool");
+		return ke;
+	} else if (id == SIZE_MAX)
+		return KCGI_OK;
+
+	if ((ke = kframe_read(fr, &sz, sizeof(size_t))) != KCGI_OK) {
+		kutil_warnx(NULL, NULL, "failed read spool size");
+		return ke;
+	} else if (id >= spoolsz || spools[id] == -1 || 
+	    priv->body != NULL || sz >= LLONG_MAX) {
+		kutil_warnx(NULL, NULL, "bad spool");
+		return KCGI_FORM;
+	}
+
+	priv->bodyfd = spools[id];
+	spools[id] = -1;
+
+	if (ftruncate(priv->bodyfd, sz + 1) == -1) {
+		kutil_warn(NULL, NULL, "ftruncate");
+		return KCGI_SYSTEM;
+	}
+	p = mmap(NULL, sz + 1, PROT_READ | PROT_WRITE, 
+		MAP_PRIVATE, priv->bodyfd, 0);
+	if (p == MAP_FAILED) {
+		kutil_warn(NULL, NULL, "mmap");
+		return KCGI_ENOMEM;
+	}
+
+	priv->body = p;
+	priv->bodysz = sz;
+	return KCGI_OK;
+}
+
+/*
+ * Seal the spooled body once the fields pointing into it are read.
+ * Writing the NUL terminator of each of these values (and of the body)
+ * gives us our own copy of its page, which the child can't change, then
+ * the body is made read-only.
+ * Returns KCGI_OK on success or an error.
+ */
+static enum kcgi_err
+kworker_parent_seal(struct kreq *r, struct kpriv *priv)
+{
+	size_t	 i;
+
+	for (i = 0; i < r->fieldsz; i++)
+		if (kpriv_body(priv, r->fields[i].val))
+			r->fields[i].val[r->fields[i].valsz] = '\0';
+	priv->body[priv->bodysz] = '\0';
+
+	if (mprotect(priv->body, priv->bodysz + 1, PROT_READ) == -1) {
+		kutil_warn(NULL, NULL, "mprotect");
+		return KCGI_SYSTEM;
+	}
+	return KCGI_OK;
+}
+
 /*
  * This is the parent kcgi process.
- * It spins on input from the child until all fields have been received.
+ * It reads the child's frame, which contains all fields.
  * These fields are sent from the child's output() function.
  * Each input field consists of the data and its validation state.
  * We build up the kpair arrays here with this data, then assign the
  * kpairs into named buckets.
+ * If the child may spool the body, "spools" are the "spoolsz" files it
+ * may have used: the one it did is taken (set to -1) for the request.
  */
 enum kcgi_err
-kworker_parent(int fd, struct kreq *r, int eofok, size_t mimesz)
+kworker_parent(int fd, struct kreq *r, size_t mimesz,
+	int *spools, size_t spoolsz)
 {
 	struct kpair	 kp;
 	struct kpair	*kpp;
+	struct kframe	 fr;
+	struct kpriv	*priv;
+	struct karena	*a;
 	enum krequ	 requ;
 	enum input	 type;
 	int		 rc;
 	enum kcgi_err	 ke;
 	size_t		 i, dgsz;
 
-	/* Pointers freed at "out" label. */
+	/* 
+	 * The frame is freed at the "out" label.
+	 * Everything else is allocated from the request arena.
+	 */
 
 	memset(&kp, 0, sizeof(struct kpair));
+	memset(&fr, 0, sizeof(struct kframe));
+
+	if ((priv = kpriv_alloc(r)) == NULL)
+		return KCGI_ENOMEM;
+	a = &priv->arena;
+
+	/* 
+	 * The child sends the whole request in a single frame.
+	 * Read it all at once, then parse from the buffer.
+	 */
+
+	if ((ke = kframe_recv(fd, &fr)) != KCGI_OK) {
+		kutil_warnx(NULL, NULL, "read request frame");
+		goto out;
+	}
 
 	/* Read all environment variables. */
 
-	if (fullread(fd, &r->envsz, sizeof(size_t), 0, &ke) < 0) {
+	if ((ke = kframe_read(&fr, &r->envsz, sizeof(size_t))) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "read environment size");
 		goto out;
 	}
 
 	if (r->envsz) {
-		r->envs = kxcalloc(r->envsz, sizeof(struct khead));
+		r->envs = karena_calloc(a, r->envsz, sizeof(struct khead));
 		if (r->envs == NULL) {
 			ke = KCGI_ENOMEM;
 			goto out;
@@ -232,11 +371,11 @@ kworker_parent(int fd, struct kreq *r, int eofok, size_t mimesz)
 	}
 
 	for (i = 0; i < r->envsz; i++) {
-		if ((ke = fullreadword(fd, &r->envs[i].key)) != KCGI_OK) {
+		if ((ke = kframe_readword(&fr, a, &r->envs[i].key)) != KCGI_OK) {
 			kutil_warnx(NULL, NULL, "read environment key");
 			goto out;
 		}
-		if ((ke = fullreadword(fd, &r->envs[i].val)) != KCGI_OK) {
+		if ((ke = kframe_readword(&fr, a, &r->envs[i].val)) != KCGI_OK) {
 			kutil_warnx(NULL, NULL, "read environment value");
 			goto out;
 		}
@@ -248,13 +387,13 @@ kworker_parent(int fd, struct kreq *r, int eofok, size_t mimesz)
 	 * request map.  (The last parsed wins.)
 	 */
 
-	if (fullread(fd, &r->reqsz, sizeof(size_t), 0, &ke) < 0) {
+	if ((ke = kframe_read(&fr, &r->reqsz, sizeof(size_t))) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "read request header size");
 		goto out;
 	}
 
 	if (r->reqsz) {
-		r->reqs = kxcalloc(r->reqsz, sizeof(struct khead));
+		r->reqs = karena_calloc(a, r->reqsz, sizeof(struct khead));
 		if (r->reqs == NULL) {
 			ke = KCGI_ENOMEM;
 			goto out;
@@ -262,15 +401,15 @@ kworker_parent(int fd, struct kreq *r, int eofok, size_t mimesz)
 	}
 
 	for (i = 0; i < r->reqsz; i++) {
-		if (fullread(fd, &requ, sizeof(enum krequ), 0, &ke) < 0) {
+		if ((ke = kframe_read(&fr, &requ, sizeof(enum krequ))) != KCGI_OK) {
 			kutil_warnx(NULL, NULL, "read request identifier");
 			goto out;
 		}
-		if ((ke = fullreadword(fd, &r->reqs[i].key)) != KCGI_OK) {
+		if ((ke = kframe_readword(&fr, a, &r->reqs[i].key)) != KCGI_OK) {
 			kutil_warnx(NULL, NULL, "read request key");
 			goto out;
 		}
-		if ((ke = fullreadword(fd, &r->reqs[i].val)) != KCGI_OK) {
+		if ((ke = kframe_readword(&fr, a, &r->reqs[i].val)) != KCGI_OK) {
 			kutil_warnx(NULL, NULL, "read request value");
 			goto out;
 		}
@@ -280,58 +419,63 @@ kworker_parent(int fd, struct kreq *r, int eofok, size_t mimesz)
 
 	/* Read remaining variables. */
 
-	if (fullread(fd, &r->method, sizeof(enum kmethod), 0, &ke) < 0) {
+	if ((ke = kframe_read(&fr, &r->method, sizeof(enum kmethod))) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "failed read request method");
 		goto out;
-	} else if (fullread(fd, &r->auth, sizeof(enum kauth), 0, &ke) < 0) {
+	} else if ((ke = kframe_read(&fr, &r->auth, sizeof(enum kauth))) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "failed read authorisation type");
 		goto out;
-	} else if ((ke = kworker_auth_parent(fd, &r->rawauth)) != KCGI_OK) {
+	} else if ((ke = kworker_auth_parent(&fr, a, &r->rawauth)) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "failed read raw authorisation");
 		goto out;
-	} else if (fullread(fd, &r->scheme, sizeof(enum kscheme), 0, &ke) < 0) {
+	} else if ((ke = kframe_read(&fr, &r->scheme, sizeof(enum kscheme))) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "failed read scheme");
 		goto out;
-	} else if ((ke = fullreadword(fd, &r->remote)) != KCGI_OK) {
+	} else if ((ke = kframe_readword(&fr, a, &r->remote)) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "failed read remote");
 		goto out;
-	} else if ((ke = fullreadword(fd, &r->fullpath)) != KCGI_OK) {
+	} else if ((ke = kframe_readword(&fr, a, &r->fullpath)) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "failed read fullpath");
 		goto out;
-	} else if ((ke = fullreadword(fd, &r->suffix)) != KCGI_OK) {
+	} else if ((ke = kframe_readword(&fr, a, &r->suffix)) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "failed read suffix");
 		goto out;
-	} else if ((ke = fullreadword(fd, &r->pagename)) != KCGI_OK) {
+	} else if ((ke = kframe_readword(&fr, a, &r->pagename)) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "failed read page part");
 		goto out;
-	} else if ((ke = fullreadword(fd, &r->path)) != KCGI_OK) {
+	} else if ((ke = kframe_readword(&fr, a, &r->path)) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "failed read path part");
 		goto out;
-	} else if ((ke = fullreadword(fd, &r->pname)) != KCGI_OK) {
+	} else if ((ke = kframe_readword(&fr, a, &r->pname)) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "failed read script name");
 		goto out;
-	} else if ((ke = fullreadword(fd, &r->host)) != KCGI_OK) {
+	} else if ((ke = kframe_readword(&fr, a, &r->host)) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "failed read host name");
 		goto out;
-	} else if (fullread(fd, &r->port, sizeof(uint16_t), 0, &ke) < 0) {
+	} else if ((ke = kframe_read(&fr, &r->port, sizeof(uint16_t))) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "failed read port");
 		goto out;
-	} else if (fullread(fd, &dgsz, sizeof(size_t), 0, &ke) < 0) {
+	} else if ((ke = kframe_read(&fr, &dgsz, sizeof(size_t))) != KCGI_OK) {
 		kutil_warnx(NULL, NULL, "failed read digest length");
 		goto out;
 	} else if (dgsz == MD5_DIGEST_LENGTH) {
 		/* This is a binary value. */
-		if ((r->rawauth.digest = kxmalloc(dgsz)) == NULL)
+		if ((r->rawauth.digest = karena_alloc(a, dgsz)) == NULL) {
+			ke = KCGI_ENOMEM;
 			goto out;
-		if (fullread(fd, r->rawauth.digest, dgsz, 0, &ke) < 0) {
+		}
+		if ((ke = kframe_read(&fr, r->rawauth.digest, dgsz)) != KCGI_OK) {
 			kutil_warnx(NULL, NULL, "failed read digest");
 			goto out;
 		}
 	}
 
+	if ((ke = kworker_parent_spool(&fr, priv, spools, spoolsz)) != KCGI_OK)
+		goto out;
+
 	for (;;) {
-		rc = input(&type, &kp, fd, &ke, 
-			eofok, mimesz, r->keysz);
+		rc = input(&type, &kp, &fr, &ke, 
+			mimesz, r->keysz, priv);
 		if (rc < 0)
 			goto out;
 		else if (rc == 0)
@@ -346,8 +490,10 @@ kworker_parent(int fd, struct kreq *r, int eofok, size_t mimesz)
 
 		assert(type < IN__MAX);
 		kpp = type == IN_COOKIE ?
-			kpair_expand(&r->cookies, &r->cookiesz) :
-			kpair_expand(&r->fields, &r->fieldsz);
+			kpair_expand(&r->cookies, 
+				&r->cookiesz, &priv->cookiemax) :
+			kpair_expand(&r->fields, 
+				&r->fieldsz, &priv->fieldmax);
 
 		if (kpp == NULL) {
 			ke = KCGI_ENOMEM;
@@ -359,6 +505,10 @@ kworker_parent(int fd, struct kreq *r, int eofok, size_t mimesz)
 
 	assert(rc == 0);
 
+	if (priv->bodyfd != -1 && 
+	    (ke = kworker_parent_seal(r, priv)) != KCGI_OK)
+		goto out;
+
 	/*
 	 * Now that the field and cookie arrays are fixed and not going
 	 * to be reallocated any more, we run through both arrays and
@@ -396,13 +546,10 @@ kworker_parent(int fd, struct kreq *r, int eofok, size_t mimesz)
 		}
 	}
 
+	kframe_free(&fr);
 	return KCGI_OK;
 out:
 	assert(ke != KCGI_OK);
-	free(kp.key);
-	free(kp.val);
-	free(kp.file);
-	free(kp.ctype);
-	free(kp.xcode);
+	kframe_free(&fr);
 	return ke;
 }
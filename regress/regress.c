@@ -17,6 +17,8 @@
 #include "../config.h"
 
 #include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <netinet/in.h>
 
@@ -25,6 +27,9 @@
 # include <err.h>
 #endif
 #include <errno.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -32,6 +37,7 @@
 
 #include <curl/curl.h>
 
+#include "../kcgi.h"
 #include "../kcgiregress.h"
 #include "regress.h"
 
@@ -128,3 +134,364 @@ regress_fcgi(cb_parent parent, cb_child child)
 
 	return kcgi_regress_fcgi(doparent, parent, dochild, child);
 }
+
+/*
+ * Byte "i" of a test body, so that any part of a body can be generated
+ * and checked without keeping a copy.
+ */
+char
+regress_bodychar(size_t i)
+{
+
+	return "abcdefghijklmnopqrstuvwxyz\n"[(i * 7 + i / 27) % 27];
+}
+
+/*
+ * Read exactly "sz" bytes into "buf".
+ * Return zero on failure (including end of file), non-zero on success.
+ */
+int
+regress_readall(int fd, void *buf, size_t sz)
+{
+	ssize_t	 ssz;
+	size_t	 pos;
+
+	for (pos = 0; pos < sz; pos += (size_t)ssz)
+		if ((ssz = read(fd, (char *)buf + pos, sz - pos)) <= 0)
+			return 0;
+	return 1;
+}
+
+/*
+ * Write all "sz" bytes of "buf".
+ * Return zero on failure, non-zero on success.
+ */
+int
+regress_writeall(int fd, const void *buf, size_t sz)
+{
+	ssize_t	 ssz;
+	size_t	 pos;
+
+	for (pos = 0; pos < sz; pos += (size_t)ssz)
+		if ((ssz = write(fd, (const char *)buf + pos, sz - pos)) <= 0)
+			return 0;
+	return 1;
+}
+
+/*
+ * The following act as a web server speaking FastCGI directly over a
+ * socket, for tests of what the regression framework can't do with a
+ * connection per request: kept connections, multiplexing, and so on.
+ * Requests are encoded into a caller's buffer, which must be large
+ * enough, then written with regress_writeall().
+ */
+
+/*
+ * Append a record of "type" for request "rid" with content "buf" of
+ * "sz" bytes (at most UINT16_MAX) and "pad" bytes of padding (at most
+ * 255) to "out" at "pos".
+ * Returns the new position.
+ */
+size_t
+regress_fcgi_record(char *out, size_t pos, int type, uint16_t rid,
+	const void *buf, size_t sz, size_t pad)
+{
+
+	out[pos++] = 1;
+	out[pos++] = type;
+	out[pos++] = (rid >> 8) & 0xff;
+	out[pos++] = rid & 0xff;
+	out[pos++] = (sz >> 8) & 0xff;
+	out[pos++] = sz & 0xff;
+	out[pos++] = pad;
+	out[pos++] = 0;
+	if (sz > 0)
+		memcpy(out + pos, buf, sz);
+	pos += sz;
+	memset(out + pos, 'P', pad);
+	return pos + pad;
+}
+
+/*
+ * Append the name-value pair "key" and "val" (each shorter than 128
+ * bytes) to "out" at "pos".
+ * Returns the new position.
+ */
+static size_t
+regress_fcgi_pair(char *out, size_t pos, const char *key, const char *val)
+{
+	size_t	 ksz = strlen(key), vsz = strlen(val);
+
+	out[pos++] = ksz;
+	out[pos++] = vsz;
+	memcpy(out + pos, key, ksz);
+	memcpy(out + pos + ksz, val, vsz);
+	return pos + ksz + vsz;
+}
+
+/*
+ * Append a parameter record with the single pair "key" and "val" and
+ * "pad" bytes of padding.
+ * Returns the new position.
+ */
+size_t
+regress_fcgi_param(char *out, size_t pos, uint16_t rid,
+	const char *key, const char *val, size_t pad)
+{
+	char	 buf[260];
+
+	return regress_fcgi_record(out, pos, 4, rid, buf,
+		regress_fcgi_pair(buf, 0, key, val), pad);
+}
+
+/*
+ * Append the record beginning request "rid" in the responder role,
+ * setting FCGI_KEEP_CONN if "keep".
+ * Returns the new position.
+ */
+size_t
+regress_fcgi_begin(char *out, size_t pos, uint16_t rid, int keep)
+{
+	char	 bgn[8];
+
+	memset(bgn, 0, sizeof(bgn));
+	bgn[1] = 1; /* FCGI_RESPONDER */
+	bgn[2] = keep ? 1 : 0; /* FCGI_KEEP_CONN */
+	return regress_fcgi_record(out, pos, 1, rid, bgn, sizeof(bgn), 0);
+}
+
+/*
+ * Append a parameter record for a GET request of "path".
+ * Returns the new position.
+ */
+size_t
+regress_fcgi_params(char *out, size_t pos, uint16_t rid, const char *path)
+{
+	char	 buf[1024];
+	size_t	 sz = 0;
+
+	sz = regress_fcgi_pair(buf, sz, "REQUEST_METHOD", "GET");
+	sz = regress_fcgi_pair(buf, sz, "PATH_INFO", path);
+	sz = regress_fcgi_pair(buf, sz, "SCRIPT_NAME", "/cgi-bin/test");
+	sz = regress_fcgi_pair(buf, sz, "SERVER_PORT", "80");
+	sz = regress_fcgi_pair(buf, sz, "HTTP_HOST", "localhost");
+	sz = regress_fcgi_pair(buf, sz, "REMOTE_ADDR", "127.0.0.1");
+	return regress_fcgi_record(out, pos, 4, rid, buf, sz, 0);
+}
+
+/*
+ * Append the records ending the parameters and (empty) body of request
+ * "rid".
+ * Returns the new position.
+ */
+size_t
+regress_fcgi_end(char *out, size_t pos, uint16_t rid)
+{
+
+	pos = regress_fcgi_record(out, pos, 4, rid, NULL, 0, 0);
+	return regress_fcgi_record(out, pos, 5, rid, NULL, 0, 0);
+}
+
+/*
+ * Append a complete GET request "rid" of "path", setting
+ * FCGI_KEEP_CONN if "keep".
+ * Returns the new position.
+ */
+size_t
+regress_fcgi_get(char *out, size_t pos, 
+	uint16_t rid, const char *path, int keep)
+{
+
+	pos = regress_fcgi_begin(out, pos, rid, keep);
+	pos = regress_fcgi_params(out, pos, rid, path);
+	return regress_fcgi_end(out, pos, rid);
+}
+
+/*
+ * Read the response to request "rid", which must be the next one on
+ * "fd", until its end-request record.
+ * Returns its standard output (NUL-terminated, of size "sz") or NULL
+ * on failure, including records of other types or requests.
+ * The result must be freed.
+ */
+char *
+regress_fcgi_response(int fd, uint16_t rid, size_t *sz)
+{
+	unsigned char	 hdr[8];
+	char		 pad[255], *out = NULL, *pp;
+	size_t		 outsz = 0, outmax = 0, len;
+
+	for (;;) {
+		if (!regress_readall(fd, hdr, 8) ||
+		    ((hdr[2] << 8) | hdr[3]) != rid)
+			break;
+		len = (hdr[4] << 8) | hdr[5];
+		if (hdr[1] == 3) {
+			if (!regress_readall(fd, pad, 8 + hdr[6]))
+				break;
+			if (out == NULL && (out = malloc(1)) == NULL)
+				break;
+			out[outsz] = '\0';
+			*sz = outsz;
+			return out;
+		}
+		if (hdr[1] != 6)
+			break;
+		if (outsz + len + 1 > outmax) {
+			outmax = (outsz + len + 1) * 2;
+			if ((pp = realloc(out, outmax)) == NULL)
+				break;
+			out = pp;
+		}
+		if (!regress_readall(fd, out + outsz, len) ||
+		    !regress_readall(fd, pad, hdr[6]))
+			break;
+		outsz += len;
+	}
+
+	free(out);
+	return NULL;
+}
+
+/*
+ * Find the body following the headers in response output "out" of
+ * "sz" bytes.
+ * Returns the body, of size "bodysz", or NULL if there's none.
+ */
+const char *
+regress_fcgi_body(const char *out, size_t sz, size_t *bodysz)
+{
+	size_t	 i;
+
+	for (i = 0; i + 4 <= sz; i++)
+		if (memcmp(out + i, "\r\n\r\n", 4) == 0) {
+			*bodysz = sz - i - 4;
+			return out + i + 4;
+		}
+	return NULL;
+}
+
+/*
+ * Bind and listen on a new UNIX socket, whose address is set in "un".
+ * The caller should unlink "un->sun_path" when done.
+ * Returns the socket or -1 on failure.
+ */
+int
+regress_fcgi_unix(struct sockaddr_un *un)
+{
+	char	 sfn[] = "/tmp/kfcgi.XXXXXXXXXX";
+	int	 fd;
+
+	if ((fd = mkstemp(sfn)) == -1) {
+		perror(sfn);
+		return -1;
+	} 
+	close(fd);
+	unlink(sfn);
+
+	memset(un, 0, sizeof(struct sockaddr_un));
+	un->sun_family = AF_UNIX;
+	strlcpy(un->sun_path, sfn, sizeof(un->sun_path));
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+		perror("socket");
+		return -1;
+	} else if (bind(fd, (struct sockaddr *)un, 
+	    sizeof(struct sockaddr_un)) == -1 || listen(fd, 5) == -1) {
+		perror(sfn);
+		close(fd);
+		unlink(sfn);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Start a FastCGI application running "server" with the listening
+ * socket "fd" as its standard input, as a FastCGI server would.
+ * The socket is closed in the caller.
+ * Returns the application's process or -1 on failure.
+ */
+pid_t
+regress_fcgi_fork(int fd, int (*server)(void))
+{
+	pid_t	 pid;
+
+	if ((pid = fork()) == -1) {
+		perror("fork");
+	} else if (pid == 0) {
+		if (dup2(fd, STDIN_FILENO) == -1)
+			_exit(EXIT_FAILURE);
+		close(fd);
+		_exit(server() ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	close(fd);
+	return pid;
+}
+
+/*
+ * Connect to the application at "sa" of length "salen".
+ * Reads time out so that tests don't hang if the application is stuck.
+ * Returns the connection or -1 on failure.
+ */
+int
+regress_fcgi_dial(const struct sockaddr *sa, size_t salen)
+{
+	struct timeval	 tv;
+	int		 fd;
+
+	if ((fd = socket(sa->sa_family, SOCK_STREAM, 0)) == -1) {
+		perror("socket");
+		return -1;
+	}
+
+	tv.tv_sec = 10;
+	tv.tv_usec = 0;
+	if (setsockopt(fd, SOL_SOCKET, 
+	    SO_RCVTIMEO, &tv, sizeof(tv)) == -1 ||
+	    connect(fd, sa, (socklen_t)salen) == -1) {
+		perror("connect");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/*
+ * Stop and reap the application "pid" started by regress_fcgi_fork().
+ */
+void
+regress_fcgi_kill(pid_t pid)
+{
+
+	if (pid == -1)
+		return;
+	kill(pid, SIGTERM);
+	waitpid(pid, NULL, 0);
+}
+
+/*
+ * A FastCGI application answering each request with its full path.
+ * Returns zero on failure, non-zero on success.
+ */
+int
+regress_fcgi_echo(void)
+{
+	struct kfcgi	*fcgi;
+	struct kreq	 r;
+	const char	*page = "index";
+
+	if (khttp_fcgi_init(&fcgi, NULL, 0, &page, 1, 0) != KCGI_OK)
+		return 0;
+	while (khttp_fcgi_parse(fcgi, &r) == KCGI_OK) {
+		khttp_head(&r, kresps[KRESP_STATUS], 
+			"%s", khttps[KHTTP_200]);
+		khttp_head(&r, kresps[KRESP_CONTENT_TYPE], 
+			"%s", kmimetypes[KMIME_TEXT_PLAIN]);
+		khttp_body(&r);
+		khttp_puts(&r, r.fullpath);
+		khttp_free(&r);
+	}
+	khttp_fcgi_free(fcgi);
+	return 1;
+}
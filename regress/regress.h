@@ -29,9 +29,34 @@ struct	log_line {
 typedef int	(*cb_child)(void);
 typedef int	(*cb_parent)(CURL *);
 
+struct	sockaddr;
+struct	sockaddr_un;
+
 int		  log_line_parse(char *, struct log_line *);
 
 int		  regress_cgi(cb_parent, cb_child);
 int		  regress_fcgi(cb_parent, cb_child);
 
+char		  regress_bodychar(size_t);
+int		  regress_readall(int, void *, size_t);
+int		  regress_writeall(int, const void *, size_t);
+
+size_t		  regress_fcgi_begin(char *, size_t, uint16_t, int);
+const char	 *regress_fcgi_body(const char *, size_t, size_t *);
+int		  regress_fcgi_dial(const struct sockaddr *, size_t);
+int		  regress_fcgi_echo(void);
+size_t		  regress_fcgi_end(char *, size_t, uint16_t);
+pid_t		  regress_fcgi_fork(int, int (*)(void));
+size_t		  regress_fcgi_get(char *, size_t, 
+			uint16_t, const char *, int);
+void		  regress_fcgi_kill(pid_t);
+size_t		  regress_fcgi_param(char *, size_t, uint16_t,
+			const char *, const char *, size_t);
+size_t		  regress_fcgi_params(char *, size_t, 
+			uint16_t, const char *);
+size_t		  regress_fcgi_record(char *, size_t, int, uint16_t,
+			const void *, size_t, size_t);
+char		 *regress_fcgi_response(int, uint16_t, size_t *);
+int		  regress_fcgi_unix(struct sockaddr_un *);
+
 #endif
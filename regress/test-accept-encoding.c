@@ -0,0 +1,212 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "../kcgi.h"
+#include "regress.h"
+
+/*
+ * Content coding negotiation with Accept-Encoding quality values.
+ * The preferred codings depend on which are compiled in.
+ * Each is run again with a minimum size the body is under, so it's
+ * never compressed, and with a content type not to compress.
+ * Either way, the response varies on Accept-Encoding unless the type
+ * isn't compressed.
+ */
+
+#if HAVE_ZSTD
+# define PREFERRED	"zstd"
+#elif HAVE_BROTLI
+# define PREFERRED	"br"
+#else
+# define PREFERRED	"gzip"
+#endif
+
+#if HAVE_ZSTD
+# define NOTGZIP	"zstd"
+#elif HAVE_BROTLI
+# define NOTGZIP	"br"
+#else
+# define NOTGZIP	NULL
+#endif
+
+struct	test {
+	const char	*accept; /* Accept-Encoding */
+	const char	*coding; /* Content-Encoding or NULL */
+};
+
+static const struct test tests[] = {
+	{ "gzip", "gzip" },
+	{ "gzip;q=0", NULL },
+	{ "gzip; q=0.000", NULL },
+	{ "GZIP;Q=1.000", "gzip" },
+	{ "x-gzip", "gzip" },
+	{ "gzip;q=0.001", "gzip" },
+	{ "deflate, gzip;q=0.5", "gzip" },
+	{ "identity", NULL },
+	{ "foo, bar;q=1", NULL },
+	{ "*", PREFERRED },
+	{ "*;q=0", NULL },
+	{ "*;q=0.1, gzip;q=0", NOTGZIP },
+	{ "br;q=0.9, zstd;q=0.9, gzip", "gzip" },
+#if HAVE_BROTLI
+	{ "gzip;q=0.5, br", "br" },
+	{ "br;q=0.5, gzip;q=0.4", "br" },
+#endif
+#if HAVE_ZSTD
+	{ "gzip, zstd;q=0.8", "gzip" },
+	{ "zstd", "zstd" },
+#endif
+};
+
+enum	mode {
+	MODE_NEGOTIATE, /* compress if acceptable */
+	MODE_MINSZ, /* defer, but under the minimum size */
+	MODE_SKIP, /* content type not compressed */
+	MODE__MAX
+};
+
+static const struct test *test;
+static enum mode mode;
+static char	 coding[32];
+static int	 vary;
+
+static size_t
+headcb(char *buf, size_t sz, size_t nm, void *dat)
+{
+	size_t	 len = nm * sz;
+
+	if (len > 18 && strncasecmp(buf, "Content-Encoding: ", 18) == 0) {
+		len -= 18;
+		while (len > 0 && (buf[18 + len - 1] == '\r' ||
+		       buf[18 + len - 1] == '\n'))
+			len--;
+		if (len >= sizeof(coding))
+			len = sizeof(coding) - 1;
+		memcpy(coding, buf + 18, len);
+		coding[len] = '\0';
+	} else if (len >= 22 && 
+	    strncasecmp(buf, "Vary: Accept-Encoding", 21) == 0 &&
+	    (buf[21] == '\r' || buf[21] == '\n'))
+		vary++;
+	return nm * sz;
+}
+
+static size_t
+doign(void *ptr, size_t sz, size_t nm, void *arg)
+{
+
+	return sz * nm;
+}
+
+static int
+parent(CURL *curl)
+{
+	struct curl_slist	*list;
+	char			 buf[128];
+	const char		*want;
+	int			 rc;
+
+	coding[0] = '\0';
+	vary = 0;
+	snprintf(buf, sizeof(buf), "Accept-Encoding: %s", test->accept);
+	if ((list = curl_slist_append(NULL, buf)) == NULL)
+		return 0;
+
+	curl_easy_setopt(curl, CURLOPT_URL, 
+		"http://localhost:17123/");
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, headcb);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, doign);
+	rc = curl_easy_perform(curl) == CURLE_OK;
+	curl_slist_free_all(list);
+	if (!rc)
+		return 0;
+
+	want = mode == MODE_NEGOTIATE ? test->coding : NULL;
+	if (want == NULL ? coding[0] != '\0' : strcmp(coding, want) != 0) {
+		warnx("%s: expected %s, have %s", test->accept, 
+			want == NULL ? "(none)" : want,
+			coding[0] == '\0' ? "(none)" : coding);
+		return 0;
+	}
+	if (vary != (mode != MODE_SKIP)) {
+		warnx("%s: expected %d Vary, have %d", test->accept,
+			mode != MODE_SKIP, vary);
+		return 0;
+	}
+	return 1;
+}
+
+static int
+child(void)
+{
+	struct kreq	 r;
+	struct kopts	 opts;
+	const char 	*page = "index";
+	const enum kmime skip = KMIME_TEXT_PLAIN;
+
+	memset(&opts, 0, sizeof(struct kopts));
+	opts.sndbufsz = -1;
+	if (mode == MODE_MINSZ)
+		opts.compminsz = 1024;
+	if (mode == MODE_SKIP) {
+		opts.compskip = &skip;
+		opts.compskipsz = 1;
+	}
+
+	if (khttp_parsex(&r, ksuffixmap, kmimetypes, KMIME__MAX,
+	    NULL, 0, &page, 1, KMIME_TEXT_HTML, 0, 
+	    NULL, NULL, 0, &opts) != KCGI_OK)
+		return 0;
+
+	khttp_head(&r, kresps[KRESP_STATUS], 
+		"%s", khttps[KHTTP_200]);
+	khttp_head(&r, kresps[KRESP_CONTENT_TYPE], 
+		"%s", kmimetypes[KMIME_TEXT_PLAIN]);
+	khttp_body(&r);
+	khttp_puts(&r, "hello, world");
+	khttp_free(&r);
+	return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t	 i;
+
+	for (mode = 0; mode < MODE__MAX; mode++)
+		for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+			test = &tests[i];
+			if (!regress_cgi(parent, child))
+				return EXIT_FAILURE;
+		}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,181 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "../kcgi.h"
+#include "regress.h"
+
+/*
+ * Compression tunables in struct kopts: the minimum size, below which
+ * output isn't compressed unless it overflows the output buffer; the
+ * content types not to compress; and the compression level.
+ */
+
+struct	test {
+	ssize_t		 sndbufsz; /* output buffer size */
+	size_t		 minsz; /* minimum compressed size */
+	int		 level; /* compression level */
+	int		 skip; /* skip KMIME_IMAGE_PNG */
+	enum kmime	 mime; /* response content type */
+	size_t		 bodysz; /* response size */
+	int		 compressed; /* expect compression */
+};
+
+static const struct test tests[] = {
+	{ -1, 1024, 0, 0, KMIME_TEXT_PLAIN, 5, 0 },
+	{ -1, 1024, 0, 0, KMIME_TEXT_PLAIN, 0, 0 },
+	{ -1, 1024, 0, 0, KMIME_TEXT_PLAIN, 1024, 1 },
+	{ -1, 1024, 0, 0, KMIME_TEXT_PLAIN, 4000, 1 },
+	{ 256, 1024, 0, 0, KMIME_TEXT_PLAIN, 700, 1 },
+	{ 256, 1024, 0, 0, KMIME_TEXT_PLAIN, 100, 0 },
+	{ 0, 1024, 0, 0, KMIME_TEXT_PLAIN, 5, 1 },
+	{ -1, 0, 0, 1, KMIME_IMAGE_PNG, 4000, 0 },
+	{ -1, 0, 0, 1, KMIME_TEXT_PLAIN, 4000, 1 },
+	{ -1, 1024, 0, 1, KMIME_IMAGE_PNG, 4000, 0 },
+	{ -1, 0, 1, 0, KMIME_TEXT_PLAIN, 100000, 1 },
+	{ -1, 0, 100, 0, KMIME_TEXT_PLAIN, 100000, 1 },
+};
+
+static const struct test *test;
+static int	 encoded;
+
+static size_t
+headcb(char *buf, size_t sz, size_t nm, void *dat)
+{
+
+	if (nm * sz >= 17 && 
+	    strncasecmp(buf, "Content-Encoding:", 17) == 0)
+		encoded = 1;
+	return nm * sz;
+}
+
+static size_t
+bufcb(void *contents, size_t sz, size_t nm, void *dat)
+{
+	struct kcgi_buf	*buf = dat;
+
+	if (kcgi_buf_write(contents, nm * sz, buf) != KCGI_OK)
+		return 0;
+	return nm * sz;
+}
+
+static int
+parent(CURL *curl)
+{
+	struct kcgi_buf	 buf;
+	size_t		 i;
+	int		 rc = 0;
+
+	memset(&buf, 0, sizeof(struct kcgi_buf));
+	encoded = 0;
+
+	curl_easy_setopt(curl, CURLOPT_URL, 
+		"http://localhost:17123/");
+	curl_easy_setopt(curl, CURLOPT_ENCODING, "gzip");
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, headcb);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, bufcb);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buf);
+	if (curl_easy_perform(curl) != CURLE_OK) {
+		warnx("curl_easy_perform");
+		goto out;
+	}
+
+	if (encoded != test->compressed) {
+		warnx("test %zu: expected %scompressed", 
+			(size_t)(test - tests), 
+			test->compressed ? "" : "un");
+		goto out;
+	}
+	if (buf.sz != test->bodysz) {
+		warnx("test %zu: bad size: %zu", 
+			(size_t)(test - tests), buf.sz);
+		goto out;
+	}
+	for (i = 0; i < buf.sz; i++)
+		if (buf.buf[i] != regress_bodychar(i)) {
+			warnx("test %zu: bad content", 
+				(size_t)(test - tests));
+			goto out;
+		}
+	rc = 1;
+out:
+	free(buf.buf);
+	return rc;
+}
+
+static int
+child(void)
+{
+	struct kreq	 r;
+	struct kopts	 opts;
+	const char 	*page = "index";
+	const enum kmime skip = KMIME_IMAGE_PNG;
+	size_t		 i;
+
+	memset(&opts, 0, sizeof(struct kopts));
+	opts.sndbufsz = test->sndbufsz;
+	opts.compminsz = test->minsz;
+	opts.complevel = test->level;
+	if (test->skip) {
+		opts.compskip = &skip;
+		opts.compskipsz = 1;
+	}
+
+	if (khttp_parsex(&r, ksuffixmap, kmimetypes, KMIME__MAX,
+	    NULL, 0, &page, 1, KMIME_TEXT_HTML, 0, 
+	    NULL, NULL, 0, &opts) != KCGI_OK)
+		return 0;
+
+	khttp_head(&r, kresps[KRESP_STATUS], 
+		"%s", khttps[KHTTP_200]);
+	khttp_head(&r, kresps[KRESP_CONTENT_TYPE], 
+		"%s", kmimetypes[test->mime]);
+	khttp_body(&r);
+
+	/* Write in pieces to exercise the buffer. */
+
+	for (i = 0; i < test->bodysz; i++)
+		khttp_putc(&r, regress_bodychar(i));
+	khttp_free(&r);
+	return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t	 i;
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		test = &tests[i];
+		if (!regress_cgi(parent, child))
+			return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,294 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+#include <zlib.h>
+
+#include "../kcgi.h"
+#include "regress.h"
+
+/*
+ * Content-Length added to held responses with the "fullbufsz" option
+ * of struct kopts.
+ */
+
+struct	test {
+	size_t		 fullbufsz; /* kopts "fullbufsz" */
+	int		 etag; /* kopts "etag" */
+	int		 post; /* POST instead of GET */
+	int		 gzip; /* accept gzip */
+	int		 len; /* set our own Content-Length */
+	enum khttp	 status; /* status or KHTTP__MAX for none */
+	size_t		 bodysz; /* response size */
+	long		 code; /* expected status */
+	int		 haslen; /* expect Content-Length */
+	int		 hastag; /* expect ETag */
+};
+
+static const struct test tests[] = {
+	{ 1024 * 1024, 0, 0, 0, 0, KHTTP__MAX, 100000, 200, 1, 0 },
+	{ 1024 * 1024, 0, 0, 0, 0, KHTTP_200, 0, 200, 1, 0 },
+	{ 1024 * 1024, 0, 0, 0, 0, KHTTP_404, 100000, 404, 1, 0 },
+	{ 1024 * 1024, 0, 1, 0, 0, KHTTP_200, 100000, 200, 1, 0 },
+	{ 1024 * 1024, 0, 0, 0, 1, KHTTP_200, 100000, 200, 1, 0 },
+	{ 1024 * 1024, 0, 0, 0, 0, KHTTP_204, 0, 204, 0, 0 },
+	{ 1024 * 1024, 0, 0, 1, 0, KHTTP_200, 100000, 200, 1, 0 },
+	{ 1024 * 1024, 0, 0, 1, 0, KHTTP_200, 10, 200, 1, 0 },
+	{ 1024 * 1024, 1, 0, 0, 0, KHTTP_200, 100000, 200, 1, 1 },
+	{ 1024 * 1024, 1, 0, 0, 0, KHTTP_200, 100000, 304, 0, 1 },
+	{ 1024 * 1024, 1, 0, 1, 0, KHTTP_200, 100000, 200, 1, 1 },
+	{ 65536, 0, 0, 0, 0, KHTTP_200, 100000, 200, 0, 0 },
+	{ 65536, 0, 0, 1, 0, KHTTP_200, 100000, 200, 0, 0 },
+	{ 65536, 1, 0, 0, 0, KHTTP_200, 100000, 200, 0, 0 },
+	{ 0, 0, 0, 0, 0, KHTTP_200, 100000, 200, 0, 0 },
+};
+
+static const struct test *test;
+static char	 etag[64]; /* ETag of current response */
+static char	 lasttag[64]; /* ETag of last response */
+static long long contlen; /* Content-Length or -1 */
+static int	 gzipped; /* Content-Encoding: gzip */
+
+static size_t
+headcb(char *buf, size_t sz, size_t nm, void *dat)
+{
+	size_t	 len = nm * sz;
+
+	if (len > 16 && strncasecmp(buf, "Content-Length: ", 16) == 0)
+		contlen = strtoll(buf + 16, NULL, 10);
+	else if (len > 22 && 
+	    strncasecmp(buf, "Content-Encoding: gzip", 22) == 0)
+		gzipped = 1;
+	else if (len > 6 && strncasecmp(buf, "ETag: ", 6) == 0) {
+		buf += 6;
+		len -= 6;
+		while (len > 0 && 
+		       (buf[len - 1] == '\r' || buf[len - 1] == '\n'))
+			len--;
+		if (len >= sizeof(etag))
+			len = sizeof(etag) - 1;
+		memcpy(etag, buf, len);
+		etag[len] = '\0';
+	}
+	return nm * sz;
+}
+
+static size_t
+bufcb(void *contents, size_t sz, size_t nm, void *dat)
+{
+	struct kcgi_buf	*buf = dat;
+
+	if (kcgi_buf_write(contents, nm * sz, buf) != KCGI_OK)
+		return 0;
+	return nm * sz;
+}
+
+/*
+ * Inflate the gzip body in "buf" into "out", which must be freed.
+ * Returns zero on failure.
+ */
+static int
+gunzip(const struct kcgi_buf *buf, struct kcgi_buf *out)
+{
+	z_stream	 z;
+	char		 tmp[8192];
+	int		 rc;
+
+	memset(&z, 0, sizeof(z_stream));
+	if (inflateInit2(&z, 16 + MAX_WBITS) != Z_OK)
+		return 0;
+	z.next_in = (Bytef *)buf->buf;
+	z.avail_in = buf->sz;
+	do {
+		z.next_out = (Bytef *)tmp;
+		z.avail_out = sizeof(tmp);
+		rc = inflate(&z, Z_NO_FLUSH);
+		if (rc != Z_OK && rc != Z_STREAM_END)
+			break;
+		if (kcgi_buf_write(tmp, 
+		    sizeof(tmp) - z.avail_out, out) != KCGI_OK)
+			break;
+	} while (rc != Z_STREAM_END);
+	inflateEnd(&z);
+	return rc == Z_STREAM_END;
+}
+
+static int
+parent(CURL *curl)
+{
+	struct curl_slist	*list = NULL;
+	struct kcgi_buf		 buf, dec;
+	const struct kcgi_buf	*body = &buf;
+	char			 hbuf[128];
+	size_t			 i, n = test - tests;
+	long			 code;
+	int			 rc = 0;
+
+	memset(&buf, 0, sizeof(struct kcgi_buf));
+	memset(&dec, 0, sizeof(struct kcgi_buf));
+	etag[0] = '\0';
+	contlen = -1;
+	gzipped = 0;
+
+	/* Send back the last tag if we expect to match it. */
+
+	if (test->code == 304) {
+		snprintf(hbuf, sizeof(hbuf), 
+			"If-None-Match: %s", lasttag);
+		if ((list = curl_slist_append(NULL, hbuf)) == NULL)
+			return 0;
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
+	}
+
+	/* Decode ourselves to compare the length with the wire. */
+
+	if (test->gzip) {
+		curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "gzip");
+		curl_easy_setopt(curl, CURLOPT_HTTP_CONTENT_DECODING, 0L);
+	}
+	if (test->post)
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "foo=bar");
+
+	curl_easy_setopt(curl, CURLOPT_URL, "http://localhost:17123/");
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, headcb);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, bufcb);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buf);
+	if (curl_easy_perform(curl) != CURLE_OK) {
+		warnx("test %zu: curl_easy_perform", n);
+		goto out;
+	}
+
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+	if (code != test->code) {
+		warnx("test %zu: bad code: %ld", n, code);
+		goto out;
+	}
+	if (test->haslen && contlen != (long long)buf.sz) {
+		warnx("test %zu: bad length: %lld (have %zu)", 
+			n, contlen, buf.sz);
+		goto out;
+	} else if (!test->haslen && contlen != -1) {
+		warnx("test %zu: unexpected length", n);
+		goto out;
+	}
+	if (test->hastag && etag[0] == '\0') {
+		warnx("test %zu: expected tag", n);
+		goto out;
+	} else if (!test->hastag && etag[0] != '\0') {
+		warnx("test %zu: unexpected tag", n);
+		goto out;
+	}
+	strlcpy(lasttag, etag, sizeof(lasttag));
+
+	if (code == 304 || code == 204) {
+		if (buf.sz != 0) {
+			warnx("test %zu: unexpected body", n);
+			goto out;
+		}
+		rc = 1;
+		goto out;
+	}
+
+	if (test->gzip && test->bodysz >= 1024 && !gzipped) {
+		warnx("test %zu: expected compression", n);
+		goto out;
+	}
+	if (gzipped) {
+		if (!gunzip(&buf, &dec)) {
+			warnx("test %zu: bad compression", n);
+			goto out;
+		}
+		body = &dec;
+	}
+
+	if (body->sz != test->bodysz) {
+		warnx("test %zu: bad size: %zu", n, body->sz);
+		goto out;
+	}
+	for (i = 0; i < body->sz; i++)
+		if (body->buf[i] != regress_bodychar(i)) {
+			warnx("test %zu: bad content", n);
+			goto out;
+		}
+	rc = 1;
+out:
+	curl_slist_free_all(list);
+	free(buf.buf);
+	free(dec.buf);
+	return rc;
+}
+
+static int
+child(void)
+{
+	struct kreq	 r;
+	struct kopts	 opts;
+	const char 	*page = "index";
+	size_t		 i;
+
+	memset(&opts, 0, sizeof(struct kopts));
+	opts.sndbufsz = -1;
+	opts.fullbufsz = test->fullbufsz;
+	opts.etag = test->etag;
+
+	if (khttp_parsex(&r, ksuffixmap, kmimetypes, KMIME__MAX,
+	    NULL, 0, &page, 1, KMIME_TEXT_HTML, 0, 
+	    NULL, NULL, 0, &opts) != KCGI_OK)
+		return 0;
+
+	if (test->status != KHTTP__MAX)
+		khttp_head(&r, kresps[KRESP_STATUS], 
+			"%s", khttps[test->status]);
+	khttp_head(&r, kresps[KRESP_CONTENT_TYPE], 
+		"%s", kmimetypes[KMIME_TEXT_PLAIN]);
+	if (test->len)
+		khttp_head(&r, kresps[KRESP_CONTENT_LENGTH], 
+			"%zu", test->bodysz);
+	khttp_body(&r);
+
+	/* Write in pieces to exercise the buffer. */
+
+	for (i = 0; i < test->bodysz; i++)
+		khttp_putc(&r, regress_bodychar(i));
+	khttp_free(&r);
+	return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t	 i;
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		test = &tests[i];
+		if (!regress_cgi(parent, child))
+			return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
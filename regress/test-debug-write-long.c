@@ -136,28 +136,32 @@ main(int argc, char *argv[])
 				goto out;
 			break;
 		case 2:
-			if (strcmp(cp, "\\r\n"))
+			if (strcmp(cp, "Vary: Accept-Encoding\\r\n"))
 				goto out;
 			break;
 		case 3:
+			if (strcmp(cp, "\\r\n"))
+				goto out;
+			break;
+		case 4:
 			if (strcmp(cp, "foo="
 			    "012345678901234567890123456789"
 			    "012345678901234567890123456789"
 			    "0123456789012345...\n"))
 				goto out;
 			break;
-		case 4:
+		case 5:
 			if (strcmp(cp, "6789"
 			    "012345678901234567890123456789"
 			    "012345678901234567890123456789"
 			    "0123456789012345...\n"))
 				goto out;
 			break;
-		case 5:
+		case 6:
 			if (strcmp(cp, "6\n"))
 				goto out;
 			break;
-		case 6:
+		case 7:
 			/* Ignore. */
 			break;
 		default:
@@ -165,7 +169,7 @@ main(int argc, char *argv[])
 		}
 	}
 
-	if (ferror(f) || lineno != 7)
+	if (ferror(f) || lineno != 8)
 		goto out;
 
 	rc = 0;
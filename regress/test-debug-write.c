@@ -119,14 +119,18 @@ main(int argc, char *argv[])
 				goto out;
 			break;
 		case 2:
-			if (strcmp(cp, "\\r\n"))
+			if (strcmp(cp, "Vary: Accept-Encoding\\r\n"))
 				goto out;
 			break;
 		case 3:
-			if (strcmp(cp, "hello, world\n"))
+			if (strcmp(cp, "\\r\n"))
 				goto out;
 			break;
 		case 4:
+			if (strcmp(cp, "hello, world\n"))
+				goto out;
+			break;
+		case 5:
 			/* Ignore. */
 			break;
 		default:
@@ -134,7 +138,7 @@ main(int argc, char *argv[])
 		}
 	}
 
-	if (ferror(f) || lineno != 5)
+	if (ferror(f) || lineno != 6)
 		goto out;
 
 	rc = 0;
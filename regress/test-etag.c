@@ -0,0 +1,275 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "../kcgi.h"
+#include "regress.h"
+
+/*
+ * Generated entity-tags with the "etag" option of struct kopts.
+ * The tags received by earlier tests are sent back as If-None-Match
+ * by later ones.
+ * A tag set by the application is left alone.
+ */
+
+enum	tag {
+	TAG_NONE, /* no entity-tag */
+	TAG_PLAIN, /* tag of the uncompressed body */
+	TAG_GZIP, /* tag of the compressed body */
+	TAG_OTHER, /* some other tag */
+	TAG_APP /* the application's tag */
+};
+
+struct	test {
+	int		 etag; /* kopts "etag" */
+	ssize_t		 sndbufsz; /* kopts "sndbufsz" */
+	int		 post; /* POST instead of GET */
+	int		 gzip; /* accept gzip */
+	enum khttp	 status; /* status or KHTTP__MAX for none */
+	size_t		 bodysz; /* response size */
+	enum tag	 inm; /* If-None-Match tag */
+	long		 code; /* expected status */
+	enum tag	 tag; /* expected ETag */
+	int		 own; /* application sets ETag */
+};
+
+static const struct test tests[] = {
+	{ 1, -1, 0, 0, KHTTP_200, 100000, TAG_NONE, 200, TAG_PLAIN, 0 },
+	{ 1, -1, 0, 0, KHTTP_200, 100000, TAG_PLAIN, 304, TAG_PLAIN, 0 },
+	{ 1, -1, 0, 0, KHTTP__MAX, 100000, TAG_PLAIN, 304, TAG_PLAIN, 0 },
+	{ 1, -1, 0, 0, KHTTP_200, 100000, TAG_OTHER, 200, TAG_PLAIN, 0 },
+	{ 1, -1, 0, 0, KHTTP_200, 100001, TAG_PLAIN, 200, TAG_OTHER, 0 },
+	{ 1, -1, 0, 0, KHTTP_200, 0, TAG_NONE, 200, TAG_OTHER, 0 },
+	{ 1, -1, 0, 0, KHTTP_404, 100000, TAG_PLAIN, 404, TAG_NONE, 0 },
+	{ 1, -1, 0, 1, KHTTP_200, 100000, TAG_NONE, 200, TAG_GZIP, 0 },
+	{ 1, -1, 0, 1, KHTTP_200, 100000, TAG_GZIP, 304, TAG_GZIP, 0 },
+	{ 1, -1, 0, 1, KHTTP_200, 100000, TAG_PLAIN, 200, TAG_GZIP, 0 },
+	{ 1, 0, 0, 0, KHTTP_200, 100000, TAG_PLAIN, 200, TAG_NONE, 0 },
+	{ 1, -1, 1, 0, KHTTP_200, 100000, TAG_PLAIN, 200, TAG_NONE, 0 },
+	{ 0, -1, 0, 0, KHTTP_200, 100000, TAG_PLAIN, 200, TAG_NONE, 0 },
+	{ 1, -1, 0, 0, KHTTP_200, 100000, TAG_NONE, 200, TAG_APP, 1 },
+	{ 1, -1, 0, 0, KHTTP_200, 100000, TAG_PLAIN, 200, TAG_APP, 1 },
+};
+
+static const struct test *test;
+static char	 tags[TAG_OTHER][64]; /* tags received */
+static char	 etag[64]; /* ETag of current response */
+static size_t	 etags; /* number of ETag headers */
+
+#define	APPTAG	"\"app\""
+
+static size_t
+headcb(char *buf, size_t sz, size_t nm, void *dat)
+{
+	size_t	 len = nm * sz;
+
+	if (len > 6 && strncasecmp(buf, "ETag: ", 6) == 0) {
+		buf += 6;
+		len -= 6;
+		while (len > 0 && 
+		       (buf[len - 1] == '\r' || buf[len - 1] == '\n'))
+			len--;
+		if (len >= sizeof(etag))
+			len = sizeof(etag) - 1;
+		memcpy(etag, buf, len);
+		etag[len] = '\0';
+		etags++;
+	}
+	return nm * sz;
+}
+
+static size_t
+bufcb(void *contents, size_t sz, size_t nm, void *dat)
+{
+	struct kcgi_buf	*buf = dat;
+
+	if (kcgi_buf_write(contents, nm * sz, buf) != KCGI_OK)
+		return 0;
+	return nm * sz;
+}
+
+static int
+parent(CURL *curl)
+{
+	struct curl_slist	*list = NULL;
+	struct kcgi_buf		 buf;
+	char			 hbuf[128];
+	size_t			 i, n = test - tests;
+	long			 code;
+	int			 rc = 0;
+
+	memset(&buf, 0, sizeof(struct kcgi_buf));
+	etag[0] = '\0';
+	etags = 0;
+
+	if (test->inm != TAG_NONE) {
+		snprintf(hbuf, sizeof(hbuf), "If-None-Match: %s", 
+			test->inm == TAG_OTHER ? "\"other\"" : 
+			tags[test->inm]);
+		if ((list = curl_slist_append(NULL, hbuf)) == NULL)
+			return 0;
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
+	}
+	if (test->gzip)
+		curl_easy_setopt(curl, CURLOPT_ENCODING, "gzip");
+	if (test->post)
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, "foo=bar");
+
+	curl_easy_setopt(curl, CURLOPT_URL, "http://localhost:17123/");
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, headcb);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, bufcb);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buf);
+	if (curl_easy_perform(curl) != CURLE_OK) {
+		warnx("test %zu: curl_easy_perform", n);
+		goto out;
+	}
+
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+	if (code != test->code) {
+		warnx("test %zu: bad code: %ld", n, code);
+		goto out;
+	}
+
+	/* Check the tag's form, then against those seen before. */
+
+	if (etags > 1) {
+		warnx("test %zu: multiple tags", n);
+		goto out;
+	}
+
+	switch (test->tag) {
+	case TAG_NONE:
+		if (etag[0] != '\0') {
+			warnx("test %zu: unexpected tag", n);
+			goto out;
+		}
+		break;
+	case TAG_PLAIN:
+	case TAG_GZIP:
+		if (tags[test->tag][0] == '\0')
+			strlcpy(tags[test->tag], etag, sizeof(tags[0]));
+		if (strcmp(tags[test->tag], etag) != 0) {
+			warnx("test %zu: bad tag: %s", n, etag);
+			goto out;
+		}
+		break;
+	case TAG_APP:
+		if (strcmp(etag, APPTAG) != 0) {
+			warnx("test %zu: bad tag: %s", n, etag);
+			goto out;
+		}
+		break;
+	default:
+		if (etag[0] != '"' || strcmp(etag, tags[TAG_PLAIN]) == 0) {
+			warnx("test %zu: bad tag: %s", n, etag);
+			goto out;
+		}
+		break;
+	}
+	if (test->tag == TAG_PLAIN && etag[0] != '"') {
+		warnx("test %zu: expected strong tag", n);
+		goto out;
+	} else if (test->tag == TAG_GZIP && 
+	    strncmp(etag, "W/\"", 3) != 0) {
+		warnx("test %zu: expected weak tag", n);
+		goto out;
+	}
+
+	if (code == 304) {
+		if (buf.sz != 0) {
+			warnx("test %zu: body with 304", n);
+			goto out;
+		}
+		rc = 1;
+		goto out;
+	}
+
+	if (buf.sz != test->bodysz) {
+		warnx("test %zu: bad size: %zu", n, buf.sz);
+		goto out;
+	}
+	for (i = 0; i < buf.sz; i++)
+		if (buf.buf[i] != regress_bodychar(i)) {
+			warnx("test %zu: bad content", n);
+			goto out;
+		}
+	rc = 1;
+out:
+	curl_slist_free_all(list);
+	free(buf.buf);
+	return rc;
+}
+
+static int
+child(void)
+{
+	struct kreq	 r;
+	struct kopts	 opts;
+	const char 	*page = "index";
+	size_t		 i;
+
+	memset(&opts, 0, sizeof(struct kopts));
+	opts.sndbufsz = test->sndbufsz;
+	opts.etag = test->etag;
+
+	if (khttp_parsex(&r, ksuffixmap, kmimetypes, KMIME__MAX,
+	    NULL, 0, &page, 1, KMIME_TEXT_HTML, 0, 
+	    NULL, NULL, 0, &opts) != KCGI_OK)
+		return 0;
+
+	if (test->status != KHTTP__MAX)
+		khttp_head(&r, kresps[KRESP_STATUS], 
+			"%s", khttps[test->status]);
+	khttp_head(&r, kresps[KRESP_CONTENT_TYPE], 
+		"%s", kmimetypes[KMIME_TEXT_PLAIN]);
+	if (test->own)
+		khttp_head(&r, kresps[KRESP_ETAG], "%s", APPTAG);
+	khttp_body(&r);
+
+	/* Write in pieces to exercise the buffer. */
+
+	for (i = 0; i < test->bodysz; i++)
+		khttp_putc(&r, regress_bodychar(i));
+	khttp_free(&r);
+	return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t	 i;
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		test = &tests[i];
+		if (!regress_cgi(parent, child))
+			return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,188 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "../kcgi.h"
+#include "regress.h"
+
+/*
+ * Check asynchronous FastCGI output ("asyncbufsz" in struct kopts).
+ * A response too large for the socket, but within the limit, is handed
+ * to the control process, so while its client doesn't read, another
+ * connection is still served.
+ * The held response must then arrive intact, and its connection be
+ * kept for the next request.
+ * A response over the limit is written by the application as usual.
+ */
+
+#define	ASYNCMAX	(1024 * 1024)
+#define	ASYNCSZ		(768 * 1024)
+#define	BIGSZ		(4 * 1024 * 1024)
+
+/*
+ * Send a request for "path" on a kept connection.
+ */
+static int
+send_request(int fd, const char *path)
+{
+	char	 buf[1024];
+
+	return regress_writeall(fd, buf, 
+		regress_fcgi_get(buf, 0, 1, path, 1));
+}
+
+/*
+ * Read a response til the end of the request and check that its body
+ * (following the headers) is "bodysz" bytes of regress_bodychar().
+ */
+static int
+read_response(int fd, size_t bodysz)
+{
+	char		*out;
+	const char	*cp;
+	size_t		 outsz, sz, i;
+	int		 rc = 0;
+
+	if ((out = regress_fcgi_response(fd, 1, &outsz)) == NULL)
+		return 0;
+	if ((cp = regress_fcgi_body(out, outsz, &sz)) == NULL)
+		goto out;
+	if (sz != bodysz) {
+		fprintf(stderr, "bad size: %zu\n", sz);
+		goto out;
+	}
+	for (i = 0; i < bodysz; i++)
+		if (cp[i] != regress_bodychar(i)) {
+			fprintf(stderr, "bad content at %zu\n", i);
+			goto out;
+		}
+	rc = 1;
+out:
+	free(out);
+	return rc;
+}
+
+static int
+server(void)
+{
+	struct kfcgi	*fcgi;
+	struct kreq	 r;
+	struct kopts	 opts;
+	const char	*page = "index";
+	char		 buf[8192];
+	size_t		 i, j, sz;
+
+	memset(&opts, 0, sizeof(struct kopts));
+	opts.sndbufsz = -1;
+	opts.asyncbufsz = ASYNCMAX;
+
+	if (khttp_fcgi_initx(&fcgi, kmimetypes, KMIME__MAX, NULL, 0,
+	    ksuffixmap, KMIME_TEXT_HTML, &page, 1, 0, NULL, NULL,
+	    0, &opts) != KCGI_OK)
+		return 0;
+	while (khttp_fcgi_parse(fcgi, &r) == KCGI_OK) {
+		if (strcmp(r.pagename, "async") == 0)
+			sz = ASYNCSZ;
+		else if (strcmp(r.pagename, "big") == 0)
+			sz = BIGSZ;
+		else
+			sz = 100;
+		khttp_head(&r, kresps[KRESP_STATUS], 
+			"%s", khttps[KHTTP_200]);
+		khttp_head(&r, kresps[KRESP_CONTENT_TYPE], 
+			"%s", kmimetypes[KMIME_TEXT_PLAIN]);
+		khttp_body(&r);
+		for (i = 0; i < sz; i += j) {
+			for (j = 0; j < sizeof(buf) && i + j < sz; j++)
+				buf[j] = regress_bodychar(i + j);
+			khttp_write(&r, buf, j);
+		}
+		khttp_free(&r);
+	}
+	khttp_fcgi_free(fcgi);
+	return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_un	 un;
+	int			 fd, slow = -1, fast = -1, rc = 0;
+	pid_t			 pid;
+
+	if ((fd = regress_fcgi_unix(&un)) == -1)
+		return EXIT_FAILURE;
+	if ((pid = regress_fcgi_fork(fd, server)) == -1) {
+		unlink(un.sun_path);
+		return EXIT_FAILURE;
+	}
+
+	/* Ask for the held response, but don't read it yet. */
+
+	slow = regress_fcgi_dial((struct sockaddr *)&un, sizeof(un));
+	if (slow == -1 || !send_request(slow, "/async"))
+		goto out;
+
+	/* Meanwhile, another connection is served. */
+
+	fast = regress_fcgi_dial((struct sockaddr *)&un, sizeof(un));
+	if (fast == -1 || !send_request(fast, "/small"))
+		goto out;
+	if (!read_response(fast, 100)) {
+		fprintf(stderr, "no response while holding output\n");
+		goto out;
+	}
+
+	/* The held response, then more on the same connection. */
+
+	if (!read_response(slow, ASYNCSZ)) {
+		fprintf(stderr, "bad held response\n");
+		goto out;
+	}
+	if (!send_request(slow, "/small") || !read_response(slow, 100)) {
+		fprintf(stderr, "bad response on kept connection\n");
+		goto out;
+	}
+
+	/* Over the limit, the application writes it all itself. */
+
+	if (!send_request(fast, "/big") || !read_response(fast, BIGSZ)) {
+		fprintf(stderr, "bad response over limit\n");
+		goto out;
+	}
+	rc = 1;
+out:
+	if (slow != -1)
+		close(slow);
+	if (fast != -1)
+		close(fast);
+	unlink(un.sun_path);
+	regress_fcgi_kill(pid);
+	return rc ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,146 @@
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "../kcgi.h"
+#include "regress.h"
+
+/*
+ * Compressed FastCGI output: the response is written in many pieces
+ * spanning several records of compressed data, which must decompress
+ * to the original.
+ */
+
+#define	LINES	20000
+
+static int	 encoded;
+
+static size_t
+bufcb(void *contents, size_t sz, size_t nm, void *dat)
+{
+	struct kcgi_buf	*buf = dat;
+
+	if (kcgi_buf_write(contents, nm * sz, buf) != KCGI_OK)
+		return 0;
+	return nm * sz;
+}
+
+static size_t
+headcb(char *buf, size_t sz, size_t nm, void *dat)
+{
+
+	if (nm * sz >= 22 && 
+	    strncasecmp(buf, "Content-Encoding: gzip", 22) == 0)
+		encoded = 1;
+	return nm * sz;
+}
+
+static int
+parent(CURL *curl)
+{
+	struct kcgi_buf	 buf;
+	char		 line[64];
+	size_t		 i, pos = 0, len;
+	int		 rc = 0;
+
+	memset(&buf, 0, sizeof(struct kcgi_buf));
+
+	curl_easy_setopt(curl, CURLOPT_URL, 
+		"http://localhost:17123/");
+	curl_easy_setopt(curl, CURLOPT_ENCODING, "gzip");
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, bufcb);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buf);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, headcb);
+	if (curl_easy_perform(curl) != CURLE_OK) {
+		warnx("curl_easy_perform");
+		goto out;
+	} else if (!encoded) {
+		warnx("response not compressed");
+		goto out;
+	}
+
+	for (i = 0; i < LINES; i++) {
+		len = snprintf(line, sizeof(line), 
+			"{\"line\": %zu, \"text\": \"hello\"}\n", i);
+		if (pos + len > buf.sz || 
+		    memcmp(buf.buf + pos, line, len) != 0) {
+			warnx("content mismatch at line %zu", i);
+			goto out;
+		}
+		pos += len;
+	}
+	if (pos != buf.sz) {
+		warnx("trailing content");
+		goto out;
+	}
+	rc = 1;
+out:
+	free(buf.buf);
+	return rc;
+}
+
+static int
+child(void)
+{
+	struct kreq	 r;
+	const char 	*page = "index";
+	struct kfcgi	*fcgi;
+	enum kcgi_err	 er;
+	size_t		 i;
+
+	if (!khttp_fcgi_test())
+		return 0;
+
+	if (khttp_fcgi_init(&fcgi, NULL, 0, &page, 1, 0) != KCGI_OK)
+		return 0;
+
+	while ((er = khttp_fcgi_parse(fcgi, &r)) == KCGI_OK) {
+		khttp_head(&r, kresps[KRESP_STATUS], 
+			"%s", khttps[KHTTP_200]);
+		khttp_head(&r, kresps[KRESP_CONTENT_TYPE], 
+			"%s", kmimetypes[KMIME_APP_JSON]);
+		khttp_body(&r);
+		for (i = 0; i < LINES; i++)
+			khttp_printf(&r, 
+				"{\"line\": %zu, \"text\": \"hello\"}\n", i);
+		khttp_free(&r);
+	}
+
+	khttp_free(&r);
+	khttp_fcgi_free(fcgi);
+	return er == KCGI_HUP;
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	return regress_fcgi(parent, child) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,96 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "../kcgi.h"
+#include "regress.h"
+
+/*
+ * Act as a web server with FCGI_KEEP_CONN: send several requests over
+ * a single FastCGI connection, then one without the flag, after which
+ * the application must close the connection.
+ * This doesn't use the regression framework, which uses a connection
+ * per request.
+ */
+
+/*
+ * Send a GET request for "path", setting FCGI_KEEP_CONN if "keep".
+ * Returns zero on failure, non-zero if the response contains "path".
+ */
+static int
+request(int fd, const char *path, int keep)
+{
+	char	 buf[1024], *out;
+	size_t	 sz;
+	int	 rc;
+
+	sz = regress_fcgi_get(buf, 0, 1, path, keep);
+	if (!regress_writeall(fd, buf, sz) ||
+	    (out = regress_fcgi_response(fd, 1, &sz)) == NULL)
+		return 0;
+	rc = strstr(out, path) != NULL;
+	free(out);
+	return rc;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_un	 un;
+	int			 fd, rc = 0;
+	char			 c;
+	pid_t			 pid;
+
+	if ((fd = regress_fcgi_unix(&un)) == -1)
+		return EXIT_FAILURE;
+	if ((pid = regress_fcgi_fork(fd, regress_fcgi_echo)) == -1) {
+		unlink(un.sun_path);
+		return EXIT_FAILURE;
+	}
+
+	fd = regress_fcgi_dial((struct sockaddr *)&un, sizeof(un));
+	if (fd == -1)
+		goto out;
+
+	if (!request(fd, "/first", 1) ||
+	    !request(fd, "/second", 1) ||
+	    !request(fd, "/third", 1) ||
+	    !request(fd, "/last", 0))
+		goto out;
+
+	/* Without FCGI_KEEP_CONN, the connection is closed. */
+
+	rc = read(fd, &c, 1) == 0;
+out:
+	if (fd != -1)
+		close(fd);
+	unlink(un.sun_path);
+	regress_fcgi_kill(pid);
+	return rc ? EXIT_SUCCESS : EXIT_FAILURE;
+}
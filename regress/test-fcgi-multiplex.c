@@ -0,0 +1,196 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "../kcgi.h"
+#include "regress.h"
+
+/*
+ * Act as a web server multiplexing requests over a single FastCGI
+ * connection.
+ * This doesn't use the regression framework, which uses a connection
+ * per request.
+ */
+
+static int
+begin(int fd, uint16_t rid)
+{
+	char	 buf[64];
+
+	return regress_writeall(fd, buf, 
+		regress_fcgi_begin(buf, 0, rid, 1));
+}
+
+static int
+params(int fd, uint16_t rid, const char *path)
+{
+	char	 buf[1024];
+
+	return regress_writeall(fd, buf, 
+		regress_fcgi_params(buf, 0, rid, path));
+}
+
+/*
+ * End the parameters and (empty) body of a request.
+ */
+static int
+finish(int fd, uint16_t rid)
+{
+	char	 buf[64];
+
+	return regress_writeall(fd, buf, 
+		regress_fcgi_end(buf, 0, rid));
+}
+
+/*
+ * Abort a request.
+ */
+static int
+abort_req(int fd, uint16_t rid)
+{
+	char	 buf[64];
+
+	return regress_writeall(fd, buf, 
+		regress_fcgi_record(buf, 0, 2, rid, NULL, 0, 0));
+}
+
+/*
+ * Read the end of the aborted request "rid", which must be the next
+ * record: FCGI_END_REQUEST with FCGI_REQUEST_COMPLETE.
+ */
+static int
+ended(int fd, uint16_t rid)
+{
+	unsigned char	 rec[16];
+
+	if (!regress_readall(fd, rec, sizeof(rec)))
+		return 0;
+	return rec[0] == 1 && rec[1] == 3 &&
+		rec[2] == (rid >> 8) && rec[3] == (rid & 0xff) &&
+		rec[4] == 0 && rec[5] == 8 && rec[12] == 0;
+}
+
+/*
+ * Read the response to request "rid", which must be the next one.
+ * Returns zero on failure, non-zero if it contains "path".
+ */
+static int
+response(int fd, uint16_t rid, const char *path)
+{
+	char	*out;
+	size_t	 sz;
+	int	 rc;
+
+	if ((out = regress_fcgi_response(fd, rid, &sz)) == NULL)
+		return 0;
+	rc = strstr(out, path) != NULL;
+	free(out);
+	return rc;
+}
+
+/*
+ * Interleave the records of three requests, all sent at once.
+ * They're answered in the order in which they're completed.
+ */
+static int
+interleaved(int fd)
+{
+
+	return begin(fd, 1) && begin(fd, 2) && begin(fd, 3) &&
+		params(fd, 3, "/three") &&
+		params(fd, 2, "/two") &&
+		params(fd, 1, "/one") &&
+		finish(fd, 2) && finish(fd, 1) && finish(fd, 3) &&
+		response(fd, 2, "/two") &&
+		response(fd, 1, "/one") &&
+		response(fd, 3, "/three");
+}
+
+/*
+ * Complete a request while another is still being sent.
+ */
+static int
+staggered(int fd)
+{
+
+	return begin(fd, 1) && begin(fd, 2) &&
+		params(fd, 2, "/late") &&
+		params(fd, 1, "/early") &&
+		finish(fd, 1) &&
+		response(fd, 1, "/early") &&
+		finish(fd, 2) &&
+		response(fd, 2, "/late");
+}
+
+/*
+ * Abort requests while others are being sent: each is ended at once
+ * without reaching the application, and the others are unaffected.
+ */
+static int
+aborted(int fd)
+{
+
+	return begin(fd, 1) && begin(fd, 2) &&
+		params(fd, 1, "/gone") &&
+		abort_req(fd, 1) &&
+		ended(fd, 1) &&
+		begin(fd, 3) && abort_req(fd, 3) &&
+		ended(fd, 3) &&
+		params(fd, 2, "/kept") &&
+		finish(fd, 2) &&
+		response(fd, 2, "/kept");
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_un	 un;
+	int			 fd, rc = 0;
+	pid_t			 pid;
+
+	if ((fd = regress_fcgi_unix(&un)) == -1)
+		return EXIT_FAILURE;
+	if ((pid = regress_fcgi_fork(fd, regress_fcgi_echo)) == -1) {
+		unlink(un.sun_path);
+		return EXIT_FAILURE;
+	}
+
+	fd = regress_fcgi_dial((struct sockaddr *)&un, sizeof(un));
+	if (fd == -1)
+		goto out;
+
+	rc = interleaved(fd) && staggered(fd) &&
+		aborted(fd) && interleaved(fd);
+out:
+	if (fd != -1)
+		close(fd);
+	unlink(un.sun_path);
+	regress_fcgi_kill(pid);
+	return rc ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,187 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "../kcgi.h"
+#include "regress.h"
+
+/*
+ * Check that request records of all sizes and paddings are read
+ * correctly: one-byte records, maximum-size records with maximum
+ * padding, and bodies larger than the worker's read buffer.
+ * Two requests are sent back to back on a kept connection, so the
+ * second is partly read along with the first.
+ */
+
+#define	BODYSZ	(1024 * 1024 + 13)
+
+/*
+ * Append a keep-alive POST request of BODYSZ bytes of
+ * regress_bodychar(), split into records of varying sizes and
+ * paddings.
+ */
+static size_t
+request(char *out, size_t pos)
+{
+	static const size_t sizes[] = 
+		{ 1, 7, 100, 65535, 3000, 65535, 65535, 12, 8 };
+	char		 bgn[8], cl[32], *body;
+	size_t		 i, sz, n;
+
+	if ((body = malloc(BODYSZ)) == NULL)
+		return 0;
+	for (i = 0; i < BODYSZ; i++)
+		body[i] = regress_bodychar(i);
+
+	memset(bgn, 0, sizeof(bgn));
+	bgn[1] = 1; /* FCGI_RESPONDER */
+	bgn[2] = 1; /* FCGI_KEEP_CONN */
+	pos = regress_fcgi_record(out, pos, 1, 1, bgn, sizeof(bgn), 3);
+
+	snprintf(cl, sizeof(cl), "%d", BODYSZ);
+	pos = regress_fcgi_param(out, pos, 1, "REQUEST_METHOD", "POST", 1);
+	pos = regress_fcgi_param(out, pos, 1, "CONTENT_TYPE", 
+		"application/octet-stream", 0);
+	pos = regress_fcgi_param(out, pos, 1, "CONTENT_LENGTH", cl, 255);
+	pos = regress_fcgi_param(out, pos, 1, "PATH_INFO", "/index", 2);
+	pos = regress_fcgi_param(out, pos, 1, 
+		"SCRIPT_NAME", "/cgi-bin/test", 0);
+	pos = regress_fcgi_param(out, pos, 1, "SERVER_PORT", "80", 5);
+	pos = regress_fcgi_param(out, pos, 1, "HTTP_HOST", "localhost", 0);
+	pos = regress_fcgi_param(out, pos, 1, 
+		"REMOTE_ADDR", "127.0.0.1", 7);
+	pos = regress_fcgi_record(out, pos, 4, 1, NULL, 0, 0);
+
+	for (i = sz = 0; sz < BODYSZ; i++, sz += n) {
+		n = sizes[i % (sizeof(sizes) / sizeof(sizes[0]))];
+		if (n > BODYSZ - sz)
+			n = BODYSZ - sz;
+		pos = regress_fcgi_record(out, pos, 5, 1, body + sz, n, 
+			n == 65535 ? 255 : i % 8);
+	}
+	pos = regress_fcgi_record(out, pos, 5, 1, NULL, 0, 4);
+
+	free(body);
+	return pos;
+}
+
+/*
+ * Read a response til the end of the request and check that its body
+ * (following the headers) is "ok".
+ */
+static int
+response(int fd)
+{
+	char	*out;
+	size_t	 sz;
+	int	 rc;
+
+	if ((out = regress_fcgi_response(fd, 1, &sz)) == NULL)
+		return 0;
+	rc = sz >= 6 && memcmp(out + sz - 6, "\r\n\r\nok", 6) == 0;
+	free(out);
+	return rc;
+}
+
+static int
+server(void)
+{
+	struct kfcgi	*fcgi;
+	struct kreq	 r;
+	const char	*page = "index", *res;
+	size_t		 i;
+
+	if (khttp_fcgi_init(&fcgi, NULL, 0, &page, 1, 0) != KCGI_OK)
+		return 0;
+	while (khttp_fcgi_parse(fcgi, &r) == KCGI_OK) {
+		res = "bad";
+		if (r.fieldsz == 1 && r.fields[0].valsz == BODYSZ) {
+			for (i = 0; i < BODYSZ; i++)
+				if (r.fields[0].val[i] != regress_bodychar(i))
+					break;
+			if (i == BODYSZ)
+				res = "ok";
+		}
+		khttp_head(&r, kresps[KRESP_STATUS], 
+			"%s", khttps[KHTTP_200]);
+		khttp_head(&r, kresps[KRESP_CONTENT_TYPE], 
+			"%s", kmimetypes[KMIME_TEXT_PLAIN]);
+		khttp_body(&r);
+		khttp_puts(&r, res);
+		khttp_free(&r);
+	}
+	khttp_fcgi_free(fcgi);
+	return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_un	 un;
+	char			*out = NULL;
+	size_t			 sz;
+	int			 fd, c = -1, rc = 0;
+	pid_t			 pid;
+
+	if ((fd = regress_fcgi_unix(&un)) == -1)
+		return EXIT_FAILURE;
+	if ((pid = regress_fcgi_fork(fd, server)) == -1) {
+		unlink(un.sun_path);
+		return EXIT_FAILURE;
+	}
+
+	c = regress_fcgi_dial((struct sockaddr *)&un, sizeof(un));
+	if (c == -1)
+		goto out;
+
+	/* Both requests at once, then both responses. */
+
+	if ((out = malloc(4 * BODYSZ)) == NULL ||
+	    (sz = request(out, 0)) == 0 ||
+	    (sz = request(out, sz)) == 0) {
+		perror(NULL);
+		goto out;
+	}
+
+	if (!regress_writeall(c, out, sz)) {
+		perror("write");
+		goto out;
+	} else if (!response(c) || !response(c)) {
+		fprintf(stderr, "bad response\n");
+		goto out;
+	}
+	rc = 1;
+out:
+	free(out);
+	if (c != -1)
+		close(c);
+	unlink(un.sun_path);
+	regress_fcgi_kill(pid);
+	return rc ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,159 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "../kcgi.h"
+#include "regress.h"
+
+/*
+ * Send a file with khttp_sendfile() over FastCGI.
+ * The file spans several records and isn't a multiple of the record
+ * alignment, so record headers and padding must wrap the file data.
+ */
+
+#define	FILESZ	200003
+
+struct	test {
+	off_t	 off; /* offset for khttp_sendfile() */
+	size_t	 sz; /* size for khttp_sendfile() */
+};
+
+static const struct test tests[] = {
+	{ 0, SIZE_MAX },
+	{ 65533, 70001 },
+	{ 65528, 65528 },
+	{ FILESZ - 1, SIZE_MAX },
+};
+
+static const struct test *test;
+static char	 fname[] = "/tmp/kcgi.XXXXXXXXXX";
+
+static size_t
+bufcb(void *contents, size_t sz, size_t nm, void *dat)
+{
+	struct kcgi_buf	*buf = dat;
+
+	if (kcgi_buf_write(contents, nm * sz, buf) != KCGI_OK)
+		return 0;
+	return nm * sz;
+}
+
+static int
+parent(CURL *curl)
+{
+	struct kcgi_buf	 buf;
+	size_t		 i, off, sz;
+	int		 rc = 0;
+
+	off = (size_t)test->off;
+	sz = FILESZ - off < test->sz ? FILESZ - off : test->sz;
+
+	memset(&buf, 0, sizeof(struct kcgi_buf));
+	curl_easy_setopt(curl, CURLOPT_URL, "http://localhost:17123/");
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, bufcb);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buf);
+	if (curl_easy_perform(curl) != CURLE_OK) {
+		warnx("curl_easy_perform");
+		goto out;
+	}
+	if (buf.sz != sz) {
+		warnx("test %zu: bad size: %zu", 
+			(size_t)(test - tests), buf.sz);
+		goto out;
+	}
+	for (i = 0; i < sz; i++)
+		if (buf.buf[i] != regress_bodychar(off + i)) {
+			warnx("test %zu: bad content", 
+				(size_t)(test - tests));
+			goto out;
+		}
+	rc = 1;
+out:
+	free(buf.buf);
+	return rc;
+}
+
+static int
+child(void)
+{
+	struct kreq	 r;
+	const char 	*page = "index";
+	struct kfcgi	*fcgi;
+	enum kcgi_err	 er;
+	int		 fd;
+
+	if (khttp_fcgi_init(&fcgi, NULL, 0, &page, 1, 0) != KCGI_OK)
+		return 0;
+
+	while ((er = khttp_fcgi_parse(fcgi, &r)) == KCGI_OK) {
+		if ((fd = open(fname, O_RDONLY)) == -1)
+			break;
+		khttp_head(&r, kresps[KRESP_STATUS], 
+			"%s", khttps[KHTTP_200]);
+		khttp_head(&r, kresps[KRESP_CONTENT_TYPE], 
+			"%s", kmimetypes[KMIME_TEXT_PLAIN]);
+		khttp_body(&r);
+		er = khttp_sendfile(&r, fd, test->off, test->sz);
+		close(fd);
+		if (er != KCGI_OK)
+			break;
+		khttp_free(&r);
+	}
+
+	khttp_free(&r);
+	khttp_fcgi_free(fcgi);
+	return er == KCGI_HUP ? 1 : 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	FILE	*f;
+	size_t	 i;
+	int	 fd, rc = 0;
+
+	if ((fd = mkstemp(fname)) == -1)
+		err(EXIT_FAILURE, "%s", fname);
+	if ((f = fdopen(fd, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", fname);
+	for (i = 0; i < FILESZ; i++)
+		fputc(regress_bodychar(i), f);
+	fclose(f);
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		test = &tests[i];
+		if (!regress_fcgi(parent, child))
+			goto out;
+	}
+	rc = 1;
+out:
+	unlink(fname);
+	return rc ? EXIT_SUCCESS : EXIT_FAILURE;
+}
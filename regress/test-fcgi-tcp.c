@@ -0,0 +1,113 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "../kcgi.h"
+#include "regress.h"
+
+/*
+ * Check that a worker accepts from a TCP listening socket, as given by
+ * kfcgi(8) with -a, and serves several requests on a kept connection.
+ */
+
+#define	REQS	20
+
+/*
+ * Read a response til the end of the request and check that its body
+ * (following the headers) is the path.
+ */
+static int
+response(int fd)
+{
+	char	*out;
+	size_t	 sz;
+	int	 rc;
+
+	if ((out = regress_fcgi_response(fd, 1, &sz)) == NULL)
+		return 0;
+	rc = sz >= 10 && memcmp(out + sz - 10, "\r\n\r\n/index", 10) == 0;
+	free(out);
+	return rc;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_in	 sin;
+	socklen_t		 sinlen;
+	char			 out[1024];
+	size_t			 sz, i;
+	int			 fd, c = -1, rc = 0, opt = 1;
+	pid_t			 pid;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	sinlen = sizeof(sin);
+
+	if ((fd = socket(AF_INET, SOCK_STREAM, 0)) == -1 ||
+	    bind(fd, (struct sockaddr *)&sin, sizeof(sin)) == -1 ||
+	    listen(fd, 5) == -1 ||
+	    getsockname(fd, (struct sockaddr *)&sin, &sinlen) == -1) {
+		perror("socket");
+		return EXIT_FAILURE;
+	}
+
+	if ((pid = regress_fcgi_fork(fd, regress_fcgi_echo)) == -1)
+		return EXIT_FAILURE;
+
+	c = regress_fcgi_dial((struct sockaddr *)&sin, sizeof(sin));
+	if (c == -1)
+		goto out;
+	if (setsockopt(c, IPPROTO_TCP, 
+	    TCP_NODELAY, &opt, sizeof(opt)) == -1) {
+		perror("setsockopt");
+		goto out;
+	}
+
+	/* One request at a time, each waiting on its response. */
+
+	sz = regress_fcgi_get(out, 0, 1, "/index", 1);
+	for (i = 0; i < REQS; i++) {
+		if (!regress_writeall(c, out, sz)) {
+			perror("write");
+			goto out;
+		} else if (!response(c)) {
+			fprintf(stderr, "bad response\n");
+			goto out;
+		}
+	}
+	rc = 1;
+out:
+	if (c != -1)
+		close(c);
+	regress_fcgi_kill(pid);
+	return rc ? EXIT_SUCCESS : EXIT_FAILURE;
+}
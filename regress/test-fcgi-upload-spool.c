@@ -0,0 +1,246 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "../kcgi.h"
+#include "regress.h"
+
+/*
+ * FastCGI uploads spooled to a temporary file with the "spoolsz" option
+ * of struct kopts: values must be as usual, and also readable from the
+ * file at their offset.
+ * Many more bodies are spooled than the worker has files at once, and
+ * one request is aborted while spooling, so files must be replaced
+ * once used and given back when not.
+ */
+
+#define	SPOOLSZ	1024
+#define	BIGSZ	(256 * 1024 + 13)
+#define	SMALLSZ	100
+#define	UPLOADS	16
+
+/*
+ * Append a POST request of "sz" bytes of regress_bodychar() in records
+ * of at most "max" bytes, without the final, empty record if "partial".
+ */
+static size_t
+request(char *out, size_t pos, size_t sz, size_t max, int partial)
+{
+	char		 cl[32], *body;
+	size_t		 i, n;
+
+	if ((body = malloc(sz)) == NULL)
+		return 0;
+	for (i = 0; i < sz; i++)
+		body[i] = regress_bodychar(i);
+
+	snprintf(cl, sizeof(cl), "%zu", sz);
+	pos = regress_fcgi_begin(out, pos, 1, 0);
+	pos = regress_fcgi_param(out, pos, 1, "REQUEST_METHOD", "POST", 0);
+	pos = regress_fcgi_param(out, pos, 1, "CONTENT_TYPE",
+		"application/octet-stream", 0);
+	pos = regress_fcgi_param(out, pos, 1, "CONTENT_LENGTH", cl, 0);
+	pos = regress_fcgi_param(out, pos, 1, "PATH_INFO", "/index", 0);
+	pos = regress_fcgi_param(out, pos, 1,
+		"SCRIPT_NAME", "/cgi-bin/test", 0);
+	pos = regress_fcgi_param(out, pos, 1, "SERVER_PORT", "80", 0);
+	pos = regress_fcgi_param(out, pos, 1, "HTTP_HOST", "localhost", 0);
+	pos = regress_fcgi_param(out, pos, 1,
+		"REMOTE_ADDR", "127.0.0.1", 0);
+	pos = regress_fcgi_record(out, pos, 4, 1, NULL, 0, 0);
+
+	for (i = 0; i < sz; i += n) {
+		n = sz - i < max ? sz - i : max;
+		pos = regress_fcgi_record(out, pos, 5, 1, body + i, n, i % 8);
+	}
+	if (!partial)
+		pos = regress_fcgi_record(out, pos, 5, 1, NULL, 0, 0);
+
+	free(body);
+	return pos;
+}
+
+/*
+ * Send a request of "sz" bytes on a new connection and check that the
+ * response body is "ok".
+ * Returns zero on failure, non-zero on success.
+ */
+static int
+upload(const struct sockaddr_un *un, char *buf, size_t sz)
+{
+	char	*out;
+	size_t	 outsz;
+	int	 c, rc = 0;
+
+	c = regress_fcgi_dial((const struct sockaddr *)un,
+		sizeof(struct sockaddr_un));
+	if (c == -1)
+		return 0;
+	if ((outsz = request(buf, 0, sz, 65535, 0)) > 0 &&
+	    regress_writeall(c, buf, outsz) &&
+	    (out = regress_fcgi_response(c, 1, &outsz)) != NULL) {
+		rc = outsz >= 6 &&
+			memcmp(out + outsz - 6, "\r\n\r\nok", 6) == 0;
+		free(out);
+	}
+	close(c);
+	return rc;
+}
+
+/*
+ * Start a request big enough to be spooled on a new connection, then
+ * abort it, which must be ended.
+ * Returns zero on failure, non-zero on success.
+ */
+static int
+aborted(const struct sockaddr_un *un, char *buf)
+{
+	unsigned char	 end[16];
+	size_t		 sz;
+	int		 c, rc;
+
+	c = regress_fcgi_dial((const struct sockaddr *)un,
+		sizeof(struct sockaddr_un));
+	if (c == -1)
+		return 0;
+	sz = request(buf, 0, BIGSZ, 4096, 1);
+	sz = regress_fcgi_record(buf, sz, 2, 1, NULL, 0, 0);
+	rc = regress_writeall(c, buf, sz) &&
+		regress_readall(c, end, sizeof(end)) &&
+		end[1] == 3 && ((end[2] << 8) | end[3]) == 1;
+	close(c);
+	return rc;
+}
+
+/*
+ * Check that the request body of "r" is spooled (or not) as expected
+ * from its size, and that its value matches the file.
+ */
+static int
+check(const struct kreq *r)
+{
+	const struct kpair *kp;
+	struct stat	 st;
+	char		*buf;
+	off_t		 off;
+	size_t		 i;
+	int		 fd, rc;
+
+	if (r->fieldsz != 1)
+		return 0;
+	kp = &r->fields[0];
+
+	for (i = 0; i < kp->valsz; i++)
+		if (kp->val[i] != regress_bodychar(i))
+			return 0;
+	if (kp->val[kp->valsz] != '\0')
+		return 0;
+
+	fd = khttp_body_fd(r, kp, &off);
+	if (kp->valsz < SPOOLSZ)
+		return fd == -1;
+	if (fd == -1 || fstat(fd, &st) == -1 || st.st_nlink != 0)
+		return 0;
+
+	if ((buf = malloc(kp->valsz)) == NULL)
+		return 0;
+	rc = pread(fd, buf, kp->valsz, off) == (ssize_t)kp->valsz &&
+		memcmp(buf, kp->val, kp->valsz) == 0;
+	free(buf);
+	return rc;
+}
+
+static int
+server(void)
+{
+	struct kfcgi	*fcgi;
+	struct kreq	 r;
+	struct kopts	 opts;
+	const char	*page = "index";
+
+	memset(&opts, 0, sizeof(struct kopts));
+	opts.sndbufsz = -1;
+	opts.spoolsz = SPOOLSZ;
+
+	if (khttp_fcgi_initx(&fcgi, kmimetypes, KMIME__MAX, NULL, 0,
+	    ksuffixmap, KMIME_TEXT_HTML, &page, 1, 0,
+	    NULL, NULL, 0, &opts) != KCGI_OK)
+		return 0;
+	while (khttp_fcgi_parse(fcgi, &r) == KCGI_OK) {
+		khttp_head(&r, kresps[KRESP_STATUS],
+			"%s", khttps[KHTTP_200]);
+		khttp_head(&r, kresps[KRESP_CONTENT_TYPE],
+			"%s", kmimetypes[KMIME_TEXT_PLAIN]);
+		khttp_body(&r);
+		khttp_puts(&r, check(&r) ? "ok" : "bad");
+		khttp_free(&r);
+	}
+	khttp_fcgi_free(fcgi);
+	return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_un	 un;
+	char			*buf = NULL;
+	size_t			 i;
+	int			 fd, rc = 0;
+	pid_t			 pid;
+
+	if ((fd = regress_fcgi_unix(&un)) == -1)
+		return EXIT_FAILURE;
+	if ((pid = regress_fcgi_fork(fd, server)) == -1) {
+		unlink(un.sun_path);
+		return EXIT_FAILURE;
+	}
+
+	if ((buf = malloc(2 * BIGSZ)) == NULL) {
+		perror(NULL);
+		goto out;
+	}
+
+	for (i = 0; i < UPLOADS; i++) {
+		if (i == UPLOADS / 2 && !aborted(&un, buf)) {
+			fprintf(stderr, "bad abort\n");
+			goto out;
+		}
+		if (!upload(&un, buf, i % 4 == 3 ? SMALLSZ : BIGSZ + i)) {
+			fprintf(stderr, "upload %zu: bad response\n", i);
+			goto out;
+		}
+	}
+	rc = 1;
+out:
+	free(buf);
+	unlink(un.sun_path);
+	regress_fcgi_kill(pid);
+	return rc ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,160 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "../kcgi.h"
+#include "../kcgijson.h"
+#include "regress.h"
+
+/*
+ * Check that a small FastCGI response goes out in as few write calls
+ * as possible: one for the response and one to notify the control
+ * process that the request is done.
+ * The application counts its write calls with Linux's /proc/self/io
+ * while answering the first request, then reports the count in the
+ * body of the second.
+ * Where the counter isn't available, this passes trivially.
+ */
+
+static int64_t	 writes = -1;
+
+/*
+ * Send a GET request for "path" and return the NUL-terminated
+ * response, which must be freed, or NULL on failure.
+ */
+static char *
+request(int fd, const char *path)
+{
+	char	 buf[1024];
+	size_t	 sz;
+
+	sz = regress_fcgi_get(buf, 0, 1, path, 1);
+	if (!regress_writeall(fd, buf, sz))
+		return NULL;
+	return regress_fcgi_response(fd, 1, &sz);
+}
+
+/*
+ * Return the number of write calls made by this process or -1 if the
+ * counter is not available.
+ */
+static int64_t
+syscw(void)
+{
+	FILE		*f;
+	char		 line[128];
+	int64_t		 v = -1;
+
+	if ((f = fopen("/proc/self/io", "r")) == NULL)
+		return -1;
+	while (fgets(line, sizeof(line), f) != NULL)
+		if (sscanf(line, "syscw: %" SCNd64, &v) == 1)
+			break;
+	fclose(f);
+	return v;
+}
+
+static int
+server(void)
+{
+	struct kfcgi	*fcgi;
+	struct kreq	 r;
+	struct kjsonreq	 req;
+	const char	*page = "index";
+	int64_t		 start, end;
+
+	if (khttp_fcgi_init(&fcgi, NULL, 0, &page, 1, 0) != KCGI_OK)
+		return 0;
+	while (khttp_fcgi_parse(fcgi, &r) == KCGI_OK) {
+		start = syscw();
+		khttp_head(&r, kresps[KRESP_STATUS], 
+			"%s", khttps[KHTTP_200]);
+		khttp_head(&r, kresps[KRESP_CONTENT_TYPE], 
+			"%s", kmimetypes[KMIME_APP_JSON]);
+		khttp_body(&r);
+		kjson_open(&req, &r);
+		kjson_obj_open(&req);
+		kjson_putintp(&req, "writes", writes);
+		kjson_obj_close(&req);
+		kjson_close(&req);
+		khttp_free(&r);
+		end = syscw();
+		writes = (start == -1 || end == -1) ? -1 : end - start;
+	}
+	khttp_fcgi_free(fcgi);
+	return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_un	 un;
+	int			 fd, rc = 0;
+	char			*buf = NULL;
+	const char		*cp;
+	long long		 n;
+	pid_t			 pid;
+
+	if ((fd = regress_fcgi_unix(&un)) == -1)
+		return EXIT_FAILURE;
+	if ((pid = regress_fcgi_fork(fd, server)) == -1) {
+		unlink(un.sun_path);
+		return EXIT_FAILURE;
+	}
+
+	fd = regress_fcgi_dial((struct sockaddr *)&un, sizeof(un));
+	if (fd == -1)
+		goto out;
+
+	if ((buf = request(fd, "/first")) == NULL)
+		goto out;
+	free(buf);
+	if ((buf = request(fd, "/second")) == NULL)
+		goto out;
+
+	/* The second response reports the writes of the first. */
+
+	if ((cp = strstr(buf, "\"writes\": ")) == NULL) {
+		fprintf(stderr, "bad response: %s\n", buf);
+		goto out;
+	}
+	if ((n = strtoll(cp + 10, NULL, 10)) > 2) {
+		fprintf(stderr, "%lld writes for response\n", n);
+		goto out;
+	}
+	rc = 1;
+out:
+	free(buf);
+	if (fd != -1)
+		close(fd);
+	unlink(un.sun_path);
+	regress_fcgi_kill(pid);
+	return rc ? EXIT_SUCCESS : EXIT_FAILURE;
+}
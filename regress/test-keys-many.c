@@ -0,0 +1,107 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "../kcgi.h"
+#include "regress.h"
+
+#define	KEYSZ	200
+
+static int
+parent(CURL *curl)
+{
+
+	curl_easy_setopt(curl, CURLOPT_URL, 
+		"http://localhost:17123/"
+		"?k0=1&k199=x&k5=2&k150=3&unknown=4");
+	return(CURLE_OK == curl_easy_perform(curl));
+}
+
+/*
+ * Look up fields against a large key table.
+ * The last key duplicates an earlier one: like the first matching
+ * key, the first duplicate must be the one assigned.
+ */
+static int
+child(void)
+{
+	struct kreq	 r;
+	struct kvalid	 keys[KEYSZ + 1];
+	char		 names[KEYSZ][8];
+	const char 	*page = "index";
+	size_t		 i;
+	int		 rc = 0;
+
+	for (i = 0; i < KEYSZ; i++) {
+		snprintf(names[i], sizeof(names[i]), "k%zu", i);
+		keys[i].name = names[i];
+		keys[i].valid = i % 2 ? kvalid_int : NULL;
+	}
+	keys[KEYSZ].name = "k5";
+	keys[KEYSZ].valid = NULL;
+
+	if (khttp_parse(&r, keys, KEYSZ + 1, 
+	    &page, 1, 0) != KCGI_OK)
+		return 0;
+
+	if (r.fieldsz != 5)
+		goto out;
+	if (r.fieldmap[0] == NULL || 
+	    strcmp(r.fieldmap[0]->val, "1"))
+		goto out;
+	if (r.fieldmap[199] != NULL || 
+	    r.fieldnmap[199] == NULL)
+		goto out;
+	if (r.fieldmap[5] == NULL || 
+	    r.fieldmap[5]->parsed.i != 2)
+		goto out;
+	if (r.fieldmap[150] == NULL || 
+	    strcmp(r.fieldmap[150]->val, "3"))
+		goto out;
+	if (r.fieldmap[KEYSZ] != NULL ||
+	    r.fieldnmap[KEYSZ] != NULL)
+		goto out;
+	for (i = 0; i < r.fieldsz; i++)
+		if (strcmp(r.fields[i].key, "unknown") == 0 &&
+		    r.fields[i].keypos != KEYSZ + 1)
+			goto out;
+
+	khttp_head(&r, kresps[KRESP_STATUS], 
+		"%s", khttps[KHTTP_200]);
+	khttp_head(&r, kresps[KRESP_CONTENT_TYPE], 
+		"%s", kmimetypes[KMIME_TEXT_HTML]);
+	khttp_body(&r);
+	rc = 1;
+out:
+	khttp_free(&r);
+	return rc;
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	return regress_cgi(parent, child) ? 0 : 1;
+}
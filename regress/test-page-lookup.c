@@ -0,0 +1,88 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "../kcgi.h"
+#include "regress.h"
+
+static int
+parent(CURL *curl)
+{
+
+	curl_easy_setopt(curl, CURLOPT_URL, 
+		"http://localhost:17123/SECOND.Json");
+	return(CURLE_OK == curl_easy_perform(curl));
+}
+
+/*
+ * Page and suffix lookups are case insensitive and the first of
+ * duplicate names wins.
+ * Parse the same request again with a persistent worker but different
+ * tables: the lookups must use the new tables.
+ */
+static int
+child(void)
+{
+	struct kreq	 r;
+	struct kopts	 opts;
+	const char 	*pages1[] = { "first", "second", "Second" };
+	const char 	*pages2[] = { "second" };
+	const struct kmimemap suffixes[] = {
+		{ "txt", KMIME_TEXT_PLAIN },
+		{ NULL, KMIME__MAX } };
+
+	memset(&opts, 0, sizeof(struct kopts));
+	opts.sndbufsz = -1;
+	opts.persist = 1;
+
+	if (khttp_parsex(&r, ksuffixmap, kmimetypes, KMIME__MAX, 
+	    NULL, 0, pages1, 3, KMIME_TEXT_HTML, 0, 
+	    NULL, NULL, 0, &opts) != KCGI_OK)
+		return 0;
+	if (r.page != 1 || r.mime != KMIME_APP_JSON)
+		return 0;
+	khttp_free(&r);
+
+	if (khttp_parsex(&r, suffixes, kmimetypes, KMIME__MAX, 
+	    NULL, 0, pages2, 1, KMIME_TEXT_HTML, 0, 
+	    NULL, NULL, 0, &opts) != KCGI_OK)
+		return 0;
+	if (r.page != 0 || r.mime != KMIME__MAX)
+		return 0;
+
+	khttp_head(&r, kresps[KRESP_STATUS], 
+		"%s", khttps[KHTTP_200]);
+	khttp_head(&r, kresps[KRESP_CONTENT_TYPE], 
+		"%s", kmimetypes[KMIME_TEXT_HTML]);
+	khttp_body(&r);
+	khttp_free(&r);
+	return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	return regress_cgi(parent, child) ? 0 : 1;
+}
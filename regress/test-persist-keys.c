@@ -0,0 +1,86 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "../kcgi.h"
+#include "regress.h"
+
+static int
+parent(CURL *curl)
+{
+
+	curl_easy_setopt(curl, CURLOPT_URL, 
+		"http://localhost:17123/?foo=bar");
+	return(CURLE_OK == curl_easy_perform(curl));
+}
+
+/*
+ * Parse the same request twice with a persistent worker, changing the
+ * validators in between: the second parse must validate with the new
+ * validators and not those the worker was started with.
+ */
+static int
+child(void)
+{
+	struct kreq	 r;
+	struct kopts	 opts;
+	const char 	*page = "index";
+	struct kvalid	 keys1[] = { { kvalid_int, "foo" } };
+	struct kvalid	 keys2[] = { { kvalid_stringne, "foo" } };
+
+	memset(&opts, 0, sizeof(struct kopts));
+	opts.sndbufsz = -1;
+	opts.persist = 1;
+
+	if (khttp_parsex(&r, ksuffixmap, kmimetypes, KMIME__MAX, 
+	    keys1, 1, &page, 1, KMIME_TEXT_HTML, 0, 
+	    NULL, NULL, 0, &opts) != KCGI_OK)
+		return 0;
+	if (r.fieldmap[0] != NULL || r.fieldnmap[0] == NULL)
+		return 0;
+	khttp_free(&r);
+
+	if (khttp_parsex(&r, ksuffixmap, kmimetypes, KMIME__MAX, 
+	    keys2, 1, &page, 1, KMIME_TEXT_HTML, 0, 
+	    NULL, NULL, 0, &opts) != KCGI_OK)
+		return 0;
+	if (r.fieldmap[0] == NULL || r.fieldnmap[0] != NULL ||
+	    strcmp(r.fieldmap[0]->parsed.s, "bar") != 0)
+		return 0;
+
+	khttp_head(&r, kresps[KRESP_STATUS], 
+		"%s", khttps[KHTTP_200]);
+	khttp_head(&r, kresps[KRESP_CONTENT_TYPE], 
+		"%s", kmimetypes[KMIME_TEXT_HTML]);
+	khttp_body(&r);
+	khttp_free(&r);
+	return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	return regress_cgi(parent, child) ? 0 : 1;
+}
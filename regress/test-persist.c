@@ -0,0 +1,98 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "../kcgi.h"
+#include "regress.h"
+
+static int
+parent(CURL *curl)
+{
+	const char	*data = "foo=bar";
+
+	curl_easy_setopt(curl, CURLOPT_URL, 
+		"http://localhost:17123/?baz=xyzzy");
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, data);
+	return(CURLE_OK == curl_easy_perform(curl));
+}
+
+/*
+ * Parse the same request twice with a persistent worker, changing the
+ * environment in between: the second parse must see the new
+ * environment and not the prior body.
+ */
+static int
+child(void)
+{
+	struct kreq	 r;
+	struct kopts	 opts;
+	const char 	*page = "index";
+
+	memset(&opts, 0, sizeof(struct kopts));
+	opts.sndbufsz = -1;
+	opts.persist = 1;
+
+	if (khttp_parsex(&r, ksuffixmap, kmimetypes, KMIME__MAX, 
+	    NULL, 0, &page, 1, KMIME_TEXT_HTML, 0, 
+	    NULL, NULL, 0, &opts) != KCGI_OK)
+		return 0;
+	if (r.fieldsz != 2 ||
+	    strcmp(r.fields[0].key, "foo") != 0 ||
+	    strcmp(r.fields[0].val, "bar") != 0 ||
+	    strcmp(r.fields[1].key, "baz") != 0 ||
+	    strcmp(r.fields[1].val, "xyzzy") != 0)
+		return 0;
+	khttp_free(&r);
+
+	if (setenv("QUERY_STRING", "baz=frobnitz", 1) == -1 ||
+	    setenv("REQUEST_METHOD", "GET", 1) == -1 ||
+	    unsetenv("CONTENT_LENGTH") == -1 ||
+	    unsetenv("CONTENT_TYPE") == -1)
+		return 0;
+
+	if (khttp_parsex(&r, ksuffixmap, kmimetypes, KMIME__MAX, 
+	    NULL, 0, &page, 1, KMIME_TEXT_HTML, 0, 
+	    NULL, NULL, 0, &opts) != KCGI_OK)
+		return 0;
+	if (r.method != KMETHOD_GET ||
+	    r.fieldsz != 1 ||
+	    strcmp(r.fields[0].key, "baz") != 0 ||
+	    strcmp(r.fields[0].val, "frobnitz") != 0)
+		return 0;
+
+	khttp_head(&r, kresps[KRESP_STATUS], 
+		"%s", khttps[KHTTP_200]);
+	khttp_head(&r, kresps[KRESP_CONTENT_TYPE], 
+		"%s", kmimetypes[KMIME_TEXT_HTML]);
+	khttp_body(&r);
+	khttp_free(&r);
+	return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	return regress_cgi(parent, child) ? 0 : 1;
+}
@@ -0,0 +1,292 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "../kcgi.h"
+#include "regress.h"
+
+/*
+ * Conditional and range requests with khttp_body_file().
+ * The file has entity-tag "v1" and was last modified on Sun, 09 Sep
+ * 2001 01:46:40 GMT.
+ * Those answered with the whole file are repeated as HEAD requests,
+ * which have the same headers but no body.
+ */
+
+#define	CONTENT	"0123456789abcdefghijklmnopqrstuvwxyz"
+#define	MTIME	1000000000
+
+struct	test {
+	const char	*head[2]; /* request headers or NULL */
+	long		 code; /* HTTP status */
+	const char	*body; /* body or NULL for multipart */
+	const char	*range; /* Content-Range or NULL */
+};
+
+static const struct test tests[] = {
+	{ { NULL, NULL }, 200, CONTENT, NULL },
+	{ { "Range: bytes=10-19", NULL }, 
+	  206, "abcdefghij", "bytes 10-19/36" },
+	{ { "Range: bytes=-5", NULL }, 
+	  206, "vwxyz", "bytes 31-35/36" },
+	{ { "Range: bytes=30-", NULL }, 
+	  206, "uvwxyz", "bytes 30-35/36" },
+	{ { "Range: bytes=30-100", NULL }, 
+	  206, "uvwxyz", "bytes 30-35/36" },
+	{ { "Range: bytes=36-", NULL }, 416, "", "bytes */36" },
+	{ { "Range: bytes=0-1, 5-6", NULL }, 206, NULL, NULL },
+	{ { "Range: bytes=abc", NULL }, 200, CONTENT, NULL },
+	{ { "Range: bytes=5-1", NULL }, 200, CONTENT, NULL },
+	{ { "Range: lines=1-2", NULL }, 200, CONTENT, NULL },
+	{ { "Range: bytes=0-0,1-1,2-2,3-3,4-4,5-5,6-6,7-7,8-8,"
+	    "9-9,10-10,11-11,12-12,13-13,14-14,15-15,16-16", NULL }, 
+	  200, CONTENT, NULL },
+	{ { "If-None-Match: \"v1\"", NULL }, 304, "", NULL },
+	{ { "If-None-Match: W/\"v1\"", NULL }, 304, "", NULL },
+	{ { "If-None-Match: \"v2\", \"v3\"", NULL }, 200, CONTENT, NULL },
+	{ { "If-None-Match: *", NULL }, 304, "", NULL },
+	{ { "If-Modified-Since: Sun, 09 Sep 2001 01:46:40 GMT", NULL }, 
+	  304, "", NULL },
+	{ { "If-Modified-Since: Sunday, 09-Sep-01 01:46:39 GMT", NULL }, 
+	  200, CONTENT, NULL },
+	{ { "If-Modified-Since: Sun Sep  9 01:46:40 2001", NULL }, 
+	  304, "", NULL },
+	{ { "If-Modified-Since: yesterday", NULL }, 200, CONTENT, NULL },
+	{ { "If-None-Match: \"v2\"", 
+	    "If-Modified-Since: Sun, 09 Sep 2001 01:46:40 GMT" }, 
+	  200, CONTENT, NULL },
+	{ { "If-Match: \"v2\"", NULL }, 412, "", NULL },
+	{ { "If-Match: W/\"v1\"", NULL }, 412, "", NULL },
+	{ { "If-Match: \"v1\"", "Range: bytes=0-0" }, 
+	  206, "0", "bytes 0-0/36" },
+	{ { "If-Unmodified-Since: Sat, 08 Sep 2001 00:00:00 GMT", NULL }, 
+	  412, "", NULL },
+	{ { "If-Range: \"v1\"", "Range: bytes=0-3" }, 
+	  206, "0123", "bytes 0-3/36" },
+	{ { "If-Range: \"v2\"", "Range: bytes=0-3" }, 200, CONTENT, NULL },
+	{ { "If-Range: Sun, 09 Sep 2001 01:46:40 GMT", "Range: bytes=0-3" }, 
+	  206, "0123", "bytes 0-3/36" },
+	{ { "If-Range: Sun, 09 Sep 2001 01:46:41 GMT", "Range: bytes=0-3" }, 
+	  200, CONTENT, NULL },
+};
+
+static const struct test *test;
+static int	 head; /* HEAD instead of GET */
+static char	 fname[] = "/tmp/kcgi.XXXXXXXXXX";
+static char	 range[64];
+static char	 ctype[128];
+static char	 clen[32];
+
+/*
+ * Copy the value of header "name" into "dst" if "buf" is that header.
+ */
+static void
+headcopy(const char *buf, size_t len, const char *name, 
+	char *dst, size_t dstsz)
+{
+	size_t	 nsz = strlen(name);
+
+	if (len <= nsz || strncasecmp(buf, name, nsz) != 0)
+		return;
+	buf += nsz;
+	len -= nsz;
+	while (len > 0 && (buf[len - 1] == '\r' || buf[len - 1] == '\n'))
+		len--;
+	if (len >= dstsz)
+		len = dstsz - 1;
+	memcpy(dst, buf, len);
+	dst[len] = '\0';
+}
+
+static size_t
+headcb(char *buf, size_t sz, size_t nm, void *dat)
+{
+
+	headcopy(buf, nm * sz, "Content-Range: ", range, sizeof(range));
+	headcopy(buf, nm * sz, "Content-Type: ", ctype, sizeof(ctype));
+	headcopy(buf, nm * sz, "Content-Length: ", clen, sizeof(clen));
+	return nm * sz;
+}
+
+static size_t
+bufcb(void *contents, size_t sz, size_t nm, void *dat)
+{
+	struct kcgi_buf	*buf = dat;
+
+	if (kcgi_buf_write(contents, nm * sz, buf) != KCGI_OK)
+		return 0;
+	return nm * sz;
+}
+
+static int
+parent(CURL *curl)
+{
+	struct curl_slist	*list = NULL, *tmp;
+	struct kcgi_buf		 buf;
+	long			 code;
+	size_t			 i, n = test - tests;
+	int			 rc = 0;
+	CURLcode		 cc;
+
+	memset(&buf, 0, sizeof(struct kcgi_buf));
+	range[0] = ctype[0] = clen[0] = '\0';
+
+	for (i = 0; i < 2 && test->head[i] != NULL; i++) {
+		if ((tmp = curl_slist_append(list, test->head[i])) == NULL)
+			goto out;
+		list = tmp;
+	}
+
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
+	curl_easy_setopt(curl, CURLOPT_URL, "http://localhost:17123/");
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, headcb);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, bufcb);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buf);
+
+	/*
+	 * Don't tell curl that HEAD has no body: it then reads one of
+	 * the given length, getting none before the connection closes.
+	 */
+
+	if (head)
+		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "HEAD");
+	cc = curl_easy_perform(curl);
+	if (head && (cc != CURLE_PARTIAL_FILE || buf.sz != 0)) {
+		warnx("test %zu: body with HEAD", n);
+		goto out;
+	} else if (!head && cc != CURLE_OK) {
+		warnx("test %zu: curl_easy_perform", n);
+		goto out;
+	}
+
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+	if (code != test->code) {
+		warnx("test %zu: bad code: %ld", n, code);
+		goto out;
+	}
+
+	if (test->range == NULL ? range[0] != '\0' :
+	    strcmp(range, test->range) != 0) {
+		warnx("test %zu: bad range: %s", n, range);
+		goto out;
+	}
+
+	if (head) {
+		if (strcmp(clen, "36") != 0) {
+			warnx("test %zu: bad length: %s", n, clen);
+			goto out;
+		}
+		rc = 1;
+		goto out;
+	}
+
+	if (test->body != NULL) {
+		if (buf.sz != strlen(test->body) ||
+		    memcmp(buf.buf, test->body, buf.sz) != 0) {
+			warnx("test %zu: bad body", n);
+			goto out;
+		}
+		rc = 1;
+		goto out;
+	}
+
+	/* Multipart: each part with its type and range. */
+
+	if (strncmp(ctype, "multipart/byteranges; boundary=", 31) != 0) {
+		warnx("test %zu: bad type: %s", n, ctype);
+		goto out;
+	}
+	if (kcgi_buf_putc(&buf, '\0') != KCGI_OK)
+		goto out;
+	if (strstr(buf.buf, "Content-Type: text/plain\r\n"
+	     "Content-Range: bytes 0-1/36\r\n\r\n01\r\n--") == NULL ||
+	    strstr(buf.buf, "Content-Type: text/plain\r\n"
+	     "Content-Range: bytes 5-6/36\r\n\r\n56\r\n--") == NULL) {
+		warnx("test %zu: bad multipart", n);
+		goto out;
+	}
+	rc = 1;
+out:
+	curl_slist_free_all(list);
+	free(buf.buf);
+	return rc;
+}
+
+static int
+child(void)
+{
+	struct kreq	 r;
+	const char 	*page = "index";
+	int		 fd, rc;
+
+	if (khttp_parse(&r, NULL, 0, &page, 1, 0) != KCGI_OK)
+		return 0;
+	if ((fd = open(fname, O_RDONLY)) == -1) {
+		khttp_free(&r);
+		return 0;
+	}
+	rc = khttp_body_file(&r, fd, 
+		kmimetypes[KMIME_TEXT_PLAIN], "\"v1\"", MTIME) == KCGI_OK;
+	close(fd);
+	khttp_free(&r);
+	return rc;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t	 i;
+	int	 fd, rc = 0;
+
+	if ((fd = mkstemp(fname)) == -1)
+		err(EXIT_FAILURE, "%s", fname);
+	if (write(fd, CONTENT, strlen(CONTENT)) == -1) {
+		close(fd);
+		unlink(fname);
+		err(EXIT_FAILURE, "%s", fname);
+	}
+	close(fd);
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		test = &tests[i];
+		if (!regress_cgi(parent, child))
+			goto out;
+	}
+	for (head = 1, i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		test = &tests[i];
+		if (test->code == 200 && !regress_cgi(parent, child))
+			goto out;
+	}
+	rc = 1;
+out:
+	unlink(fname);
+	return rc ? EXIT_SUCCESS : EXIT_FAILURE;
+}
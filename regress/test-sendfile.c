@@ -0,0 +1,281 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "../kcgi.h"
+#include "regress.h"
+
+/*
+ * Sending files with khttp_sendfile(), khttp_template_fd() without a
+ * template, and khttp_body_sendfile() with a precompressed sibling,
+ * which must always vary by Accept-Encoding and sends no body for HEAD.
+ */
+
+#define	FILESZ	200003
+#define	SIBLING	"not really gzip"
+
+enum	mode {
+	MODE_SENDFILE, /* khttp_body(), khttp_sendfile() */
+	MODE_TEMPLATE, /* khttp_body(), khttp_template_fd() */
+	MODE_BODY, /* khttp_body_sendfile() */
+	MODE_HEAD /* khttp_body_sendfile() for HEAD */
+};
+
+struct	test {
+	enum mode	 mode;
+	const char	*accept; /* Accept-Encoding or NULL */
+	off_t		 off; /* offset for khttp_sendfile() */
+	size_t		 sz; /* size for khttp_sendfile() */
+	const char	*coding; /* Content-Encoding or NULL */
+	int		 sibling; /* expect the sibling */
+};
+
+static const struct test tests[] = {
+	{ MODE_SENDFILE, NULL, 0, SIZE_MAX, NULL, 0 },
+	{ MODE_SENDFILE, NULL, 1000, 5000, NULL, 0 },
+	{ MODE_SENDFILE, NULL, FILESZ - 10, 100, NULL, 0 },
+	{ MODE_SENDFILE, "gzip", 0, SIZE_MAX, "gzip", 0 },
+	{ MODE_TEMPLATE, NULL, 0, SIZE_MAX, NULL, 0 },
+	{ MODE_BODY, NULL, 0, SIZE_MAX, NULL, 0 },
+	{ MODE_BODY, "gzip", 0, SIZE_MAX, "gzip", 1 },
+	{ MODE_BODY, "gzip;q=0", 0, SIZE_MAX, NULL, 0 },
+	{ MODE_BODY, "br, zstd", 0, SIZE_MAX, NULL, 0 },
+	{ MODE_BODY, "br, gzip;q=0.5", 0, SIZE_MAX, "gzip", 1 },
+	{ MODE_HEAD, NULL, 0, SIZE_MAX, NULL, 0 },
+	{ MODE_HEAD, "gzip", 0, SIZE_MAX, "gzip", 1 },
+};
+
+static const struct test *test;
+static char	 fname[] = "/tmp/kcgi.XXXXXXXXXX";
+static char	 coding[32];
+static int	 vary; /* saw Vary: Accept-Encoding */
+
+static size_t
+headcb(char *buf, size_t sz, size_t nm, void *dat)
+{
+	size_t	 len = nm * sz;
+
+	if (len > 18 && strncasecmp(buf, "Content-Encoding: ", 18) == 0) {
+		len -= 18;
+		while (len > 0 && (buf[18 + len - 1] == '\r' ||
+		       buf[18 + len - 1] == '\n'))
+			len--;
+		if (len >= sizeof(coding))
+			len = sizeof(coding) - 1;
+		memcpy(coding, buf + 18, len);
+		coding[len] = '\0';
+	} else if (len >= 21 && 
+	    strncasecmp(buf, "Vary: Accept-Encoding", 21) == 0)
+		vary = 1;
+	return nm * sz;
+}
+
+static size_t
+bufcb(void *contents, size_t sz, size_t nm, void *dat)
+{
+	struct kcgi_buf	*buf = dat;
+
+	if (kcgi_buf_write(contents, nm * sz, buf) != KCGI_OK)
+		return 0;
+	return nm * sz;
+}
+
+static int
+parent(CURL *curl)
+{
+	struct curl_slist	*list = NULL;
+	struct kcgi_buf		 buf;
+	char			 hbuf[128];
+	size_t			 i, off, sz;
+	int			 rc = 0;
+	CURLcode		 cc;
+
+	memset(&buf, 0, sizeof(struct kcgi_buf));
+	coding[0] = '\0';
+	vary = 0;
+
+	if (test->accept != NULL) {
+		snprintf(hbuf, sizeof(hbuf), 
+			"Accept-Encoding: %s", test->accept);
+		if ((list = curl_slist_append(NULL, hbuf)) == NULL)
+			return 0;
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, list);
+	}
+
+	/* Decode compressed streams but not precompressed siblings. */
+
+	if (test->coding != NULL && !test->sibling)
+		curl_easy_setopt(curl, CURLOPT_ENCODING, "gzip");
+
+	curl_easy_setopt(curl, CURLOPT_URL, 
+		"http://localhost:17123/");
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, headcb);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, bufcb);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, &buf);
+
+	/*
+	 * Don't tell curl that HEAD has no body: it then reads one of
+	 * the given length, getting none before the connection closes.
+	 */
+
+	if (test->mode == MODE_HEAD)
+		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "HEAD");
+	cc = curl_easy_perform(curl);
+	if (test->mode == MODE_HEAD && 
+	    (cc != CURLE_PARTIAL_FILE || buf.sz != 0)) {
+		warnx("test %zu: body with HEAD", (size_t)(test - tests));
+		goto out;
+	} else if (test->mode != MODE_HEAD && cc != CURLE_OK) {
+		warnx("curl_easy_perform");
+		goto out;
+	}
+
+	if (test->coding == NULL ? coding[0] != '\0' :
+	    strcmp(coding, test->coding) != 0) {
+		warnx("test %zu: bad coding: %s", 
+			(size_t)(test - tests), coding);
+		goto out;
+	}
+
+	/* Even the file itself depends on Accept-Encoding. */
+
+	if (test->mode >= MODE_BODY && !vary) {
+		warnx("test %zu: no vary", (size_t)(test - tests));
+		goto out;
+	}
+
+	if (test->mode == MODE_HEAD) {
+		rc = 1;
+		goto out;
+	}
+
+	if (test->sibling) {
+		if (buf.sz != strlen(SIBLING) ||
+		    memcmp(buf.buf, SIBLING, buf.sz) != 0) {
+			warnx("test %zu: bad sibling", 
+				(size_t)(test - tests));
+			goto out;
+		}
+		rc = 1;
+		goto out;
+	}
+
+	off = (size_t)test->off;
+	sz = FILESZ - off < test->sz ? FILESZ - off : test->sz;
+	if (buf.sz != sz) {
+		warnx("test %zu: bad size: %zu", 
+			(size_t)(test - tests), buf.sz);
+		goto out;
+	}
+	for (i = 0; i < sz; i++)
+		if (buf.buf[i] != regress_bodychar(off + i)) {
+			warnx("test %zu: bad content", 
+				(size_t)(test - tests));
+			goto out;
+		}
+	rc = 1;
+out:
+	curl_slist_free_all(list);
+	free(buf.buf);
+	return rc;
+}
+
+static int
+child(void)
+{
+	struct kreq	 r;
+	const char 	*page = "index";
+	int		 fd, rc = 0;
+
+	if (khttp_parse(&r, NULL, 0, &page, 1, 0) != KCGI_OK)
+		return 0;
+
+	khttp_head(&r, kresps[KRESP_STATUS], 
+		"%s", khttps[KHTTP_200]);
+	khttp_head(&r, kresps[KRESP_CONTENT_TYPE], 
+		"%s", kmimetypes[KMIME_TEXT_PLAIN]);
+
+	if (test->mode >= MODE_BODY) {
+		rc = khttp_body_sendfile(&r, fname) == KCGI_OK;
+		khttp_free(&r);
+		return rc;
+	}
+
+	khttp_body(&r);
+	if ((fd = open(fname, O_RDONLY)) == -1) {
+		khttp_free(&r);
+		return 0;
+	}
+	if (test->mode == MODE_SENDFILE)
+		rc = khttp_sendfile(&r, fd, 
+			test->off, test->sz) == KCGI_OK;
+	else
+		rc = khttp_template_fd(&r, NULL, fd, fname) == KCGI_OK;
+	close(fd);
+	khttp_free(&r);
+	return rc;
+}
+
+int
+main(int argc, char *argv[])
+{
+	char	 sib[sizeof(fname) + 3];
+	FILE	*f;
+	size_t	 i;
+	int	 fd, rc = 0;
+
+	if ((fd = mkstemp(fname)) == -1)
+		err(EXIT_FAILURE, "%s", fname);
+	if ((f = fdopen(fd, "w")) == NULL)
+		err(EXIT_FAILURE, "%s", fname);
+	for (i = 0; i < FILESZ; i++)
+		fputc(regress_bodychar(i), f);
+	fclose(f);
+
+	snprintf(sib, sizeof(sib), "%s.gz", fname);
+	if ((f = fopen(sib, "w")) == NULL) {
+		unlink(fname);
+		err(EXIT_FAILURE, "%s", sib);
+	}
+	fputs(SIBLING, f);
+	fclose(f);
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		test = &tests[i];
+		if (!regress_cgi(parent, child))
+			goto out;
+	}
+	rc = 1;
+out:
+	unlink(fname);
+	unlink(sib);
+	return rc ? EXIT_SUCCESS : EXIT_FAILURE;
+}
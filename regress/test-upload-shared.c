@@ -0,0 +1,120 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#include <sys/stat.h>
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "../kcgi.h"
+#include "regress.h"
+
+static int
+parent(CURL *curl)
+{
+	struct curl_httppost	*post, *last;
+	char 			 htmlbuffer[] = "<HTML>test buffer</HTML>";
+	int			 rc;
+
+	/* Embedded NUL to make sure binary values work. */
+
+	htmlbuffer[8] = '\0';
+	post = last = NULL;
+
+	curl_formadd(&post, &last, CURLFORM_COPYNAME, 
+		"name", CURLFORM_COPYCONTENTS, "content", CURLFORM_END);
+	curl_formadd(&post, &last, CURLFORM_COPYNAME, 
+		"html_code_with_hole", CURLFORM_PTRCONTENTS, 
+		htmlbuffer, CURLFORM_CONTENTSLENGTH, 
+		sizeof(htmlbuffer) - 1, CURLFORM_CONTENTTYPE, 
+		"text/html", CURLFORM_END); 
+	curl_formadd(&post, &last, CURLFORM_COPYNAME, 
+		"picture", CURLFORM_FILE, "kcgi.c", CURLFORM_END);
+
+	curl_easy_setopt(curl, CURLOPT_HTTPPOST, post);
+	curl_easy_setopt(curl, CURLOPT_URL, 
+		"http://localhost:17123/");
+	rc = curl_easy_perform(curl);
+	curl_formfree(post);
+	return(CURLE_OK == rc);
+}
+
+static int
+child(void)
+{
+	struct kreq	 r;
+	struct kopts	 opts;
+	const char 	*page = "index";
+	size_t		 i, found = 0;
+	struct stat	 st;
+
+	memset(&opts, 0, sizeof(struct kopts));
+	opts.sndbufsz = -1;
+	opts.sharedbody = 1;
+
+	if (khttp_parsex(&r, ksuffixmap, kmimetypes, KMIME__MAX, 
+	    NULL, 0, &page, 1, KMIME_TEXT_HTML, 0, 
+	    NULL, NULL, 0, &opts) != KCGI_OK)
+		return 0;
+
+	for (i = 0; i < r.fieldsz; i++) {
+		if (r.fields[i].val[r.fields[i].valsz] != '\0')
+			return 0;
+		if (strcmp(r.fields[i].key, "name") == 0) {
+			if (r.fields[i].valsz != 7 ||
+			    strcmp(r.fields[i].val, "content"))
+				return 0;
+		} else if (strcmp(r.fields[i].key, 
+		           "html_code_with_hole") == 0) {
+			if (r.fields[i].valsz != 24 ||
+			    memcmp(r.fields[i].val, 
+			    "<HTML>te\0t buffer</HTML>", 24))
+				return 0;
+		} else if (strcmp(r.fields[i].key, "picture") == 0) {
+			if (r.fields[i].file == NULL ||
+			    stat("kcgi.c", &st) == -1 ||
+			    (size_t)st.st_size != r.fields[i].valsz)
+				return 0;
+		} else
+			return 0;
+		found++;
+	}
+
+	if (found != 3)
+		return 0;
+
+	khttp_head(&r, kresps[KRESP_STATUS], 
+		"%s", khttps[KHTTP_200]);
+	khttp_head(&r, kresps[KRESP_CONTENT_TYPE], 
+		"%s", kmimetypes[KMIME_TEXT_HTML]);
+	khttp_body(&r);
+	khttp_free(&r);
+	return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+
+	return regress_cgi(parent, child) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,173 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2026 agent <agent@local>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../config.h"
+
+#include <sys/stat.h>
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <curl/curl.h>
+
+#include "../kcgi.h"
+#include "regress.h"
+
+/*
+ * Uploads spooled to a temporary file with the "spoolsz" option of
+ * struct kopts, by a worker per request or by the persistent worker:
+ * values must be as usual, and also readable from the file at their
+ * offset.
+ */
+
+struct	test {
+	size_t		 spoolsz; /* kopts "spoolsz" */
+	int		 persist; /* kopts "persist" */
+	int		 spooled; /* expect the body spooled */
+};
+
+static const struct test tests[] = {
+	{ 1024, 0, 1 },
+	{ 1024 * 1024 * 1024, 0, 0 },
+	{ 0, 0, 0 },
+	{ 1024, 1, 1 },
+	{ 1024 * 1024 * 1024, 1, 0 },
+};
+
+static const struct test *test;
+
+static int
+parent(CURL *curl)
+{
+	struct curl_httppost	*post, *last;
+	int			 rc;
+
+	post = last = NULL;
+
+	curl_formadd(&post, &last, CURLFORM_COPYNAME, 
+		"name", CURLFORM_COPYCONTENTS, "content", CURLFORM_END);
+	curl_formadd(&post, &last, CURLFORM_COPYNAME, 
+		"picture", CURLFORM_FILE, "kcgi.c", CURLFORM_END);
+
+	curl_easy_setopt(curl, CURLOPT_HTTPPOST, post);
+	curl_easy_setopt(curl, CURLOPT_URL, 
+		"http://localhost:17123/");
+	rc = curl_easy_perform(curl);
+	curl_formfree(post);
+	return(CURLE_OK == rc);
+}
+
+/*
+ * Check that the value of "kp" is spooled (or not) as expected.
+ */
+static int
+check(const struct kreq *r, const struct kpair *kp)
+{
+	int	 fd;
+	off_t	 off;
+	char	*buf;
+	int	 rc;
+
+	fd = khttp_body_fd(r, kp, &off);
+	if (!test->spooled)
+		return fd == -1;
+	if (fd == -1)
+		return 0;
+
+	if ((buf = malloc(kp->valsz + 1)) == NULL)
+		return 0;
+	rc = pread(fd, buf, kp->valsz, off) == (ssize_t)kp->valsz &&
+		memcmp(buf, kp->val, kp->valsz) == 0;
+	free(buf);
+	return rc;
+}
+
+static int
+child(void)
+{
+	struct kreq	 r;
+	struct kopts	 opts;
+	const char 	*page = "index";
+	size_t		 i, found = 0;
+	struct stat	 st;
+	int		 fd;
+	off_t		 off;
+
+	memset(&opts, 0, sizeof(struct kopts));
+	opts.sndbufsz = -1;
+	opts.spoolsz = test->spoolsz;
+	opts.persist = test->persist;
+
+	if (khttp_parsex(&r, ksuffixmap, kmimetypes, KMIME__MAX, 
+	    NULL, 0, &page, 1, KMIME_TEXT_HTML, 0, 
+	    NULL, NULL, 0, &opts) != KCGI_OK)
+		return 0;
+
+	/* The whole body, in an unlinked file. */
+
+	fd = khttp_body_fd(&r, NULL, &off);
+	if (test->spooled && (fd == -1 || off != 0 ||
+	    fstat(fd, &st) == -1 || st.st_nlink != 0))
+		return 0;
+	else if (!test->spooled && fd != -1)
+		return 0;
+
+	for (i = 0; i < r.fieldsz; i++) {
+		if (r.fields[i].val[r.fields[i].valsz] != '\0')
+			return 0;
+		if (strcmp(r.fields[i].key, "name") == 0) {
+			if (r.fields[i].valsz != 7 ||
+			    strcmp(r.fields[i].val, "content"))
+				return 0;
+		} else if (strcmp(r.fields[i].key, "picture") == 0) {
+			if (r.fields[i].file == NULL ||
+			    stat("kcgi.c", &st) == -1 ||
+			    (size_t)st.st_size != r.fields[i].valsz)
+				return 0;
+		} else
+			return 0;
+		if (!check(&r, &r.fields[i]))
+			return 0;
+		found++;
+	}
+
+	if (found != 2)
+		return 0;
+
+	khttp_head(&r, kresps[KRESP_STATUS], 
+		"%s", khttps[KHTTP_200]);
+	khttp_head(&r, kresps[KRESP_CONTENT_TYPE], 
+		"%s", kmimetypes[KMIME_TEXT_HTML]);
+	khttp_body(&r);
+	khttp_free(&r);
+	return 1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	size_t	 i;
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		test = &tests[i];
+		if (!regress_cgi(parent, child))
+			return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -63,7 +63,8 @@ child(void)
 		{ kvalid_date, "fail6" }};
 	const char 	*page[] = { "index" };
 
-	if (KCGI_OK != khttp_parse(&r, key, sizeof(key), page, 1, 0))
+	if (KCGI_OK != khttp_parse(&r, key, 
+	    sizeof(key) / sizeof(key[0]), page, 1, 0))
 		return(0);
 
 	if (NULL == r.fieldmap[0] ||
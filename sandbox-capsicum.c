@@ -107,7 +107,7 @@ ksandbox_capsicum_init_control(int worker, int fdfiled, int fdaccept)
 }
 
 static int
-ksandbox_capsicum_init_worker(int fd1, int fd2)
+ksandbox_capsicum_init_worker(int fd1, int fd2, int recvfd)
 {
 	int rc;
 	struct rlimit	 rl_zero;
@@ -159,7 +159,9 @@ ksandbox_capsicum_init_worker(int fd1, int fd2)
 	}
 #endif
 
-	if (setrlimit(RLIMIT_NOFILE, &rl_zero) == -1) {
+	/* Received descriptors count against the limit. */
+
+	if (!recvfd && setrlimit(RLIMIT_NOFILE, &rl_zero) == -1) {
 		kutil_warn(NULL, NULL, "setrlimit");
 		return 0;
 	} else if (setrlimit(RLIMIT_NPROC, &rl_zero) == -1) {
@@ -185,7 +187,10 @@ ksandbox_capsicum_init_child(enum sandtype type,
 
 	switch (type) {
 	case SAND_WORKER:
-		rc = ksandbox_capsicum_init_worker(fd1, fd2);
+		rc = ksandbox_capsicum_init_worker(fd1, fd2, 0);
+		break;
+	case SAND_WORKER_FCGI:
+		rc = ksandbox_capsicum_init_worker(fd1, fd2, 1);
 		break;
 	case SAND_CONTROL_OLD:
 		assert(fd2 == -1);
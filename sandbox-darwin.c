@@ -35,7 +35,7 @@ ksandbox_darwin_init_child(enum sandtype type)
 	char		*er;
 	struct rlimit	 rl_zero;
 
-	rc = type == SAND_WORKER ?
+	rc = type == SAND_WORKER || type == SAND_WORKER_FCGI ?
 		sandbox_init(kSBXProfilePureComputation, 
 			SANDBOX_NAMED, &er) :
 		sandbox_init(kSBXProfileNoWrite, 
@@ -30,9 +30,14 @@ ksandbox_pledge_init_child(enum sandtype type)
 {
 	const char	*fl;
 
-	fl = type != SAND_WORKER ?
-		"stdio unix sendfd recvfd" :
-		"stdio";
+	if (type == SAND_WORKER)
+		fl = "stdio";
+	else if (type == SAND_WORKER_FCGI)
+		fl = "stdio recvfd";
+	else if (type == SAND_CONTROL_OLD)
+		fl = "stdio unix inet sendfd recvfd";
+	else
+		fl = "stdio unix sendfd recvfd";
 
 	if (pledge(fl, NULL) == -1) {
 		kutil_warn(NULL, NULL, "pledge");
@@ -115,6 +115,9 @@ static const struct sock_filter preauth_ctrl[] = {
 #endif
 #ifdef __NR_recvmsg /* XXX: untested: mirroring __NR_sendmsg */
 	SC_ALLOW(recvmsg),
+#endif
+#ifdef __NR_recvfrom /* peeking at kept connections */
+	SC_ALLOW(recvfrom),
 #endif
 	SC_ALLOW(read),
 	SC_ALLOW(readv),
@@ -186,10 +189,16 @@ static const struct sock_filter preauth_work[] = {
 	SC_ALLOW(clock_gettime),
 #ifdef __NR_time /* not defined on EABI ARM */
 	SC_ALLOW(time),
+#endif
+#ifdef __NR_recvmsg /* FastCGI connections */
+	SC_ALLOW(recvmsg),
+#endif
+#ifdef __NR_socketcall /* used for recvmsg on __i386__ (linux) */
+	SC_ALLOW(socketcall),
 #endif
 	SC_ALLOW(read),
 	SC_ALLOW(readv),
-	SC_ALLOW(lseek), /* for kutil_openlog logging */
+	SC_ALLOW(lseek), /* for kutil_openlog logging and spools */
 	SC_ALLOW(fstat), /* for kutil_openlog logging */
 #ifdef __NR_newfstatat
 	SC_ALLOW(newfstatat), /* for kutil_openlog logging */
@@ -287,7 +296,8 @@ ssh_sandbox_child_debugging(enum sandtype type)
 	sigemptyset(&mask);
 	sigaddset(&mask, SIGSYS);
 
-	act.sa_sigaction = SAND_WORKER == type ?
+	act.sa_sigaction = SAND_WORKER == type ||
+	    SAND_WORKER_FCGI == type ?
 		&ssh_sandbox_violation_worker :
 		&ssh_sandbox_violation_control;
 	act.sa_flags = SA_SIGINFO;
@@ -335,7 +345,7 @@ ksandbox_seccomp_init_child(enum sandtype type)
 	}
 
 	if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, 
-	    SAND_WORKER != type ?
+	    SAND_WORKER != type && SAND_WORKER_FCGI != type ?
 	    &preauth_prog_ctrl : &preauth_prog_work) == -1)
 		kutil_warn(NULL, NULL, "prctl");
 	else if (nnp_failed) {
@@ -39,10 +39,12 @@
  * Each sandbox will want to do something here to make sure that the
  * child context is sandboxed properly.
  * This function depends on "type": if SAND_WORKER, we set fd1 to be the
- * descriptor between the child and the application; if fd2 isn't -1,
- * it's the FastCGI control connection (fdfiled and fdaccept should be
- * ignored in SAND_WORKER case).
- * If not SAND_WORKER, we're the control process in a FastCGI context:
+ * descriptor between the child and the application (fdfiled and
+ * fdaccept should be ignored in SAND_WORKER case).
+ * If SAND_WORKER_FCGI, it's the same, but the worker is also passed
+ * the descriptors it reads from: over fd2, the FastCGI control
+ * connection, or (for the persistent CGI worker, where fd2 is -1) fd1.
+ * Otherwise, we're the control process in a FastCGI context:
  * fd1 is the control connection; fd2 is -1; fdaccept, if not -1, is the
  * old-style FastCGI socket; fdfiled, if not -1, is the new-style
  * transport descriptor interface.
@@ -208,6 +208,11 @@ khttp_template_fd(struct kreq *req,
 {
 	struct ktemplatex x;
 
+	/* Without substitutions, send the file as-is. */
+
+	if (t == NULL)
+		return khttp_sendfile(req, fd, 0, SIZE_MAX);
+
 	memset(&x, 0, sizeof(struct ktemplatex));
 	x.writer = khttp_templatex_write;
 	return khttp_templatex_fd(t, fd, fname, &x, req);
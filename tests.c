@@ -74,6 +74,20 @@ main(void)
 	return b64_ntop((const unsigned char *)src, 11, output, sizeof(output)) > 0 ? 0 : 1;
 }
 #endif /* TEST_B64_NTOP */
+#if TEST_BROTLI
+#include <brotli/encode.h>
+
+int
+main(void)
+{
+	BrotliEncoderState *s;
+
+	if ((s = BrotliEncoderCreateInstance(NULL, NULL, NULL)) == NULL)
+		return 1;
+	BrotliEncoderDestroyInstance(s);
+	return 0;
+}
+#endif /* TEST_BROTLI */
 #if TEST_CAPSICUM
 #include <sys/capsicum.h>
 
@@ -525,6 +539,18 @@ main(void)
 	return(EFAULT == errno ? 0 : 1);
 }
 #endif /* TEST_SECCOMP_FILTER */
+#if TEST_SENDFILE
+#include <sys/types.h>
+#include <sys/sendfile.h>
+
+int
+main(void)
+{
+	off_t	 off = 0;
+
+	return sendfile(1, 0, &off, 0) == -1;
+}
+#endif /* TEST_SENDFILE */
 #if TEST_SETRESGID
 #define _GNU_SOURCE /* linux */
 #include <sys/types.h>
@@ -840,3 +866,17 @@ main(void)
 	return waitpid(WAIT_ANY, &st, WNOHANG) != -1;
 }
 #endif /* TEST_WAIT_ANY */
+#if TEST_ZSTD
+#include <zstd.h>
+
+int
+main(void)
+{
+	ZSTD_CCtx *c;
+
+	if ((c = ZSTD_createCCtx()) == NULL)
+		return 1;
+	ZSTD_freeCCtx(c);
+	return 0;
+}
+#endif /* TEST_ZSTD */
@@ -16,12 +16,16 @@
  */
 #include "config.h"
 
+#if HAVE_SENDFILE
+# include <sys/sendfile.h>
+#endif
 #include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/uio.h>
 #include <sys/wait.h>
 
 #include <assert.h>
+#include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <poll.h>
@@ -136,6 +140,215 @@ kxstrdup(const char *cp)
 	return NULL;
 }
 
+/*
+ * Allocate "sz" bytes from the arena, which are released all at once
+ * with karena_free().
+ * Allocations are aligned to KARENA_ALIGN.
+ * Allocations larger than a block get their own block.
+ * Returns NULL on memory exhaustion or zero-length allocations.
+ */
+void *
+karena_alloc(struct karena *a, size_t sz)
+{
+	struct karena_blk	*b;
+	size_t			 blksz;
+
+	if (sz == 0) {
+		kutil_warnx(NULL, NULL, "arena: zero length");
+		return NULL;
+	} else if (sz > SIZE_MAX - KARENA_ALIGN) {
+		kutil_warnx(NULL, NULL, "arena: overflow");
+		return NULL;
+	}
+
+	sz = (sz + KARENA_ALIGN - 1) & ~((size_t)KARENA_ALIGN - 1);
+
+	if ((b = a->blks) != NULL && b->sz - b->pos >= sz) {
+		b->pos += sz;
+		return b->data + b->pos - sz;
+	}
+
+	/* 
+	 * Start a new block.
+	 * If the allocation is larger than a block, put it behind the
+	 * current block so that its remaining space can still be used.
+	 */
+
+	blksz = sz > KARENA_BLKSZ ? sz : KARENA_BLKSZ;
+	if (blksz > SIZE_MAX - sizeof(struct karena_blk)) {
+		kutil_warnx(NULL, NULL, "arena: overflow");
+		return NULL;
+	}
+
+	b = kxmalloc(sizeof(struct karena_blk) + blksz);
+	if (b == NULL)
+		return NULL;
+
+	b->sz = blksz;
+	b->pos = sz;
+
+	if (sz > KARENA_BLKSZ && a->blks != NULL) {
+		b->next = a->blks->next;
+		a->blks->next = b;
+	} else {
+		b->next = a->blks;
+		a->blks = b;
+	}
+
+	return b->data;
+}
+
+/*
+ * Like karena_alloc(), but zeroing the memory and checking the
+ * multiplicative overflow as calloc() would.
+ */
+void *
+karena_calloc(struct karena *a, size_t nm, size_t sz)
+{
+	void	*p;
+
+	if (nm && sz > SIZE_MAX / nm) {
+		kutil_warnx(NULL, NULL, "arena: overflow");
+		return NULL;
+	}
+	if ((p = karena_alloc(a, nm * sz)) != NULL)
+		memset(p, 0, nm * sz);
+	return p;
+}
+
+/*
+ * Release all memory allocated from the arena, which may then be
+ * re-used.
+ */
+void
+karena_free(struct karena *a)
+{
+	struct karena_blk	*b;
+
+	while ((b = a->blks) != NULL) {
+		a->blks = b->next;
+		free(b);
+	}
+}
+
+/*
+ * Case-insensitive FNV-1a hash, matching strcasecmp(3) in the "C"
+ * locale.
+ */
+static size_t
+kstrmap_hash(const char *key)
+{
+	uint32_t	 h = 2166136261U;
+
+	for ( ; *key != '\0'; key++) {
+		h ^= (unsigned char)tolower((unsigned char)*key);
+		h *= 16777619U;
+	}
+	return h;
+}
+
+/*
+ * Allocate a map with room for "n" names.
+ * Returns zero on memory allocation failure, non-zero on success.
+ */
+static int
+kstrmap_alloc(struct kstrmap *m, size_t n)
+{
+	size_t	 sz;
+
+	memset(m, 0, sizeof(struct kstrmap));
+	if (n > SIZE_MAX / 4) {
+		kutil_warnx(NULL, NULL, "kstrmap_alloc: overflow");
+		return 0;
+	}
+
+	/* Keep the load factor at or below one half. */
+
+	for (sz = 16; sz < n * 2; sz *= 2)
+		continue;
+	m->slots = kxcalloc(sz, sizeof(struct kstrmap_ent));
+	if (m->slots == NULL)
+		return 0;
+	m->mask = sz - 1;
+	return 1;
+}
+
+/*
+ * Add "name" with "val" unless "name" is already mapped: like a linear
+ * scan with strcasecmp(3), the first of duplicate names wins.
+ * The name is not copied.
+ */
+static void
+kstrmap_add(struct kstrmap *m, const char *name, size_t val)
+{
+	size_t	 i;
+
+	i = kstrmap_hash(name) & m->mask;
+	for ( ; m->slots[i].name != NULL; i = (i + 1) & m->mask)
+		if (strcasecmp(m->slots[i].name, name) == 0)
+			return;
+	m->slots[i].name = name;
+	m->slots[i].val = val;
+}
+
+/*
+ * Map each of "pagesz" pages to its position in "pages".
+ * Returns zero on memory allocation failure, non-zero on success.
+ */
+int
+kstrmap_pages(struct kstrmap *m, const char *const *pages, size_t pagesz)
+{
+	size_t	 i;
+
+	if (!kstrmap_alloc(m, pagesz))
+		return 0;
+	for (i = 0; i < pagesz; i++)
+		kstrmap_add(m, pages[i], i);
+	return 1;
+}
+
+/*
+ * Map each suffix in the NULL-terminated "suffixmap" to its MIME type.
+ * Returns zero on memory allocation failure, non-zero on success.
+ */
+int
+kstrmap_suffixes(struct kstrmap *m, const struct kmimemap *suffixmap)
+{
+	const struct kmimemap	*mm;
+
+	for (mm = suffixmap; mm->name != NULL; mm++)
+		continue;
+	if (!kstrmap_alloc(m, (size_t)(mm - suffixmap)))
+		return 0;
+	for (mm = suffixmap; mm->name != NULL; mm++)
+		kstrmap_add(m, mm->name, mm->mime);
+	return 1;
+}
+
+/*
+ * Look up "name" case-insensitively.
+ * Returns its value or "def" if not found.
+ */
+size_t
+kstrmap_get(const struct kstrmap *m, const char *name, size_t def)
+{
+	size_t	 i;
+
+	i = kstrmap_hash(name) & m->mask;
+	for ( ; m->slots[i].name != NULL; i = (i + 1) & m->mask)
+		if (strcasecmp(m->slots[i].name, name) == 0)
+			return m->slots[i].val;
+	return def;
+}
+
+void
+kstrmap_free(struct kstrmap *m)
+{
+
+	free(m->slots);
+	memset(m, 0, sizeof(struct kstrmap));
+}
+
 /*
  * waitpid() and logging anything but a return with EXIT_SUCCESS.
  * Returns KCGI_OK on EXIT_SUCCESS, KCGI_SYSTEM on waitpid() error,
@@ -314,6 +527,243 @@ fullwritenoerr(int fd, const void *buf, size_t bufsz)
 	return er;
 }
 
+/*
+ * Like fullwritenoerr(), but gathering the "iovcnt" buffers of "iov" in
+ * as few writev(2) calls as possible.
+ * The "iov" array is modified as data is written.
+ */
+enum kcgi_err
+fullwritevnoerr(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t	 	  ssz;
+	size_t	 	  sz;
+	struct pollfd	  pfd;
+	int		  rc;
+	enum kcgi_err	  er = KCGI_OK;
+	void		(*sig)(int);
+
+	pfd.fd = fd;
+	pfd.events = POLLOUT;
+
+	if ((sig = signal(SIGPIPE, SIG_IGN)) == SIG_ERR) {
+		kutil_warn(NULL, NULL, "signal");
+		return KCGI_SYSTEM;
+	}
+
+	for (;;) {
+		/* Skip past fully-written (or empty) buffers. */
+
+		while (iovcnt > 0 && iov->iov_len == 0) {
+			iov++;
+			iovcnt--;
+		}
+		if (iovcnt == 0)
+			break;
+
+		if ((rc = poll(&pfd, 1, -1)) < 0) {
+			kutil_warn(NULL, NULL, "poll");
+			er = KCGI_SYSTEM;
+			break;
+		} else if (rc == 0) {
+			kutil_warnx(NULL, NULL, "poll: timeout!?");
+			continue;
+		}
+
+		if (pfd.revents & POLLHUP) {
+			kutil_warnx(NULL, NULL, "poll: hangup");
+			er = KCGI_HUP;
+			break;
+		} else if (pfd.revents & POLLERR) {
+			kutil_warnx(NULL, NULL, "poll: error");
+			er = KCGI_SYSTEM;
+			break;
+		}
+
+		/* See note in fullwrite(). */
+
+#ifdef __APPLE__
+		if (!(pfd.revents & POLLOUT) && 
+		    !(pfd.revents & POLLNVAL)) {
+			kutil_warnx(NULL, NULL, "poll: no output");
+			er = KCGI_SYSTEM;
+			break;
+		}
+#else
+		if (!(pfd.revents & POLLOUT)) {
+			kutil_warnx(NULL, NULL, "poll: no output");
+			er = KCGI_SYSTEM;
+			break;
+		}
+#endif
+
+		if ((ssz = writev(fd, iov, iovcnt)) < 0) {
+			er = errno == EPIPE ? KCGI_HUP : KCGI_SYSTEM;
+			kutil_warn(NULL, NULL, "writev");
+			break;
+		}
+
+		/* Consume what was written. */
+
+		for (sz = (size_t)ssz; sz > 0; ) {
+			if (sz < iov->iov_len) {
+				iov->iov_base = (char *)iov->iov_base + sz;
+				iov->iov_len -= sz;
+				break;
+			}
+			sz -= iov->iov_len;
+			iov->iov_len = 0;
+			iov++;
+			iovcnt--;
+		}
+	}
+
+	if (signal(SIGPIPE, sig) == SIG_ERR) {
+		kutil_warn(NULL, NULL, "signal");
+		er = KCGI_SYSTEM;
+	}
+
+	return er;
+}
+
+/*
+ * Like fullwritevnoerr(), but with a single writev(2) to the
+ * non-blocking "fd" that writes only what it can without blocking,
+ * possibly nothing.
+ * The "iov" array is modified as data is written, so what remains is
+ * what wasn't written.
+ */
+enum kcgi_err
+trywritevnoerr(int fd, struct iovec *iov, int iovcnt)
+{
+	ssize_t	 	  ssz;
+	size_t	 	  sz;
+	enum kcgi_err	  er = KCGI_OK;
+	void		(*sig)(int);
+
+	if ((sig = signal(SIGPIPE, SIG_IGN)) == SIG_ERR) {
+		kutil_warn(NULL, NULL, "signal");
+		return KCGI_SYSTEM;
+	}
+
+	if ((ssz = writev(fd, iov, iovcnt)) < 0) {
+		if (errno != EAGAIN && errno != EWOULDBLOCK &&
+		    errno != EINTR) {
+			er = errno == EPIPE ? KCGI_HUP : KCGI_SYSTEM;
+			kutil_warn(NULL, NULL, "writev");
+		}
+		ssz = 0;
+	}
+
+	for (sz = (size_t)ssz; sz > 0; ) {
+		if (sz < iov->iov_len) {
+			iov->iov_base = (char *)iov->iov_base + sz;
+			iov->iov_len -= sz;
+			break;
+		}
+		sz -= iov->iov_len;
+		iov->iov_len = 0;
+		iov++;
+	}
+
+	if (signal(SIGPIPE, sig) == SIG_ERR) {
+		kutil_warn(NULL, NULL, "signal");
+		er = KCGI_SYSTEM;
+	}
+
+	return er;
+}
+
+/*
+ * Write "sz" bytes from the file "in" at offset "off" to "out", the
+ * offset being advanced by what's written.
+ * This uses sendfile(2) where available, so the data doesn't pass
+ * through userland, and otherwise (or if the descriptors aren't
+ * supported by sendfile(2)) reads into a buffer and writes with
+ * fullwritenoerr().
+ * Returns KCGI_OK on success, KCGI_HUP on hangup, or KCGI_SYSTEM on
+ * failure or if the file is shorter than expected.
+ */
+enum kcgi_err
+fullsendfile(int out, int in, off_t *off, size_t sz)
+{
+	char		  buf[BUFSIZ];
+	ssize_t		  ssz;
+	enum kcgi_err	  er = KCGI_OK;
+#if HAVE_SENDFILE
+	struct pollfd	  pfd;
+	void		(*sig)(int);
+
+	pfd.fd = out;
+	pfd.events = POLLOUT;
+
+	if ((sig = signal(SIGPIPE, SIG_IGN)) == SIG_ERR) {
+		kutil_warn(NULL, NULL, "signal");
+		return KCGI_SYSTEM;
+	}
+
+	while (sz > 0) {
+		if (poll(&pfd, 1, -1) < 0) {
+			kutil_warn(NULL, NULL, "poll");
+			er = KCGI_SYSTEM;
+			break;
+		} else if (pfd.revents & POLLHUP) {
+			kutil_warnx(NULL, NULL, "poll: hangup");
+			er = KCGI_HUP;
+			break;
+		} else if (pfd.revents & POLLERR) {
+			kutil_warnx(NULL, NULL, "poll: error");
+			er = KCGI_SYSTEM;
+			break;
+		}
+
+		ssz = sendfile(out, in, off, sz);
+		if (ssz < 0 && (errno == EINTR || errno == EAGAIN))
+			continue;
+
+		/* Not supported for these descriptors: do it by hand. */
+
+		if (ssz < 0 && (errno == EINVAL || errno == ENOSYS))
+			break;
+
+		if (ssz < 0) {
+			er = errno == EPIPE ? KCGI_HUP : KCGI_SYSTEM;
+			kutil_warn(NULL, NULL, "sendfile");
+			break;
+		} else if (ssz == 0) {
+			kutil_warnx(NULL, NULL, "sendfile: short file");
+			er = KCGI_SYSTEM;
+			break;
+		}
+		sz -= (size_t)ssz;
+	}
+
+	if (signal(SIGPIPE, sig) == SIG_ERR) {
+		kutil_warn(NULL, NULL, "signal");
+		er = KCGI_SYSTEM;
+	}
+#endif
+
+	while (er == KCGI_OK && sz > 0) {
+		ssz = pread(in, buf, 
+			sz < sizeof(buf) ? sz : sizeof(buf), *off);
+		if (ssz < 0 && errno == EINTR)
+			continue;
+		if (ssz < 0) {
+			kutil_warn(NULL, NULL, "pread");
+			er = KCGI_SYSTEM;
+		} else if (ssz == 0) {
+			kutil_warnx(NULL, NULL, "pread: short file");
+			er = KCGI_SYSTEM;
+		} else if ((er = fullwritenoerr
+		    (out, buf, (size_t)ssz)) == KCGI_OK) {
+			*off += ssz;
+			sz -= (size_t)ssz;
+		}
+	}
+
+	return er;
+}
+
 /*
  * Write "buf", which can be NULL so long as bufsz is zero in which case
  * it's a noop.
@@ -491,6 +941,195 @@ fullreadword(int fd, char **cp)
 	return fullreadwordsz(fd, cp, &sz);
 }
 
+/*
+ * Append "buf" of size "bufsz" to the frame, growing it as needed.
+ * Like fullwrite(), "buf" may be NULL if "bufsz" is zero.
+ * On memory exhaustion, this will exit the process with the exit code
+ * EXIT_FAILURE.
+ */
+void
+kframe_write(struct kframe *fr, const void *buf, size_t bufsz)
+{
+	size_t	 maxsz;
+	void	*pp;
+
+	if (bufsz == 0)
+		return;
+
+	assert(buf != NULL);
+
+	/* Reserve room at the front for the frame length. */
+
+	if (fr->sz == 0)
+		fr->sz = sizeof(size_t);
+
+	if (fr->sz + bufsz > fr->maxsz) {
+		maxsz = fr->maxsz == 0 ? 4096 : fr->maxsz;
+		while (maxsz < fr->sz + bufsz)
+			maxsz *= 2;
+		if ((pp = kxrealloc(fr->buf, maxsz)) == NULL)
+			exit(EXIT_FAILURE);
+		fr->buf = pp;
+		fr->maxsz = maxsz;
+	}
+
+	memcpy(fr->buf + fr->sz, buf, bufsz);
+	fr->sz += bufsz;
+}
+
+/*
+ * Append a string "buf" to the frame.
+ * If "buf" is NULL, then write a zero-length string.
+ * This has the same format as fullwriteword().
+ * See kframe_readword().
+ */
+void
+kframe_writeword(struct kframe *fr, const char *buf)
+{
+	size_t	 sz;
+
+	sz = buf == NULL ? 0 : strlen(buf);
+	kframe_write(fr, &sz, sizeof(size_t));
+	kframe_write(fr, buf, sz);
+}
+
+/*
+ * Send the frame's contents, prefixed by its length, in a single
+ * write (if the channel permits) and reset it for re-use.
+ * See kframe_recv().
+ * On error, this will exit the process with the exit code EXIT_FAILURE.
+ */
+void
+kframe_send(int fd, struct kframe *fr)
+{
+	size_t	 sz;
+
+	/* Nothing's been written: send an empty frame. */
+
+	if (fr->sz == 0) {
+		sz = 0;
+		fullwrite(fd, &sz, sizeof(size_t));
+		return;
+	}
+
+	sz = fr->sz - sizeof(size_t);
+	memcpy(fr->buf, &sz, sizeof(size_t));
+	fullwrite(fd, fr->buf, fr->sz);
+	fr->sz = fr->pos = 0;
+}
+
+/*
+ * Receive a whole frame sent by kframe_send() into "fr", which is
+ * reset for reading.
+ * Returns KCGI_OK on success, KCGI_HUP if the channel was closed before
+ * the frame started, or another error.
+ */
+enum kcgi_err
+kframe_recv(int fd, struct kframe *fr)
+{
+	enum kcgi_err	 ke;
+	size_t		 sz;
+	void		*pp;
+	int		 rc;
+
+	fr->sz = fr->pos = 0;
+
+	if ((rc = fullread(fd, &sz, sizeof(size_t), 1, &ke)) < 0)
+		return ke;
+	else if (rc == 0)
+		return KCGI_HUP;
+
+	if (sz > fr->maxsz) {
+		if ((pp = kxrealloc(fr->buf, sz)) == NULL)
+			return KCGI_ENOMEM;
+		fr->buf = pp;
+		fr->maxsz = sz;
+	}
+
+	if (sz > 0 && fullread(fd, fr->buf, sz, 0, &ke) < 0)
+		return ke;
+
+	fr->sz = sz;
+	return KCGI_OK;
+}
+
+/*
+ * Read "bufsz" bytes from the frame into "buf".
+ * Returns KCGI_OK on success or KCGI_FORM if the frame is short.
+ */
+enum kcgi_err
+kframe_read(struct kframe *fr, void *buf, size_t bufsz)
+{
+
+	if (bufsz > fr->sz - fr->pos) {
+		kutil_warnx(NULL, NULL, "frame: short read");
+		return KCGI_FORM;
+	}
+	memcpy(buf, fr->buf + fr->pos, bufsz);
+	fr->pos += bufsz;
+	return KCGI_OK;
+}
+
+/*
+ * Like fullreadwordsz(), but reading a string from the frame.
+ * The string is copied into a NUL-terminated buffer allocated from
+ * "a" or, if NULL, the heap.
+ */
+enum kcgi_err
+kframe_readwordsz(struct kframe *fr, struct karena *a, 
+	char **cp, size_t *sz)
+{
+	enum kcgi_err	 ke;
+
+	*cp = NULL;
+	*sz = 0;
+
+	if ((ke = kframe_read(fr, sz, sizeof(size_t))) != KCGI_OK)
+		return ke;
+
+	if (*sz > fr->sz - fr->pos) {
+		kutil_warnx(NULL, NULL, "frame: short read");
+		*sz = 0;
+		return KCGI_FORM;
+	}
+
+	*cp = a == NULL ? kxmalloc(*sz + 1) : karena_alloc(a, *sz + 1);
+	if (*cp == NULL) {
+		*sz = 0;
+		return KCGI_ENOMEM;
+	}
+
+	memcpy(*cp, fr->buf + fr->pos, *sz);
+	(*cp)[*sz] = '\0';
+	fr->pos += *sz;
+	return KCGI_OK;
+}
+
+/*
+ * See kframe_readwordsz() with a discarded size.
+ */
+enum kcgi_err
+kframe_readword(struct kframe *fr, struct karena *a, char **cp)
+{
+	size_t	 sz;
+
+	return kframe_readwordsz(fr, a, cp, &sz);
+}
+
+/*
+ * Free the frame's buffer and zero it.
+ * Does nothing if the frame is NULL.
+ */
+void
+kframe_free(struct kframe *fr)
+{
+
+	if (fr == NULL)
+		return;
+	free(fr->buf);
+	memset(fr, 0, sizeof(struct kframe));
+}
+
 /*
  * Write a file-descriptor "sendfd" and a buffer "b" of length "bsz",
  * which must be 256 bytes or fewer, but not zero.
@@ -610,10 +1249,8 @@ again:
 	if ((rc = recvmsg(fd, &msg, 0)) < 0) {
 		kutil_warn(NULL, NULL, "recvmsg");
 		return (-1);
-	} else if (rc == 0) {
-		kutil_warnx(NULL, NULL, "recvmsg: short read");
+	} else if (rc == 0)
 		return 0;
-	}
 
 	memcpy(b, m_buffer, bsz);
 	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;